@@ -0,0 +1,129 @@
+local regress = require"regress"
+local cqueues = require"cqueues"
+
+local bench = {
+	cqueues = cqueues,
+	regress = regress,
+	check = regress.check,
+	info = regress.info,
+	now = cqueues.monotime,
+}
+
+local scale = tonumber(os.getenv"BENCH_SCALE" or 1)
+
+--
+-- bench.count
+--
+-- Scale an iteration count by $BENCH_SCALE, never going below 1.
+--
+function bench.count(n)
+	return math.max(1, math.floor(n * scale))
+end -- bench.count
+
+--
+-- bench.time
+--
+-- Run f(...) and return the elapsed wall-clock seconds followed by f's
+-- return values.
+--
+function bench.time(f, ...)
+	local begin = cqueues.monotime()
+
+	local function done(...)
+		return cqueues.monotime() - begin, ...
+	end
+
+	return done(f(...))
+end -- bench.time
+
+
+local function escape(s)
+	return (string.gsub(s, '[%c"\\]', function (c)
+		if c == '"' or c == "\\" then
+			return "\\" .. c
+		else
+			return string.format("\\u%.4x", string.byte(c))
+		end
+	end))
+end -- escape
+
+local function encode(v)
+	local t = type(v)
+
+	if t == "number" then
+		if v ~= v or v == math.huge or v == -math.huge then
+			return "null"
+		elseif v == math.floor(v) and math.abs(v) < 2^53 then
+			return string.format("%.0f", v)
+		else
+			return string.format("%.17g", v)
+		end
+	elseif t == "boolean" then
+		return tostring(v)
+	elseif t == "string" then
+		return '"' .. escape(v) .. '"'
+	elseif t == "table" then
+		local list = {}
+
+		if #v > 0 then
+			for i = 1, #v do
+				list[i] = encode(v[i])
+			end
+
+			return "[" .. table.concat(list, ",") .. "]"
+		end
+
+		for k in pairs(v) do
+			list[#list + 1] = tostring(k)
+		end
+
+		table.sort(list)
+
+		for i, k in ipairs(list) do
+			list[i] = '"' .. escape(k) .. '":' .. encode(v[k])
+		end
+
+		return "{" .. table.concat(list, ",") .. "}"
+	else
+		return "null"
+	end
+end -- encode
+
+bench.encode = encode
+
+--
+-- bench.emit
+--
+-- Write a result as a single line of JSON to stdout. The result must
+-- name the benchmark (.bench and .name), the iteration count (.n), the
+-- elapsed time (.seconds) and the unit of .n (.unit). The rate is
+-- derived.
+--
+function bench.emit(result)
+	result.rate = (result.seconds > 0 and result.n / result.seconds) or nil
+	result.lua = result.lua or _VERSION
+
+	io.stdout:write(encode(result), "\n")
+	io.stdout:flush()
+
+	regress.info("%s.%s: %d %s in %.6fs", result.bench, result.name, result.n, result.unit, result.seconds)
+
+	return result
+end -- bench.emit
+
+--
+-- bench.loop
+--
+-- Run f inside a new controller and loop until it finishes, propagating
+-- any error.
+--
+function bench.loop(f, ...)
+	local cq = cqueues.new()
+
+	cq:wrap(f, ...)
+	regress.check(cq:loop())
+
+	return cq
+end -- bench.loop
+
+return bench
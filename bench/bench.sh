@@ -0,0 +1,12 @@
+#!/bin/sh
+#
+# Sourced by the benchmark scripts. Reuses the regression suite's build and
+# interpreter environment, and adds bench/ to the module search path.
+#
+: ${CQUEUES_SRCDIR:="$(cd "${0%%/*}/.." && pwd -L)"}
+
+. "${CQUEUES_SRCDIR}/regress/regress.sh"
+
+export LUA_PATH="${CQUEUES_SRCDIR}/bench/?.lua;${LUA_PATH}"
+export LUA_PATH_5_2="${CQUEUES_SRCDIR}/bench/?.lua;${LUA_PATH_5_2}"
+export LUA_PATH_5_3="${CQUEUES_SRCDIR}/bench/?.lua;${LUA_PATH_5_3}"
@@ -0,0 +1,92 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/bench.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket.pair echo throughput and round-trip latency in each output
+-- buffering mode: "n" (LSO_NOBUF), "l" (LSO_LINEBUF) and "f" (LSO_FULLBUF).
+--
+local bench = require"bench"
+local socket = require"cqueues.socket"
+local check = bench.check
+
+local CHUNK = 4096
+local chunk = string.rep("x", CHUNK - 1) .. "\n"
+local ping = string.rep("p", 63) .. "\n"
+
+for _, mode in ipairs{ "n", "l", "f" } do
+	-- throughput: stream chunks through an echoing peer
+	bench.loop(function ()
+		local cqueues = require"cqueues"
+		local a, b = check(socket.pair())
+		local count = bench.count(16384)
+
+		a:setmode("b", "b" .. mode)
+		b:setmode("b", "b" .. mode)
+
+		cqueues.running():wrap(function ()
+			for data in b:lines(CHUNK) do
+				check(b:write(data))
+			end
+
+			check(b:flush())
+			b:close()
+		end)
+
+		local elapsed = bench.time(function ()
+			cqueues.running():wrap(function ()
+				for _ = 1, count do
+					check(a:write(chunk))
+				end
+
+				check(a:flush())
+				check(a:shutdown"w")
+			end)
+
+			local total = 0
+
+			for data in a:lines(CHUNK) do
+				total = total + #data
+			end
+
+			check(total == count * CHUNK, "short echo (%d of %d bytes)", total, count * CHUNK)
+		end)
+
+		a:close()
+
+		bench.emit{ bench = "socket", name = "echo-throughput", mode = mode, n = count * CHUNK, seconds = elapsed, unit = "bytes" }
+	end)
+
+	-- latency: ping-pong a short line, flushing explicitly after each
+	-- write so that the fully buffered mode doesn't stall
+	bench.loop(function ()
+		local cqueues = require"cqueues"
+		local a, b = check(socket.pair())
+		local count = bench.count(100000)
+
+		a:setmode("b", "b" .. mode)
+		b:setmode("b", "b" .. mode)
+
+		cqueues.running():wrap(function ()
+			for line in b:lines("*L") do
+				check(b:write(line))
+				check(b:flush())
+			end
+
+			b:close()
+		end)
+
+		local elapsed = bench.time(function ()
+			for _ = 1, count do
+				check(a:write(ping))
+				check(a:flush())
+				check(a:read("*L"))
+			end
+		end)
+
+		a:close()
+
+		bench.emit{ bench = "socket", name = "echo-latency", mode = mode, n = count, seconds = elapsed, unit = "roundtrips", latency = elapsed / count }
+	end)
+end
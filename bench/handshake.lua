@@ -0,0 +1,36 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/bench.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- TLS handshake rate over socket.pair. Requires luaossl.
+--
+local bench = require"bench"
+local regress = bench.regress
+local socket = require"cqueues.socket"
+local check = bench.check
+
+local srv_ctx = regress.getsslctx("TLS", true)
+local cli_ctx = regress.getsslctx("TLS", false, false)
+
+bench.loop(function ()
+	local cqueues = require"cqueues"
+	local count = bench.count(1000)
+
+	local elapsed = bench.time(function ()
+		for _ = 1, count do
+			local srv, cli = check(socket.pair(socket.SOCK_STREAM))
+
+			cqueues.running():wrap(function ()
+				check(cli:starttls(cli_ctx))
+				cli:close()
+			end)
+
+			check(srv:starttls(srv_ctx))
+			srv:close()
+		end
+	end)
+
+	bench.emit{ bench = "tls", name = "handshake", n = count, seconds = elapsed, unit = "handshakes" }
+end)
@@ -0,0 +1,103 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/bench.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- dns.resolver queries per second against a local stub nameserver. The
+-- socket API has no recvfrom/sendto, so the stub answers over TCP and
+-- the resolvers are configured with TCP_ONLY.
+--
+local bench = require"bench"
+local socket = require"cqueues.socket"
+local config = require"cqueues.dns.config"
+local resolver = require"cqueues.dns.resolver"
+local check = bench.check
+
+local char = string.char
+
+-- echo the question back with a single A record answer
+local function answer(query)
+	local i = 13
+
+	while query:byte(i) ~= 0 do
+		i = i + query:byte(i) + 1
+	end
+
+	local flags = query:byte(3)
+
+	if flags < 0x80 then
+		flags = flags + 0x80 -- QR
+	end
+
+	return query:sub(1, 2)
+	    .. char(flags, 0x80, 0, 1, 0, 1, 0, 0, 0, 0)
+	    .. query:sub(13, i + 4)
+	    .. char(0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x0e, 0x10, 0, 4, 127, 0, 0, 1)
+end -- answer
+
+local function serve(con)
+	con:setmode("b", "bn")
+
+	while true do
+		local len = con:read(2)
+
+		if not len or #len < 2 then
+			break
+		end
+
+		local query = check(con:read(len:byte(1) * 256 + len:byte(2)))
+		local reply = answer(query)
+
+		check(con:write(char(math.floor(#reply / 256), #reply % 256), reply))
+	end
+
+	con:close()
+end -- serve
+
+bench.loop(function ()
+	local cqueues = require"cqueues"
+	local cq = cqueues.running()
+	local srv = check(socket.listen{ host = "127.0.0.1", port = 0 })
+	local _, host, port = check(srv:localname())
+
+	cq:wrap(function ()
+		for con in srv:clients() do
+			cq:wrap(serve, con)
+		end
+	end)
+
+	for _, width in ipairs{ 1, 16 } do
+		local count = bench.count(10000)
+		local per = math.max(1, math.floor(count / width))
+		local cv = require"cqueues.condition".new()
+		local running = width
+
+		local elapsed = bench.time(function ()
+			for _ = 1, width do
+				cq:wrap(function ()
+					local R = check(resolver.stub{
+						nameserver = { string.format("[%s]:%d", host, port) },
+						options = { tcp = config.TCP_ONLY },
+					})
+
+					for _ = 1, per do
+						check(R:query("bench.example", "A", "IN", 5))
+					end
+
+					R:close()
+					running = running - 1
+					cv:signal()
+				end)
+			end
+
+			while running > 0 do
+				cv:wait()
+			end
+		end)
+
+		bench.emit{ bench = "dns", name = "query", width = width, n = per * width, seconds = elapsed, unit = "queries" }
+	end
+
+	srv:close()
+end)
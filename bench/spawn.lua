@@ -0,0 +1,25 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/bench.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- thread.start spawn and join cost.
+--
+local bench = require"bench"
+local thread = require"cqueues.thread"
+local check = bench.check
+
+bench.loop(function ()
+	local count = bench.count(1000)
+
+	local elapsed = bench.time(function ()
+		for _ = 1, count do
+			local thr = check(thread.start(function () end))
+
+			check(thr:join())
+		end
+	end)
+
+	bench.emit{ bench = "thread", name = "spawn-join", n = count, seconds = elapsed, unit = "threads", cost = elapsed / count }
+end)
@@ -0,0 +1,36 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/bench.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- Coroutine yield/resume throughput through cqueue_step. Every coroutine
+-- yields with no events, so each step resumes all of them once.
+--
+local bench = require"bench"
+local cqueues = bench.cqueues
+
+for _, width in ipairs{ 1, 100, 10000 } do
+	local cq = cqueues.new()
+	local steps = math.max(1, math.floor(bench.count(1000000) / width))
+	local running = true
+
+	for _ = 1, width do
+		cq:wrap(function ()
+			while running do
+				cqueues.poll()
+			end
+		end)
+	end
+
+	local elapsed = bench.time(function ()
+		for _ = 1, steps do
+			bench.check(cq:step(0))
+		end
+	end)
+
+	running = false
+	bench.check(cq:loop())
+
+	bench.emit{ bench = "step", name = "yield-resume", width = width, n = steps * width, seconds = elapsed, unit = "resumes" }
+end
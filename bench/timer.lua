@@ -0,0 +1,47 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/bench.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- Timer arm and disarm rate at 10^3 to 10^6 outstanding timers. Each
+-- coroutine waits on a shared condition with a long timeout, arming a
+-- timer; signaling the condition wakes them all, disarming it.
+--
+local bench = require"bench"
+local cqueues = bench.cqueues
+local condition = require"cqueues.condition"
+
+local limit = tonumber(os.getenv"BENCH_TIMERS_MAX" or 1e6)
+
+for exp = 3, 6 do
+	if 10^exp > limit then
+		break
+	end
+
+	local count = bench.count(10^exp)
+
+	local cq = cqueues.new()
+	local cv = condition.new()
+
+	for i = 1, count do
+		cq:wrap(function ()
+			cqueues.poll(cv, 60 + (i % 997) / 997)
+		end)
+	end
+
+	local arm = bench.time(function ()
+		bench.check(cq:step(0))
+	end)
+
+	cv:signal()
+
+	local disarm = bench.time(function ()
+		while not cq:empty() do
+			bench.check(cq:step(0))
+		end
+	end)
+
+	bench.emit{ bench = "timer", name = "arm", timers = count, n = count, seconds = arm, unit = "timers" }
+	bench.emit{ bench = "timer", name = "disarm", timers = count, n = count, seconds = disarm, unit = "timers" }
+end
@@ -0,0 +1,80 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- When the shared TCP connection of a dns.mux drops, queries still under
+-- their attempt limit are resent on a new connection and the rest fail
+-- with the reset error. A bug in dns_mux_tcp_reset overwrote that error
+-- with the result of the first successful resend, so queries finished
+-- after it failed with an error code of 0.
+--
+require"regress".export".*"
+
+local mux = require"cqueues.dns.mux"
+
+local function readquery(con)
+	local hdr = con:xread(2, "b", 3)
+
+	if not hdr then
+		return
+	end
+
+	return check(con:xread(hdr:byte(1) * 256 + hdr:byte(2), "b", 3), "short query")
+end -- readquery
+
+-- echo the query back with QR set; an empty NOERROR answer
+local function answer(con, q)
+	local a = q:sub(1, 2) .. string.char(q:byte(3) + 128) .. q:sub(4)
+
+	check(con:xwrite(string.char(math.floor(#a / 256), #a % 256) .. a, "bn", 3))
+end -- answer
+
+local srv = check(socket.listen("127.0.0.1", 0))
+check(srv:listen())
+local _, host, port = check(srv:localname())
+
+local main = cqueues.new()
+
+--
+-- Connection 1 drops query A. Connection 2 drops A (now on its last
+-- attempt) and B (on its first). Connection 3 answers B.
+--
+main:wrap(function ()
+	for _, n in ipairs{ 1, 2 } do
+		local con = check(srv:accept(3))
+
+		for i = 1, n do
+			check(readquery(con), "no query on connection")
+		end
+
+		info("dropping connection after %d queries", n)
+		con:close()
+	end
+
+	local con = check(srv:accept(3))
+	answer(con, check(readquery(con), "no resent query"))
+	con:close()
+end)
+
+local M = check(mux.new(string.format("[%s]:%d", host, port), { tcp = true, attempts = 2, timeout = 3 }))
+
+main:wrap(function ()
+	local pkt, why = M:query("a.example", "A", "IN", 5)
+
+	check(not pkt, "query A should have failed")
+	check(why == errno.ECONNRESET, "query A failed with %s (expected ECONNRESET)", tostring(why))
+	info("query A failed with %s", errno.strerror(why))
+end)
+
+main:wrap(function ()
+	cqueues.sleep(0.25)
+
+	check(M:query("b.example", "A", "IN", 5), "query B not answered")
+	info"query B answered"
+end)
+
+check(main:loop())
+
+say"OK"
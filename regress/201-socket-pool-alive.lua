@@ -0,0 +1,98 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket.pool hands back an idle connection only if socket:alive says it's
+-- still open. socket:alive used to peek at the raw descriptor, and under
+-- TLS treated any pending bytes as alive. A keep-alive TLS peer usually
+-- closes with close_notify followed by FIN, which left the alert pending,
+-- so the pool handed out a dead connection.
+--
+require"regress".export".*"
+
+local pool = require"cqueues.socket.pool"
+
+local srv_ctx = getsslctx("TLS", true)
+local cli_ctx = getsslctx("TLS", false, false)
+
+local srv = check(socket.listen("127.0.0.1", 0))
+check(srv:listen())
+local _, host, port = check(srv:localname())
+
+local main = cqueues.new()
+local closing = condition.new()
+local closed = condition.new()
+
+-- echo lines until the client goes away, however it does
+local function serve(con)
+	con:onerror(function (_, _, why) return why end)
+	check(con:starttls(srv_ctx, 3))
+
+	local ln = con:xread("*l", 3)
+
+	while ln do
+		con:xwrite(ln .. "\n", "n", 3)
+		ln = con:xread("*l", 3)
+	end
+end -- serve
+
+main:wrap(function ()
+	-- first connection: echo until told to close, then close cleanly
+	local con = check(srv:accept(3))
+
+	main:wrap(function ()
+		serve(con)
+	end)
+
+	closing:wait()
+	info"server: sending close_notify"
+	check(con:shutdown"w")
+	cqueues.sleep(0.1)
+	closed:signal()
+
+	-- second connection: the pool's replacement
+	con = check(srv:accept(3))
+	serve(con)
+	con:close()
+end)
+
+main:wrap(function ()
+	local P = pool.new{ timeout = 3 }
+	local opts = { host = host, port = port, tls = cli_ctx }
+
+	local function ping(con)
+		check(con:xwrite("ping\n", "n", 3))
+		check(con:xread("*l", 3) == "ping", "no echo")
+	end
+
+	local first = check(P:get(opts))
+	ping(first)
+	P:put(first)
+
+	local con = check(P:get(opts))
+	check(con == first, "idle connection not reused")
+	check(P:stat().hits == 1, "expected a pool hit")
+	ping(con)
+	P:put(con)
+	check(first:alive(), "idle TLS connection reported dead")
+
+	closing:signal()
+	closed:wait()
+
+	check(not first:alive(), "closed TLS connection reported alive")
+
+	con = check(P:get(opts))
+	check(con ~= first, "pool handed out a closed connection")
+	check(P:stat().dead == 1, "expected one dead connection")
+	ping(con)
+	P:discard(con)
+
+	info"pool replaced closed connection"
+	srv:close()
+end)
+
+check(main:loop())
+
+say"OK"
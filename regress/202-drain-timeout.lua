@@ -0,0 +1,65 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket:drain waits until the kernel's unsent queue falls below the
+-- threshold set with socket:setlowat. It used to poll once and report
+-- success when that poll timed out, with the queue still at or above the
+-- threshold. Fill the queue of a connection whose peer never reads and
+-- check that drain only returns true below the threshold, and eventually
+-- fails with ETIMEDOUT.
+--
+require"regress".export".*"
+
+local lowat = 16384
+local chunk = string.rep("x", 2048) -- fits the output buffer
+
+local srv = check(socket.listen("127.0.0.1", 0))
+check(srv:listen())
+local _, host, port = check(srv:localname())
+
+local main = cqueues.new()
+
+main:wrap(function ()
+	local peer = check(socket.connect(host, port))
+
+	check(peer:connect(3))
+
+	local con = check(srv:accept(3))
+
+	local ok, why = peer:setlowat(lowat)
+
+	if not ok then
+		info("TCP_NOTSENT_LOWAT not available (%s)", errno.strerror(why))
+		return
+	end
+
+	-- the accepted end never reads
+	peer:onerror(function (_, _, why) return why end)
+
+	for i = 1, 65536 do
+		check(peer:xwrite(chunk, "bf", 3))
+
+		ok, why = peer:drain(0.1)
+
+		if not ok then
+			check(why == errno.ETIMEDOUT, "drain failed with %s (expected ETIMEDOUT)", tostring(why))
+			info("drain timed out after %d chunks", i)
+			break
+		end
+
+		local unsent = select(3, peer:pending())
+		check(not unsent or unsent < lowat, "drain returned with %d bytes unsent", unsent or 0)
+	end
+
+	check(not ok, "drain never timed out")
+
+	peer:close()
+	con:close()
+end)
+
+check(main:loop())
+
+say"OK"
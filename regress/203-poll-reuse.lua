@@ -0,0 +1,116 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- A coroutine's poll registrations are kept across its resume and reused
+-- when it polls the same objects again. Check that a re-yielded poll only
+-- wakes for new readiness, that a condition signaled while the coroutine
+-- was running isn't consumed, and that cancelling a descriptor from the
+-- running coroutine (e.g. by closing its socket) doesn't leave the reused
+-- registration pending, in both level- and edge-triggered mode.
+--
+require"regress".export".*"
+
+local function check_reyield(cq)
+	local a, b = check(socket.pair())
+	local rounds = 8
+
+	cq:wrap(function ()
+		for i = 1, rounds do
+			info("writer: round %d", i)
+			check(b:xwrite("x", "bn", 3))
+			cqueues.sleep(0.05)
+		end
+
+		b:close()
+	end)
+
+	cq:wrap(function ()
+		local n = 0
+
+		while true do
+			local ready = cqueues.poll(a, 3)
+
+			check(ready == a, "timeout waiting for data")
+
+			local data, why = a:recv(-64, "b")
+
+			if data then
+				n = n + #data
+			elseif why == errno.EAGAIN then
+				panic("spurious wakeup after %d bytes", n)
+			else
+				break -- EOF
+			end
+		end
+
+		check(n == rounds, "read %d bytes (expected %d)", n, rounds)
+		a:close()
+	end)
+end -- check_reyield
+
+local function check_condition(cq)
+	local cv = condition.new()
+	local signaled = false
+
+	cq:wrap(function ()
+		check(cqueues.poll(cv, 3) == cv, "condition not signaled")
+
+		-- signal ourselves while running; nobody is waiting on it
+		cv:signal()
+
+		check(cqueues.poll(cv, 0.1) ~= cv, "condition signal consumed while running")
+		signaled = true
+	end)
+
+	cq:wrap(function ()
+		cv:signal()
+	end)
+
+	return function ()
+		check(signaled, "condition test didn't finish")
+	end
+end -- check_condition
+
+local function check_cancel(cq)
+	local a, b = check(socket.pair())
+	local obj = {}
+
+	function obj:pollfd() return a:pollfd() end
+	function obj:events() return "r" end
+
+	cq:wrap(function ()
+		check(b:xwrite("x", "bn", 3))
+
+		check(cqueues.poll(obj, 3) == obj, "timeout waiting for data")
+
+		-- cancels the descriptor while its event is kept for reuse
+		a:close()
+		b:close()
+
+		-- likely reuses the descriptor number
+		a, b = check(socket.pair())
+
+		check(cqueues.poll(obj, 0.1) ~= obj, "woke on a cancelled descriptor")
+
+		a:close()
+		b:close()
+	end)
+end -- check_cancel
+
+for _, edge in ipairs{ false, true } do
+	info("edge-triggered: %s", tostring(edge))
+
+	local cq = check(cqueues.new{ edge = edge })
+
+	check_reyield(cq)
+	local done = check_condition(cq)
+	check_cancel(cq)
+
+	check(cq:loop())
+	done()
+end
+
+say"OK"
@@ -0,0 +1,105 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- cqueues.thread.pool dispatches jobs over a shared channel. A job
+-- function's bytecode is only sent until every worker has cached it, so
+-- run enough jobs that later ones go out without it. Also check that job
+-- functions with upvalues are rejected like they are by thread.start, and
+-- that a failing init function is reported instead of hanging the pool,
+-- and that close doesn't deadlock on a worker blocked on a full result
+-- queue.
+--
+require"regress".export".*"
+
+local thrpool = require"cqueues.thread.pool"
+
+local function check_dispatch()
+	local P = check(thrpool.new{ size = 2 })
+	local ids = {}
+
+	local function square(n)
+		return n * n, "sq"
+	end
+
+	for i = 1, 200 do
+		ids[i] = check(P:submit(square, i))
+	end
+
+	for i = 1, 200 do
+		local ok, v, tag = P:wait(ids[i], 5)
+
+		check(ok, "job %d failed: %s", i, tostring(v))
+		check(v == i * i and tag == "sq", "job %d returned %s", i, tostring(v))
+	end
+
+	local ok, why = P:run(function () error("oops", 0) end)
+	check(not ok and why == "oops", "job error not returned (got %s)", tostring(why))
+
+	check(P:stat().pending == 0, "jobs still pending")
+	check(P:close(5))
+
+	info"dispatch OK"
+end -- check_dispatch
+
+local function check_upvalues()
+	local P = check(thrpool.new{ size = 1 })
+	local x = 1
+
+	local ok, why = pcall(P.submit, P, function () return x end)
+
+	check(not ok, "job with upvalues accepted")
+	check(string.find(tostring(why), "function has upvalues", 1, true), "unexpected error (%s)", tostring(why))
+	check(P:close(5))
+
+	info"upvalues OK"
+end -- check_upvalues
+
+local function check_init()
+	local P = check(thrpool.new({ size = 2, init = function (msg) error(msg, 0) end }, "init failed"))
+
+	local ok, why = P:run(function () return true end)
+
+	check(not ok, "job ran without a worker")
+	check(why == "init failed", "unexpected error (%s)", tostring(why))
+	check(P:stat().failed == 2, "expected 2 failed workers")
+
+	local id
+	id, why = P:submit(function () return true end)
+	check(not id and why == "init failed", "submit to dead pool didn't fail")
+
+	check(P:close(5))
+
+	info"init OK"
+end -- check_init
+
+local function check_close()
+	local P = check(thrpool.new{ size = 1, queue = 2 })
+
+	-- more results than the queue holds, none of them waited for
+	for i = 1, 16 do
+		check(P:submit(function (n) return n end, i))
+	end
+
+	local t0 = cqueues.monotime()
+
+	check(P:close(5))
+	check(cqueues.monotime() - t0 < 5, "close timed out")
+
+	info"close OK"
+end -- check_close
+
+local main = cqueues.new()
+
+main:wrap(function ()
+	check_dispatch()
+	check_upvalues()
+	check_init()
+	check_close()
+end)
+
+check(main:loop())
+
+say"OK"
@@ -0,0 +1,58 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- iov_trimcrlf unfolds "*h" header fields by removing every line break.
+-- It used to skip the two bytes following each \r\n it removed, so a
+-- line break right after another one was left in the field. iov_trimcr,
+-- which converts \r\n to \n in text mode, was rewritten with it.
+--
+require"regress".export".*"
+
+local a, b = check(socket.pair())
+
+check(b:xwrite(table.concat{
+	"A: x\r\n\ty\r\n",          -- plain fold
+	"B: a\n\tb\n",              -- bare LF fold
+	"C: x\r\n \n y\r\n",        -- break right after a removed \r\n
+	"D: 1\r\n \r\n \r\n 2\r\n", -- consecutive folds
+	"E: a\rb\r\n",              -- lone \r is kept
+	"\r\n",
+	"one\r\n",
+	"two\r\r\n",
+	"x\r\ny\r\r\n\r",
+}, "bn", 3))
+b:close()
+
+local fields = {
+	"A: x\ty",
+	"B: a\tb",
+	"C: x  y",
+	"D: 1   2",
+	"E: a\rb",
+}
+
+for i, expected in ipairs(fields) do
+	local field = a:xread("*h", "t", 3)
+
+	check(field == expected, "field %d: expected %q, got %q", i, expected, tostring(field))
+	info("field %d OK", i)
+end
+
+check(a:xread("*h", "t", 3) == nil, "end of headers not detected")
+check(a:xread("*l", "t", 3) == "", "blank line after headers not returned")
+
+local ln = a:xread("*l", "t", 3)
+check(ln == "one", "expected \"one\", got %q", tostring(ln))
+
+ln = a:xread("*l", "t", 3)
+check(ln == "two\r", "expected \"two\\r\", got %q", tostring(ln))
+
+local rest = a:xread("*a", "t", 3)
+check(rest == "x\ny\r\n\r", "expected \"x\\ny\\r\\n\\r\", got %q", tostring(rest))
+
+a:close()
+
+say"OK"
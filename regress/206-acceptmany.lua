@@ -0,0 +1,86 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket:acceptmany takes a burst of pending connections in one call, and
+-- socket:clients{ batch = n } hands them out one at a time. Also check
+-- that the connection count may be omitted in favor of an options table.
+--
+require"regress".export".*"
+
+local srv = check(socket.listen("127.0.0.1", 0))
+check(srv:listen())
+local _, host, port = check(srv:localname())
+
+local main = cqueues.new()
+
+local function dial(n)
+	local list = {}
+
+	for i = 1, n do
+		list[i] = check(socket.connect(host, port))
+		check(list[i]:connect(3))
+	end
+
+	return list
+end -- dial
+
+local function hangup(list)
+	for _, con in ipairs(list) do
+		con:close()
+	end
+end -- hangup
+
+main:wrap(function ()
+	local peers = dial(5)
+
+	local cons = check(srv:acceptmany(3, nil, 3))
+	check(#cons == 3, "expected 3 connections, got %d", #cons)
+	hangup(cons)
+
+	cons = check(srv:acceptmany(16, nil, 3))
+	check(#cons == 2, "expected 2 connections, got %d", #cons)
+	hangup(cons)
+	hangup(peers)
+
+	info"burst OK"
+
+	local none, why = srv:acceptmany(nil, nil, 0.1)
+	check(not none and why == errno.ETIMEDOUT, "expected ETIMEDOUT, got %s", tostring(why))
+
+	info"timeout OK"
+
+	peers = dial(2)
+	cons = check(srv:acceptmany({ nodelay = true }, 3))
+	check(#cons == 2, "expected 2 connections, got %d", #cons)
+	hangup(cons)
+	hangup(peers)
+
+	info"options table OK"
+
+	peers = dial(6)
+
+	local n = 0
+
+	for con in srv:clients({ batch = 4 }, 0.5) do
+		n = n + 1
+		con:close()
+
+		if n == 6 then
+			break
+		end
+	end
+
+	check(n == 6, "expected 6 clients, got %d", n)
+	hangup(peers)
+
+	info"clients batch OK"
+
+	srv:close()
+end)
+
+check(main:loop())
+
+say"OK"
@@ -0,0 +1,118 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- notify.opentree watches subdirectories as they appear and forgets them
+-- as they go away. Check that nested directories created at once are
+-- all watched, that a directory renamed within the tree is reported along
+-- with its contents and watched under its new name only, and that after
+-- rm -rf a directory recreated under the same name is watched again.
+--
+require"regress".export".*"
+
+local notify = require"cqueues.notify"
+
+local function sh(fmt, ...)
+	local cmd = string.format(fmt, ...)
+	local ok = os.execute(cmd)
+
+	check(ok == true or ok == 0, "%s: failed", cmd)
+end -- sh
+
+local root = os.tmpname()
+os.remove(root)
+sh("mkdir %q", root)
+
+local tree, why = notify.opentree(root)
+
+if not tree then
+	sh("rm -rf %q", root)
+
+	if why == errno.EOPNOTSUPP then
+		info"notify trees not supported"
+		say"OK"
+		return
+	end
+
+	panic("notify.opentree: %s", errno.strerror(why))
+end
+
+-- wait until every name in list was reported with its change
+local function expect(what, list)
+	local seen = {}
+	local deadline = cqueues.monotime() + 3
+
+	local function done()
+		for name, flag in pairs(list) do
+			if not (seen[name] and seen[name][flag]) then
+				return false
+			end
+		end
+
+		return true
+	end
+
+	while not done() do
+		local left = deadline - cqueues.monotime()
+
+		check(left > 0, "%s: timeout", what)
+
+		for name, changes in pairs(tree:batch(left)) do
+			info("%s: %s %s", what, name, table.concat({ notify.strflag(changes) }, "|"))
+
+			seen[name] = seen[name] or {}
+
+			for flag in notify.flags(changes) do
+				seen[name][flag] = true
+			end
+		end
+	end
+
+	info("%s OK", what)
+
+	return seen
+end -- expect
+
+local main = cqueues.new()
+
+main:wrap(function ()
+	sh("mkdir -p %q/a/b/c", root)
+	expect("mkdir", {
+		["a"] = notify.CREATE,
+		["a/b"] = notify.CREATE,
+		["a/b/c"] = notify.CREATE,
+	})
+
+	sh("touch %q/a/b/c/f", root)
+	expect("nested", { ["a/b/c/f"] = notify.CREATE })
+
+	sh("mv %q/a/b %q/x", root, root)
+	expect("rename", {
+		["a/b"] = notify.DELETE,
+		["x"] = notify.CREATE,
+		["x/c"] = notify.CREATE,
+		["x/c/f"] = notify.CREATE,
+	})
+
+	sh("touch %q/x/c/g", root)
+	local seen = expect("renamed", { ["x/c/g"] = notify.CREATE })
+	check(not seen["a/b/c/g"], "change reported under the old name")
+
+	sh("rm -rf %q/x", root)
+	expect("rm -rf", { ["x"] = notify.DELETE })
+
+	sh("mkdir %q/x", root)
+	expect("recreate", { ["x"] = notify.CREATE })
+
+	sh("touch %q/x/h", root)
+	expect("rewatched", { ["x/h"] = notify.CREATE })
+end)
+
+local ok, why = main:loop()
+
+sh("rm -rf %q", root)
+check(ok, "%s", tostring(why))
+
+say"OK"
@@ -0,0 +1,47 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- In edge-triggered mode a descriptor stays registered after its last
+-- waiter leaves. Objects like notify don't cancel their descriptor when
+-- collected, so if the number was reused by a new socket the controller
+-- believed it was still registered and never added it, and the socket's
+-- waiter hung.
+--
+require"regress".export".*"
+
+local notify = require"cqueues.notify"
+
+local main = check(cqueues.new{ edge = true })
+
+main:wrap(function ()
+	local nfy = check(notify.opendir("."))
+	local fd = nfy:pollfd()
+
+	cqueues.poll(nfy, 0.01) -- registers fd
+	cqueues.sleep(0.01) -- and leaves it without a waiter
+
+	nfy = nil
+	collectgarbage"collect"
+	collectgarbage"collect"
+
+	local a, b = check(socket.pair())
+
+	if a:pollfd() ~= fd and b:pollfd() ~= fd then
+		info("descriptor %d not reused", fd)
+	end
+
+	check(b:xwrite("x", "bn", 3))
+	check(a:xwrite("y", "bn", 3))
+	check(cqueues.poll(a, 3) == a, "timeout polling socket a (fd:%d)", a:pollfd())
+	check(cqueues.poll(b, 3) == b, "timeout polling socket b (fd:%d)", b:pollfd())
+
+	a:close()
+	b:close()
+end)
+
+check(main:loop())
+
+say"OK"
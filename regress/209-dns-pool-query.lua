@@ -0,0 +1,56 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- dns.resolvers pool:query ran the query under pcall, which can't be
+-- yielded across on Lua 5.1, so every pooled query failed there with
+-- "attempt to yield across a C-call boundary". Resolve through a fake
+-- TCP nameserver, with two concurrent queries coalesced into one.
+--
+require"regress".export".*"
+
+local config = require"cqueues.dns.config"
+local resolvers = require"cqueues.dns.resolvers"
+
+local srv = check(socket.listen("127.0.0.1", 0))
+check(srv:listen())
+local _, host, port = check(srv:localname())
+
+local main = cqueues.new()
+
+-- answer the one query with an echo, QR set; an empty NOERROR answer
+main:wrap(function ()
+	local con = check(srv:accept(3))
+	local hdr = check(con:xread(2, "b", 3), "no query")
+	local q = check(con:xread(hdr:byte(1) * 256 + hdr:byte(2), "b", 3), "short query")
+	local a = q:sub(1, 2) .. string.char(q:byte(3) + 128) .. q:sub(4)
+
+	check(con:xwrite(string.char(math.floor(#a / 256), #a % 256) .. a, "bn", 3))
+	con:close()
+end)
+
+local pool = resolvers.new({
+	nameserver = { string.format("[%s]:%d", host, port) },
+	lookup = { "bind" },
+	options = { tcp = config.TCP_ONLY, timeout = 3, attempts = 1 },
+}, nil, nil, false)
+
+local answered = 0
+
+for i = 1, 2 do
+	main:wrap(function ()
+		local pkt, why = pool:query("a.example.", "A", "IN", 5)
+
+		check(pkt, "query %d failed: %s", i, tostring(why))
+		answered = answered + 1
+	end)
+end
+
+check(main:loop())
+
+check(answered == 2, "expected 2 answers, got %d", answered)
+check(pool:stat().coalesced == 1, "expected 1 coalesced query, got %d", pool:stat().coalesced)
+
+say"OK"
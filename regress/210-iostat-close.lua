@@ -0,0 +1,35 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- A socket's I/O counters used to be rolled into its controller's
+-- stats only when the socket was polled, so I/O which never had to wait,
+-- or came after the last poll, was missing from cqueue:stats().io. What
+-- remains is now credited when the socket is closed.
+--
+require"regress".export".*"
+
+local main = cqueues.new()
+
+main:wrap(function ()
+	local a, b = check(socket.pair())
+
+	-- neither of these needs to poll
+	check(a:xwrite("hello", "bn", 3))
+	check(b:xread(5, "b", 3) == "hello", "short read")
+
+	a:close()
+	b:close()
+end)
+
+check(main:loop())
+
+local st = main:stats().io
+
+check(st.sent.count == 5, "expected 5 bytes sent, got %d", st.sent.count)
+check(st.rcvd.count == 5, "expected 5 bytes received, got %d", st.rcvd.count)
+check(st.sent.calls >= 1 and st.rcvd.calls >= 1, "system calls not counted")
+
+say"OK"
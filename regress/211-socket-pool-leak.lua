@@ -0,0 +1,67 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- A socket pool connection dropped without pool:put or pool:discard
+-- never gave its slot back, so once .max of them had leaked every later
+-- pool:get timed out. The slot is now returned when the connection is
+-- garbage collected.
+--
+require"regress".export".*"
+
+local sockpool = require"cqueues.socket.pool"
+
+local srv = check(socket.listen("127.0.0.1", 0))
+check(srv:listen())
+local _, host, port = check(srv:localname())
+
+local main = cqueues.new()
+local done = false
+
+main:wrap(function ()
+	local cons = {}
+
+	while not done do
+		local con = srv:accept(0.1)
+
+		if con then
+			cons[#cons + 1] = con
+		end
+	end
+
+	for _, con in ipairs(cons) do
+		con:close()
+	end
+end)
+
+main:wrap(function ()
+	local P = sockpool.new{ max = 1 }
+	local opts = { host = host, port = port }
+
+	-- check out and drop a connection, leaving nothing on our stack
+	local function leak()
+		check(P:get(opts, 3))
+	end
+
+	leak()
+
+	collectgarbage"collect"
+	collectgarbage"collect"
+
+	local con, why = P:get(opts, 1)
+
+	check(con, "slot not returned after leak (%s)", tostring(why))
+	check(P:stat().leaked == 1, "expected 1 leaked connection, got %d", P:stat().leaked)
+	check(P:stat().busy == 1, "expected 1 busy connection, got %d", P:stat().busy)
+
+	P:discard(con)
+	check(P:stat().busy == 0, "expected no busy connections")
+
+	done = true
+end)
+
+check(main:loop())
+
+say"OK"
@@ -0,0 +1,84 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- Timers are kept in a hierarchical timing wheel, cascading to lower
+-- levels as the clock advances, with deadlines beyond the wheel's range
+-- kept aside in an overflow tree. Check that sleeps landing on each of
+-- the first three levels wake in order and neither early nor much late,
+-- and that an overflow deadline is reported by :timeout and can be
+-- cancelled.
+--
+require"regress".export".*"
+
+local slack = 0.25
+
+local function check_cascade()
+	local main = cqueues.new()
+	local order = {}
+
+	-- level 0 spans 64ms, level 1 about 4s
+	for _, timeout in ipairs{ 0.003, 4.2, 0.05, 1.1, 0.07, 0.3 } do
+		main:wrap(function ()
+			local began = cqueues.monotime()
+
+			cqueues.sleep(timeout)
+
+			local elapsed = cqueues.monotime() - began
+
+			check(elapsed >= timeout, "%gs sleep woke early (%gs)", timeout, elapsed)
+			check(elapsed < timeout + slack, "%gs sleep woke late (%gs)", timeout, elapsed)
+
+			order[#order + 1] = timeout
+		end)
+	end
+
+	check(main:loop())
+
+	for i = 2, #order do
+		check(order[i - 1] < order[i], "%gs sleep woke before %gs sleep", order[i], order[i - 1])
+	end
+
+	info"cascade OK"
+end -- check_cascade
+
+local function check_overflow()
+	local main = cqueues.new()
+	local cv = condition.new()
+	local signaled = false
+
+	-- about 5.5 hours, beyond the wheel's range
+	main:wrap(function ()
+		signaled = (cqueues.poll(cv, 20000) == cv)
+	end)
+
+	main:wrap(function ()
+		cqueues.sleep(0.02)
+	end)
+
+	check(main:step(0))
+
+	local timeout = main:timeout()
+	check(timeout and timeout <= 0.02, "expected the short sleep first, got %s", tostring(timeout))
+
+	while main:count() > 1 do
+		check(main:step())
+	end
+
+	timeout = main:timeout()
+	check(timeout and math.abs(timeout - 20000) < 10, "expected overflow timeout of ~20000s, got %s", tostring(timeout))
+
+	cv:signal()
+	check(main:loop())
+	check(signaled, "overflow poll timed out instead of being signaled")
+	check(main:timeout() == nil, "timer left armed")
+
+	info"overflow OK"
+end -- check_overflow
+
+check_overflow()
+check_cascade()
+
+say"OK"
@@ -0,0 +1,117 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- cqueues.new{ backend = "io_uring" } polls through io_uring instead of
+-- the native interface. Its poll requests are one-shot, so check a
+-- stream that must be rearmed many times, sleeps, condition variables,
+-- a descriptor closed while polled, and a controller nested inside one
+-- using the native backend.
+--
+require"regress".export".*"
+
+local native = cqueues.new():stats().backend
+local ok, main = pcall(cqueues.new, { backend = "io_uring" })
+
+if not ok then
+	info("io_uring backend not available: %s", tostring(main))
+	say"OK"
+	return
+end
+
+check(main:stats().backend == "io_uring", "expected io_uring backend, got %s", tostring(main:stats().backend))
+check(cqueues.new{ backend = native }:stats().backend == native, "native backend %s not selectable", native)
+
+local chunk = string.rep("x", 4096)
+local count = 256
+
+-- a stream larger than the socket buffers, so each end polls repeatedly
+main:wrap(function ()
+	local a, b = check(socket.pair())
+
+	a:setmode("bn", "bn")
+	b:setmode("bn", "bn")
+
+	cqueues.running():wrap(function ()
+		for _ = 1, count do
+			check(a:xwrite(chunk, "bn", 3))
+		end
+
+		check(a:flush("n", 3))
+		a:shutdown"w"
+	end)
+
+	local total = 0
+
+	for data in b:lines(#chunk) do
+		total = total + #data
+	end
+
+	check(total == count * #chunk, "expected %d bytes, got %d", count * #chunk, total)
+
+	a:close()
+	b:close()
+
+	info"stream OK"
+end)
+
+main:wrap(function ()
+	local began = cqueues.monotime()
+
+	cqueues.sleep(0.1)
+	check(cqueues.monotime() - began >= 0.1, "sleep woke early")
+
+	local cv = condition.new()
+
+	cqueues.running():wrap(function ()
+		cqueues.sleep(0.05)
+		cv:signal()
+	end)
+
+	check(cv:wait(3), "condition not signaled")
+
+	info"timers OK"
+end)
+
+main:wrap(function ()
+	local a, b = check(socket.pair())
+
+	cqueues.running():wrap(function ()
+		cqueues.sleep(0.05)
+		b:close()
+	end)
+
+	-- the peer closing wakes the poll on a
+	check(cqueues.poll(a, 3) == a, "timeout polling socket closed by peer")
+	a:close()
+
+	info"close OK"
+end)
+
+check(main:loop())
+
+-- nested in a native controller
+local outer = cqueues.new()
+local inner = check(cqueues.new{ backend = "io_uring" })
+local done = false
+
+inner:wrap(function ()
+	cqueues.sleep(0.05)
+	done = true
+end)
+
+outer:wrap(function ()
+	while not inner:empty() do
+		cqueues.poll(inner)
+		check(inner:step(0))
+	end
+end)
+
+check(outer:loop())
+check(done, "nested io_uring controller didn't finish")
+
+info"nested OK"
+
+say"OK"
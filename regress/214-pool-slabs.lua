@@ -0,0 +1,49 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- The controller's event, fileno and wakecb objects are carved out of
+-- slabs, and emptied slabs beyond a small watermark are given back. Park
+-- a burst of coroutines on a condition variable so the event pool grows
+-- by many slabs, then check that once they've all been woken the pool is
+-- empty and keeps at most a couple of idle slabs.
+--
+require"regress".export".*"
+
+local nthread = 4096
+local idle = 2 -- SLAB_IDLE
+
+local main = cqueues.new()
+local cv = condition.new()
+local woken = 0
+
+for _ = 1, nthread do
+	main:wrap(function ()
+		check(cqueues.poll(cv, 10) == cv, "timeout waiting on condition")
+		woken = woken + 1
+	end)
+end
+
+check(main:step(0))
+
+local event = main:stats().pools.event
+info("spike: used=%d free=%d slabs=%d bytes=%d", event.used, event.free, event.slabs, event.bytes)
+
+check(event.used >= nthread, "expected at least %d events in use, got %d", nthread, event.used)
+check(event.slabs > idle, "expected more than %d slabs, got %d", idle, event.slabs)
+check(event.free >= 0, "pool reports %d free objects", event.free)
+
+cv:signal()
+check(main:loop())
+check(woken == nthread, "expected %d wakeups, got %d", nthread, woken)
+
+for name, pool in pairs(main:stats().pools) do
+	info("%s: used=%d free=%d slabs=%d bytes=%d", name, pool.used, pool.free, pool.slabs, pool.bytes)
+
+	check(pool.used == 0, "%s: %d objects still in use", name, pool.used)
+	check(pool.slabs <= idle, "%s: %d idle slabs kept", name, pool.slabs)
+end
+
+say"OK"
@@ -0,0 +1,69 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket:sendfile sends straight from a file, picking up after each
+-- short write. Send a file much larger than the socket buffers to a peer
+-- which starts reading late, so the kernel takes it in pieces, and check
+-- the peer gets the buffered output, then exactly the requested range of
+-- the file, in order. Also check a send to end-of-file without a length.
+--
+require"regress".export".*"
+
+local nblock = 65536
+local block = {}
+
+for i = 1, nblock do
+	block[i] = string.format("%07d\n", i)
+end
+
+local data = table.concat(block)
+local file = check(io.tmpfile())
+
+check(file:write(data))
+check(file:flush())
+
+local main = cqueues.new()
+
+main:wrap(function ()
+	local a, b = check(socket.pair())
+
+	a:setmode(nil, "bf")
+	b:setmode("b", nil)
+
+	-- a range starting mid-block, and the rest of the file
+	local offset, len = 8 * 1000 + 3, 8 * 40000
+	local head = "head\n"
+
+	cqueues.running():wrap(function ()
+		check(a:write(head))
+
+		local n = check(a:sendfile(file, offset, len, 10))
+		check(n == len, "sent %d of %d bytes", n, len)
+
+		n = check(a:sendfile(file, offset + len, nil, 10))
+		check(n == #data - offset - len, "sent %d of %d bytes to end-of-file", n, #data - offset - len)
+
+		check(a:flush("n", 3))
+		check(a:shutdown"w")
+	end)
+
+	cqueues.sleep(0.1) -- let the socket buffers fill
+
+	local got = check(b:read"*a")
+	local want = head .. data:sub(offset + 1)
+
+	check(#got == #want, "expected %d bytes, got %d", #want, #got)
+	check(got == want, "data out of order")
+
+	a:close()
+	b:close()
+end)
+
+check(main:loop())
+
+file:close()
+
+say"OK"
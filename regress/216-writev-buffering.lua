@@ -0,0 +1,86 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket:writev gathers the output buffer and its strings into one write,
+-- picking up after each short write, and buffers output as socket:write
+-- does. Write far more than the socket buffers hold to a peer which
+-- starts reading late and check it arrives whole and in order. Then check
+-- that with full buffering a small writev stays buffered until flushed,
+-- and that with line buffering only complete lines go out.
+--
+require"regress".export".*"
+
+local main = cqueues.new()
+
+-- true if something can be read from con within timeout
+local function readable(con, timeout)
+	local obj = { pollfd = con:pollfd(), events = "r" }
+
+	return cqueues.poll(obj, timeout) == obj
+end -- readable
+
+main:wrap(function ()
+	local a, b = check(socket.pair())
+	local list = {}
+
+	for i = 1, 4096 do
+		list[i] = string.format("%07d\n", i) .. string.rep("x", i % 512)
+	end
+
+	a:setmode(nil, "bn")
+	b:setmode("b", nil)
+
+	cqueues.running():wrap(function ()
+		check(a:write"head\n")
+		check(a:writev(list))
+		check(a:writev("tail", "\n"))
+		check(a:shutdown"w")
+	end)
+
+	cqueues.sleep(0.1) -- let the socket buffers fill
+
+	local got = check(b:read"*a")
+	local want = "head\n" .. table.concat(list) .. "tail\n"
+
+	check(#got == #want, "expected %d bytes, got %d", #want, #got)
+	check(got == want, "data out of order")
+
+	a:close()
+	b:close()
+
+	info"partial writes OK"
+end)
+
+main:wrap(function ()
+	local a, b = check(socket.pair())
+
+	a:setmode(nil, "bf")
+	b:setmode("b", nil)
+
+	check(a:writev("ab", "cd\n", "ef"))
+	check(not readable(b, 0.05), "fully buffered writev sent early")
+
+	check(a:flush("n", 3))
+	check(b:xread(7, "b", 3) == "abcd\nef", "unexpected data after flush")
+
+	a:setmode(nil, "bl")
+
+	check(a:writev("gh\n", "ij"))
+	check(b:xread(3, "b", 3) == "gh\n", "expected the complete line")
+	check(not readable(b, 0.05), "incomplete line sent early")
+
+	check(a:flush("n", 3))
+	check(b:xread(2, "b", 3) == "ij", "unexpected data after flush")
+
+	a:close()
+	b:close()
+
+	info"buffering OK"
+end)
+
+check(main:loop())
+
+say"OK"
@@ -0,0 +1,83 @@
+#!/bin/sh
+_=[[
+	. "${0%%/*}/regress.sh"
+	exec runlua "$0" "$@"
+]]
+--
+-- socket:recvlines returns the lines already complete in the input
+-- buffer, up to a count, after waiting only for the first. Check the
+-- count is honoured, that "*l" strips and "*L" keeps line endings with
+-- \r\n translated in text mode, that a line arriving in pieces is not
+-- returned until it's complete, and that the final unterminated line is
+-- returned at EOF.
+--
+require"regress".export".*"
+
+local main = cqueues.new()
+
+main:wrap(function ()
+	local a, b = check(socket.pair())
+	local nline = 200
+
+	cqueues.running():wrap(function ()
+		local out = {}
+
+		for i = 1, nline do
+			out[i] = string.format("line %d\r\n", i)
+		end
+
+		check(b:xwrite(table.concat(out), "bn", 3))
+		check(b:xwrite("split", "bn", 3)) -- completed below
+		cqueues.sleep(0.05)
+		check(b:xwrite(" line\r\nlast", "bn", 3))
+		b:close()
+	end)
+
+	cqueues.sleep(0.02) -- let every line arrive
+
+	local got = {}
+
+	local lines = check(a:recvlines(64, "*l", "t", 3))
+	check(#lines == 64, "expected 64 lines, got %d", #lines)
+
+	for _, ln in ipairs(lines) do
+		got[#got + 1] = ln
+	end
+
+	lines = check(a:recvlines(10, "*L", "t", 3))
+	check(#lines == 10, "expected 10 lines, got %d", #lines)
+	check(lines[1] == "line 65\n", "expected \"line 65\\n\", got %q", lines[1])
+
+	for _, ln in ipairs(lines) do
+		got[#got + 1] = ln:sub(1, -2)
+	end
+
+	while #got < nline do
+		lines = check(a:recvlines(nil, "*l", "t", 3))
+		check(#lines <= 64, "expected at most 64 lines, got %d", #lines)
+
+		for _, ln in ipairs(lines) do
+			got[#got + 1] = ln
+		end
+	end
+
+	check(#got == nline, "expected %d lines, got %d", nline, #got)
+
+	for i, ln in ipairs(got) do
+		check(ln == string.format("line %d", i), "line %d: got %q", i, ln)
+	end
+
+	lines = check(a:recvlines(64, "*l", "t", 3))
+	check(#lines == 1 and lines[1] == "split line", "expected only \"split line\", got %q", tostring(lines[1]))
+
+	lines = check(a:recvlines(64, "*L", "t", 3))
+	check(#lines == 1 and lines[1] == "last", "expected unterminated \"last\", got %q", tostring(lines[1]))
+
+	check(a:recvlines(64, "*l", "t", 3) == nil, "EOF not reported")
+
+	a:close()
+end)
+
+check(main:loop())
+
+say"OK"
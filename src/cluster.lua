@@ -0,0 +1,327 @@
+local loader = function(loader, ...)
+	local socket = require"cqueues.socket"
+	local thread = require"cqueues.thread"
+	local errno = require"cqueues.errno"
+	local monotime = require"cqueues".monotime
+
+	local cluster = {}
+	local methods = {}
+	local mt = { __index = methods }
+
+	--
+	-- worker
+	--
+	-- Entry point of each worker thread. It's serialized by thread.start
+	-- and so must not reference any upvalues.
+	--
+	-- Reports "ok <port>" or "error <errno>" over the pipe once set up.
+	-- EOF on the pipe means the cluster was stopped.
+	--
+	local function worker(pipe, id, count, cpu, balance, enter, nopts, ...)
+		local cqueues = require"cqueues"
+		local socket = require"cqueues.socket"
+		local thread = require"cqueues.thread"
+		local opts = {}
+
+		for i = 1, nopts do
+			local k, v = select(i * 2 - 1, ...)
+			opts[k] = v
+		end
+
+		local self = {
+			id = id,
+			workers = count,
+			cpu = cpu or nil,
+			pipe = pipe,
+			cqueue = cqueues.new(),
+		}
+
+		local function setup()
+			local srv, ok, why
+
+			if cpu then
+				ok, why = thread.setaffinity(cpu)
+
+				if not ok then
+					return nil, why
+				end
+			end
+
+			if balance ~= "reuseport" then
+				return 0
+			end
+
+			opts.reuseport = true
+
+			srv, why = socket.listen(opts)
+
+			if not srv then
+				return nil, why
+			end
+
+			ok, why = srv:listen()
+
+			if not ok then
+				srv:close()
+
+				return nil, why
+			end
+
+			self.socket = srv
+
+			local _, _, port = srv:localname()
+
+			return tonumber(port) or 0
+		end
+
+		local port, why = setup()
+
+		if not port then
+			pipe:write(string.format("error %s\n", tostring(why)))
+
+			return
+		end
+
+		pipe:write(string.format("ok %d\n", port))
+
+		function self:clients(timeout)
+			if self.socket then
+				return function ()
+					return (self.socket:accept(nil, timeout))
+				end
+			elseif balance == "sendfd" then
+				return function ()
+					local _, con = self.pipe:recvfd(nil, timeout)
+
+					return con
+				end
+			else
+				return function () end
+			end
+		end
+
+		if self.socket then
+			self.cqueue:wrap(function ()
+				self.pipe:read(1)
+				self.socket:close()
+			end)
+		end
+
+		self.cqueue:wrap(enter, self, select(nopts * 2 + 1, ...))
+
+		assert(self.cqueue:loop())
+	end -- worker
+
+	local function flatten(opts)
+		local list = {}
+
+		for k, v in pairs(opts or {}) do
+			local t = type(v)
+
+			if type(k) == "string" and (t == "string" or t == "number" or t == "boolean") then
+				list[#list + 1] = k
+				list[#list + 1] = v
+			end
+		end
+
+		return list
+	end -- flatten
+
+	local function getcpus(affinity)
+		if not affinity then
+			return nil
+		elseif type(affinity) == "table" then
+			return affinity
+		else
+			local cpus = thread.getaffinity()
+
+			if not cpus then
+				cpus = {}
+
+				for i = 1, thread.ncpu() do
+					cpus[i] = i - 1
+				end
+			end
+
+			return cpus
+		end
+	end -- getcpus
+
+	local function ready(con, deadline)
+		local ln, why = con:read("*l", deadline and math.max(deadline - monotime(), 0))
+		local status, value = string.match(ln or "", "^(%a+) (%S+)$")
+
+		if status == "ok" then
+			return tonumber(value)
+		elseif status == "error" then
+			return nil, tonumber(value) or value
+		else
+			return nil, why or errno.EPIPE
+		end
+	end -- ready
+
+	--
+	-- cluster.start
+	--
+	-- Start opts.workers (default thread.ncpu()) worker threads, each
+	-- running enter(worker, ...) inside its own controller. See the
+	-- user guide for the options and the worker object.
+	--
+	function cluster.start(opts, enter, ...)
+		opts = opts or {}
+
+		local count = opts.workers or thread.ncpu()
+		local balance = (opts.listen and (opts.balance or "reuseport")) or "none"
+		local cpus = getcpus(opts.affinity)
+		local deadline = opts.timeout and (monotime() + opts.timeout)
+		local listen = {}
+		local self = setmetatable({ workers = {}, balance = balance }, mt)
+
+		for k, v in pairs(opts.listen or {}) do
+			listen[k] = v
+		end
+
+		if balance == "sendfd" then
+			local srv, ok, why
+
+			srv, why = socket.listen(listen)
+
+			if not srv then
+				return nil, why
+			end
+
+			ok, why = srv:listen()
+
+			if not ok then
+				srv:close()
+
+				return nil, why
+			end
+
+			local _, _, port = srv:localname()
+
+			self.socket = srv
+			self.port = tonumber(port)
+		elseif balance ~= "reuseport" and balance ~= "none" then
+			error(string.format("%s: unknown balance method", tostring(balance)), 2)
+		end
+
+		for id = 1, count do
+			local cpu = cpus and #cpus > 0 and cpus[(id - 1) % #cpus + 1]
+			local flat = flatten(listen)
+			local thr, con, why = thread.start(worker, id, count, cpu or false, balance, enter, #flat / 2, (table.unpack or unpack)(flat))
+			local port
+
+			if not thr then
+				self:stop()
+				self:join()
+
+				return nil, why
+			end
+
+			self.workers[id] = { thread = thr, pipe = con, cpu = cpu or nil }
+
+			port, why = ready(con, deadline)
+
+			if not port then
+				self:stop()
+				self:join()
+
+				return nil, why
+			end
+
+			-- an ephemeral port is resolved by the first worker;
+			-- the rest must join its SO_REUSEPORT group
+			if balance == "reuseport" and id == 1 then
+				self.port = port
+				listen.port = port
+			end
+		end
+
+		return self
+	end -- cluster.start
+
+	--
+	-- cluster:dispatch
+	--
+	-- With .balance = "sendfd", accept connections on the shared
+	-- listener and hand them to the workers round-robin. Returns once
+	-- the listener is closed by cluster:stop.
+	--
+	function methods:dispatch(timeout)
+		local next = 0
+
+		if not self.socket then
+			return true
+		end
+
+		for con in self.socket:clients(timeout) do
+			local ok, why
+
+			next = next % #self.workers + 1
+			ok, why = self.workers[next].pipe:sendfd("c", con)
+			con:close()
+
+			if not ok then
+				return false, why
+			end
+		end
+
+		return true
+	end -- cluster:dispatch
+
+	--
+	-- cluster:stop
+	--
+	-- Close the shared listener and every worker pipe. Workers close
+	-- their listeners on EOF and exit once their controllers empty.
+	--
+	function methods:stop()
+		if self.socket then
+			self.socket:close()
+			self.socket = nil
+		end
+
+		for _, w in ipairs(self.workers) do
+			if w.pipe then
+				w.pipe:close()
+				w.pipe = nil
+			end
+		end
+	end -- cluster:stop
+
+	--
+	-- cluster:join
+	--
+	-- Join every worker thread. Returns true, or false and the first
+	-- local error code or thread failure encountered.
+	--
+	function methods:join(timeout)
+		local deadline = timeout and (monotime() + timeout)
+		local result, failure = true, nil
+
+		for _, w in ipairs(self.workers) do
+			if w.thread then
+				local ok, why = w.thread:join(deadline and math.max(deadline - monotime(), 0))
+
+				if not ok then
+					return false, why
+				end
+
+				w.thread = nil
+
+				if why ~= nil and result then
+					result, failure = false, why
+				end
+			end
+		end
+
+		return result, failure
+	end -- cluster:join
+
+	cluster.loader = loader
+
+	return cluster
+end
+
+return loader(loader, ...)
@@ -29,6 +29,7 @@
 #include <float.h>	/* FLT_RADIX */
 #include <stdarg.h>	/* va_list va_start va_end */
 #include <stddef.h>	/* NULL offsetof() size_t */
+#include <stdint.h>	/* UINT64_MAX uint64_t */
 #include <stdlib.h>	/* malloc(3) free(3) */
 #include <string.h>	/* memset(3) */
 #include <signal.h>	/* sigprocmask(2) pthread_sigmask(3) */
@@ -304,6 +305,18 @@ static inline double monotime(void) {
 } /* monotime() */
 
 
+/* CPU time of the calling thread, or wall time if unavailable */
+static inline double cputime(void) {
+#if defined CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return ts2f(&ts);
+#endif
+	return monotime();
+} /* cputime() */
+
+
 static inline double abstimeout(double timeout) {
 	return (isfinite(timeout))? monotime() + fmax(timeout, 0) : NAN;
 } /* abstimeout() */
@@ -336,76 +349,145 @@ static inline double mintimeout(double a, double b) {
  *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-static void *make(size_t size, int *error) {
-	void *p;
+/*
+ * Objects are carved out of SLAB_SIZE chunks allocated at SLAB_SIZE
+ * alignment, so the owning slab of any object is found by masking its
+ * address. The slab header is padded to a cache line, and objects are
+ * packed behind it at SLAB_ALIGN granularity. Allocation prefers partially
+ * used slabs to keep live objects dense; a slab which empties out is kept
+ * for reuse, but only up to SLAB_IDLE of them, beyond which they're
+ * returned to the system.
+ */
+#define SLAB_SIZE 16384
+#define SLAB_LINE 64
+#define SLAB_ALIGN 16
+#define SLAB_IDLE 2
 
-	if (!(p = malloc(size)))
-		*error = errno;
-
-	return p;
-} /* make() */
+struct slab {
+	LIST_ENTRY(slab) le;
+	void *head; /* free objects */
+	unsigned used;
+}; /* struct slab */
 
+#define SLAB_HDRSIZE (((sizeof (struct slab) + SLAB_LINE - 1) / SLAB_LINE) * SLAB_LINE)
 
 struct pool {
-	size_t size, count;
-	void *head;
+	size_t size, nslab; /* object size and objects per slab */
+	LIST_HEAD(, slab) partial, full, empty;
+	size_t slabs, idle, used;
 }; /* pool */
 
 static void pool_init(struct pool *P, size_t size) {
-	P->size  = MAX(size, sizeof (void **));
-	P->count = 0;
-	P->head  = NULL;
+	P->size  = ((MAX(size, sizeof (void **)) + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN;
+	P->nslab = (SLAB_SIZE - SLAB_HDRSIZE) / P->size;
+	LIST_INIT(&P->partial);
+	LIST_INIT(&P->full);
+	LIST_INIT(&P->empty);
+	P->slabs = 0;
+	P->idle  = 0;
+	P->used  = 0;
 } /* pool_init() */
 
+static void slab_free(struct pool *P, struct slab *slab) {
+	LIST_REMOVE(slab, le);
+	free(slab);
+	P->slabs--;
+} /* slab_free() */
+
 static void pool_destroy(struct pool *P) {
-	void *p;
+	struct slab *slab;
 
-	while ((p = P->head)) {
-		P->head = *(void **)p;
-		free(p);
-		P->count--;
-	}
+	while ((slab = LIST_FIRST(&P->partial)))
+		slab_free(P, slab);
+	while ((slab = LIST_FIRST(&P->full)))
+		slab_free(P, slab);
+	while ((slab = LIST_FIRST(&P->empty)))
+		slab_free(P, slab);
+
+	P->idle = 0;
+	P->used = 0;
 } /* pool_destroy() */
 
-static void pool_put(struct pool *P, void *p) {
-	*(void **)p = P->head;
-	P->head = p;
-} /* pool_put() */
+static struct slab *pool_grow(struct pool *P, int *error) {
+	struct slab *slab;
+	unsigned char *p;
+	void *base;
+	size_t i;
 
-static int pool_grow(struct pool *P, size_t n) {
-	void *p;
-	int error;
+	if (!P->nslab) {
+		*error = ENOMEM;
 
-	while (n--) {
-		if (P->count + 1 == 0)
-			return ENOMEM;
+		return NULL;
+	}
 
-		if (!(p = make(P->size, &error)))
-			return error;
+	if ((*error = posix_memalign(&base, SLAB_SIZE, SLAB_SIZE)))
+		return NULL;
 
-		P->count++;
+	slab = base;
+	slab->head = NULL;
+	slab->used = 0;
 
-		pool_put(P, p);
+	/* thread the free list in address order */
+	for (i = P->nslab, p = (unsigned char *)slab + SLAB_HDRSIZE + (P->nslab - 1) * P->size; i > 0; i--, p -= P->size) {
+		*(void **)p = slab->head;
+		slab->head = p;
 	}
 
-	return 0;
+	LIST_INSERT_HEAD(&P->partial, slab, le);
+	P->slabs++;
+
+	return slab;
 } /* pool_grow() */
 
-static void *pool_get(struct pool *P, int *_error) {
-	void *p;
-	int error;
+static void pool_put(struct pool *P, void *p) {
+	struct slab *slab = (struct slab *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1));
 
-	if (!(p = P->head)) {
-		error = pool_grow(P, MAX(1, P->count));
+	if (!slab->head) {
+		LIST_REMOVE(slab, le);
+		LIST_INSERT_HEAD(&P->partial, slab, le);
+	}
 
-		if (!(p = P->head)) {
-			*_error = error;
+	*(void **)p = slab->head;
+	slab->head = p;
+	slab->used--;
+	P->used--;
 
+	if (!slab->used) {
+		LIST_REMOVE(slab, le);
+
+		if (P->idle < SLAB_IDLE) {
+			LIST_INSERT_HEAD(&P->empty, slab, le);
+			P->idle++;
+		} else {
+			free(slab);
+			P->slabs--;
+		}
+	}
+} /* pool_put() */
+
+static void *pool_get(struct pool *P, int *error) {
+	struct slab *slab;
+	void *p;
+
+	if (!(slab = LIST_FIRST(&P->partial))) {
+		if ((slab = LIST_FIRST(&P->empty))) {
+			LIST_REMOVE(slab, le);
+			LIST_INSERT_HEAD(&P->partial, slab, le);
+			P->idle--;
+		} else if (!(slab = pool_grow(P, error))) {
 			return NULL;
 		}
 	}
 
-	P->head = *(void **)p;
+	p = slab->head;
+	slab->head = *(void **)p;
+	slab->used++;
+	P->used++;
+
+	if (!slab->head) {
+		LIST_REMOVE(slab, le);
+		LIST_INSERT_HEAD(&P->full, slab, le);
+	}
 
 	return p;
 } /* pool_get() */
@@ -426,6 +508,15 @@ static void *pool_get(struct pool *P, int *_error) {
 #error "No polling backend available"
 #endif
 
+#if ENABLE_IOURING
+#if !ENABLE_EPOLL
+#error "io_uring backend requires epoll"
+#endif
+#include <linux/io_uring.h> /* struct io_uring_params struct io_uring_sqe struct io_uring_cqe IORING_* */
+#include <sys/mman.h>	/* mmap(2) munmap(2) */
+#include <sys/syscall.h> /* __NR_io_uring_setup __NR_io_uring_enter */
+#endif
+
 #if HAVE_SYS_EVENTFD_H
 #include <sys/eventfd.h> /* eventfd(2) */
 #endif
@@ -433,7 +524,34 @@ static void *pool_get(struct pool *P, int *_error) {
 
 #define KPOLL_FOREACH(ke, kp) for (ke = (kp)->pending.event; ke < &(kp)->pending.event[(kp)->pending.count]; ke++)
 
-#define KPOLL_MAXWAIT 32
+/*
+ * The pending event array starts at KPOLL_MINWAIT entries, doubles each
+ * time a wait fills it (up to .maxevents, by default KPOLL_MAXWAIT), and
+ * is halved after KPOLL_IDLEWAIT consecutive waits which used less than a
+ * quarter of it.
+ */
+#define KPOLL_MINWAIT 32
+#define KPOLL_MAXWAIT 1024
+#define KPOLL_IDLEWAIT 64
+
+/*
+ * The io_uring backend arms one-shot IORING_OP_POLL_ADD requests. Arming
+ * only queues a submission entry; the whole batch is handed to the kernel
+ * by the io_uring_enter(2) which also waits for completions. Completions
+ * are translated into struct epoll_event so the rest of the controller
+ * needn't care which backend is in use.
+ *
+ * .user_data holds the descriptor (plus one, so 0 and 1 can be reserved)
+ * in the upper half and a per-descriptor generation in the lower half.
+ * The generation is bumped whenever a request is armed or removed, so
+ * completions for requests which were superseded or cancelled, and whose
+ * fileno may since have been recycled, are recognized and dropped.
+ */
+#define KPOLL_URING_SQ 256
+#define KPOLL_URING_CQ 4096
+
+#define KPOLL_URING_IGNORE 0
+#define KPOLL_URING_ALERT 1
 
 #if ENABLE_EPOLL
 typedef struct epoll_event kpoll_event_t;
@@ -448,12 +566,26 @@ typedef port_event_t kpoll_event_t;
 typedef struct kevent kpoll_event_t;
 #endif
 
+#if ENABLE_IOURING
+enum kpoll_uring {
+	KPOLL_URING_OFF,
+	KPOLL_URING_TRY,  /* use io_uring if the kernel supports it */
+	KPOLL_URING_ON,
+}; /* enum kpoll_uring */
+
+struct kpoll_urfd {
+	void *udata;
+	uint32_t gen;
+}; /* struct kpoll_urfd */
+#endif
+
 struct kpoll {
 	int fd;
 
 	struct {
-		kpoll_event_t event[KPOLL_MAXWAIT];
-		size_t count;
+		kpoll_event_t *event;
+		size_t count, size, max;
+		unsigned idle;
 	} pending;
 
 	struct {
@@ -461,23 +593,482 @@ struct kpoll {
 		short state;
 		int pending;
 	} alert;
+
+	struct {
+		unsigned long wait, full;
+	} stats;
+
+#if ENABLE_IOURING
+	struct {
+		enum kpoll_uring mode;
+		_Bool on;
+
+		struct {
+			unsigned *head, *tail, *mask, *entries, *array;
+			struct io_uring_sqe *sqe;
+			unsigned ktail, queued;
+		} sq;
+
+		struct {
+			unsigned *head, *tail, *mask;
+			struct io_uring_cqe *cqe;
+		} cq;
+
+		struct {
+			void *base;
+			size_t size;
+		} map[3];
+
+		struct kpoll_urfd *fdtab;
+		size_t fdlen;
+	} uring;
+#endif
 }; /* struct kpoll */
 
 
 static void kpoll_preinit(struct kpoll *kp) {
 	kp->fd = -1;
+	kp->pending.event = NULL;
 	kp->pending.count = 0;
+	kp->pending.size = 0;
+	kp->pending.max = KPOLL_MAXWAIT;
+	kp->pending.idle = 0;
 	for (size_t i = 0; i < countof(kp->alert.fd); i++)
 		kp->alert.fd[i] = -1;
 	kp->alert.state = 0;
 	kp->alert.pending = 0;
+	kp->stats.wait = 0;
+	kp->stats.full = 0;
+#if ENABLE_IOURING
+	memset(&kp->uring, 0, sizeof kp->uring);
+	kp->uring.mode = KPOLL_URING_TRY;
+	for (size_t i = 0; i < countof(kp->uring.map); i++)
+		kp->uring.map[i].base = MAP_FAILED;
+#endif
 } /* kpoll_preinit() */
 
 
-static int kpoll_ctl(struct kpoll *, int, short *, short, void *);
+static int kpoll_resize(struct kpoll *kp, size_t size) {
+	kpoll_event_t *event;
+
+	if (size == kp->pending.size)
+		return 0;
+
+	if (size > INT_MAX || size > SIZE_MAX / sizeof *event)
+		return ENOMEM;
+
+	if (!(event = realloc(kp->pending.event, size * sizeof *event)))
+		return errno;
+
+	kp->pending.event = event;
+	kp->pending.size = size;
+	kp->pending.count = MIN(kp->pending.count, size);
+	kp->pending.idle = 0;
+
+	return 0;
+} /* kpoll_resize() */
+
+
+/* adapt the batch size to how many events the last wait returned */
+static void kpoll_adapt(struct kpoll *kp) {
+	size_t min = MIN(KPOLL_MINWAIT, kp->pending.max);
+
+	kp->stats.wait++;
+
+	if (kp->pending.count == kp->pending.size) {
+		kp->stats.full++;
+		kp->pending.idle = 0;
+
+		/* failure to grow is not fatal; we just poll more often */
+		if (kp->pending.size < kp->pending.max)
+			(void)kpoll_resize(kp, MIN(kp->pending.size * 2, kp->pending.max));
+	} else if (kp->pending.size > min && kp->pending.count < kp->pending.size / 4) {
+		if (++kp->pending.idle >= KPOLL_IDLEWAIT)
+			(void)kpoll_resize(kp, MAX(kp->pending.size / 2, min));
+	} else {
+		kp->pending.idle = 0;
+	}
+} /* kpoll_adapt() */
+
+
+#if ENABLE_IOURING
+static int uring_enter(struct kpoll *kp, unsigned submit, unsigned mincomplete, const struct timespec *ts) {
+	struct io_uring_getevents_arg arg;
+	unsigned flags = 0;
+	long n;
+
+	memset(&arg, 0, sizeof arg);
+
+	if (mincomplete) {
+		arg.ts = (uint64_t)(uintptr_t)ts;
+		flags = IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG;
+	}
+
+	if (-1 == (n = syscall(__NR_io_uring_enter, kp->fd, submit, mincomplete, flags, &arg, sizeof arg)))
+		return errno;
+
+	kp->uring.sq.queued -= MIN((unsigned)n, kp->uring.sq.queued);
+
+	return 0;
+} /* uring_enter() */
+
+
+static void *uring_map(struct kpoll *kp, size_t i, size_t size, off_t offset, int *error) {
+	void *base;
+
+	if (MAP_FAILED == (base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, kp->fd, offset))) {
+		*error = errno;
+
+		return NULL;
+	}
+
+	kp->uring.map[i].base = base;
+	kp->uring.map[i].size = size;
+
+	return base;
+} /* uring_map() */
+
+
+static void uring_destroy(struct kpoll *kp) {
+	for (size_t i = 0; i < countof(kp->uring.map); i++) {
+		if (kp->uring.map[i].base != MAP_FAILED)
+			munmap(kp->uring.map[i].base, kp->uring.map[i].size);
+		kp->uring.map[i].base = MAP_FAILED;
+	}
+
+	free(kp->uring.fdtab);
+	kp->uring.fdtab = NULL;
+	kp->uring.fdlen = 0;
+
+	kp->uring.sq.ktail = 0;
+	kp->uring.sq.queued = 0;
+	kp->uring.on = 0;
+} /* uring_destroy() */
+
+
+static int uring_init(struct kpoll *kp) {
+	struct io_uring_params params;
+	size_t sqlen, cqlen;
+	unsigned char *sq, *cq;
+	int error = 0;
+
+	memset(&params, 0, sizeof params);
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = KPOLL_URING_CQ;
+
+	if (-1 == (kp->fd = syscall(__NR_io_uring_setup, KPOLL_URING_SQ, &params)))
+		return errno;
+
+	/* we rely on timed waits and on the kernel never dropping completions */
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+		error = ENOTSUP;
+		goto error;
+	}
+
+	sqlen = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+	cqlen = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (!(sq = uring_map(kp, 0, MAX(sqlen, cqlen), IORING_OFF_SQ_RING, &error)))
+			goto error;
+		cq = sq;
+	} else {
+		if (!(sq = uring_map(kp, 0, sqlen, IORING_OFF_SQ_RING, &error)))
+			goto error;
+		if (!(cq = uring_map(kp, 1, cqlen, IORING_OFF_CQ_RING, &error)))
+			goto error;
+	}
+
+	if (!(kp->uring.sq.sqe = uring_map(kp, 2, params.sq_entries * sizeof (struct io_uring_sqe), IORING_OFF_SQES, &error)))
+		goto error;
+
+	kp->uring.sq.head = (unsigned *)(sq + params.sq_off.head);
+	kp->uring.sq.tail = (unsigned *)(sq + params.sq_off.tail);
+	kp->uring.sq.mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	kp->uring.sq.entries = (unsigned *)(sq + params.sq_off.ring_entries);
+	kp->uring.sq.array = (unsigned *)(sq + params.sq_off.array);
+	kp->uring.sq.ktail = *kp->uring.sq.tail;
+	kp->uring.sq.queued = 0;
+
+	/* submission slots are always used in ring order */
+	for (unsigned i = 0; i < params.sq_entries; i++)
+		kp->uring.sq.array[i] = i;
+
+	kp->uring.cq.head = (unsigned *)(cq + params.cq_off.head);
+	kp->uring.cq.tail = (unsigned *)(cq + params.cq_off.tail);
+	kp->uring.cq.mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	kp->uring.cq.cqe = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	kp->uring.on = 1;
+
+	return 0;
+error:
+	uring_destroy(kp);
+	cqs_closefd(&kp->fd);
+
+	return error;
+} /* uring_init() */
+
+
+static struct io_uring_sqe *uring_getsqe(struct kpoll *kp, int *error) {
+	struct io_uring_sqe *sqe;
+
+	if (kp->uring.sq.ktail - __atomic_load_n(kp->uring.sq.head, __ATOMIC_ACQUIRE) >= *kp->uring.sq.entries) {
+		/* ring full; hand what we have to the kernel */
+		if ((*error = uring_enter(kp, kp->uring.sq.queued, 0, NULL)) && *error != EINTR)
+			return NULL;
+
+		if (kp->uring.sq.ktail - __atomic_load_n(kp->uring.sq.head, __ATOMIC_ACQUIRE) >= *kp->uring.sq.entries) {
+			*error = EBUSY;
+
+			return NULL;
+		}
+	}
+
+	sqe = &kp->uring.sq.sqe[kp->uring.sq.ktail & *kp->uring.sq.mask];
+	memset(sqe, 0, sizeof *sqe);
+
+	return sqe;
+} /* uring_getsqe() */
+
+
+static void uring_putsqe(struct kpoll *kp) {
+	__atomic_store_n(kp->uring.sq.tail, ++kp->uring.sq.ktail, __ATOMIC_RELEASE);
+	kp->uring.sq.queued++;
+} /* uring_putsqe() */
+
+
+static inline uint64_t uring_udata(int fd, uint32_t gen) {
+	return ((uint64_t)fd + 1) << 32 | gen;
+} /* uring_udata() */
+
+
+static int uring_ctl(struct kpoll *kp, int fd, short *state, short events, void *udata) {
+	struct io_uring_sqe *sqe;
+	int error;
+
+	if (*state == events)
+		return 0;
+
+	if (fd < 0)
+		return EBADF;
+
+	if ((size_t)fd >= kp->uring.fdlen) {
+		size_t fdlen = MAX(64, kp->uring.fdlen);
+		struct kpoll_urfd *fdtab;
+
+		while (fdlen <= (size_t)fd)
+			fdlen *= 2;
+
+		if (!(fdtab = realloc(kp->uring.fdtab, fdlen * sizeof *fdtab)))
+			return errno;
+
+		memset(&fdtab[kp->uring.fdlen], 0, (fdlen - kp->uring.fdlen) * sizeof *fdtab);
+		kp->uring.fdtab = fdtab;
+		kp->uring.fdlen = fdlen;
+	}
+
+	if (*state) {
+		if (!(sqe = uring_getsqe(kp, &error)))
+			return error;
+
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = uring_udata(fd, kp->uring.fdtab[fd].gen);
+		sqe->user_data = KPOLL_URING_IGNORE;
+		uring_putsqe(kp);
+
+		*state = 0;
+	}
+
+	kp->uring.fdtab[fd].gen++;
+	kp->uring.fdtab[fd].udata = udata;
+
+	if (events) {
+		if (!(sqe = uring_getsqe(kp, &error)))
+			return error;
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		/* the 16-bit field lands in the right half on either endianness */
+		sqe->poll_events = (unsigned short)events;
+		sqe->user_data = uring_udata(fd, kp->uring.fdtab[fd].gen);
+		uring_putsqe(kp);
+
+		*state = events;
+	}
+
+	return 0;
+} /* uring_ctl() */
+
+
+static _Bool uring_reap(struct kpoll *kp, const struct io_uring_cqe *cqe, kpoll_event_t *event) {
+	uint64_t fd;
+
+	if (cqe->user_data == KPOLL_URING_IGNORE)
+		return 0;
+
+	memset(event, 0, sizeof *event);
+
+	if (cqe->user_data == KPOLL_URING_ALERT) {
+		event->events = POLLIN;
+		event->data.ptr = &kp->alert;
+
+		return 1;
+	}
+
+	fd = (cqe->user_data >> 32) - 1;
+
+	if (fd >= kp->uring.fdlen || kp->uring.fdtab[fd].gen != (uint32_t)cqe->user_data)
+		return 0; /* stale */
+
+	if (cqe->res == -ECANCELED)
+		return 0;
+
+	event->events = (cqe->res < 0)? POLLERR : (unsigned)cqe->res;
+	event->data.ptr = kp->uring.fdtab[fd].udata;
+
+	return 1;
+} /* uring_reap() */
+
+
+static int uring_wait(struct kpoll *kp, double timeout) {
+	unsigned head, tail;
+	int error;
+
+	kp->pending.count = 0;
+
+	head = *kp->uring.cq.head;
+	tail = __atomic_load_n(kp->uring.cq.tail, __ATOMIC_ACQUIRE);
+
+	/* submit and wait with a single syscall */
+	if (head == tail && timeout != 0.0) {
+		error = uring_enter(kp, kp->uring.sq.queued, 1, f2ts(timeout));
+	} else if (kp->uring.sq.queued) {
+		error = uring_enter(kp, kp->uring.sq.queued, 0, NULL);
+	} else {
+		error = 0;
+	}
+
+	/* EBUSY means the completion queue is backlogged; drain it below */
+	if (error && error != ETIME && error != EINTR && error != EBUSY && error != EAGAIN)
+		return error;
+
+	tail = __atomic_load_n(kp->uring.cq.tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail && kp->pending.count < kp->pending.size) {
+		if (uring_reap(kp, &kp->uring.cq.cqe[head & *kp->uring.cq.mask], &kp->pending.event[kp->pending.count]))
+			kp->pending.count++;
+		head++;
+	}
+
+	__atomic_store_n(kp->uring.cq.head, head, __ATOMIC_RELEASE);
+
+	kpoll_adapt(kp);
+
+	return 0;
+} /* uring_wait() */
+
+
+static int uring_alert(struct kpoll *kp) {
+	struct io_uring_sqe *sqe;
+	int error;
+
+	if (!(sqe = uring_getsqe(kp, &error)))
+		return error;
+
+	sqe->opcode = IORING_OP_NOP;
+	sqe->fd = -1;
+	sqe->user_data = KPOLL_URING_ALERT;
+	uring_putsqe(kp);
+
+	/* the completion is what makes our descriptor readable */
+	return uring_enter(kp, kp->uring.sq.queued, 0, NULL);
+} /* uring_alert() */
+#endif
+
+
+/*
+ * Select the backend used by subsequent kpoll_init calls. Only "io_uring"
+ * and the native backend name are understood.
+ */
+static int kpoll_setbackend(struct kpoll *kp NOTUSED, const char *name) {
+#if ENABLE_IOURING
+	if (!strcmp(name, "io_uring")) {
+		kp->uring.mode = KPOLL_URING_ON;
+
+		return 0;
+	}
+#endif
+#if ENABLE_EPOLL
+	if (!strcmp(name, "epoll")) {
+#elif ENABLE_PORTS
+	if (!strcmp(name, "ports")) {
+#elif ENABLE_KQUEUE
+	if (!strcmp(name, "kqueue")) {
+#endif
+#if ENABLE_IOURING
+		kp->uring.mode = KPOLL_URING_OFF;
+#endif
+		return 0;
+	}
+
+	return EINVAL;
+} /* kpoll_setbackend() */
+
+
+static const char *kpoll_backend(struct kpoll *kp NOTUSED) {
+#if ENABLE_IOURING
+	if (kp->uring.on)
+		return "io_uring";
+#endif
+#if ENABLE_EPOLL
+	return "epoll";
+#elif ENABLE_PORTS
+	return "ports";
+#elif ENABLE_KQUEUE
+	return "kqueue";
+#endif
+} /* kpoll_backend() */
+
+
+/*
+ * Edge-triggered registration (see cqueues.new{ edge = true }) is possible
+ * with epoll (EPOLLET) and kqueue (EV_CLEAR). Solaris Event Ports and our
+ * io_uring polls are one-shot, so descriptors are re-armed after every
+ * event anyway.
+ */
+static _Bool kpoll_haveedge(struct kpoll *kp NOTUSED) {
+#if ENABLE_IOURING
+	if (kp->uring.on)
+		return 0;
+#endif
+#if ENABLE_PORTS
+	return 0;
+#else
+	return 1;
+#endif
+} /* kpoll_haveedge() */
+
+
+/* hand queued submissions to the kernel so our descriptor reflects them */
+static int kpoll_flush(struct kpoll *kp NOTUSED) {
+#if ENABLE_IOURING
+	if (kp->uring.on && kp->uring.sq.queued)
+		return uring_enter(kp, kp->uring.sq.queued, 0, NULL);
+#endif
+	return 0;
+} /* kpoll_flush() */
+
+
+static int kpoll_ctl(struct kpoll *, int, short *, short, _Bool, void *);
 static int alert_rearm(struct kpoll *);
 
 static int alert_init(struct kpoll *kp) {
+#if ENABLE_IOURING
+	if (kp->uring.on)
+		return 0;
+#endif
 #if ENABLE_PORTS
 	(void)kp;
 	return 0;
@@ -512,10 +1103,14 @@ static void alert_destroy(struct kpoll *kp) {
 } /* alert_destroy() */
 
 static int alert_rearm(struct kpoll *kp) {
+#if ENABLE_IOURING
+	if (kp->uring.on)
+		return 0;
+#endif
 #if ENABLE_PORTS
 	return 0;
 #else
-	return kpoll_ctl(kp, kp->alert.fd[0], &kp->alert.state, POLLIN, &kp->alert);
+	return kpoll_ctl(kp, kp->alert.fd[0], &kp->alert.state, POLLIN, 0, &kp->alert);
 #endif
 } /* alert_rearm() */
 
@@ -523,6 +1118,15 @@ static int alert_rearm(struct kpoll *kp) {
 static int kpoll_init(struct kpoll *kp) {
 	int error;
 
+#if ENABLE_IOURING
+	if (kp->uring.mode != KPOLL_URING_OFF) {
+		if (!(error = uring_init(kp)))
+			goto pending;
+		else if (kp->uring.mode == KPOLL_URING_ON)
+			return error;
+		/* otherwise fall back to epoll */
+	}
+#endif
 #if ENABLE_EPOLL
 #if defined EPOLL_CLOEXEC
 	(void)error;
@@ -548,15 +1152,32 @@ static int kpoll_init(struct kpoll *kp) {
 	if ((error = setcloexec(kp->fd)))
 		return error;
 #endif
+#if ENABLE_IOURING
+pending:
+#endif
+	if (!kp->pending.event && (error = kpoll_resize(kp, MIN(KPOLL_MINWAIT, kp->pending.max))))
+		return error;
 
 	return alert_init(kp);
 } /* kpoll_init() */
 
 
+/* NB: preserves .pending.max and .stats across cqueue_reboot() */
 static void kpoll_destroy(struct kpoll *kp) {
 	alert_destroy(kp);
-	(void)close(kp->fd);
-	kpoll_preinit(kp);
+#if ENABLE_IOURING
+	uring_destroy(kp);
+#endif
+	cqs_closefd(&kp->fd);
+
+	free(kp->pending.event);
+	kp->pending.event = NULL;
+	kp->pending.count = 0;
+	kp->pending.size = 0;
+	kp->pending.idle = 0;
+
+	kp->alert.state = 0;
+	kp->alert.pending = 0;
 } /* kpoll_destroy() */
 
 
@@ -582,7 +1203,12 @@ static inline short kpoll_pending(const kpoll_event_t *event) {
 } /* kpoll_pending() */
 
 
-static inline short kpoll_diff(const kpoll_event_t *event NOTUSED, short ostate NOTUSED) {
+static inline short kpoll_diff(struct kpoll *kp NOTUSED, const kpoll_event_t *event NOTUSED, short ostate NOTUSED) {
+#if ENABLE_IOURING
+	/* io_uring polls are one-shot, too */
+	if (kp->uring.on)
+		return 0;
+#endif
 #if ENABLE_PORTS
 	/* Solaris Event Ports aren't persistent. */
 	return 0;
@@ -592,11 +1218,16 @@ static inline short kpoll_diff(const kpoll_event_t *event NOTUSED, short ostate
 } /* kpoll_diff() */
 
 
-static int kpoll_ctl(struct kpoll *kp, int fd, short *state, short events, void *udata) {
+static int kpoll_ctl(struct kpoll *kp, int fd, short *state, short events, _Bool edge NOTUSED, void *udata) {
 #if ENABLE_EPOLL
 	struct epoll_event event;
 	int op;
 
+#if ENABLE_IOURING
+	if (kp->uring.on)
+		return uring_ctl(kp, fd, state, events, udata);
+#endif
+
 	if (*state == events)
 		return 0;
 
@@ -604,7 +1235,7 @@ static int kpoll_ctl(struct kpoll *kp, int fd, short *state, short events, void
 
 	memset(&event, 0, sizeof event);
 
-	event.events = events;
+	event.events = events | ((edge)? EPOLLET : 0);
 	event.data.ptr = udata;
 
 	if (0 != epoll_ctl(kp->fd, op, fd, &event))
@@ -636,7 +1267,7 @@ static int kpoll_ctl(struct kpoll *kp, int fd, short *state, short events, void
 
 	if (events & POLLIN) {
 		if (!(*state & POLLIN)) {
-			KP_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, udata);
+			KP_SET(&event, fd, EVFILT_READ, EV_ADD|((edge)? EV_CLEAR : 0), 0, 0, udata);
 
 			if (0 != kevent(kp->fd, &event, 1, NULL, 0, &(struct timespec){ 0, 0 }))
 				return errno;
@@ -654,25 +1285,72 @@ static int kpoll_ctl(struct kpoll *kp, int fd, short *state, short events, void
 
 	if (events & POLLOUT) {
 		if (!(*state & POLLOUT)) {
-			KP_SET(&event, fd, EVFILT_WRITE, EV_ADD, 0, 0, udata);
+			KP_SET(&event, fd, EVFILT_WRITE, EV_ADD|((edge)? EV_CLEAR : 0), 0, 0, udata);
+
+			if (0 != kevent(kp->fd, &event, 1, NULL, 0, &(struct timespec){ 0, 0 }))
+				return errno;
+
+			*state |= POLLOUT;
+		}
+	} else if (*state & POLLOUT) {
+		KP_SET(&event, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+
+		if (0 != kevent(kp->fd, &event, 1, NULL, 0, &(struct timespec){ 0, 0 }))
+			return errno;
+
+		*state &= ~POLLOUT;
+	}
+
+	return 0;
+#endif
+} /* kpoll_ctl() */
+
+
+/*
+ * Like kpoll_ctl, but don't trust *state: the descriptor may have been
+ * closed, dropping its registration, and its number since reused.
+ */
+static int kpoll_renew(struct kpoll *kp, int fd, short *state, short events, _Bool edge, void *udata) {
+#if ENABLE_EPOLL
+	struct epoll_event event;
+	int error;
+
+#if ENABLE_IOURING
+	if (kp->uring.on) {
+		/* a pending poll pins the old file, so replace it */
+		if ((error = uring_ctl(kp, fd, state, 0, udata)))
+			return error;
+
+		return uring_ctl(kp, fd, state, events, udata);
+	}
+#endif
+
+	if (!*state || !events)
+		return kpoll_ctl(kp, fd, state, events, edge, udata);
+
+	memset(&event, 0, sizeof event);
 
-			if (0 != kevent(kp->fd, &event, 1, NULL, 0, &(struct timespec){ 0, 0 }))
-				return errno;
+	event.events = events | ((edge)? EPOLLET : 0);
+	event.data.ptr = udata;
 
-			*state |= POLLOUT;
-		}
-	} else if (*state & POLLOUT) {
-		KP_SET(&event, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+	if (0 != epoll_ctl(kp->fd, EPOLL_CTL_MOD, fd, &event)) {
+		if ((error = errno) != ENOENT)
+			return error;
 
-		if (0 != kevent(kp->fd, &event, 1, NULL, 0, &(struct timespec){ 0, 0 }))
+		if (0 != epoll_ctl(kp->fd, EPOLL_CTL_ADD, fd, &event))
 			return errno;
-
-		*state &= ~POLLOUT;
 	}
 
+	*state = events;
+
 	return 0;
+#else
+	/* re-adding is harmless for kqueue and event ports */
+	*state = 0;
+
+	return kpoll_ctl(kp, fd, state, events, edge, udata);
 #endif
-} /* kpoll_ctl() */
+} /* kpoll_renew() */
 
 
 static int kpoll_alert(struct kpoll *kp) {
@@ -684,6 +1362,16 @@ static int kpoll_alert(struct kpoll *kp) {
 	/* initialization may have been delayed */
 	if ((error = alert_init(kp)))
 		return error;
+#if ENABLE_IOURING
+	if (kp->uring.on) {
+		if ((error = uring_alert(kp)))
+			return error;
+
+		kp->alert.pending = 1;
+
+		return 0;
+	}
+#endif
 #if ENABLE_PORTS
 	if (0 != port_send(kp->fd, POLLIN, &kp->alert)) {
 		if (errno != EBUSY)
@@ -720,6 +1408,15 @@ static int kpoll_alert(struct kpoll *kp) {
 static int kpoll_calm(struct kpoll *kp) {
 	int error;
 
+#if ENABLE_IOURING
+	/* each NOP completion is discrete */
+	if (kp->uring.on) {
+		kp->alert.pending = 0;
+
+		return 0;
+	}
+#endif
+
 #if ENABLE_PORTS
 	/* each PORT_SOURCE_USER event is discrete */
 #elif HAVE_EVENTFD
@@ -770,10 +1467,18 @@ static int kpoll_wait(struct kpoll *kp, double timeout) {
 #if ENABLE_EPOLL
 	int n;
 
-	if (-1 == (n = epoll_wait(kp->fd, kp->pending.event, (int)countof(kp->pending.event), f2ms(timeout))))
+#if ENABLE_IOURING
+	if (kp->uring.on)
+		return uring_wait(kp, timeout);
+#endif
+
+	kp->pending.count = 0;
+
+	if (-1 == (n = epoll_wait(kp->fd, kp->pending.event, (int)kp->pending.size, f2ms(timeout))))
 		return (errno == EINTR)? 0 : errno;
 
 	kp->pending.count = n;
+	kpoll_adapt(kp);
 
 	return 0;
 #elif ENABLE_PORTS
@@ -782,25 +1487,211 @@ static int kpoll_wait(struct kpoll *kp, double timeout) {
 
 	kp->pending.count = 0;
 
-	if (0 != port_getn(kp->fd, kp->pending.event, countof(kp->pending.event), &n, f2ts(timeout)))
+	if (0 != port_getn(kp->fd, kp->pending.event, (uint_t)kp->pending.size, &n, f2ts(timeout)))
 		return (errno == ETIME || errno == EINTR)? 0 : errno;
 
 	kp->pending.count = n;
+	kpoll_adapt(kp);
 
 	return 0;
 #elif ENABLE_KQUEUE
 	int n;
 
-	if (-1 == (n = kevent(kp->fd, NULL, 0, kp->pending.event, (int)countof(kp->pending.event), f2ts(timeout))))
+	kp->pending.count = 0;
+
+	if (-1 == (n = kevent(kp->fd, NULL, 0, kp->pending.event, (int)kp->pending.size, f2ts(timeout))))
 		return (errno == EINTR)? 0 : errno;
 
 	kp->pending.count = n;
+	kpoll_adapt(kp);
 
 	return 0;
 #endif
 } /* kpoll_wait() */
 
 
+/*
+ * P O S T  B O X  R O U T I N E S
+ *
+ * Posts are pushed onto a lock-free LIFO which the controller swaps out
+ * and reverses in one step. Only a post which finds the box quiet writes
+ * the doorbell, so a burst of posts between two steps costs a single
+ * write(2). The doorbell is polled by the controller like any other
+ * descriptor, as the alert descriptor may only be written from the
+ * controller's own thread.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct post {
+	struct post *next;
+	cqs_postfn_t *fn; /* NULL for messages posted from Lua */
+	void *arg;
+
+	int type;
+	_Bool isinteger;
+
+	union {
+		lua_Number number;
+		lua_Integer integer;
+		_Bool boolean;
+	} v;
+
+	size_t len;
+	char data[];
+}; /* struct post */
+
+struct cqs_postbox {
+	unsigned refs;
+	int rung, closed;
+	int fd[2]; /* eventfd in [0], or pipe */
+	struct post *head;
+}; /* struct cqs_postbox */
+
+
+static struct cqs_postbox *postbox_open(int *error) {
+	struct cqs_postbox *box;
+
+	if (!(box = calloc(1, sizeof *box))) {
+		*error = errno;
+
+		return NULL;
+	}
+
+	box->refs = 1;
+	box->fd[0] = -1;
+	box->fd[1] = -1;
+
+#if HAVE_EVENTFD
+	if (-1 == (box->fd[0] = eventfd(0, O_CLOEXEC|O_NONBLOCK))) {
+		*error = errno;
+		free(box);
+
+		return NULL;
+	}
+#else
+	if ((*error = cqs_pipe(box->fd, O_CLOEXEC|O_NONBLOCK))) {
+		free(box);
+
+		return NULL;
+	}
+#endif
+
+	return box;
+} /* postbox_open() */
+
+
+static void postbox_ring(struct cqs_postbox *box) {
+#if HAVE_EVENTFD
+	static const uint64_t one = 1;
+
+	while (-1 == write(box->fd[0], &one, sizeof one) && errno == EINTR)
+		;;
+#else
+	while (-1 == write(box->fd[1], "!", 1) && errno == EINTR)
+		;;
+#endif
+} /* postbox_ring() */
+
+
+static void postbox_clear(struct cqs_postbox *box) {
+#if HAVE_EVENTFD
+	uint64_t n;
+
+	while (-1 == read(box->fd[0], &n, sizeof n) && errno == EINTR)
+		;;
+#else
+	char buf[64];
+
+	while (0 < read(box->fd[0], buf, sizeof buf) || errno == EINTR)
+		;;
+#endif
+} /* postbox_clear() */
+
+
+/* take every pending post, oldest first */
+static struct post *postbox_take(struct cqs_postbox *box) {
+	struct post *post, *nxt, *head = NULL;
+
+	__atomic_store_n(&box->rung, 0, __ATOMIC_SEQ_CST);
+	postbox_clear(box);
+
+	post = __atomic_exchange_n(&box->head, NULL, __ATOMIC_SEQ_CST);
+
+	for (; post; post = nxt) {
+		nxt = post->next;
+		post->next = head;
+		head = post;
+	}
+
+	return head;
+} /* postbox_take() */
+
+
+static cqs_error_t postbox_push(struct cqs_postbox *box, struct post *post) {
+	if (__atomic_load_n(&box->closed, __ATOMIC_ACQUIRE))
+		return EPIPE;
+
+	post->next = __atomic_load_n(&box->head, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&box->head, &post->next, post, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		;;
+
+	if (!__atomic_exchange_n(&box->rung, 1, __ATOMIC_SEQ_CST))
+		postbox_ring(box);
+
+	return 0;
+} /* postbox_push() */
+
+
+static void postbox_acquire(struct cqs_postbox *box) {
+	__atomic_add_fetch(&box->refs, 1, __ATOMIC_RELAXED);
+} /* postbox_acquire() */
+
+
+/* free posts which will never run, letting C callbacks release their arg */
+static void postbox_discard(struct post *post) {
+	struct post *nxt;
+
+	for (; post; post = nxt) {
+		nxt = post->next;
+
+		if (post->fn)
+			post->fn(NULL, post->arg);
+
+		free(post);
+	}
+} /* postbox_discard() */
+
+
+void cqs_postbox_release(struct cqs_postbox *box) {
+	if (!box || __atomic_sub_fetch(&box->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	postbox_discard(postbox_take(box));
+
+	cqs_closefd(&box->fd[0]);
+	cqs_closefd(&box->fd[1]);
+	free(box);
+} /* cqs_postbox_release() */
+
+
+cqs_error_t cqs_post(struct cqs_postbox *box, cqs_postfn_t *fn, void *arg) {
+	struct post *post;
+	int error;
+
+	if (!(post = calloc(1, sizeof *post)))
+		return errno;
+
+	post->fn = fn;
+	post->arg = arg;
+
+	if ((error = postbox_push(box, post)))
+		free(post);
+
+	return error;
+} /* cqs_post() */
+
+
 /*
  * A U X I L I A R Y  L I B R A R Y  R O U T I N E S
  *
@@ -1096,6 +1987,169 @@ int luaopen__cqueues_condition(lua_State *L) {
 } /* luaopen__cqueues_condition() */
 
 
+/*
+ * P O L L A B L E  H A N D L E  R O U T I N E S
+ *
+ * A handle publishes a descriptor, event set and timeout which only change
+ * when explicitly updated. Storing one in the .pollfd field of a Lua object
+ * lets the controller poll that object without calling any Lua code.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct pollhandle {
+	int fd;
+	short events;
+	double timeout;
+}; /* struct pollhandle */
+
+
+/* accepts an integer mask or a string of 'r', 'w' and 'p' flags */
+static short events_check(lua_State *L, int index) {
+	const char *mode;
+	short events = 0;
+
+	if (lua_isnumber(L, index))
+		return (POLLIN|POLLOUT|POLLPRI) & lua_tointeger(L, index);
+
+	for (mode = luaL_optstring(L, index, ""); *mode; mode++) {
+		switch (*mode) {
+		case 'r':
+			events |= POLLIN;
+			break;
+		case 'w':
+			events |= POLLOUT;
+			break;
+		case 'p':
+			events |= POLLPRI;
+			break;
+		}
+	}
+
+	return events;
+} /* events_check() */
+
+
+static int ph_pollfd_(lua_State *L, int index) {
+	return ((struct pollhandle *)lua_touserdata(L, index))->fd;
+} /* ph_pollfd_() */
+
+
+static short ph_events_(lua_State *L, int index) {
+	return ((struct pollhandle *)lua_touserdata(L, index))->events;
+} /* ph_events_() */
+
+
+static double ph_timeout_(lua_State *L, int index) {
+	return ((struct pollhandle *)lua_touserdata(L, index))->timeout;
+} /* ph_timeout_() */
+
+
+static const struct cqs_pollable ph_pollable = {
+	.pollfd  = &ph_pollfd_,
+	.events  = &ph_events_,
+	.timeout = &ph_timeout_,
+}; /* ph_pollable */
+
+
+static int ph_setfd(lua_State *L) {
+	struct pollhandle *ph = luaL_checkudata(L, 1, CQS_POLLABLE);
+
+	ph->fd = MAX(-1, luaL_optinteger(L, 2, -1));
+
+	lua_settop(L, 1);
+
+	return 1;
+} /* ph_setfd() */
+
+
+static int ph_setevents(lua_State *L) {
+	struct pollhandle *ph = luaL_checkudata(L, 1, CQS_POLLABLE);
+
+	ph->events = events_check(L, 2);
+
+	lua_settop(L, 1);
+
+	return 1;
+} /* ph_setevents() */
+
+
+static int ph_settimeout(lua_State *L) {
+	struct pollhandle *ph = luaL_checkudata(L, 1, CQS_POLLABLE);
+
+	ph->timeout = luaL_optnumber(L, 2, NAN);
+
+	lua_settop(L, 1);
+
+	return 1;
+} /* ph_settimeout() */
+
+
+static int ph_pollfd(lua_State *L) {
+	struct pollhandle *ph = luaL_checkudata(L, 1, CQS_POLLABLE);
+
+	if (ph->fd < 0)
+		return 0;
+
+	lua_pushinteger(L, ph->fd);
+
+	return 1;
+} /* ph_pollfd() */
+
+
+static int ph_events(lua_State *L) {
+	struct pollhandle *ph = luaL_checkudata(L, 1, CQS_POLLABLE);
+
+	lua_pushinteger(L, ph->events);
+
+	return 1;
+} /* ph_events() */
+
+
+static int ph_timeout(lua_State *L) {
+	struct pollhandle *ph = luaL_checkudata(L, 1, CQS_POLLABLE);
+
+	if (isnan(ph->timeout))
+		return 0;
+
+	lua_pushnumber(L, ph->timeout);
+
+	return 1;
+} /* ph_timeout() */
+
+
+static int ph_new(lua_State *L) {
+	struct pollhandle *ph;
+
+	lua_settop(L, 3);
+
+	ph = lua_newuserdata(L, sizeof *ph);
+	ph->fd = MAX(-1, luaL_optinteger(L, 1, -1));
+	ph->events = events_check(L, 2);
+	ph->timeout = luaL_optnumber(L, 3, NAN);
+
+	luaL_getmetatable(L, CQS_POLLABLE);
+	lua_setmetatable(L, -2);
+
+	return 1;
+} /* ph_new() */
+
+
+static const luaL_Reg ph_methods[] = {
+	{ "setfd",      &ph_setfd },
+	{ "setevents",  &ph_setevents },
+	{ "settimeout", &ph_settimeout },
+	{ "pollfd",     &ph_pollfd },
+	{ "events",     &ph_events },
+	{ "timeout",    &ph_timeout },
+	{ NULL,         NULL }
+}; /* ph_methods[] */
+
+
+static const luaL_Reg ph_metatable[] = {
+	{ NULL, NULL }
+}; /* ph_metatable[] */
+
+
 /*
  * C O N T I N U A T I O N  Q U E U E  R O U T I N E S
  *
@@ -1119,6 +2173,7 @@ struct event {
 	double timeout;
 
 	_Bool pending;
+	_Bool stale; /* kept across a resume; see event_reuse() */
 
 	int index; /* on .thread->L stack */
 
@@ -1135,6 +2190,8 @@ struct event {
 struct fileno {
 	int fd;
 	short state;
+	short ready; /* edge mode: readiness not yet delivered to a waiter */
+	_Bool renew; /* edge mode: first waiter since idle, registration suspect */
 
 	LIST_HEAD(, event) events;
 
@@ -1144,13 +2201,50 @@ struct fileno {
 }; /* struct fileno */
 
 
+/*
+ * Timers are kept in a hierarchical timing wheel. Each of the WHEEL_LEN
+ * levels has WHEEL_NUM slots, and a slot on level n spans WHEEL_NUM^n
+ * ticks. A timer is placed on the level of the most significant digit in
+ * which its expiration tick differs from the current tick, which makes
+ * arming and disarming O(1). Deadlines too distant for the wheel (about
+ * 4.6 hours at the default resolution) are kept in an LLRB tree and
+ * migrated into the wheel as the clock advances.
+ */
+#define WHEEL_HZ   1000 /* ticks per second */
+#define WHEEL_BIT  6
+#define WHEEL_NUM  (1U << WHEEL_BIT)
+#define WHEEL_MASK (WHEEL_NUM - 1)
+#define WHEEL_LEN  4
+
 struct timer {
 	double timeout;
+	uint64_t tick;
 
+	enum {
+		TIMER_IDLE,
+		TIMER_EXPIRED,
+		TIMER_WHEEL,
+		TIMER_OVERFLOW,
+	} state;
+	unsigned char level, slot;
+
+	TAILQ_ENTRY(timer) tqe;
 	LLRB_ENTRY(timer) rbe;
 }; /* struct timer */
 
 
+TAILQ_HEAD(timerq, timer);
+
+struct wheel {
+	uint64_t curtick;
+	uint64_t pending[WHEEL_LEN]; /* bitmap of non-empty slots */
+	struct timerq slot[WHEEL_LEN][WHEEL_NUM];
+	struct timerq expired; /* tick <= curtick */
+
+	LLRB_HEAD(timers, timer) overflow;
+}; /* struct wheel */
+
+
 struct thread {
 	lua_State *L; /* only for coroutines */
 
@@ -1163,17 +2257,60 @@ struct thread {
 	double mintimeout;
 
 	struct timer timer;
+
+	struct {
+		unsigned long resumes;
+		double cpu, max;
+	} profile; /* only maintained while profiling */
 }; /* struct thread */
 
 #define timer2thread(timer) ((struct thread *)((char *)(timer) - offsetof(struct thread, timer)))
 
 
+/*
+ * Step instrumentation, enabled with cqueues.new{ profile = true }. When
+ * disabled every hook reduces to a test of Q->profile. Step run times are
+ * binned by floor(log2(microseconds)) + 1, with bin 0 holding steps
+ * which took under a microsecond.
+ */
+#define PROFILE_NBIN 32
+
+struct profile {
+	unsigned long steps, events, resumes;
+	double wait, run;
+	unsigned long latency[PROFILE_NBIN];
+}; /* struct profile */
+
+static void profile_wait(struct profile *P, double began, size_t events) {
+	P->steps++;
+	P->events += events;
+	P->wait += monotime() - began;
+} /* profile_wait() */
+
+static void profile_run(struct profile *P, double began) {
+	double elapsed = monotime() - began;
+	double us = elapsed * 1000000;
+	unsigned bin = 0;
+
+	while (us >= 1.0 && bin < PROFILE_NBIN - 1) {
+		us /= 2;
+		bin++;
+	}
+
+	P->run += elapsed;
+	P->latency[bin]++;
+} /* profile_run() */
+
+
 struct cqueue {
 	struct kpoll kp;
 
 	struct {
+		struct fileno ***page; /* see fileno_find() */
+		size_t npage;
 		LLRB_HEAD(table, fileno) table;
 		LIST_HEAD(, fileno) polling, outstanding, inactive;
+		_Bool edge; /* register once, edge-triggered */
 	} fileno;
 
 	struct {
@@ -1186,7 +2323,17 @@ struct cqueue {
 		unsigned count;
 	} thread;
 
-	LLRB_HEAD(timers, timer) timers;
+	struct wheel timers;
+
+	struct profile *profile; /* NULL unless profiling */
+
+	struct cqs_iostat io; /* see cqs_socket_iostat() */
+
+	struct {
+		struct cqs_postbox *box; /* NULL until first requested */
+		struct post *pending; /* taken from the box but not yet run */
+		short state;
+	} post;
 
 	struct cstack *cstack;
 
@@ -1388,6 +2535,8 @@ static void err_error(lua_State *L, struct callinfo *I) {
 } /* err_error() */
 
 
+static void wheel_init(struct wheel *, double);
+
 static void cqueue_preinit(struct cqueue *Q) {
 	memset(Q, 0, sizeof *Q);
 
@@ -1398,6 +2547,8 @@ static void cqueue_preinit(struct cqueue *Q) {
 	pool_init(&Q->pool.wakecb, sizeof (struct wakecb));
 	pool_init(&Q->pool.fileno, sizeof (struct fileno));
 	pool_init(&Q->pool.event, sizeof (struct event));
+
+	wheel_init(&Q->timers, monotime());
 } /* cqueue_preinit() */
 
 
@@ -1411,6 +2562,9 @@ static void cqueue_init(lua_State *L, struct cqueue *Q, int index) {
 	if ((error = kpoll_init(&Q->kp)))
 		luaL_error(L, "unable to initialize continuation queue: %s", cqs_strerror(error));
 
+	if (!kpoll_haveedge(&Q->kp))
+		Q->fileno.edge = 0;
+
 	/*
 	 * give ourselves an empty table of threads
 	 */
@@ -1431,7 +2585,6 @@ static void cstack_del(struct cqueue *);
 static void cqueue_destroy(lua_State *L, struct cqueue *Q, struct callinfo *I) {
 	struct thread *thread;
 	struct fileno *fileno;
-	void *next;
 
 	cstack_del(Q);
 
@@ -1445,17 +2598,97 @@ static void cqueue_destroy(lua_State *L, struct cqueue *Q, struct callinfo *I) {
 		thread_del(L, Q, I, thread);
 	}
 
-	for (fileno = LLRB_MIN(table, &Q->fileno.table); fileno; fileno = next) {
-		next = LLRB_NEXT(table, &Q->fileno.table, fileno);
-		fileno_del(Q, fileno, 0);
+	while ((fileno = LIST_FIRST(&Q->fileno.polling))) {
+		fileno_del(Q, fileno, 0);
+	}
+
+	while ((fileno = LIST_FIRST(&Q->fileno.outstanding))) {
+		fileno_del(Q, fileno, 0);
+	}
+
+	while ((fileno = LIST_FIRST(&Q->fileno.inactive))) {
+		fileno_del(Q, fileno, 0);
+	}
+
+	for (size_t i = 0; i < Q->fileno.npage; i++)
+		free(Q->fileno.page[i]);
+	free(Q->fileno.page);
+	Q->fileno.page = NULL;
+	Q->fileno.npage = 0;
+
+	free(Q->profile);
+	Q->profile = NULL;
+
+	postbox_discard(Q->post.pending);
+	Q->post.pending = NULL;
+
+	if (Q->post.box) {
+		__atomic_store_n(&Q->post.box->closed, 1, __ATOMIC_RELEASE);
+		cqs_postbox_release(Q->post.box);
+		Q->post.box = NULL;
+		Q->post.state = 0;
+	}
+
+	kpoll_destroy(&Q->kp);
+
+	pool_destroy(&Q->pool.event);
+	pool_destroy(&Q->pool.fileno);
+	pool_destroy(&Q->pool.wakecb);
+} /* cqueue_destroy() */
+
+
+static lua_Integer optfinteger(lua_State *L, int t, const char *k, lua_Integer def) {
+	lua_Integer i;
+
+	lua_getfield(L, t, k);
+	i = luaL_optinteger(L, -1, def);
+	lua_pop(L, 1);
+
+	return i;
+} /* optfinteger() */
+
+
+static _Bool optfbool(lua_State *L, int t, const char *k, _Bool def) {
+	_Bool b;
+
+	lua_getfield(L, t, k);
+	b = (lua_isnil(L, -1))? def : lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	return b;
+} /* optfbool() */
+
+
+static void cqueue_checkopts(lua_State *L, struct cqueue *Q, int index) {
+	lua_Integer maxevents;
+
+	if (lua_isnoneornil(L, index))
+		return;
+
+	luaL_checktype(L, index, LUA_TTABLE);
+
+	maxevents = optfinteger(L, index, "maxevents", KPOLL_MAXWAIT);
+	luaL_argcheck(L, maxevents > 0 && maxevents <= INT_MAX, index, "maxevents out of range");
+	Q->kp.pending.max = maxevents;
+
+	Q->fileno.edge = optfbool(L, index, "edge", 0);
+
+	lua_getfield(L, index, "backend");
+	if (!lua_isnil(L, -1)) {
+		const char *backend = luaL_checkstring(L, -1);
+
+		if (kpoll_setbackend(&Q->kp, backend))
+			luaL_argerror(L, index, lua_pushfstring(L, "%s: unsupported backend", backend));
 	}
+	lua_pop(L, 1);
 
-	kpoll_destroy(&Q->kp);
-
-	pool_destroy(&Q->pool.event);
-	pool_destroy(&Q->pool.fileno);
-	pool_destroy(&Q->pool.wakecb);
-} /* cqueue_destroy() */
+	/*
+	 * Allocate last. Q has no __gc metamethod yet, so anything
+	 * allocated before an argument error above would leak.
+	 */
+	if (optfbool(L, index, "profile", 0) && !(Q->profile = calloc(1, sizeof *Q->profile)))
+		luaL_error(L, "unable to enable profiling: %s", cqs_strerror(errno));
+} /* cqueue_checkopts() */
 
 
 static int cqueue_new(lua_State *L) {
@@ -1465,6 +2698,8 @@ static int cqueue_new(lua_State *L) {
 
 	cqueue_preinit(Q);
 
+	cqueue_checkopts(L, Q, 1);
+
 	luaL_getmetatable(L, CQUEUE_CLASS);
 	lua_setmetatable(L, -2);
 
@@ -1495,8 +2730,28 @@ static void thread_move(struct thread *T, struct threads *list) {
 } /* thread_move() */
 
 
+/*
+ * Descriptors below FILENO_NDIRECT are looked up through a two-level table
+ * of lazily allocated pages of FILENO_PAGELEN slots. Larger descriptors,
+ * and any descriptor whose page couldn't be allocated, live in the LLRB
+ * tree, which is only searched when it isn't empty.
+ */
+#define FILENO_PAGEBIT 10
+#define FILENO_PAGELEN (1U << FILENO_PAGEBIT)
+#define FILENO_MAXPAGE 1024U
+#define FILENO_NDIRECT (FILENO_MAXPAGE * FILENO_PAGELEN)
+
 static struct fileno *fileno_find(struct cqueue *Q, int fd) {
-	struct fileno key;
+	unsigned pg = (unsigned)fd >> FILENO_PAGEBIT;
+	struct fileno *fileno, key;
+
+	if (pg < Q->fileno.npage && Q->fileno.page[pg]) {
+		if ((fileno = Q->fileno.page[pg][(unsigned)fd & (FILENO_PAGELEN - 1)]))
+			return fileno;
+	}
+
+	if (LLRB_EMPTY(&Q->fileno.table))
+		return NULL;
 
 	key.fd = fd;
 
@@ -1504,6 +2759,64 @@ static struct fileno *fileno_find(struct cqueue *Q, int fd) {
 } /* fileno_find() */
 
 
+static struct fileno **fileno_slot(struct cqueue *Q, int fd) {
+	unsigned pg = (unsigned)fd >> FILENO_PAGEBIT;
+
+	if (fd < 0 || (unsigned)fd >= FILENO_NDIRECT)
+		return NULL;
+
+	if (pg >= Q->fileno.npage) {
+		size_t npage = MAX(Q->fileno.npage, 4);
+		struct fileno ***page;
+
+		while (npage <= pg)
+			npage *= 2;
+		npage = MIN(npage, FILENO_MAXPAGE);
+
+		if (!(page = realloc(Q->fileno.page, npage * sizeof *page)))
+			return NULL;
+
+		memset(&page[Q->fileno.npage], 0, (npage - Q->fileno.npage) * sizeof *page);
+		Q->fileno.page = page;
+		Q->fileno.npage = npage;
+	}
+
+	if (!Q->fileno.page[pg] && !(Q->fileno.page[pg] = calloc(FILENO_PAGELEN, sizeof **Q->fileno.page)))
+		return NULL;
+
+	return &Q->fileno.page[pg][(unsigned)fd & (FILENO_PAGELEN - 1)];
+} /* fileno_slot() */
+
+
+/* allocation failures just push the descriptor onto the slow path */
+static void fileno_index(struct cqueue *Q, struct fileno *fileno) {
+	struct fileno **slot;
+
+	if ((slot = fileno_slot(Q, fileno->fd)) && !*slot)
+		*slot = fileno;
+	else
+		LLRB_INSERT(table, &Q->fileno.table, fileno);
+} /* fileno_index() */
+
+
+static void fileno_unindex(struct cqueue *Q, struct fileno *fileno) {
+	unsigned pg = (unsigned)fileno->fd >> FILENO_PAGEBIT;
+	struct fileno **slot;
+
+	if (pg < Q->fileno.npage && Q->fileno.page[pg]) {
+		slot = &Q->fileno.page[pg][(unsigned)fileno->fd & (FILENO_PAGELEN - 1)];
+
+		if (*slot == fileno) {
+			*slot = NULL;
+
+			return;
+		}
+	}
+
+	LLRB_REMOVE(table, &Q->fileno.table, fileno);
+} /* fileno_unindex() */
+
+
 static struct fileno *fileno_get(struct cqueue *Q, int fd, int *error) {
 	struct fileno *fileno;
 
@@ -1513,10 +2826,12 @@ static struct fileno *fileno_get(struct cqueue *Q, int fd, int *error) {
 
 		fileno->fd = fd;
 		fileno->state = 0;
+		fileno->ready = 0;
+		fileno->renew = 0;
 		LIST_INIT(&fileno->events);
 
 		LIST_INSERT_HEAD(&Q->fileno.inactive, fileno, le);
-		LLRB_INSERT(table, &Q->fileno.table, fileno);
+		fileno_index(Q, fileno);
 	}
 
 	return fileno;
@@ -1525,9 +2840,41 @@ static struct fileno *fileno_get(struct cqueue *Q, int fd, int *error) {
 
 static cqs_error_t fileno_signal(struct cqueue *Q, struct fileno *fileno, short events) {
 	struct event *event;
+	short delivered = 0;
 	int error = 0, _error;
 
+	if (Q->fileno.edge) {
+		/*
+		 * The registration covers the union of every interest ever
+		 * expressed, so only wake the threads actually waiting on
+		 * these events, and latch whatever nobody consumed.
+		 */
+		if (events & (POLLERR|POLLHUP))
+			events |= POLLIN|POLLOUT|POLLPRI;
+
+		LIST_FOREACH(event, &fileno->events, fle) {
+			if (event->stale || !(event->events & events))
+				continue;
+
+			event->pending = 1;
+			delivered |= event->events & events;
+
+			thread_move(event->thread, &Q->thread.pending);
+
+			if ((_error = cqueue_tryalert(Q)))
+				error = _error;
+		}
+
+		fileno->ready = (fileno->ready | events) & ~delivered & (POLLIN|POLLOUT|POLLPRI);
+
+		return error;
+	}
+
 	LIST_FOREACH(event, &fileno->events, fle) {
+		/* its thread is running; see event_reuse() */
+		if (event->stale)
+			continue;
+
 		/* XXX: If POLLPRI should we always mark as pending? */
 		if (event->events & events)
 			event->pending = 1;
@@ -1542,12 +2889,20 @@ static cqs_error_t fileno_signal(struct cqueue *Q, struct fileno *fileno, short
 } /* fileno_signal() */
 
 
-static int fileno_ctl(struct cqueue *Q, struct fileno *fileno, short events) {
+static int fileno_ctl(struct cqueue *Q, struct fileno *fileno, short events, _Bool renew) {
 	int error;
 
-	if ((error = kpoll_ctl(&Q->kp, fileno->fd, &fileno->state, events, fileno)))
+	if (renew)
+		error = kpoll_renew(&Q->kp, fileno->fd, &fileno->state, events, Q->fileno.edge, fileno);
+	else
+		error = kpoll_ctl(&Q->kp, fileno->fd, &fileno->state, events, Q->fileno.edge, fileno);
+
+	if (error)
 		return error; /* XXX: Should we call fileno_signal? */
 
+	if (!fileno->state)
+		fileno->ready = 0;
+
 	LIST_REMOVE(fileno, le);
 
 	if (fileno->state)
@@ -1567,7 +2922,28 @@ static int fileno_update(struct cqueue *Q, struct fileno *fileno) {
 		events |= event->events;
 	}
 
-	return fileno_ctl(Q, fileno, events);
+	/*
+	 * In edge mode the registration only ever grows, and it persists
+	 * after the last waiter leaves. The kernel is only consulted when a
+	 * new kind of interest appears, or on cancellation.
+	 *
+	 * But nothing tells us when a descriptor is closed without being
+	 * cancelled, as signal, notify and thread objects, controllers and
+	 * raw descriptors are. The kernel drops the registration with the
+	 * descriptor, and if the number is reused our state is wrong. So
+	 * event_link() flags the first waiter after an idle spell, and the
+	 * registration is renewed then.
+	 */
+	if (Q->fileno.edge) {
+		_Bool renew = fileno->renew && !LIST_EMPTY(&fileno->events);
+
+		if (renew)
+			fileno->renew = 0;
+
+		return fileno_ctl(Q, fileno, events | fileno->state, renew);
+	}
+
+	return fileno_ctl(Q, fileno, events, 0);
 } /* fileno_update() */
 
 
@@ -1583,7 +2959,7 @@ static int fileno_del(struct cqueue *Q, struct fileno *fileno, _Bool update) {
 	if (update)
 		error = fileno_update(Q, fileno);
 
-	LLRB_REMOVE(table, &Q->fileno.table, fileno);
+	fileno_unindex(Q, fileno);
 
 	LIST_REMOVE(fileno, le);
 
@@ -1648,14 +3024,23 @@ static int object_getcv(lua_State *L, struct cqueue *Q, struct callinfo *I, stru
 	}
 
 	wakecb_init(event->wakecb, &wakecb_wakeup, Q, event);
+	event->wakecb->arg[2] = cv; /* remembered across resumes */
 	wakecb_add(event->wakecb, cv);
 
 	return LUA_OK;
 } /* object_getcv() */
 
 
+static void object_getpollable(lua_State *L, const struct cqs_pollable *pollable, int index, struct event *event) {
+	event->fd = MAX(pollable->pollfd(L, index), -1);
+	event->events = (POLLIN|POLLOUT|POLLPRI) & pollable->events(L, index);
+	event->timeout = abstimeout(pollable->timeout(L, index));
+} /* object_getpollable() */
+
+
 NONNULL(1, 2, 3, 6)
 static cqs_status_t object_getinfo(lua_State *L, struct cqueue *Q, struct callinfo *I, struct thread *T, int index, struct event *event) {
+	const struct cqs_pollable *pollable;
 	int status;
 
 	/* optimize simple timeout */
@@ -1676,9 +3061,12 @@ static cqs_status_t object_getinfo(lua_State *L, struct cqueue *Q, struct callin
 		event->fd = cqs_socket_pollfd(L, -1);
 		event->events = cqs_socket_events(L, -1);
 		event->timeout = abstimeout(cqs_socket_timeout(L, -1));
+		cqs_socket_iostat(L, -1, &Q->io);
 	} else if (cqs_testudata(L, -1, 3)) {
 		if ((LUA_OK != (status = object_getcv(L, Q, I, T, -1, event))))
 			goto oops;
+	} else if ((pollable = cqs_getpollable(L, -1))) {
+		object_getpollable(L, pollable, -1, event);
 	} else {
 		if (LUA_OK != (status = object_pcall(L, I, T, -1, "pollfd", LUA_TNUMBER, LUA_TUSERDATA, LUA_TNIL)))
 			goto oops;
@@ -1686,6 +3074,12 @@ static cqs_status_t object_getinfo(lua_State *L, struct cqueue *Q, struct callin
 		if (lua_isuserdata(L, -1) && cqs_testudata(L, -1, 3)) {
 			if ((LUA_OK != (status = object_getcv(L, Q, I, T, -1, event))))
 				goto oops;
+		} else if ((pollable = cqs_getpollable(L, -1))) {
+			/* a published handle speaks for the whole object */
+			object_getpollable(L, pollable, -1, event);
+			lua_pop(L, 2); /* pop handle and object */
+
+			return LUA_OK;
 		} else {
 			event->fd = luaL_optinteger(L, -1, -1);
 			event->fd = MAX(event->fd, -1);
@@ -1696,23 +3090,7 @@ static cqs_status_t object_getinfo(lua_State *L, struct cqueue *Q, struct callin
 		if (LUA_OK != (status = object_pcall(L, I, T, -1, "events", LUA_TNUMBER, LUA_TSTRING, LUA_TNIL)))
 			goto oops;
 
-		if (lua_isnumber(L, -1)) {
-			event->events = (POLLIN|POLLOUT|POLLPRI) & lua_tointeger(L, -1);
-		} else {
-			const char *mode = luaL_optstring(L, -1, "");
-
-			event->events = 0;
-
-			while (*mode) {
-				if (*mode == 'r')
-					event->events |= POLLIN;
-				else if (*mode == 'w')
-					event->events |= POLLOUT;
-				else if (*mode == 'p')
-					event->events |= POLLPRI;
-				mode++;
-			}
-		}
+		event->events = events_check(L, -1);
 
 		lua_pop(L, 1); /* pop event mode */
 
@@ -1745,9 +3123,42 @@ static void event_init(struct event *event, struct thread *T, int index) {
 } /* event_init() */
 
 
+static void event_ready(struct event *event) {
+	struct fileno *fileno = event->fileno;
+
+	/* an edge we saw earlier won't be reported again */
+	if (fileno->ready & event->events) {
+		event->pending = 1;
+		fileno->ready &= ~event->events;
+	}
+} /* event_ready() */
+
+
+static int event_link(struct cqueue *Q, struct event *event) {
+	struct fileno *fileno;
+	int error;
+
+	if (!(fileno = fileno_get(Q, event->fd, &error)))
+		return error;
+
+	/* see fileno_update() */
+	if (Q->fileno.edge && fileno->state && LIST_EMPTY(&fileno->events))
+		fileno->renew = 1;
+
+	LIST_INSERT_HEAD(&fileno->events, event, fle);
+	event->fileno = fileno;
+
+	event_ready(event);
+
+	LIST_REMOVE(fileno, le);
+	LIST_INSERT_HEAD(&Q->fileno.outstanding, fileno, le);
+
+	return 0;
+} /* event_link() */
+
+
 static cqs_status_t event_add(lua_State *L, struct cqueue *Q, struct callinfo *I, struct thread *T, int index) {
 	struct event *event;
-	struct fileno *fileno;
 	int error, status;
 
 	if (!(event = pool_get(&Q->pool.event, &error)))
@@ -1759,53 +3170,364 @@ static cqs_status_t event_add(lua_State *L, struct cqueue *Q, struct callinfo *I
 		return status;
 
 	if (event->fd >= 0 && event->events) {
-		if (!(fileno = fileno_get(Q, event->fd, &error)))
+		if ((error = event_link(Q, event)))
 			goto error;
+	}
+
+	return LUA_OK;
+error:
+	err_setinfo(L, I, error, T, index, "unable to add event: %s", cqs_strerror(error));
+
+	return LUA_ERRRUN;
+} /* event_add() */
+
+
+/*
+ * A coroutine's events survive its resume so that when it polls the same
+ * objects again, as a connection handler does on every iteration, they
+ * can be refreshed in place instead of being torn down and rebuilt. A
+ * condition is simply requeued, and a descriptor is only reconsidered by
+ * cqueue_update() when its number or interest changed, or when a one-shot
+ * backend dropped the registration.
+ */
+static struct event *event_stale(lua_State *L, struct thread *T, int otop, int index) {
+	struct event *event;
+
+	TAILQ_FOREACH(event, &T->events, tqe) {
+		if (!event->stale)
+			continue;
+
+		/* the previously yielded objects were preserved above otop */
+		lua_pushvalue(T->L, index);
+		lua_xmove(T->L, L, 1);
+
+		if (lua_rawequal(L, -1, otop + event->index)) {
+			lua_pop(L, 1);
+
+			return event;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	return NULL;
+} /* event_stale() */
+
+
+static cqs_status_t event_reuse(lua_State *L, struct cqueue *Q, struct callinfo *I, struct thread *T, struct event *event, int index) {
+	struct fileno *fileno = event->fileno;
+	short events = event->events;
+	int error, status;
+
+	event->index = index;
+	event->stale = 0;
+	event->pending = 0;
+
+	/* keep the list in yield order, as event_add would */
+	TAILQ_REMOVE(&T->events, event, tqe);
+	TAILQ_INSERT_TAIL(&T->events, event, tqe);
+
+	if (event->wakecb) {
+		struct condition *cv = event->wakecb->arg[2];
+
+		if (lua_touserdata(T->L, index) == (void *)cv) {
+			wakecb_add(event->wakecb, cv);
+
+			return LUA_OK;
+		}
+
+		/* object handed us a condition; it may hand us another */
+		pool_put(&Q->pool.wakecb, event->wakecb);
+		event->wakecb = NULL;
+	}
+
+	event->fd = -1;
+	event->events = 0;
+	event->timeout = NAN;
+
+	if (LUA_OK != (status = object_getinfo(L, Q, I, T, index, event)))
+		return status;
 
-		LIST_INSERT_HEAD(&fileno->events, event, fle);
-		event->fileno = fileno;
+	if (fileno && (event->fd != fileno->fd || !event->events)) {
+		LIST_REMOVE(event, fle);
+		event->fileno = NULL;
 
 		LIST_REMOVE(fileno, le);
 		LIST_INSERT_HEAD(&Q->fileno.outstanding, fileno, le);
+
+		fileno = NULL;
+	}
+
+	if (fileno) {
+		event_ready(event);
+
+		if (event->events != events || (fileno->state & event->events) != event->events) {
+			LIST_REMOVE(fileno, le);
+			LIST_INSERT_HEAD(&Q->fileno.outstanding, fileno, le);
+		}
+	} else if (event->fd >= 0 && event->events) {
+		if ((error = event_link(Q, event))) {
+			err_setinfo(L, I, error, T, index, "unable to add event: %s", cqs_strerror(error));
+
+			return LUA_ERRRUN;
+		}
 	}
 
 	return LUA_OK;
-error:
-	err_setinfo(L, I, error, T, index, "unable to add event: %s", cqs_strerror(error));
+} /* event_reuse() */
+
+
+static void event_del(struct cqueue *Q, struct event *event) {
+	if (event->wakecb) {
+		wakecb_del(event->wakecb);
+		pool_put(&Q->pool.wakecb, event->wakecb);
+	}
+
+	if (event->fileno) {
+		LIST_REMOVE(event->fileno, le);
+		LIST_INSERT_HEAD(&Q->fileno.outstanding, event->fileno, le);
+
+		LIST_REMOVE(event, fle);
+	}
+
+	TAILQ_REMOVE(&event->thread->events, event, tqe);
+	assert(event->thread->count > 0);
+	event->thread->count--;
+
+	pool_put(&Q->pool.event, event);
+} /* event_del() */
+
+
+/* delete events which weren't polled again */
+static void event_purge(struct cqueue *Q, struct thread *T) {
+	struct event *event, *nxt;
+
+	for (event = TAILQ_FIRST(&T->events); event; event = nxt) {
+		nxt = TAILQ_NEXT(event, tqe);
+
+		if (event->stale)
+			event_del(Q, event);
+	}
+} /* event_purge() */
+
+
+static inline uint64_t f2tick(double f) {
+	f *= WHEEL_HZ;
+
+	if (!(f > 0))
+		return 0;
+	else if (f >= (double)(UINT64_MAX / 2))
+		return UINT64_MAX / 2;
+	else
+		return (uint64_t)f;
+} /* f2tick() */
+
+
+static inline int wheel_fls(uint64_t n) {
+#if __GNUC__
+	return (n)? 64 - __builtin_clzll(n) : 0;
+#else
+	int i;
+
+	for (i = 0; n; i++)
+		n >>= 1;
+
+	return i;
+#endif
+} /* wheel_fls() */
+
+
+static inline int wheel_ctz(uint64_t n) {
+#if __GNUC__
+	return __builtin_ctzll(n);
+#else
+	int i;
+
+	for (i = 0; !(n & 1); i++)
+		n >>= 1;
+
+	return i;
+#endif
+} /* wheel_ctz() */
+
+
+static void wheel_init(struct wheel *W, double curtime) {
+	W->curtick = f2tick(curtime);
+
+	for (size_t i = 0; i < countof(W->slot); i++) {
+		W->pending[i] = 0;
+
+		for (size_t j = 0; j < countof(W->slot[i]); j++)
+			TAILQ_INIT(&W->slot[i][j]);
+	}
+
+	TAILQ_INIT(&W->expired);
+	LLRB_INIT(&W->overflow);
+} /* wheel_init() */
+
+
+static void wheel_del(struct wheel *W, struct timer *timer) {
+	switch (timer->state) {
+	case TIMER_EXPIRED:
+		TAILQ_REMOVE(&W->expired, timer, tqe);
+		break;
+	case TIMER_WHEEL:
+		TAILQ_REMOVE(&W->slot[timer->level][timer->slot], timer, tqe);
+
+		if (TAILQ_EMPTY(&W->slot[timer->level][timer->slot]))
+			W->pending[timer->level] &= ~((uint64_t)1 << timer->slot);
+
+		break;
+	case TIMER_OVERFLOW:
+		LLRB_REMOVE(timers, &W->overflow, timer);
+		break;
+	default:
+		break;
+	}
+
+	timer->state = TIMER_IDLE;
+} /* wheel_del() */
+
+
+/*
+ * Place timer relative to W->curtick. Because every digit above the
+ * timer's level equals that of the current tick, and the digit at its
+ * level is greater, the slot is reached precisely when the clock enters
+ * the timer's digit on that level.
+ */
+static void wheel_add(struct wheel *W, struct timer *timer) {
+	int level;
+
+	if (timer->tick <= W->curtick) {
+		TAILQ_INSERT_TAIL(&W->expired, timer, tqe);
+		timer->state = TIMER_EXPIRED;
+
+		return;
+	}
+
+	level = (wheel_fls(timer->tick ^ W->curtick) - 1) / WHEEL_BIT;
+
+	if (level >= WHEEL_LEN) {
+		LLRB_INSERT(timers, &W->overflow, timer);
+		timer->state = TIMER_OVERFLOW;
+
+		return;
+	}
+
+	timer->level = level;
+	timer->slot = WHEEL_MASK & (timer->tick >> (level * WHEEL_BIT));
+
+	TAILQ_INSERT_TAIL(&W->slot[timer->level][timer->slot], timer, tqe);
+	W->pending[timer->level] |= (uint64_t)1 << timer->slot;
+	timer->state = TIMER_WHEEL;
+} /* wheel_add() */
+
+
+/*
+ * Advance the clock, cascading timers from every slot reached onto a lower
+ * level or the expired queue, and pulling in overflow timers which now fit
+ * in the wheel.
+ */
+static void wheel_step(struct wheel *W, double curtime) {
+	uint64_t curtick = f2tick(curtime), elapsed, pending;
+	struct timerq todo;
+	struct timer *timer;
+	int level, slot;
+
+	if (curtick <= W->curtick)
+		return;
+
+	TAILQ_INIT(&todo);
+
+	for (level = 0; level < WHEEL_LEN; level++) {
+		elapsed = (curtick >> (level * WHEEL_BIT)) - (W->curtick >> (level * WHEEL_BIT));
+
+		if (!elapsed)
+			break; /* higher levels can't have moved either */
+
+		if (elapsed >= WHEEL_NUM) {
+			pending = ~(uint64_t)0;
+		} else {
+			slot = WHEEL_MASK & (W->curtick >> (level * WHEEL_BIT));
+			pending = (((uint64_t)1 << elapsed) - 1) << 1;
+			if (slot)
+				pending = (pending << slot) | (pending >> (WHEEL_NUM - slot));
+		}
+
+		pending &= W->pending[level];
+
+		while (pending) {
+			slot = wheel_ctz(pending);
+			pending &= pending - 1;
+
+			while ((timer = TAILQ_FIRST(&W->slot[level][slot]))) {
+				TAILQ_REMOVE(&W->slot[level][slot], timer, tqe);
+				TAILQ_INSERT_TAIL(&todo, timer, tqe);
+			}
+
+			W->pending[level] &= ~((uint64_t)1 << slot);
+		}
+	}
+
+	W->curtick = curtick;
 
-	return LUA_ERRRUN;
-} /* event_add() */
+	while ((timer = TAILQ_FIRST(&todo))) {
+		TAILQ_REMOVE(&todo, timer, tqe);
+		wheel_add(W, timer);
+	}
 
+	while ((timer = LLRB_MIN(timers, &W->overflow))) {
+		if (timer->tick > curtick && wheel_fls(timer->tick ^ curtick) > WHEEL_LEN * WHEEL_BIT)
+			break;
 
-static void event_del(struct cqueue *Q, struct event *event) {
-	if (event->wakecb) {
-		wakecb_del(event->wakecb);
-		pool_put(&Q->pool.wakecb, event->wakecb);
+		LLRB_REMOVE(timers, &W->overflow, timer);
+		wheel_add(W, timer);
 	}
+} /* wheel_step() */
 
-	if (event->fileno) {
-		LIST_REMOVE(event->fileno, le);
-		LIST_INSERT_HEAD(&Q->fileno.outstanding, event->fileno, le);
 
-		LIST_REMOVE(event, fle);
+/*
+ * Return the earliest deadline. Timers on the lowest occupied level always
+ * precede those on higher levels, and on each level the lowest occupied
+ * slot precedes the others, so at most one slot need be scanned.
+ */
+static double wheel_min(struct wheel *W) {
+	double timeout = NAN;
+	struct timerq *list = NULL;
+	struct timer *timer;
+	int level;
+
+	if (!TAILQ_EMPTY(&W->expired)) {
+		list = &W->expired;
+	} else {
+		for (level = 0; level < WHEEL_LEN; level++) {
+			if (W->pending[level]) {
+				list = &W->slot[level][wheel_ctz(W->pending[level])];
+				break;
+			}
+		}
 	}
 
-	TAILQ_REMOVE(&event->thread->events, event, tqe);
-	assert(event->thread->count > 0);
-	event->thread->count--;
+	if (!list)
+		return ((timer = LLRB_MIN(timers, &W->overflow)))? timer->timeout : NAN;
 
-	pool_put(&Q->pool.event, event);
-} /* event_del() */
+	TAILQ_FOREACH(timer, list, tqe) {
+		timeout = mintimeout(timeout, timer->timeout);
+	}
+
+	return timeout;
+} /* wheel_min() */
 
 
 static void timer_init(struct timer *timer) {
 	timer->timeout = NAN;
+	timer->state = TIMER_IDLE;
 } /* timer_init() */
 
 
 static void timer_del(struct cqueue *Q, struct timer *timer) {
-	if (isfinite(timer->timeout)) {
-		LLRB_REMOVE(timers, &Q->timers, timer);
+	if (timer->state != TIMER_IDLE) {
+		wheel_del(&Q->timers, timer);
 		timer->timeout = NAN;
 	}
 } /* timer_del() */
@@ -1816,7 +3538,8 @@ static void timer_add(struct cqueue *Q, struct timer *timer, double timeout) {
 
 	if (isfinite(timeout)) {
 		timer->timeout = timeout;
-		LLRB_INSERT(timers, &Q->timers, timer);
+		timer->tick = f2tick(timeout);
+		wheel_add(&Q->timers, timer);
 	}
 } /* timer_add() */
 
@@ -1826,6 +3549,18 @@ static void timer_destroy(struct cqueue *Q, struct timer *timer) {
 } /* timer_destroy() */
 
 
+static _Bool thread_ready(struct thread *T) {
+	struct event *event;
+
+	TAILQ_FOREACH(event, &T->events, tqe) {
+		if (event->pending)
+			return 1;
+	}
+
+	return 0;
+} /* thread_ready() */
+
+
 static double thread_timeout(struct thread *T) {
 	double timeout = NAN;
 	struct event *event;
@@ -1932,6 +3667,8 @@ error:
 } /* cqueue_update() */
 
 
+static cqs_error_t cqueue_postarm(struct cqueue *);
+
 static cqs_error_t cqueue_reboot(struct cqueue *Q, _Bool stop, _Bool restart) {
 	if (stop) {
 		struct fileno *fileno;
@@ -1950,6 +3687,8 @@ static cqs_error_t cqueue_reboot(struct cqueue *Q, _Bool stop, _Bool restart) {
 			thread_move(thread, &Q->thread.pending);
 		}
 
+		Q->post.state = 0;
+
 		kpoll_destroy(&Q->kp);
 	}
 
@@ -1958,6 +3697,9 @@ static cqs_error_t cqueue_reboot(struct cqueue *Q, _Bool stop, _Bool restart) {
 
 		if ((error = kpoll_init(&Q->kp)))
 			return error;
+
+		if ((error = cqueue_postarm(Q)))
+			return error;
 	}
 
 	return 0;
@@ -2001,13 +3743,22 @@ static cqs_status_t cqueue_resume(lua_State *L, struct cqueue *Q, struct callinf
 		if (!lua_checkstack(T->L, T->count + LUA_MINSTACK))
 			goto nospace;
 
-		while ((event = TAILQ_FIRST(&T->events))) {
+		TAILQ_FOREACH(event, &T->events, tqe) {
 			if (event->pending) {
 				lua_pushvalue(T->L, event->index);
 				nargs++;
 			}
 
-			event_del(Q, event);
+			/*
+			 * Keep the event for event_reuse, but stop listening
+			 * to the condition so that a signal isn't consumed
+			 * while we're not actually waiting.
+			 */
+			event->pending = 0;
+			event->stale = 1;
+
+			if (event->wakecb)
+				wakecb_del(event->wakecb);
 		}
 	} else {
 		nargs = lua_gettop(T->L);
@@ -2021,7 +3772,19 @@ static cqs_status_t cqueue_resume(lua_State *L, struct cqueue *Q, struct callinf
 
 	cstack_push(Q->cstack, &(struct stackinfo){ Q, L, I->self, T->L });
 
-	status = lua_resume(T->L, L, nargs);
+	if (Q->profile) {
+		double began = cputime(), elapsed;
+
+		status = lua_resume(T->L, L, nargs);
+
+		elapsed = cputime() - began;
+		T->profile.cpu += elapsed;
+		T->profile.max = MAX(T->profile.max, elapsed);
+		T->profile.resumes++;
+		Q->profile->resumes++;
+	} else {
+		status = lua_resume(T->L, L, nargs);
+	}
 
 	cstack_pop(Q->cstack);
 
@@ -2032,20 +3795,38 @@ static cqs_status_t cqueue_resume(lua_State *L, struct cqueue *Q, struct callinf
 				switch (lua_type(T->L, index)) {
 				case LUA_TNIL:
 					continue;
+				case LUA_TNUMBER:
+					/* a plain timeout is cheaper to add anew */
+					status = event_add(L, Q, I, T, index);
+
+					break;
 				default:
-					if (LUA_OK != (status = event_add(L, Q, I, T, index)))
-						goto defunct;
+					if ((event = event_stale(L, T, otop, index)))
+						status = event_reuse(L, Q, I, T, event, index);
+					else
+						status = event_add(L, Q, I, T, index);
+
+					break;
 				}
+
+				if (LUA_OK != status)
+					goto defunct;
 			}
 
+			event_purge(Q, T);
+
 			if (LUA_OK != (status = cqueue_update(L, Q, I, T)))
 				goto defunct;
 
 			timer_add(Q, &T->timer, thread_timeout(T));
 
-			if (!TAILQ_EMPTY(&T->events) || isfinite(T->timer.timeout))
+			if (thread_ready(T))
+				thread_move(T, &Q->thread.pending);
+			else if (!TAILQ_EMPTY(&T->events) || isfinite(T->timer.timeout))
 				thread_move(T, &Q->thread.polling);
 		} else {
+			event_purge(Q, T);
+
 			if (LUA_OK != (tmp_status = cqueue_update(L, Q, I, T))) {
 				status = tmp_status;
 				goto defunct;
@@ -2087,6 +3868,119 @@ nospace:
 } /* cqueue_resume() */
 
 
+static int cqueue__post; /* address used as uservalue key of post handler */
+
+static cqs_error_t cqueue_postarm(struct cqueue *Q) {
+	if (!Q->post.box)
+		return 0;
+
+	return kpoll_ctl(&Q->kp, Q->post.box->fd[0], &Q->post.state, POLLIN, 0, Q->post.box);
+} /* cqueue_postarm() */
+
+
+static struct cqs_postbox *cqueue_postbox(struct cqueue *Q, int *_error) {
+	struct cqs_postbox *box;
+	int error;
+
+	if (Q->post.box)
+		return Q->post.box;
+
+	if (!(box = postbox_open(&error)))
+		goto error;
+
+	Q->post.box = box;
+
+	if ((error = cqueue_postarm(Q))) {
+		Q->post.box = NULL;
+		cqs_postbox_release(box);
+
+		goto error;
+	}
+
+	return box;
+error:
+	*_error = error;
+
+	return NULL;
+} /* cqueue_postbox() */
+
+
+/*
+ * Run each post on the stepping thread. Messages posted from Lua are
+ * handed to the :onpost handler, each in a new managed coroutine.
+ *
+ * Posts not yet run are kept on Q rather than on the C stack, so if a
+ * callback raises an error the rest run on the next step instead of
+ * being lost.
+ */
+static void cqueue_runposts(lua_State *L, struct cqueue *Q, struct callinfo *I) {
+	struct post *post, **tail;
+	cqs_postfn_t *fn;
+	void *arg;
+
+	for (tail = &Q->post.pending; *tail; tail = &(*tail)->next)
+		;;
+
+	if (Q->post.box)
+		*tail = postbox_take(Q->post.box);
+
+	while ((post = Q->post.pending)) {
+		if (post->fn) {
+			/* off the list first; a callback which errors isn't rerun */
+			Q->post.pending = post->next;
+			fn = post->fn;
+			arg = post->arg;
+			free(post);
+
+			fn(L, arg);
+		} else {
+			luaL_checkstack(L, 4, "too many arguments");
+
+			cqs_getuservalue(L, I->self);
+			lua_rawgetp(L, -1, &cqueue__post);
+
+			if (lua_isfunction(L, -1)) {
+				lua_State *newL = lua_newthread(L);
+
+				lua_insert(L, -2);
+
+				switch (post->type) {
+				case LUA_TNUMBER:
+					if (post->isinteger)
+						lua_pushinteger(L, post->v.integer);
+					else
+						lua_pushnumber(L, post->v.number);
+					break;
+				case LUA_TBOOLEAN:
+					lua_pushboolean(L, post->v.boolean);
+					break;
+				case LUA_TSTRING:
+					lua_pushlstring(L, post->data, post->len);
+					break;
+				default:
+					lua_pushnil(L);
+					break;
+				}
+
+				Q->post.pending = post->next;
+				free(post);
+
+				lua_xmove(L, newL, 2);
+				thread_add(L, Q, I, -1);
+				lua_pop(L, 1);
+			} else {
+				Q->post.pending = post->next;
+				free(post);
+
+				lua_pop(L, 1);
+			}
+
+			lua_pop(L, 1);
+		}
+	}
+} /* cqueue_runposts() */
+
+
 static cqs_status_t cqueue_process_threads(lua_State *L, struct cqueue *Q, struct callinfo *I) {
 	cqs_status_t status;
 	struct thread *nxt;
@@ -2104,7 +3998,7 @@ static cqs_status_t cqueue_process_threads(lua_State *L, struct cqueue *Q, struc
 
 
 static cqs_status_t cqueue_process(lua_State *L, struct cqueue *Q, struct callinfo *I) {
-	int onalert = 0;
+	int onalert = 0, onpost = 0;
 	kpoll_event_t *ke;
 	struct fileno *fileno;
 	struct event *event;
@@ -2121,18 +4015,32 @@ static cqs_status_t cqueue_process(lua_State *L, struct cqueue *Q, struct callin
 			continue;
 		}
 
+		if (Q->post.box && kpoll_udata(ke) == Q->post.box) {
+			Q->post.state = kpoll_diff(&Q->kp, ke, Q->post.state);
+			onpost = 1;
+
+			continue;
+		}
+
 		fileno = kpoll_udata(ke);
 		events = kpoll_pending(ke);
 
 		fileno_signal(Q, fileno, events);
-		fileno->state = kpoll_diff(ke, fileno->state);
+		fileno->state = kpoll_diff(&Q->kp, ke, fileno->state);
+	}
+
+	/* before resuming, so new coroutines run in this step */
+	if (onpost || Q->post.pending) {
+		cqueue_runposts(L, Q, I);
 	}
 
 	curtime = monotime();
 
-	LLRB_FOREACH(timer, timers, &Q->timers) {
+	wheel_step(&Q->timers, curtime);
+
+	TAILQ_FOREACH(timer, &Q->timers.expired, tqe) {
 		if (isgreater(timer->timeout, curtime))
-			break;
+			continue;
 
 		T = timer2thread(timer);
 
@@ -2154,20 +4062,29 @@ static cqs_status_t cqueue_process(lua_State *L, struct cqueue *Q, struct callin
 		kpoll_calm(&Q->kp);
 	}
 
+	if (onpost) {
+		(void)cqueue_postarm(Q);
+	}
+
+	/* errors resurface at the next kpoll_wait */
+	(void)kpoll_flush(&Q->kp);
+
 	return LUA_OK;
 } /* cqueue_process() */
 
 
 static double cqueue_timeout_(struct cqueue *Q) {
-	struct timer *timer;
-	double curtime;
+	double timeout, curtime;
+
+	if (Q->post.pending)
+		return 0.0; /* left over after a post raised an error */
 
-	if (!(timer = LLRB_MIN(timers, &Q->timers)))
+	if (!isfinite(timeout = wheel_min(&Q->timers)))
 		return NAN;
 
 	curtime = monotime();
 
-	return (islessequal(timer->timeout, curtime))? 0.0 : timer->timeout - curtime;
+	return (islessequal(timeout, curtime))? 0.0 : timeout - curtime;
 } /* cqueue_timeout_() */
 
 
@@ -2195,6 +4112,8 @@ static int cqueue_step_cont(lua_State *L, int status NOTUSED, lua_KContext ctx N
 
 	switch(cqueue_process_threads(L, Q, &I)) {
 	case LUA_OK:
+		(void)kpoll_flush(&Q->kp);
+
 		break;
 	case LUA_YIELD:
 		/* clear everything off the stack except for cqueue object; `I` now invalid */
@@ -2228,8 +4147,8 @@ oops:
 static int cqueue_step(lua_State *L) {
 	struct callinfo I;
 	struct cqueue *Q;
-	double timeout;
-	int error;
+	double timeout, began = 0;
+	int error, status;
 	int nargs;
 
 	lua_settop(L, 2);
@@ -2246,13 +4165,26 @@ static int cqueue_step(lua_State *L) {
 		timeout = 0.0;
 	}
 
+	if (Q->profile)
+		began = monotime();
+
 	if ((error = kpoll_wait(&Q->kp, timeout))) {
 		err_setfstring(L, &I, "error polling: %s", cqs_strerror(error));
 		err_setcode(L, &I, error);
 		goto oops;
 	}
 
-	switch(cqueue_process(L, Q, &I)) {
+	if (Q->profile) {
+		profile_wait(Q->profile, began, Q->kp.pending.count);
+		began = monotime();
+	}
+
+	status = cqueue_process(L, Q, &I);
+
+	if (Q->profile)
+		profile_run(Q->profile, began);
+
+	switch(status) {
 	case LUA_OK:
 		break;
 	case LUA_YIELD:
@@ -2363,6 +4295,161 @@ error:
 } /* cqueue_alert() */
 
 
+struct cqs_postbox *cqs_postbox_acquire(lua_State *L, int index) {
+	struct cqs_postbox **ud, *box;
+	struct cqueue *Q;
+	int error;
+
+	if ((ud = luaL_testudata(L, index, CQS_POSTER))) {
+		box = *ud;
+	} else {
+		Q = luaL_checkudata(L, index, CQUEUE_CLASS);
+
+		if (!(box = cqueue_postbox(Q, &error)))
+			luaL_error(L, "unable to open post box: %s", cqs_strerror(error));
+	}
+
+	postbox_acquire(box);
+
+	return box;
+} /* cqs_postbox_acquire() */
+
+
+/* push a poster object, taking over the caller's reference */
+void cqs_postbox_push(lua_State *L, struct cqs_postbox *box) {
+	struct cqs_postbox **ud;
+
+	luaL_checkstack(L, 3, "too many arguments");
+
+	ud = lua_newuserdata(L, sizeof *ud);
+	*ud = box;
+
+	luaL_getmetatable(L, CQS_POSTER);
+
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		cqs_requiref(L, "_cqueues", &luaopen__cqueues, 0);
+		lua_pop(L, 1);
+		luaL_getmetatable(L, CQS_POSTER);
+	}
+
+	lua_setmetatable(L, -2);
+} /* cqs_postbox_push() */
+
+
+static int cqueue_poster(lua_State *L) {
+	cqs_postbox_push(L, cqs_postbox_acquire(L, 1));
+
+	return 1;
+} /* cqueue_poster() */
+
+
+static int cqueue_onpost(lua_State *L) {
+	cqueue_checkself(L, 1);
+
+	if (!lua_isnoneornil(L, 2))
+		luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	lua_settop(L, 2);
+	cqs_getuservalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_rawsetp(L, -2, &cqueue__post);
+
+	lua_pushvalue(L, 1);
+
+	return 1;
+} /* cqueue_onpost() */
+
+
+static struct cqs_postbox *poster_checkself(lua_State *L, int index) {
+	return *(struct cqs_postbox **)luaL_checkudata(L, index, CQS_POSTER);
+} /* poster_checkself() */
+
+
+static int poster_post(lua_State *L) {
+	struct cqs_postbox *box = poster_checkself(L, 1);
+	struct post *post;
+	const char *src = NULL;
+	size_t len = 0;
+	int type = lua_type(L, 2), error;
+
+	switch (type) {
+	case LUA_TNONE:
+		type = LUA_TNIL;
+		/* FALL THROUGH */
+	case LUA_TNIL:
+	case LUA_TNUMBER:
+	case LUA_TBOOLEAN:
+		break;
+	default:
+		/* FALL THROUGH (maybe has __tostring metamethod) */
+	case LUA_TSTRING:
+		src = luaL_checklstring(L, 2, &len);
+		type = LUA_TSTRING;
+		break;
+	}
+
+	if (!(post = calloc(1, sizeof *post + len)))
+		goto syerr;
+
+	post->type = type;
+
+	if (type == LUA_TNUMBER) {
+#if LUA_VERSION_NUM >= 503
+		if ((post->isinteger = lua_isinteger(L, 2)))
+			post->v.integer = lua_tointeger(L, 2);
+		else
+#endif
+		post->v.number = lua_tonumber(L, 2);
+	} else if (type == LUA_TBOOLEAN) {
+		post->v.boolean = lua_toboolean(L, 2);
+	} else if (type == LUA_TSTRING) {
+		memcpy(post->data, src, len);
+		post->len = len;
+	}
+
+	if ((error = postbox_push(box, post))) {
+		free(post);
+
+		goto error;
+	}
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+syerr:
+	error = errno;
+error:
+	lua_pushnil(L);
+	lua_pushstring(L, cqs_strerror(error));
+	lua_pushinteger(L, error);
+
+	return 3;
+} /* poster_post() */
+
+
+static int poster__gc(lua_State *L) {
+	struct cqs_postbox **ud = luaL_checkudata(L, 1, CQS_POSTER);
+
+	cqs_postbox_release(*ud);
+	*ud = NULL;
+
+	return 0;
+} /* poster__gc() */
+
+
+static const luaL_Reg poster_methods[] = {
+	{ "post", &poster_post },
+	{ NULL,   NULL }
+}; /* poster_methods[] */
+
+
+static const luaL_Reg poster_metatable[] = {
+	{ "__gc", &poster__gc },
+	{ NULL,   NULL }
+}; /* poster_metatable[] */
+
+
 static int cqueue_empty(lua_State *L) {
 	struct cqueue *Q = cqueue_checkself(L, 1);
 
@@ -2390,7 +4477,7 @@ static cqs_error_t cqueue_cancelfd(struct cqueue *Q, int fd) {
 
 	if ((_error = fileno_signal(Q, fileno, POLLIN|POLLOUT|POLLPRI)))
 		error = _error;
-	if ((_error = fileno_ctl(Q, fileno, 0)))
+	if ((_error = fileno_ctl(Q, fileno, 0, 0)))
 		error = _error;
 
 	return error;
@@ -2414,6 +4501,151 @@ static int cqueue_checkfd(lua_State *L, struct callinfo *I, int index) {
 } /* cqueue_checkfd() */
 
 
+static void pool_pushstats(lua_State *L, const struct pool *P) {
+	lua_createtable(L, 0, 4);
+
+	lua_pushinteger(L, P->used);
+	lua_setfield(L, -2, "used");
+
+	lua_pushinteger(L, P->slabs * P->nslab - P->used);
+	lua_setfield(L, -2, "free");
+
+	lua_pushinteger(L, P->slabs);
+	lua_setfield(L, -2, "slabs");
+
+	lua_pushinteger(L, P->slabs * SLAB_SIZE);
+	lua_setfield(L, -2, "bytes");
+} /* pool_pushstats() */
+
+
+static void iolog_pushstats(lua_State *L, const struct cqs_iolog *log) {
+	lua_createtable(L, 0, 4);
+
+	lua_pushinteger(L, log->count);
+	lua_setfield(L, -2, "count");
+
+	lua_pushinteger(L, log->calls);
+	lua_setfield(L, -2, "calls");
+
+	lua_pushinteger(L, log->again);
+	lua_setfield(L, -2, "again");
+
+	lua_pushinteger(L, log->records);
+	lua_setfield(L, -2, "records");
+} /* iolog_pushstats() */
+
+
+static int cqueue_stats(lua_State *L) {
+	struct cqueue *Q = cqueue_checkself(L, 1);
+
+	lua_createtable(L, 0, 8);
+
+	lua_pushstring(L, kpoll_backend(&Q->kp));
+	lua_setfield(L, -2, "backend");
+
+	lua_pushinteger(L, Q->kp.stats.wait);
+	lua_setfield(L, -2, "steps");
+
+	lua_pushinteger(L, Q->kp.stats.full);
+	lua_setfield(L, -2, "saturated");
+
+	lua_pushinteger(L, Q->kp.pending.size);
+	lua_setfield(L, -2, "batch");
+
+	lua_pushinteger(L, Q->kp.pending.max);
+	lua_setfield(L, -2, "maxevents");
+
+	lua_createtable(L, 0, 3);
+	pool_pushstats(L, &Q->pool.event);
+	lua_setfield(L, -2, "event");
+	pool_pushstats(L, &Q->pool.fileno);
+	lua_setfield(L, -2, "fileno");
+	pool_pushstats(L, &Q->pool.wakecb);
+	lua_setfield(L, -2, "wakecb");
+	lua_setfield(L, -2, "pools");
+
+	lua_createtable(L, 0, 2);
+	iolog_pushstats(L, &Q->io.sent);
+	lua_setfield(L, -2, "sent");
+	iolog_pushstats(L, &Q->io.rcvd);
+	lua_setfield(L, -2, "rcvd");
+	lua_setfield(L, -2, "io");
+
+	if (Q->profile) {
+		lua_createtable(L, 0, 6);
+
+		lua_pushinteger(L, Q->profile->steps);
+		lua_setfield(L, -2, "steps");
+
+		lua_pushinteger(L, Q->profile->events);
+		lua_setfield(L, -2, "events");
+
+		lua_pushinteger(L, Q->profile->resumes);
+		lua_setfield(L, -2, "resumes");
+
+		lua_pushnumber(L, Q->profile->wait);
+		lua_setfield(L, -2, "wait");
+
+		lua_pushnumber(L, Q->profile->run);
+		lua_setfield(L, -2, "run");
+
+		lua_createtable(L, PROFILE_NBIN, 0);
+		for (int i = 0; i < PROFILE_NBIN; i++) {
+			lua_pushinteger(L, Q->profile->latency[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		lua_setfield(L, -2, "latency");
+
+		lua_setfield(L, -2, "profile");
+	}
+
+	return 1;
+} /* cqueue_stats() */
+
+
+static void profile_pushthread(lua_State *L, int self, struct thread *T) {
+	lua_createtable(L, 0, 4);
+
+	/* the coroutine is anchored to the thread context */
+	cqs_getuservalue(L, self);
+	lua_rawgetp(L, -1, T);
+	cqs_getuservalue(L, -1);
+	lua_setfield(L, -4, "coroutine");
+	lua_pop(L, 2);
+
+	lua_pushinteger(L, T->profile.resumes);
+	lua_setfield(L, -2, "resumes");
+
+	lua_pushnumber(L, T->profile.cpu);
+	lua_setfield(L, -2, "cpu");
+
+	lua_pushnumber(L, T->profile.max);
+	lua_setfield(L, -2, "max");
+} /* profile_pushthread() */
+
+
+static int cqueue_profile(lua_State *L) {
+	struct cqueue *Q = cqueue_checkself(L, 1);
+	struct threads *list[] = { &Q->thread.pending, &Q->thread.polling };
+	struct thread *T;
+	lua_Integer n = 0;
+
+	if (!Q->profile)
+		return 0;
+
+	lua_createtable(L, Q->thread.count, 0);
+
+	for (size_t i = 0; i < countof(list); i++) {
+		LIST_FOREACH(T, list[i], le) {
+			profile_pushthread(L, 1, T);
+			lua_rawseti(L, -2, ++n);
+		}
+	}
+
+	return 1;
+} /* cqueue_profile() */
+
+
 static int cqueue_cancel(lua_State *L) {
 	struct callinfo I;
 	int top = lua_gettop(L);
@@ -2754,6 +4986,13 @@ void cqs_cancelfd(lua_State *L, int fd) {
 } /* cqs_cancelfd() */
 
 
+struct cqs_iostat *cqs_running_iostat(lua_State *L) {
+	struct cstack *CS = cstack_self(L);
+
+	return (CS->running)? &CS->running->Q->io : NULL;
+} /* cqs_running_iostat() */
+
+
 static int cstack_reset(lua_State *L) {
 	struct cstack *CS = cstack_self(L);
 	struct cqueue *Q;
@@ -2824,8 +5063,12 @@ static const luaL_Reg cqueue_methods[] = {
 	{ "attach",  &cqueue_attach },
 	{ "wrap",    &cqueue_wrap },
 	{ "alert",   &cqueue_alert },
+	{ "poster",  &cqueue_poster },
+	{ "onpost",  &cqueue_onpost },
 	{ "empty",   &cqueue_empty },
 	{ "count",   &cqueue_count },
+	{ "stats",   &cqueue_stats },
+	{ "profile", &cqueue_profile },
 	{ "cancel",  &cqueue_cancel },
 	{ "reset",   &cqueue_reset },
 	{ "pause",   &cqueue_pause },
@@ -2847,6 +5090,7 @@ static const luaL_Reg cqueues_globals[] = {
 	{ "type",      &cqueue_type },
 	{ "interpose", &cqueue_interpose },
 	{ "monotime",  &cqueue_monotime },
+	{ "pollable",  &ph_new },
 	{ "cancel",    &cstack_cancel },
 	{ "reset",     &cstack_reset },
 	{ "running",   &cstack_running },
@@ -2860,6 +5104,13 @@ int luaopen__cqueues(lua_State *L) {
 	cqs_requiref(L, "_cqueues.condition", &luaopen__cqueues_condition, 0);
 	lua_pop(L, 2);
 
+	cqs_newmetatable(L, CQS_POLLABLE, ph_methods, ph_metatable, 0);
+	cqs_setpollable(L, -1, &ph_pollable);
+	lua_pop(L, 1);
+
+	cqs_newmetatable(L, CQS_POSTER, poster_methods, poster_metatable, 0);
+	lua_pop(L, 1);
+
 	/* push functions with shared upvalues for fast metatable lookup */
 	cqs_pushnils(L, 3); /* initial upvalues */
 	cqs_newmetatable(L, CQUEUE_CLASS, cqueue_methods, cqueue_metatable, 3);
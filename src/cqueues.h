@@ -26,6 +26,7 @@
 #ifndef CQUEUES_H
 #define CQUEUES_H
 
+#include <string.h>	/* strcmp(3) */
 #include <signal.h>	/* sigset_t */
 #include <errno.h>	/* EOVERFLOW */
 #include <assert.h>     /* static_assert */
@@ -88,6 +89,11 @@
 #define ENABLE_KQUEUE HAVE_KQUEUE
 #endif
 
+/* io_uring requires Linux 5.11 or later; opt-in with -DENABLE_IOURING */
+#ifndef ENABLE_IOURING
+#define ENABLE_IOURING 0
+#endif
+
 #if __GNUC__
 #define NOTUSED __attribute__((unused))
 #define EXTENSION __extension__
@@ -117,8 +123,11 @@
 #define CQS_SOCKET "CQS Socket"
 #define CQS_SIGNAL "CQS Signal"
 #define CQS_THREAD "CQS Thread"
+#define CQS_CHANNEL "CQS Channel"
 #define CQS_NOTIFY "CQS Notify"
 #define CQS_CONDITION "CQS Condition"
+#define CQS_POLLABLE "CQS Pollable"
+#define CQS_POSTER "CQS Poster"
 
 #define CQUEUE__POLL ((void *)&cqueue__poll)
 const char *cqueue__poll; // signals multilevel yield
@@ -133,6 +142,8 @@ cqs_nargs_t luaopen__cqueues_signal(lua_State *);
 
 cqs_nargs_t luaopen__cqueues_thread(lua_State *);
 
+cqs_nargs_t luaopen__cqueues_thread_channel(lua_State *);
+
 cqs_nargs_t luaopen__cqueues_notify(lua_State *);
 
 cqs_nargs_t luaopen__cqueues_condition(lua_State *);
@@ -147,8 +158,12 @@ cqs_nargs_t luaopen__cqueues_dns_hosts(lua_State *);
 
 cqs_nargs_t luaopen__cqueues_dns_hints(lua_State *);
 
+cqs_nargs_t luaopen__cqueues_dns_cache(lua_State *);
+
 cqs_nargs_t luaopen__cqueues_dns_resolver(lua_State *);
 
+cqs_nargs_t luaopen__cqueues_dns_mux(lua_State *);
+
 cqs_nargs_t luaopen__cqueues_dns(lua_State *);
 
 
@@ -165,6 +180,45 @@ int cqs_socket_events(lua_State *, int);
 
 double cqs_socket_timeout(lua_State *, int);
 
+/*
+ * Socket I/O counters rolled up by a controller. A socket's counters
+ * are credited to whichever controller polls it, by the amount they
+ * grew since it was last polled, and what remains when it's closed to
+ * the innermost running controller. See socket:stat and cqueue:stats.
+ */
+struct cqs_iostat {
+	struct cqs_iolog {
+		unsigned long long count, calls, again, records;
+	} sent, rcvd;
+}; /* struct cqs_iostat */
+
+void cqs_socket_iostat(lua_State *, int, struct cqs_iostat *);
+
+struct cqs_iostat *cqs_running_iostat(lua_State *);
+
+
+/*
+ * Thread-safe submission of work into a controller. A post box belongs to
+ * one controller and may be used from any thread once acquired. Posted
+ * functions are called as fn(L, arg) from within the controller's :step,
+ * in posting order, where L is the stepping Lua thread. They must leave
+ * the stack balanced and must not raise errors or yield. If the
+ * controller is destroyed first, pending functions are called as
+ * fn(NULL, arg) so that arg can be released, and later posts fail with
+ * EPIPE.
+ */
+struct cqs_postbox;
+
+typedef void cqs_postfn_t(lua_State *, void *);
+
+struct cqs_postbox *cqs_postbox_acquire(lua_State *, int);
+
+void cqs_postbox_release(struct cqs_postbox *);
+
+void cqs_postbox_push(lua_State *, struct cqs_postbox *);
+
+cqs_error_t cqs_post(struct cqs_postbox *, cqs_postfn_t *, void *);
+
 
 static void cqs_requiref(lua_State *L, const char *modname, lua_CFunction openf, int glb) {
 	luaL_getsubtable(L, LUA_REGISTRYINDEX, "_LOADED");
@@ -194,7 +248,9 @@ static void cqs_openlibs(lua_State *L) {
 	cqs_requiref(L, "_cqueues.dns.config", &luaopen__cqueues_dns_config, 0);
 	cqs_requiref(L, "_cqueues.dns.hosts", &luaopen__cqueues_dns_hosts, 0);
 	cqs_requiref(L, "_cqueues.dns.hints", &luaopen__cqueues_dns_hints, 0);
+	cqs_requiref(L, "_cqueues.dns.cache", &luaopen__cqueues_dns_cache, 0);
 	cqs_requiref(L, "_cqueues.dns.resolver", &luaopen__cqueues_dns_resolver, 0);
+	cqs_requiref(L, "_cqueues.dns.mux", &luaopen__cqueues_dns_mux, 0);
 	cqs_requiref(L, "_cqueues.dns", &luaopen__cqueues_dns, 0);
 #endif
 
@@ -215,6 +271,16 @@ static inline int cqs_interpose(lua_State *L, const char *mt) {
 	lua_pushvalue(L, 2); /* push new method */
 	lua_settable(L, -4);  /* replace old method */
 
+	/* the C fast path would bypass the new method */
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		const char *name = lua_tostring(L, 1);
+
+		if (!strcmp(name, "pollfd") || !strcmp(name, "events") || !strcmp(name, "timeout")) {
+			lua_pushnil(L);
+			lua_setfield(L, -4, "__pollable");
+		}
+	}
+
 	return 1; /* return old method */
 } /* cqs_interpose() */
 
@@ -295,6 +361,45 @@ static inline void cqs_setmetaupvalue(lua_State *L, int tindex, int n) {
 } /* cqs_setmetaupvalue() */
 
 
+/*
+ * Pollable userdata classes can describe themselves to the controller
+ * directly, sparing it the :pollfd, :events and :timeout method calls.
+ * The callbacks must agree with those methods and must not throw. events
+ * returns a POLLIN/POLLOUT/POLLPRI mask, and timeout returns NAN when
+ * there's none.
+ */
+struct cqs_pollable {
+	int (*pollfd)(lua_State *, int);
+	short (*events)(lua_State *, int);
+	double (*timeout)(lua_State *, int);
+}; /* struct cqs_pollable */
+
+/* register the callbacks with the metatable at index */
+static inline void cqs_setpollable(lua_State *L, int index, const struct cqs_pollable *pollable) {
+	index = lua_absindex(L, index);
+
+	lua_pushlightuserdata(L, (void *)pollable);
+	lua_setfield(L, index, "__pollable");
+} /* cqs_setpollable() */
+
+static inline const struct cqs_pollable *cqs_getpollable(lua_State *L, int index) {
+	const struct cqs_pollable *pollable = NULL;
+
+	if (lua_type(L, index) != LUA_TUSERDATA || !lua_getmetatable(L, index))
+		return NULL;
+
+	lua_pushliteral(L, "__pollable");
+	lua_rawget(L, -2);
+
+	if (lua_islightuserdata(L, -1))
+		pollable = lua_touserdata(L, -1);
+
+	lua_pop(L, 2);
+
+	return pollable;
+} /* cqs_getpollable() */
+
+
 /* test metatable against copy at upvalue */
 static inline void *cqs_testudata(lua_State *L, int index, int upvalue) {
 	void *ud = lua_touserdata(L, index);
@@ -30,9 +30,14 @@
 #include <stdlib.h> /* free(3) */
 #include <stdio.h>  /* tmpfile(3) fclose(3) */
 #include <string.h> /* memset(3) strcmp(3) */
+#include <ctype.h>  /* tolower(3) */
+#include <time.h>   /* time(3) clock_gettime(3) */
 #include <errno.h>
 
+#include <pthread.h>
+
 #include <sys/types.h>
+#include <sys/queue.h>  /* TAILQ_* */
 #include <sys/socket.h> /* AF_INET AF_INET6 */
 #include <netinet/in.h> /* struct sockaddr_in struct sockaddr_in6 */
 #include <arpa/inet.h>  /* INET_ADDSTRLEN INET6_ADDRSTRLEN inet_ntop(3) */
@@ -41,6 +46,7 @@
 #include <lauxlib.h>
 
 #include "lib/dns.h"
+#include "lib/llrb.h"
 #include "cqueues.h"
 
 #define RR_ANY_CLASS   "DNS RR Any"
@@ -58,10 +64,13 @@
 #define RR_SPF_CLASS   "DNS RR SPF"
 
 #define PACKET_CLASS   "DNS Packet"
+#define CURSOR_CLASS   "DNS Cursor"
 #define RESCONF_CLASS  "DNS Config"
 #define HOSTS_CLASS    "DNS Hosts"
 #define HINTS_CLASS    "DNS Hints"
+#define CACHE_CLASS    "DNS Cache"
 #define RESOLVER_CLASS "DNS Resolver"
+#define MUX_CLASS      "DNS Mux"
 
 
 static int optfint(lua_State *L, int t, const char *k, int def) {
@@ -86,6 +95,17 @@ static int optfbool(lua_State *L, int t, const char *k, _Bool def) {
 } /* optfbool() */
 
 
+static double optfnumber(lua_State *L, int t, const char *k, double def) {
+	double n;
+
+	lua_getfield(L, t, k);
+	n = luaL_optnumber(L, -1, def);
+	lua_pop(L, 1);
+
+	return n;
+} /* optfnumber() */
+
+
 /*
  * R E S O U R C E  R E C O R D  B I N D I N G S
  *
@@ -1026,6 +1046,310 @@ static int pkt_grep(lua_State *L) {
 } /* pkt_grep() */
 
 
+/*
+ * Cursor Bindings
+ *
+ * A cursor is a single userdata stepped over the records of a packet.
+ * Fixed fields are read straight from the packet and names are only
+ * expanded when asked for, so bulk scans don't allocate per record.
+ */
+struct cursor {
+	struct dns_packet *P; /* anchored by the cursor's uservalue */
+	struct dns_rr_i i;
+	struct dns_rr rr;
+	_Bool valid;
+}; /* struct cursor */
+
+
+static struct cursor *cur_check(lua_State *L, int index) {
+	struct cursor *C = luaL_checkudata(L, index, CURSOR_CLASS);
+
+	luaL_argcheck(L, C->valid, index, "cursor not positioned on a record");
+
+	return C;
+} /* cur_check() */
+
+
+static int cur_pushname(lua_State *L, struct dns_packet *P, unsigned short src) {
+	char name[DNS_D_MAXNAME + 1];
+	size_t len;
+	int error;
+
+	if (!(len = dns_d_expand(name, sizeof name, src, P, &error)))
+		return luaL_error(L, "dns.cursor: %s", cqs_strerror(error));
+
+	lua_pushlstring(L, name, MIN(len, sizeof name - 1));
+
+	return 1;
+} /* cur_pushname() */
+
+
+/* RDATA offset of the embedded host name, or 0 if there isn't one */
+static unsigned short cur_hostp(const struct dns_rr *rr) {
+	if (rr->section == DNS_S_QD)
+		return 0;
+
+	switch (rr->type) {
+	case DNS_T_NS:
+	case DNS_T_CNAME:
+	case DNS_T_PTR:
+		return (rr->rd.len > 0)? rr->rd.p : 0;
+	case DNS_T_MX:
+		return (rr->rd.len > 2)? rr->rd.p + 2 : 0;
+	case DNS_T_SRV:
+		return (rr->rd.len > 6)? rr->rd.p + 6 : 0;
+	default:
+		return 0;
+	}
+} /* cur_hostp() */
+
+
+static int cur_u16(lua_State *L, enum dns_type type, unsigned off) {
+	struct cursor *C = cur_check(L, 1);
+	const unsigned char *rd = &C->P->data[C->rr.rd.p];
+
+	if (C->rr.type != type || C->rr.section == DNS_S_QD || C->rr.rd.len < off + 2)
+		return lua_pushnil(L), 1;
+
+	lua_pushinteger(L, ((0xff & rd[off]) << 8) | (0xff & rd[off + 1]));
+
+	return 1;
+} /* cur_u16() */
+
+
+static int cur_section(lua_State *L) {
+	lua_pushinteger(L, cur_check(L, 1)->rr.section);
+
+	return 1;
+} /* cur_section() */
+
+static int cur_name(lua_State *L) {
+	struct cursor *C = cur_check(L, 1);
+
+	return cur_pushname(L, C->P, C->rr.dn.p);
+} /* cur_name() */
+
+static int cur_type(lua_State *L) {
+	lua_pushinteger(L, cur_check(L, 1)->rr.type);
+
+	return 1;
+} /* cur_type() */
+
+static int cur_class(lua_State *L) {
+	lua_pushinteger(L, cur_check(L, 1)->rr.class);
+
+	return 1;
+} /* cur_class() */
+
+static int cur_ttl(lua_State *L) {
+	lua_pushinteger(L, cur_check(L, 1)->rr.ttl);
+
+	return 1;
+} /* cur_ttl() */
+
+static int cur_rdata(lua_State *L) {
+	struct cursor *C = cur_check(L, 1);
+
+	if (C->rr.section == DNS_S_QD)
+		return lua_pushliteral(L, ""), 1;
+
+	lua_pushlstring(L, (char *)&C->P->data[C->rr.rd.p], C->rr.rd.len);
+
+	return 1;
+} /* cur_rdata() */
+
+static int cur_addr(lua_State *L) {
+	struct cursor *C = cur_check(L, 1);
+	char addr[INET6_ADDRSTRLEN + 1] = "";
+
+	if (C->rr.section == DNS_S_QD)
+		return lua_pushnil(L), 1;
+
+	if (C->rr.type == DNS_T_A && C->rr.rd.len == 4)
+		inet_ntop(AF_INET, &C->P->data[C->rr.rd.p], addr, sizeof addr);
+	else if (C->rr.type == DNS_T_AAAA && C->rr.rd.len == 16)
+		inet_ntop(AF_INET6, &C->P->data[C->rr.rd.p], addr, sizeof addr);
+	else
+		return lua_pushnil(L), 1;
+
+	lua_pushstring(L, addr);
+
+	return 1;
+} /* cur_addr() */
+
+static int cur_host(lua_State *L) {
+	struct cursor *C = cur_check(L, 1);
+	unsigned short p;
+
+	if (!(p = cur_hostp(&C->rr)))
+		return lua_pushnil(L), 1;
+
+	return cur_pushname(L, C->P, p);
+} /* cur_host() */
+
+static int cur_preference(lua_State *L) {
+	return cur_u16(L, DNS_T_MX, 0);
+} /* cur_preference() */
+
+static int cur_priority(lua_State *L) {
+	return cur_u16(L, DNS_T_SRV, 0);
+} /* cur_priority() */
+
+static int cur_weight(lua_State *L) {
+	return cur_u16(L, DNS_T_SRV, 2);
+} /* cur_weight() */
+
+static int cur_port(lua_State *L) {
+	return cur_u16(L, DNS_T_SRV, 4);
+} /* cur_port() */
+
+/* materialize the current record as a regular record object */
+static int cur_record(lua_State *L) {
+	struct cursor *C = cur_check(L, 1);
+
+	rr_push(L, &C->rr, C->P);
+
+	return 1;
+} /* cur_record() */
+
+static const luaL_Reg cur_methods[] = {
+	{ "section",    &cur_section },
+	{ "name",       &cur_name },
+	{ "type",       &cur_type },
+	{ "class",      &cur_class },
+	{ "ttl",        &cur_ttl },
+	{ "rdata",      &cur_rdata },
+	{ "addr",       &cur_addr },
+	{ "host",       &cur_host },
+	{ "preference", &cur_preference },
+	{ "priority",   &cur_priority },
+	{ "weight",     &cur_weight },
+	{ "port",       &cur_port },
+	{ "record",     &cur_record },
+	{ NULL,         NULL }
+}; /* cur_methods[] */
+
+static const luaL_Reg cur_metatable[] = {
+	{ NULL, NULL }
+}; /* cur_metatable[] */
+
+
+static int pkt_nextrecord(lua_State *L) {
+	struct cursor *C = lua_touserdata(L, lua_upvalueindex(1));
+	int error = 0;
+
+	if (!(C->valid = dns_rr_grep(&C->rr, 1, &C->i, C->P, &error)))
+		return (error)? luaL_error(L, "dns.packet:records: %s", cqs_strerror(error)) : 0;
+
+	lua_pushvalue(L, lua_upvalueindex(1));
+
+	return 1;
+} /* pkt_nextrecord() */
+
+static int pkt_records(lua_State *L) {
+	struct dns_packet *P = luaL_checkudata(L, 1, PACKET_CLASS);
+	struct cursor *C;
+
+	lua_settop(L, 2);
+
+	C = memset(lua_newuserdata(L, sizeof *C), '\0', sizeof *C);
+	luaL_setmetatable(L, CURSOR_CLASS);
+	lua_pushvalue(L, 1);
+	cqs_setuservalue(L, -2);
+
+	C->P = P;
+	dns_rr_i_init(&C->i, P);
+
+	if (!lua_isnil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		C->i.section = optfint(L, 2, "section", 0);
+		C->i.type = optfint(L, 2, "type", 0);
+		C->i.class = optfint(L, 2, "class", 0);
+
+		lua_getfield(L, 2, "name");
+		if (!(C->i.name = luaL_optstring(L, -1, NULL)))
+			lua_pop(L, 1);
+	}
+
+	lua_pushcclosure(L, &pkt_nextrecord, lua_gettop(L) - 2);
+
+	return 1;
+} /* pkt_records() */
+
+
+static void pkt_packaddrs(lua_State *L, struct dns_packet *P, int section, int type, size_t len) {
+	struct dns_rr_i I;
+	struct dns_rr rr;
+	luaL_Buffer B;
+	int error = 0;
+
+	dns_rr_i_init(memset(&I, 0, sizeof I), P);
+	I.section = section;
+	I.type = type;
+
+	luaL_buffinit(L, &B);
+
+	while (dns_rr_grep(&rr, 1, &I, P, &error)) {
+		if (rr.section != DNS_S_QD && rr.class == DNS_C_IN && rr.rd.len == len)
+			luaL_addlstring(&B, (char *)&P->data[rr.rd.p], len);
+	}
+
+	luaL_pushresult(&B);
+
+	if (error)
+		luaL_error(L, "dns.packet:addresses: %s", cqs_strerror(error));
+} /* pkt_packaddrs() */
+
+/*
+ * Return every A and AAAA address in the section (default ANSWER), as
+ * a table of presentation strings or, given "binary", as two strings of
+ * packed 4-byte IPv4 and 16-byte IPv6 addresses.
+ */
+static int pkt_addresses(lua_State *L) {
+	static const char *const opts[] = { "string", "binary", NULL };
+	struct dns_packet *P = luaL_checkudata(L, 1, PACKET_CLASS);
+	int binary = luaL_checkoption(L, 2, "string", opts);
+	int section = luaL_optint(L, 3, DNS_S_AN);
+	char addr[INET6_ADDRSTRLEN + 1];
+	struct dns_rr_i I;
+	struct dns_rr rr;
+	int error = 0, n = 0;
+
+	if (binary) {
+		pkt_packaddrs(L, P, section, DNS_T_A, 4);
+		pkt_packaddrs(L, P, section, DNS_T_AAAA, 16);
+
+		return 2;
+	}
+
+	dns_rr_i_init(memset(&I, 0, sizeof I), P);
+	I.section = section;
+
+	lua_newtable(L);
+
+	while (dns_rr_grep(&rr, 1, &I, P, &error)) {
+		if (rr.section == DNS_S_QD || rr.class != DNS_C_IN)
+			continue;
+
+		if (rr.type == DNS_T_A && rr.rd.len == 4)
+			inet_ntop(AF_INET, &P->data[rr.rd.p], addr, sizeof addr);
+		else if (rr.type == DNS_T_AAAA && rr.rd.len == 16)
+			inet_ntop(AF_INET6, &P->data[rr.rd.p], addr, sizeof addr);
+		else
+			continue;
+
+		lua_pushstring(L, addr);
+		lua_rawseti(L, -2, ++n);
+	}
+
+	if (error)
+		return luaL_error(L, "dns.packet:addresses: %s", cqs_strerror(error));
+
+	return 1;
+} /* pkt_addresses() */
+
+
 static int pkt_load(lua_State *L) {
 	struct dns_packet *P = luaL_checkudata(L, 1, PACKET_CLASS);
 	size_t size;
@@ -1077,16 +1401,18 @@ static int pkt__tostring(lua_State *L) {
 
 
 static const luaL_Reg pkt_methods[] = {
-	{ "qid",      &pkt_qid },
-	{ "setqid",   &pkt_setqid },
-	{ "flags",    &pkt_flags },
-	{ "setflags", &pkt_setflags },
-	{ "push",     &pkt_push },
-	{ "count",    &pkt_count },
-	{ "grep",     &pkt_grep },
-	{ "load",     &pkt_load },
-	{ "dump",     &pkt_dump },
-	{ NULL,       NULL },
+	{ "qid",       &pkt_qid },
+	{ "setqid",    &pkt_setqid },
+	{ "flags",     &pkt_flags },
+	{ "setflags",  &pkt_setflags },
+	{ "push",      &pkt_push },
+	{ "count",     &pkt_count },
+	{ "grep",      &pkt_grep },
+	{ "records",   &pkt_records },
+	{ "addresses", &pkt_addresses },
+	{ "load",      &pkt_load },
+	{ "dump",      &pkt_dump },
+	{ NULL,        NULL },
 }; /* pkt_methods[] */
 
 static const luaL_Reg pkt_metatable[] = {
@@ -1128,6 +1454,7 @@ int luaopen__cqueues_dns_packet(lua_State *L) {
 	};
 
 	cqs_newmetatable(L, PACKET_CLASS, pkt_methods, pkt_metatable, 0);
+	cqs_newmetatable(L, CURSOR_CLASS, cur_methods, cur_metatable, 0);
 
 	luaL_newlib(L, pkt_globals);
 
@@ -2052,150 +2379,760 @@ int luaopen__cqueues_dns_hints(lua_State *L) {
 
 
 /*
- * R E S O L V E R  B I N D I N G S
+ * C A C H E  B I N D I N G S
+ *
+ * A bounded, TTL-honouring answer cache shared by any number of
+ * resolvers. Positive answers live for the smallest ANSWER TTL, negative
+ * answers (RFC 2308) for the smaller of the SOA TTL and SOA MINIMUM.
+ * Entries are evicted in LRU order once .size is reached.
+ *
+ * Each resolver gets its own struct dns_cache adapter pointing at the
+ * shared store. The resolver consults it through the "cache" lookup
+ * keyword, and res_fetch inserts whatever answer the resolver produced
+ * for a query the cache couldn't satisfy.
  *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-struct resolver {
-	struct dns_resolver *res;
-	lua_State *mainthread;
-}; /* struct resolver */
+struct cache_entry {
+	LLRB_ENTRY(cache_entry) rbe;
+	TAILQ_ENTRY(cache_entry) tqe;
 
+	enum dns_class class;
+	enum dns_type type;
+	char name[DNS_D_MAXNAME + 1];
 
-static struct resolver *res_prep(lua_State *L) {
-	struct resolver *R = lua_newuserdata(L, sizeof *R);
+	double stored, expires;
+	_Bool prefetch; /* refresh already handed to a resolver */
 
-	R->res = 0;
+	struct dns_packet *answer;
+}; /* struct cache_entry */
 
-#if defined LUA_RIDX_MAINTHREAD
-	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
-	R->mainthread = lua_tothread(L, -1);
-	lua_pop(L, 1);
-#else
-	R->mainthread = 0;
-#endif
+struct cache {
+	pthread_mutex_t mutex;
+	unsigned refcount;
 
-	luaL_setmetatable(L, RESOLVER_CLASS);
+	LLRB_HEAD(entries, cache_entry) entries;
+	TAILQ_HEAD(cache_lru, cache_entry) lru;
+	unsigned count;
 
-	return R;
-} /* res_prep() */
+	struct {
+		unsigned size;
+		double maxttl, negttl, prefetch;
+	} opts;
 
+	struct {
+		unsigned long hits, misses, negative, prefetches;
+		unsigned long inserts, expired, evicted;
+	} stats;
+}; /* struct cache */
 
-static int res_closefd(int *fd, void *arg) {
-	struct resolver *R = arg;
+struct cache_adapter {
+	struct dns_cache cache; /* must be first */
+	struct cache *store;
 
-	if (R->mainthread) {
-		cqs_cancelfd(R->mainthread, *fd);
-		cqs_closefd(fd);
-	}
+	struct {
+		enum dns_class class;
+		enum dns_type type;
+		_Bool pending;
+	} query;
 
-	return 0;
-} /* res_closefd() */
+	char hit[DNS_D_MAXNAME + 1]; /* key of the last answer served from the cache */
+}; /* struct cache_adapter */
 
 
-static int res_new(lua_State *L) {
-	struct resolver *R = res_prep(L);
-	struct dns_resolv_conf *resconf = resconf_test(L, 1);
-	struct dns_hosts *hosts = hosts_test(L, 2);
-	struct dns_hints *hints = hints_test(L, 3);
-	int error;
+static int cache_cmp(struct cache_entry *a, struct cache_entry *b) {
+	int cmp;
 
-	if (resconf)
-		dns_resconf_acquire(resconf);
-	if (hosts)
-		dns_hosts_acquire(hosts);
-	if (hints)
-		dns_hints_acquire(hints);
+	if ((cmp = a->class - b->class))
+		return cmp;
+	if ((cmp = a->type - b->type))
+		return cmp;
 
-	if (!resconf && !(resconf = dns_resconf_local(&error)))
-		goto error;
+	return strcmp(a->name, b->name);
+} /* cache_cmp() */
 
-	if (!hosts) {
-		if (resconf->options.recurse)
-			hosts = dns_hosts_open(&error);
-		else
-			hosts = dns_hosts_local(&error);
+LLRB_GENERATE_STATIC(entries, cache_entry, rbe, cache_cmp)
 
-		if (!hosts)
-			goto error;
-	}
 
-	if (!hints) {
-		if (resconf->options.recurse)
-			hints = dns_hints_root(resconf, &error);
-		else
-			hints = dns_hints_local(resconf, &error);
+static double cache_now(void) {
+#if HAVE_CLOCK_GETTIME
+	struct timespec ts;
 
-		if (!hints)
-			goto error;
-	}
+	if (0 == clock_gettime(CLOCK_MONOTONIC, &ts))
+		return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+#endif
+	return time(NULL);
+} /* cache_now() */
 
-	if (!(R->res = dns_res_open(resconf, hosts, hints, NULL, dns_opts(.closefd = { R, &res_closefd }), &error)))
-		goto error;
 
-	dns_resconf_close(resconf);
-	dns_hosts_close(hosts);
-	dns_hints_close(hints);
+/* lowercased and anchored, so "Example.COM" and "example.com." match */
+static size_t cache_key(char *dst, size_t lim, const void *src, size_t len) {
+	size_t n, i;
 
-	return 1;
-error:
-	dns_resconf_close(resconf);
-	dns_hosts_close(hosts);
-	dns_hints_close(hints);
+	if ((n = dns_d_anchor(dst, lim, src, len)) >= lim)
+		return 0;
 
-	lua_pushnil(L);
-	lua_pushinteger(L, error);
+	for (i = 0; i < n; i++)
+		dst[i] = tolower((unsigned char)dst[i]);
 
-	return 2;
-} /* res_new() */
+	return n;
+} /* cache_key() */
 
 
-static int res_interpose(lua_State *L) {
-	return cqs_interpose(L, RESOLVER_CLASS);
-} /* res_interpose() */
+static void cache_remove(struct cache *C, struct cache_entry *ent) {
+	LLRB_REMOVE(entries, &C->entries, ent);
+	TAILQ_REMOVE(&C->lru, ent, tqe);
+	C->count--;
 
+	free(ent->answer);
+	free(ent);
+} /* cache_remove() */
 
-static int res_type(lua_State *L) {
-	struct resolver *R;
 
-	if ((R = luaL_testudata(L, 1, RESOLVER_CLASS))) {
-		lua_pushstring(L, (R->res)? "dns resolver" : "closed dns resolver");
-	} else {
-		lua_pushnil(L);
-	}
+static void cache_clear(struct cache *C) {
+	struct cache_entry *ent;
 
-	return 1;
-} /* res_type() */
+	while ((ent = TAILQ_FIRST(&C->lru)))
+		cache_remove(C, ent);
+} /* cache_clear() */
 
 
-static inline struct dns_resolver *res_check(lua_State *L, int index) {
-	struct resolver *R = luaL_checkudata(L, index, RESOLVER_CLASS);
+static struct cache *cache_open(int *error) {
+	struct cache *C;
 
-	if (!R->res)
-		luaL_argerror(L, index, "resolver defunct");
+	if (!(C = calloc(1, sizeof *C)))
+		goto syerr;
 
-	return R->res;
-} /* res_check() */
+	if ((*error = pthread_mutex_init(&C->mutex, NULL))) {
+		free(C);
 
+		return NULL;
+	}
 
-static int res_submit(lua_State *L) {
-	struct dns_resolver *R = res_check(L, 1);
-	const char *name = luaL_checkstring(L, 2);
-	int type = luaL_optint(L, 3, DNS_T_A);
-	int class = luaL_optint(L, 4, DNS_C_IN);
-	int error;
+	C->refcount = 1;
+	LLRB_INIT(&C->entries);
+	TAILQ_INIT(&C->lru);
 
-	if (!(error = dns_res_submit(R, name, type, class))) {
-		lua_pushboolean(L, 1);
+	C->opts.size = 1024;
+	C->opts.maxttl = 86400;
+	C->opts.negttl = 10800; /* RFC 2308 section 5 */
+	C->opts.prefetch = 0.1;
 
-		return 1;
-	} else {
-		lua_pushboolean(L, 0);
-		lua_pushinteger(L, error);
+	return C;
+syerr:
+	*error = errno;
 
-		return 2;
-	}
-} /* res_submit() */
+	return NULL;
+} /* cache_open() */
+
+
+static void cache_acquire(struct cache *C) {
+	pthread_mutex_lock(&C->mutex);
+	C->refcount++;
+	pthread_mutex_unlock(&C->mutex);
+} /* cache_acquire() */
+
+
+static void cache_close(struct cache *C) {
+	unsigned refcount;
+
+	if (!C)
+		return;
+
+	pthread_mutex_lock(&C->mutex);
+	refcount = --C->refcount;
+	pthread_mutex_unlock(&C->mutex);
+
+	if (refcount > 0)
+		return;
+
+	cache_clear(C);
+	pthread_mutex_destroy(&C->mutex);
+	free(C);
+} /* cache_close() */
+
+
+/*
+ * Return the number of seconds answer P may be cached for, or 0 if it
+ * mustn't be cached at all (truncated, SERVFAIL, a negative answer
+ * without an SOA, etc).
+ */
+static double cache_ttl(struct cache *C, struct dns_packet *P) {
+	struct dns_rr rr;
+	struct dns_soa soa;
+	unsigned ttl = UINT_MAX;
+	int rcode = dns_p_rcode(P);
+	int error;
+
+	if (dns_header(P)->tc)
+		return 0;
+
+	if (rcode == DNS_RC_NOERROR && dns_p_count(P, DNS_S_AN) > 0) {
+		dns_rr_foreach(&rr, P, .section = DNS_S_AN) {
+			ttl = DNS_PP_MIN(ttl, rr.ttl);
+		}
+
+		return DNS_PP_MIN(ttl, C->opts.maxttl);
+	} else if (rcode == DNS_RC_NOERROR || rcode == DNS_RC_NXDOMAIN) {
+		dns_rr_foreach(&rr, P, .section = DNS_S_NS, .type = DNS_T_SOA) {
+			if ((error = dns_soa_parse(&soa, &rr, P)))
+				continue;
+
+			ttl = DNS_PP_MIN(ttl, DNS_PP_MIN(rr.ttl, soa.minimum));
+		}
+
+		return (ttl == UINT_MAX)? 0 : DNS_PP_MIN(ttl, C->opts.negttl);
+	}
+
+	return 0;
+} /* cache_ttl() */
+
+
+static void cache_insert(struct cache *C, const char *name, enum dns_type type, enum dns_class class, struct dns_packet *P) {
+	struct cache_entry key, *ent;
+	struct dns_packet *answer;
+	double ttl, now;
+	int error;
+
+	if (!cache_key(key.name, sizeof key.name, name, strlen(name)))
+		return;
+
+	key.class = class;
+	key.type = type;
+
+	if (!(ttl = cache_ttl(C, P)))
+		return;
+
+	if (!(answer = dns_p_copy(dns_p_make(P->end, &error), P)))
+		return;
+
+	now = cache_now();
+
+	pthread_mutex_lock(&C->mutex);
+
+	if ((ent = LLRB_FIND(entries, &C->entries, &key))) {
+		TAILQ_REMOVE(&C->lru, ent, tqe);
+		free(ent->answer);
+	} else {
+		while (C->count > 0 && C->count >= C->opts.size) {
+			cache_remove(C, TAILQ_LAST(&C->lru, cache_lru));
+			C->stats.evicted++;
+		}
+
+		if (!C->opts.size || !(ent = malloc(sizeof *ent))) {
+			pthread_mutex_unlock(&C->mutex);
+			free(answer);
+
+			return;
+		}
+
+		*ent = key;
+		LLRB_INSERT(entries, &C->entries, ent);
+		C->count++;
+	}
+
+	ent->stored = now;
+	ent->expires = now + ttl;
+	ent->prefetch = 0;
+	ent->answer = answer;
+	TAILQ_INSERT_HEAD(&C->lru, ent, tqe);
+	C->stats.inserts++;
+
+	pthread_mutex_unlock(&C->mutex);
+} /* cache_insert() */
+
+
+/* age every TTL by the time spent in the cache */
+static void cache_age(struct dns_packet *P, unsigned age) {
+	struct dns_rr rr;
+	unsigned char *ttl;
+	unsigned n;
+
+	dns_rr_foreach(&rr, P, .section = (DNS_S_ALL & ~DNS_S_QD)) {
+		if (rr.type == DNS_T_OPT)
+			continue;
+
+		n = (rr.ttl > age)? rr.ttl - age : 0;
+		ttl = &P->data[rr.rd.p - 6];
+
+		ttl[0] = 0xff & (n >> 24);
+		ttl[1] = 0xff & (n >> 16);
+		ttl[2] = 0xff & (n >> 8);
+		ttl[3] = 0xff & (n >> 0);
+	}
+} /* cache_age() */
+
+
+static struct dns_packet *cache_query(struct dns_packet *Q, struct dns_cache *cache, int *error) {
+	struct cache_adapter *A = (struct cache_adapter *)cache;
+	struct cache *C = A->store;
+	struct cache_entry key, *ent;
+	struct dns_packet *P = NULL;
+	struct dns_rr rr;
+	char name[DNS_D_MAXNAME + 1];
+	double now, stored = 0;
+	int _error = 0;
+
+	if (!dns_rr_grep(&rr, 1, dns_rr_i_new(Q, .section = DNS_S_QD), Q, &_error))
+		return NULL;
+
+	if (!dns_d_expand(name, sizeof name, rr.dn.p, Q, &_error))
+		return NULL;
+
+	if (!cache_key(key.name, sizeof key.name, name, strlen(name)))
+		return NULL;
+
+	key.class = rr.class;
+	key.type = rr.type;
+
+	now = cache_now();
+
+	pthread_mutex_lock(&C->mutex);
+
+	if ((ent = LLRB_FIND(entries, &C->entries, &key))) {
+		if (ent->expires <= now) {
+			cache_remove(C, ent);
+			C->stats.expired++;
+			ent = NULL;
+		} else if (!ent->prefetch && ent->expires - now <= C->opts.prefetch * (ent->expires - ent->stored)) {
+			/*
+			 * Let this one query through to refresh the entry
+			 * while everybody else keeps using it.
+			 */
+			ent->prefetch = 1;
+			C->stats.prefetches++;
+			ent = NULL;
+		}
+	}
+
+	if (ent && (P = dns_p_copy(dns_p_make(ent->answer->end, &_error), ent->answer))) {
+		TAILQ_REMOVE(&C->lru, ent, tqe);
+		TAILQ_INSERT_HEAD(&C->lru, ent, tqe);
+
+		stored = ent->stored;
+		C->stats.hits++;
+
+		if (dns_p_count(P, DNS_S_AN) == 0)
+			C->stats.negative++;
+	} else {
+		C->stats.misses++;
+	}
+
+	pthread_mutex_unlock(&C->mutex);
+
+	if (!P) {
+		*error = _error;
+
+		return NULL;
+	}
+
+	cache_age(P, (unsigned)(now - stored));
+	dns_header(P)->qid = dns_header(Q)->qid;
+
+	if (key.class == A->query.class && key.type == A->query.type)
+		dns_strlcpy(A->hit, key.name, sizeof A->hit);
+
+	return P;
+} /* cache_query() */
+
+
+static dns_refcount_t cache_adapter_release(struct dns_cache *cache) {
+	struct cache_adapter *A = (struct cache_adapter *)cache;
+	dns_refcount_t refcount = cache->_.refcount--;
+
+	if (refcount == 1) {
+		cache_close(A->store);
+		free(A);
+	}
+
+	return refcount;
+} /* cache_adapter_release() */
+
+
+static struct dns_cache *cache_adapter_open(struct cache *C, int *error) {
+	struct cache_adapter *A;
+
+	if (!(A = calloc(1, sizeof *A)))
+		return *error = errno, (void *)0;
+
+	dns_cache_init(&A->cache);
+	A->cache.state = C;
+	A->cache.query = &cache_query;
+	A->cache.release = &cache_adapter_release;
+
+	cache_acquire(C);
+	A->store = C;
+
+	return &A->cache;
+} /* cache_adapter_open() */
+
+
+/*
+ * Remember the top-level query so res_fetch knows what to insert. Only the
+ * type and class; a relative name is expanded through the search list, so
+ * the key is taken from the question of whichever answer comes back.
+ */
+static void cache_adapter_expect(struct dns_cache *cache, enum dns_type type, enum dns_class class) {
+	struct cache_adapter *A = (struct cache_adapter *)cache;
+
+	A->query.type = type;
+	A->query.class = class;
+	A->query.pending = 1;
+	A->hit[0] = '\0';
+} /* cache_adapter_expect() */
+
+
+static void cache_adapter_store(struct dns_cache *cache, struct dns_packet *P) {
+	struct cache_adapter *A = (struct cache_adapter *)cache;
+	struct dns_rr rr;
+	char name[DNS_D_MAXNAME + 1], key[DNS_D_MAXNAME + 1];
+	int error = 0;
+
+	if (!A->query.pending)
+		return;
+
+	A->query.pending = 0;
+
+	if (!dns_rr_grep(&rr, 1, dns_rr_i_new(P, .section = DNS_S_QD), P, &error))
+		return;
+
+	if (rr.class != A->query.class || rr.type != A->query.type)
+		return;
+
+	if (!dns_d_expand(name, sizeof name, rr.dn.p, P, &error))
+		return;
+
+	if (!cache_key(key, sizeof key, name, strlen(name)) || !strcmp(key, A->hit))
+		return;
+
+	cache_insert(A->store, key, rr.type, rr.class, P);
+} /* cache_adapter_store() */
+
+
+static struct cache *cache_check(lua_State *L, int index) {
+	struct cache **C = luaL_checkudata(L, index, CACHE_CLASS);
+
+	if (!*C)
+		luaL_argerror(L, index, "cache defunct");
+
+	return *C;
+} /* cache_check() */
+
+
+static struct cache *cache_test(lua_State *L, int index) {
+	struct cache **C = luaL_testudata(L, index, CACHE_CLASS);
+	return (C)? *C : 0;
+} /* cache_test() */
+
+
+static int cacheL_new(lua_State *L) {
+	struct cache **C;
+	int error;
+
+	C = lua_newuserdata(L, sizeof *C);
+	*C = 0;
+	luaL_setmetatable(L, CACHE_CLASS);
+
+	if (!(*C = cache_open(&error)))
+		return lua_pushboolean(L, 0), lua_pushinteger(L, error), 2;
+
+	if (lua_istable(L, 1)) {
+		(*C)->opts.size = optfint(L, 1, "size", (*C)->opts.size);
+		(*C)->opts.maxttl = optfnumber(L, 1, "maxttl", (*C)->opts.maxttl);
+		(*C)->opts.negttl = optfnumber(L, 1, "negttl", (*C)->opts.negttl);
+		(*C)->opts.prefetch = optfnumber(L, 1, "prefetch", (*C)->opts.prefetch);
+	}
+
+	return 1;
+} /* cacheL_new() */
+
+
+static int cacheL_interpose(lua_State *L) {
+	return cqs_interpose(L, CACHE_CLASS);
+} /* cacheL_interpose() */
+
+
+static int cacheL_type(lua_State *L) {
+	if (cache_test(L, 1)) {
+		lua_pushstring(L, "dns cache");
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+} /* cacheL_type() */
+
+
+static int cacheL_stat(lua_State *L) {
+	struct cache *C = cache_check(L, 1);
+
+	pthread_mutex_lock(&C->mutex);
+
+	lua_newtable(L);
+
+#define setfield(k, v) do { \
+	lua_pushnumber(L, (v)); \
+	lua_setfield(L, -2, (k)); \
+} while (0)
+
+	setfield("count", C->count);
+	setfield("size", C->opts.size);
+	setfield("hits", C->stats.hits);
+	setfield("misses", C->stats.misses);
+	setfield("negative", C->stats.negative);
+	setfield("prefetches", C->stats.prefetches);
+	setfield("inserts", C->stats.inserts);
+	setfield("expired", C->stats.expired);
+	setfield("evicted", C->stats.evicted);
+
+#undef setfield
+
+	pthread_mutex_unlock(&C->mutex);
+
+	return 1;
+} /* cacheL_stat() */
+
+
+static int cacheL_clear(lua_State *L) {
+	struct cache *C = cache_check(L, 1);
+
+	pthread_mutex_lock(&C->mutex);
+	cache_clear(C);
+	pthread_mutex_unlock(&C->mutex);
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+} /* cacheL_clear() */
+
+
+static int cacheL__gc(lua_State *L) {
+	struct cache **C = luaL_checkudata(L, 1, CACHE_CLASS);
+
+	cache_close(*C);
+	*C = 0;
+
+	return 0;
+} /* cacheL__gc() */
+
+
+static const luaL_Reg cache_methods[] = {
+	{ "stat",  &cacheL_stat },
+	{ "clear", &cacheL_clear },
+	{ NULL,    NULL },
+}; /* cache_methods[] */
+
+static const luaL_Reg cache_metatable[] = {
+	{ "__gc", &cacheL__gc },
+	{ NULL,   NULL }
+}; /* cache_metatable[] */
+
+static const luaL_Reg cache_globals[] = {
+	{ "new",       &cacheL_new },
+	{ "interpose", &cacheL_interpose },
+	{ "type",      &cacheL_type },
+	{ NULL,        NULL }
+};
+
+int luaopen__cqueues_dns_cache(lua_State *L) {
+	cqs_newmetatable(L, CACHE_CLASS, cache_methods, cache_metatable, 0);
+
+	luaL_newlib(L, cache_globals);
+
+	return 1;
+} /* luaopen__cqueues_dns_cache() */
+
+
+/*
+ * R E S O L V E R  B I N D I N G S
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct resolver {
+	struct dns_resolver *res;
+	struct dns_cache *cache; /* owned by res */
+	lua_State *mainthread;
+}; /* struct resolver */
+
+
+static struct resolver *res_prep(lua_State *L) {
+	struct resolver *R = lua_newuserdata(L, sizeof *R);
+
+	R->res = 0;
+	R->cache = 0;
+
+#if defined LUA_RIDX_MAINTHREAD
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	R->mainthread = lua_tothread(L, -1);
+	lua_pop(L, 1);
+#else
+	R->mainthread = 0;
+#endif
+
+	luaL_setmetatable(L, RESOLVER_CLASS);
+
+	return R;
+} /* res_prep() */
+
+
+static int res_closefd(int *fd, void *arg) {
+	struct resolver *R = arg;
+
+	if (R->mainthread) {
+		cqs_cancelfd(R->mainthread, *fd);
+		cqs_closefd(fd);
+	}
+
+	return 0;
+} /* res_closefd() */
+
+
+static int res_new(lua_State *L) {
+	struct resolver *R = res_prep(L);
+	struct dns_resolv_conf *resconf = resconf_test(L, 1);
+	struct dns_hosts *hosts = hosts_test(L, 2);
+	struct dns_hints *hints = hints_test(L, 3);
+	struct cache *cache = cache_test(L, 4);
+	struct dns_cache *adapter = NULL;
+	int error;
+
+	if (resconf)
+		dns_resconf_acquire(resconf);
+	if (hosts)
+		dns_hosts_acquire(hosts);
+	if (hints)
+		dns_hints_acquire(hints);
+
+	if (!resconf && !(resconf = dns_resconf_local(&error)))
+		goto error;
+
+	if (!hosts) {
+		if (resconf->options.recurse)
+			hosts = dns_hosts_open(&error);
+		else
+			hosts = dns_hosts_local(&error);
+
+		if (!hosts)
+			goto error;
+	}
+
+	if (!hints) {
+		if (resconf->options.recurse)
+			hints = dns_hints_root(resconf, &error);
+		else
+			hints = dns_hints_local(resconf, &error);
+
+		if (!hints)
+			goto error;
+	}
+
+	/*
+	 * The resolver only consults the cache where "cache" appears in
+	 * the lookup order, so put it first if it's missing. The config
+	 * may be shared with other resolvers, so change a private copy.
+	 */
+	if (cache) {
+		size_t n = 0;
+
+		while (n < sizeof resconf->lookup && resconf->lookup[n])
+			n++;
+
+		if (!memchr(resconf->lookup, 'c', n) && n < sizeof resconf->lookup) {
+			struct dns_resolv_conf *copy;
+
+			if (!(copy = dns_resconf_open(&error)))
+				goto error;
+
+			memcpy(copy, resconf, offsetof(struct dns_resolv_conf, _));
+			dns_resconf_close(resconf);
+			resconf = copy;
+
+			memmove(&resconf->lookup[1], &resconf->lookup[0], n);
+			resconf->lookup[0] = 'c';
+		}
+
+		if (!(adapter = cache_adapter_open(cache, &error)))
+			goto error;
+	}
+
+	if (!(R->res = dns_res_open(resconf, hosts, hints, adapter, dns_opts(.closefd = { R, &res_closefd }), &error)))
+		goto error;
+
+	R->cache = adapter;
+
+	dns_resconf_close(resconf);
+	dns_hosts_close(hosts);
+	dns_hints_close(hints);
+	dns_cache_close(adapter);
+
+	return 1;
+error:
+	dns_resconf_close(resconf);
+	dns_hosts_close(hosts);
+	dns_hints_close(hints);
+	dns_cache_close(adapter);
+
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* res_new() */
+
+
+static int res_interpose(lua_State *L) {
+	return cqs_interpose(L, RESOLVER_CLASS);
+} /* res_interpose() */
+
+
+static int res_type(lua_State *L) {
+	struct resolver *R;
+
+	if ((R = luaL_testudata(L, 1, RESOLVER_CLASS))) {
+		lua_pushstring(L, (R->res)? "dns resolver" : "closed dns resolver");
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+} /* res_type() */
+
+
+static inline struct dns_resolver *res_check(lua_State *L, int index) {
+	struct resolver *R = luaL_checkudata(L, index, RESOLVER_CLASS);
+
+	if (!R->res)
+		luaL_argerror(L, index, "resolver defunct");
+
+	return R->res;
+} /* res_check() */
+
+
+static inline struct dns_cache *res_cache(lua_State *L, int index) {
+	return ((struct resolver *)luaL_checkudata(L, index, RESOLVER_CLASS))->cache;
+} /* res_cache() */
+
+
+static int res_submit(lua_State *L) {
+	struct dns_resolver *R = res_check(L, 1);
+	const char *name = luaL_checkstring(L, 2);
+	int type = luaL_optint(L, 3, DNS_T_A);
+	int class = luaL_optint(L, 4, DNS_C_IN);
+	int error;
+
+	if (!(error = dns_res_submit(R, name, type, class))) {
+		if (res_cache(L, 1))
+			cache_adapter_expect(res_cache(L, 1), type, class);
+
+		lua_pushboolean(L, 1);
+
+		return 1;
+	} else {
+		lua_pushboolean(L, 0);
+		lua_pushinteger(L, error);
+
+		return 2;
+	}
+} /* res_submit() */
 
 
 static int res_fetch(lua_State *L) {
@@ -2212,6 +3149,9 @@ error:
 		return 2;
 	}
 
+	if (res_cache(L, 1))
+		cache_adapter_store(res_cache(L, 1), pkt);
+
 	/* FIXME: Leaks packet if lua_newuserdata throws */
 	size = dns_p_sizeof(pkt);
 	error = dns_p_study(dns_p_copy(dns_p_init(lua_newuserdata(L, size), size), pkt));
@@ -2305,10 +3245,12 @@ static int res_close(lua_State *L) {
 		R->mainthread = L;
 		dns_res_close(R->res);
 		R->res = 0;
+		R->cache = 0;
 		R->mainthread = 0;
 	} else {
 		dns_res_close(R->res);
 		R->res = 0;
+		R->cache = 0;
 	}
 
 	return 0;
@@ -2322,6 +3264,7 @@ static int res__gc(lua_State *L) {
 
 	dns_res_close(R->res);
 	R->res = 0;
+	R->cache = 0;
 
 	return 0;
 } /* res__gc() */
@@ -2356,6 +3299,7 @@ int luaopen__cqueues_dns_resolver(lua_State *L) {
 	cqs_requiref(L, "_cqueues.dns.config", &luaopen__cqueues_dns_config, 0);
 	cqs_requiref(L, "_cqueues.dns.hosts", &luaopen__cqueues_dns_hosts, 0);
 	cqs_requiref(L, "_cqueues.dns.hints", &luaopen__cqueues_dns_hints, 0);
+	cqs_requiref(L, "_cqueues.dns.cache", &luaopen__cqueues_dns_cache, 0);
 	cqs_requiref(L, "_cqueues.dns.packet", &luaopen__cqueues_dns_packet, 0);
 
 	luaL_newlib(L, res_globals);
@@ -2364,6 +3308,383 @@ int luaopen__cqueues_dns_resolver(lua_State *L) {
 } /* luaopen__cqueues_dns_resolver() */
 
 
+/*
+ * M U L T I P L E X E R  B I N D I N G S
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct mux {
+	struct dns_mux *mux;
+	lua_State *mainthread;
+}; /* struct mux */
+
+
+static int mux_closefd(int *fd, void *arg) {
+	struct mux *M = arg;
+
+	if (M->mainthread) {
+		cqs_cancelfd(M->mainthread, *fd);
+		cqs_closefd(fd);
+	}
+
+	return 0;
+} /* mux_closefd() */
+
+
+static int mux_socktype(lua_State *L, int index, int def) {
+	int type = def;
+
+	lua_getfield(L, index, "tcp");
+
+	if (lua_isboolean(L, -1))
+		type = (lua_toboolean(L, -1))? SOCK_STREAM : SOCK_DGRAM;
+
+	lua_pop(L, 1);
+
+	return type;
+} /* mux_socktype() */
+
+
+static int mux_new(lua_State *L) {
+	struct dns_resolv_conf *resconf = resconf_test(L, 1);
+	struct sockaddr_storage ss;
+	time_t timeout = 5;
+	unsigned attempts = 2;
+	int type = 0, error;
+	struct mux *M;
+
+	memset(&ss, 0, sizeof ss);
+
+	if (resconf) {
+		memcpy(&ss, &resconf->nameserver[0], sizeof ss);
+		timeout = resconf->options.timeout;
+		attempts = resconf->options.attempts;
+
+		if (resconf->options.tcp == DNS_RESCONF_TCP_ONLY)
+			type = SOCK_STREAM;
+		else if (resconf->options.tcp == DNS_RESCONF_TCP_DISABLE)
+			type = SOCK_DGRAM;
+	} else if ((error = dns_resconf_pton(&ss, luaL_checkstring(L, 1)))) {
+		goto error;
+	}
+
+	if (lua_istable(L, 2)) {
+		timeout = optfint(L, 2, "timeout", timeout);
+		attempts = optfint(L, 2, "attempts", attempts);
+		type = mux_socktype(L, 2, type);
+	}
+
+	M = lua_newuserdata(L, sizeof *M);
+	M->mux = 0;
+
+#if defined LUA_RIDX_MAINTHREAD
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	M->mainthread = lua_tothread(L, -1);
+	lua_pop(L, 1);
+#else
+	M->mainthread = 0;
+#endif
+
+	luaL_setmetatable(L, MUX_CLASS);
+
+	if (!(M->mux = dns_mux_open((struct sockaddr *)&ss, type, dns_opts(.closefd = { M, &mux_closefd }), &error)))
+		goto error;
+
+	dns_mux_setopts(M->mux, timeout, attempts);
+
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* mux_new() */
+
+
+static int mux_interpose(lua_State *L) {
+	return cqs_interpose(L, MUX_CLASS);
+} /* mux_interpose() */
+
+
+static int mux_type(lua_State *L) {
+	struct mux *M;
+
+	if ((M = luaL_testudata(L, 1, MUX_CLASS))) {
+		lua_pushstring(L, (M->mux)? "dns mux" : "closed dns mux");
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+} /* mux_type() */
+
+
+static inline struct dns_mux *mux_check(lua_State *L, int index) {
+	struct mux *M = luaL_checkudata(L, index, MUX_CLASS);
+
+	if (!M->mux)
+		luaL_argerror(L, index, "mux defunct");
+
+	return M->mux;
+} /* mux_check() */
+
+
+/* socket type selected by an optional "udp" or "tcp" argument */
+static int mux_which(lua_State *L, int index) {
+	static const char *const opts[] = { "udp", "tcp", NULL };
+
+	return (luaL_checkoption(L, index, "udp", opts))? SOCK_STREAM : SOCK_DGRAM;
+} /* mux_which() */
+
+
+static int mux_submit(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+	struct dns_packet *Q;
+	unsigned id;
+	int error;
+
+	if ((Q = luaL_testudata(L, 2, PACKET_CLASS))) {
+		error = dns_mux_submit(M, Q, &id);
+	} else {
+		const char *name = luaL_checkstring(L, 2);
+		int type = luaL_optint(L, 3, DNS_T_A);
+		int class = luaL_optint(L, 4, DNS_C_IN);
+
+		if (!(Q = dns_p_make(DNS_P_QBUFSIZ, &error)))
+			goto error;
+
+		if (!(error = dns_p_push(Q, DNS_S_QD, name, strlen(name), type, class, 0, 0))) {
+			dns_header(Q)->rd = 1;
+			error = dns_mux_submit(M, Q, &id);
+		}
+
+		free(Q);
+	}
+
+	if (error)
+		goto error;
+
+	lua_pushinteger(L, id);
+
+	return 1;
+error:
+	lua_pushboolean(L, 0);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* mux_submit() */
+
+
+static int mux_check_(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+	int error;
+
+	if ((error = dns_mux_check(M))) {
+		lua_pushboolean(L, 0);
+		lua_pushinteger(L, error);
+
+		return 2;
+	}
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+} /* mux_check_() */
+
+
+static int mux_fetch(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+	unsigned id = luaL_checkinteger(L, 2);
+	struct dns_packet *pkt;
+	size_t size;
+	int error;
+
+	if (!(pkt = dns_mux_fetch(M, id, &error))) {
+error:
+		lua_pushboolean(L, 0);
+		lua_pushinteger(L, error);
+
+		return 2;
+	}
+
+	/* FIXME: Leaks packet if lua_newuserdata throws */
+	size = dns_p_sizeof(pkt);
+	error = dns_p_study(dns_p_copy(dns_p_init(lua_newuserdata(L, size), size), pkt));
+	free(pkt);
+
+	if (error)
+		goto error;
+
+	luaL_setmetatable(L, PACKET_CLASS);
+
+	return 1;
+} /* mux_fetch() */
+
+
+static int mux_cancel(lua_State *L) {
+	dns_mux_cancel(mux_check(L, 1), luaL_checkinteger(L, 2));
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+} /* mux_cancel() */
+
+
+static int mux_pollfd(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+
+	lua_pushinteger(L, dns_mux_pollfd(M, mux_which(L, 2)));
+
+	return 1;
+} /* mux_pollfd() */
+
+
+static int mux_events(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+
+	switch (dns_mux_events(M, mux_which(L, 2))) {
+	case POLLIN|POLLOUT:
+		lua_pushliteral(L, "rw");
+		break;
+	case POLLIN:
+		lua_pushliteral(L, "r");
+		break;
+	case POLLOUT:
+		lua_pushliteral(L, "w");
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+
+	return 1;
+} /* mux_events() */
+
+
+static int mux_timeout(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+	time_t timeout = dns_mux_timeout(M);
+
+	if (timeout < 0)
+		lua_pushnil(L);
+	else
+		lua_pushnumber(L, timeout);
+
+	return 1;
+} /* mux_timeout() */
+
+
+static int mux_count(lua_State *L) {
+	lua_pushinteger(L, dns_mux_count(mux_check(L, 1)));
+
+	return 1;
+} /* mux_count() */
+
+
+static int mux_stat(lua_State *L) {
+	struct dns_mux *M = mux_check(L, 1);
+	const struct dns_stat *st = dns_mux_stat(M);
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, st->queries);
+	lua_setfield(L, -2, "queries");
+
+	lua_pushinteger(L, dns_mux_count(M));
+	lua_setfield(L, -2, "outstanding");
+
+#define setboth(st, table) do { \
+	lua_newtable(L); \
+	lua_pushinteger(L, (st).count); \
+	lua_setfield(L, -2, "count"); \
+	lua_pushinteger(L, (st).bytes); \
+	lua_setfield(L, -2, "bytes"); \
+	lua_setfield(L, -2, table); \
+} while (0)
+
+	lua_newtable(L);
+	setboth(st->udp.sent, "sent");
+	setboth(st->udp.rcvd, "rcvd");
+	lua_setfield(L, -2, "udp");
+
+	lua_newtable(L);
+	setboth(st->tcp.sent, "sent");
+	setboth(st->tcp.rcvd, "rcvd");
+	lua_setfield(L, -2, "tcp");
+
+#undef setboth
+
+	return 1;
+} /* mux_stat() */
+
+
+static int mux_close(lua_State *L) {
+	struct mux *M = luaL_checkudata(L, 1, MUX_CLASS);
+
+	if (!M->mainthread) {
+		M->mainthread = L;
+		dns_mux_close(M->mux);
+		M->mux = 0;
+		M->mainthread = 0;
+	} else {
+		dns_mux_close(M->mux);
+		M->mux = 0;
+	}
+
+	return 0;
+} /* mux_close() */
+
+
+static int mux__gc(lua_State *L) {
+	struct mux *M = luaL_checkudata(L, 1, MUX_CLASS);
+
+	M->mainthread = 0;
+
+	dns_mux_close(M->mux);
+	M->mux = 0;
+
+	return 0;
+} /* mux__gc() */
+
+
+static const luaL_Reg mux_methods[] = {
+	{ "submit",  &mux_submit },
+	{ "check",   &mux_check_ },
+	{ "fetch",   &mux_fetch },
+	{ "cancel",  &mux_cancel },
+	{ "pollfd",  &mux_pollfd },
+	{ "events",  &mux_events },
+	{ "timeout", &mux_timeout },
+	{ "count",   &mux_count },
+	{ "stat",    &mux_stat },
+	{ "close",   &mux_close },
+	{ NULL,      NULL },
+}; /* mux_methods[] */
+
+static const luaL_Reg mux_metatable[] = {
+	{ "__gc", &mux__gc },
+	{ NULL,   NULL }
+}; /* mux_metatable[] */
+
+static const luaL_Reg mux_globals[] = {
+	{ "new",       &mux_new },
+	{ "interpose", &mux_interpose },
+	{ "type",      &mux_type },
+	{ NULL,        NULL }
+};
+
+int luaopen__cqueues_dns_mux(lua_State *L) {
+	cqs_newmetatable(L, MUX_CLASS, mux_methods, mux_metatable, 0);
+
+	cqs_requiref(L, "_cqueues.dns.config", &luaopen__cqueues_dns_config, 0);
+	cqs_requiref(L, "_cqueues.dns.packet", &luaopen__cqueues_dns_packet, 0);
+
+	luaL_newlib(L, mux_globals);
+
+	return 1;
+} /* luaopen__cqueues_dns_mux() */
+
+
 /*
  * G L O B A L  B I N D I N G S
  *
@@ -0,0 +1,9 @@
+local loader = function(loader, ...)
+	local cache = require"_cqueues.dns.cache"
+
+	cache.loader = loader
+
+	return cache
+end
+
+return loader(loader, ...)
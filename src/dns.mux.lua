@@ -0,0 +1,120 @@
+local loader = function(loader, ...)
+	local cqueues = require"cqueues"
+	local mux = require"_cqueues.dns.mux"
+	local config = require"cqueues.dns.config"
+	local record = require"cqueues.dns.record"
+	local errno = require"cqueues.errno"
+	local EAGAIN = errno.EAGAIN
+	local ETIMEDOUT = errno.ETIMEDOUT
+	local monotime = cqueues.monotime
+
+	local _new = mux.new; mux.new = function (server, opts)
+		if type(server) == "table" then
+			server = config.new(server)
+		elseif server == nil then
+			server = config.stub()
+		end
+
+		return _new(server, opts)
+	end
+
+	local function toconst(id, map, what, lvl)
+		local n
+
+		if id == nil then
+			return
+		elseif type(id) == "number" then
+			n = map[id] and id
+		elseif type(id) == "string" then
+			n = map[id] or map[string.upper(id)]
+		end
+
+		if not n then
+			error((tostring(id) .. ": unknown DNS " .. what), lvl + 1)
+		end
+
+		return n
+	end -- toconst
+
+	local _submit; _submit = mux.interpose("submit", function (self, name, type, class)
+		type = toconst(type, record.type, "type", 2)
+		class = toconst(class, record.class, "class", 2)
+
+		return _submit(self, name, type, class)
+	end)
+
+	--
+	-- The TCP connection is polled through a proxy object so that a
+	-- query blocks on both descriptors at once.
+	--
+	local function tcpof(self)
+		return {
+			pollfd = function () return self:pollfd"tcp" end,
+			events = function () return self:events"tcp" end,
+			timeout = function () return self:timeout() end,
+		}
+	end -- tcpof
+
+	--
+	-- mux:query
+	--
+	-- Submit a query and wait for its answer. Any number of coroutines
+	-- may query concurrently; whichever wakes first reads every pending
+	-- answer off the shared sockets.
+	--
+	mux.interpose("query", function (self, name, type, class, timeout)
+		local deadline = timeout and (monotime() + timeout)
+		local tcp = tcpof(self)
+		local id, why, answer
+
+		id, why = self:submit(name, type, class)
+
+		if not id then
+			return nil, why
+		end
+
+		repeat
+			local ok
+
+			ok, why = self:check()
+
+			if not ok then
+				self:cancel(id)
+
+				return nil, why
+			end
+
+			answer, why = self:fetch(id)
+
+			if not answer then
+				if why == EAGAIN then
+					local wait = self:timeout() or 1
+
+					if deadline then
+						local curtime = monotime()
+
+						if deadline <= curtime then
+							self:cancel(id)
+
+							return nil, ETIMEDOUT
+						end
+
+						wait = math.min(wait, deadline - curtime)
+					end
+
+					cqueues.poll(math.min(wait, 1), self, tcp)
+				else
+					return nil, why
+				end
+			end
+		until answer
+
+		return answer
+	end)
+
+	mux.loader = loader
+
+	return mux
+end
+
+return loader(loader, ...)
@@ -30,38 +30,59 @@ local loader = function(loader, ...)
 	end) -- packet:push
 
 
+	local function tosection(section, lvl)
+		if type(section) == "string" then
+			local n = 0
+
+			for s in string.gmatch(section, "%a+") do
+				n = n + toconst(s, packet.section, "section", lvl + 1)
+			end
+
+			return n
+		elseif type(section) == "table" then
+			local n = 0
+
+			for i=1,#section do
+				n = n + toconst(section[i], packet.section, "section", lvl + 1)
+			end
+
+			return n
+		end
+
+		return section
+	end -- tosection
+
+
 	--
 	-- TODO: Don't restrict ourselves to the C iteration interface,
 	-- which is limited by fixed-sized fields. For example, you cannot
 	-- specify multiple different record types because the type
 	-- identifiers cannot be ORd together.
 	--
-	local _grep; _grep = packet.interpose("grep", function (self, opts)
+	local function toopts(opts, lvl)
 		if opts then
-			opts.type = toconst(opts.type, record.type, "type", 2)
-			opts.class = toconst(opts.class, record.class, "class", 2)
+			opts.type = toconst(opts.type, record.type, "type", lvl + 1)
+			opts.class = toconst(opts.class, record.class, "class", lvl + 1)
+			opts.section = tosection(opts.section, lvl + 1)
+		end
 
-			if type(opts.section) == "string" then
-				local n = 0
+		return opts
+	end -- toopts
 
-				for s in string.gmatch(opts.section, "%a+") do
-					n = n + toconst(s, packet.section, "section", 2)
-				end
 
-				opts.section = n
-			elseif type(opts.section) == "table" then
-				local n = 0
+	local _grep; _grep = packet.interpose("grep", function (self, opts)
+		return _grep(self, toopts(opts, 2))
+	end) -- packet:grep
 
-				for i=1,#opts.section do
-					n = n + toconst(opts.section[i], packet.section, "section", 2)
-				end
 
-				opts.section = n
-			end
-		end
+	local _records; _records = packet.interpose("records", function (self, opts)
+		return _records(self, toopts(opts, 2))
+	end) -- packet:records
 
-		return _grep(self, opts)
-	end) -- packet:grep
+
+	local _addresses; _addresses = packet.interpose("addresses", function (self, format, section)
+		return _addresses(self, format, tosection(section, 2))
+	end) -- packet:addresses
 
 
 	return packet
@@ -8,20 +8,20 @@ local loader = function(loader, ...)
 	local ETIMEDOUT = errno.ETIMEDOUT
 	local monotime = cqueues.monotime
 
-	local _new = resolver.new; resolver.new = function (resconf, hosts, hints)
+	local _new = resolver.new; resolver.new = function (resconf, hosts, hints, cache)
 		if type(resconf) == "table" then
 			resconf = config.new(resconf)
 		end
 
-		return _new(resconf, hosts, hints)
+		return _new(resconf, hosts, hints, cache)
 	end
 
-	resolver.stub = function (init)
-		return resolver.new(config.stub(init), nil, nil)
+	resolver.stub = function (init, cache)
+		return resolver.new(config.stub(init), nil, nil, cache)
 	end
 
-	resolver.root = function (init)
-		return resolver.new(config.root(init), nil, nil)
+	resolver.root = function (init, cache)
+		return resolver.new(config.root(init), nil, nil, cache)
 	end
 
 	local function toconst(id, map, what, lvl)
@@ -1,10 +1,12 @@
 local loader = function(loader, ...)
 	local resolver = require"cqueues.dns.resolver"
 	local config = require"cqueues.dns.config"
+	local dnscache = require"cqueues.dns.cache"
 	local condition = require"cqueues.condition"
 	local monotime = require"cqueues".monotime
 	local random = require"cqueues.dns".random
 	local errno = require"cqueues.errno"
+	local auxlib = require"cqueues.auxlib"
 	local ETIMEDOUT = errno.ETIMEDOUT
 
 
@@ -128,7 +130,7 @@ local loader = function(loader, ...)
 				end
 			elseif self.alive.n < self.hiwat then
 				local why
-				res, why = resolver.new(self.resconf, self.hosts, self.hints)
+				res, why = resolver.new(self.resconf, self.hosts, self.hints, self.dnscache)
 				if not res then
 					return nil, why
 				end
@@ -169,8 +171,7 @@ local loader = function(loader, ...)
 	end -- pool:signal
 
 
-	function pool:query(name, type, class, timeout)
-		local deadline = todeadline(timeout or self.timeout)
+	local function query(self, name, type, class, deadline)
 		local res, why = getby(self, deadline)
 
 		if not res then
@@ -184,9 +185,64 @@ local loader = function(loader, ...)
 		end
 
 		return r
+	end -- query
+
+
+	--
+	-- NOTE: Concurrent queries for the same (name, type, class) are
+	-- coalesced. The first caller resolves and the rest wait on its
+	-- condition variable and share the answer packet. A waiter whose
+	-- own timeout expires gives up without affecting the others.
+	--
+	function pool:query(name, type, class, timeout)
+		local deadline = todeadline(timeout or self.timeout)
+		local key = string.format("%s|%s|%s", string.lower(tostring(name)), tostring(type or "A"), tostring(class or "IN"))
+		local pending = self.inflight[key]
+
+		if pending then
+			self.stats.coalesced = self.stats.coalesced + 1
+
+			while not pending.done do
+				if deadline and deadline <= monotime() then
+					return nil, ETIMEDOUT
+				end
+
+				pending.condvar:wait(totimeout(deadline))
+			end
+
+			return pending.answer, pending.why
+		end
+
+		pending = { condvar = condition.new() }
+		self.inflight[key] = pending
+
+		-- query polls, and pcall can't be yielded across on Lua 5.1
+		local ok, answer, why = auxlib.resume(coroutine.create(query), self, name, type, class, deadline)
+
+		self.inflight[key] = nil
+		pending.done = true
+
+		if ok then
+			pending.answer, pending.why = answer, why
+		else
+			pending.why = errno.EFAULT
+		end
+
+		pending.condvar:signal()
+
+		if not ok then
+			error(answer, 0)
+		end
+
+		return answer, why
 	end -- pool:query
 
 
+	function pool:stat()
+		return { coalesced = self.stats.coalesced, alive = self.alive.n, cached = #self.cache }
+	end -- pool:stat
+
+
 	function pool:check()
 		return self.alive:check()
 	end -- pool:check
@@ -205,12 +261,23 @@ local loader = function(loader, ...)
 	resolvers.onleak = nil
 	resolvers.lifo = false
 
-	function resolvers.new(resconf, hosts, hints)
+	--
+	-- resolvers.new
+	--
+	-- Unless cache is false every resolver in the pool shares one
+	-- cqueues.dns.cache object, either the one passed or a new one.
+	--
+	function resolvers.new(resconf, hosts, hints, cache)
 		local self = {}
 
+		if cache == nil then
+			cache = dnscache.new()
+		end
+
 		self.resconf = (type(resconf) == "table" and config.new(resconf)) or resconf
 		self.hosts = hosts
 		self.hints = hints
+		self.dnscache = cache or nil
 		self.condvar = condition.new()
 		self.lowat = resolvers.lowat
 		self.hiwat = resolvers.hiwat
@@ -220,18 +287,20 @@ local loader = function(loader, ...)
 		self.lifo = resolvers.lifo
 		self.cache = {}
 		self.alive = alive.new(self.condvar)
+		self.inflight = {}
+		self.stats = { coalesced = 0 }
 
 		return setmetatable(self, { __index = pool })
 	end -- resolvers.new
 
 
-	function resolvers.stub(cfg)
-		return resolvers.new(config.stub(cfg))
+	function resolvers.stub(cfg, cache)
+		return resolvers.new(config.stub(cfg), nil, nil, cache)
 	end -- resolvers.stub
 
 
-	function resolvers.root(cfg)
-		return resolvers.new(config.root(cfg))
+	function resolvers.root(cfg, cache)
+		return resolvers.new(config.root(cfg), nil, nil, cache)
 	end -- resolvers.root
 
 
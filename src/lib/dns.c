@@ -302,6 +302,7 @@ int dns_v_api(void) {
 #define DNS_EISCONN	WSAEISCONN
 #define DNS_EWOULDBLOCK	WSAEWOULDBLOCK
 #define DNS_EALREADY	WSAEALREADY
+#define DNS_ECONNRESET	WSAECONNRESET
 #define DNS_EAGAIN	EAGAIN
 #define DNS_ETIMEDOUT	WSAETIMEDOUT
 
@@ -315,6 +316,7 @@ int dns_v_api(void) {
 #define DNS_EISCONN	EISCONN
 #define DNS_EWOULDBLOCK	EWOULDBLOCK
 #define DNS_EALREADY	EALREADY
+#define DNS_ECONNRESET	ECONNRESET
 #define DNS_EAGAIN	EAGAIN
 #define DNS_ETIMEDOUT	ETIMEDOUT
 
@@ -6249,6 +6251,9 @@ struct dns_socket {
 
 	struct dns_stat stat;
 
+	unsigned char *batch; /* see dns_so_udp_recv() */
+	size_t blen;
+
 	/*
 	 * NOTE: dns_so_reset() zeroes everything from here down.
 	 */
@@ -6378,6 +6383,10 @@ error:
 static void dns_so_destroy(struct dns_socket *so) {
 	dns_so_reset(so);
 	dns_so_closefds(so, DNS_SO_CLOSE_ALL);
+
+	free(so->batch);
+	so->batch = NULL;
+	so->blen = 0;
 } /* dns_so_destroy() */
 
 
@@ -6587,6 +6596,87 @@ static int dns_so_tcp_recv(struct dns_socket *so) {
 #endif
 
 
+/*
+ * Where recvmmsg(2) is available, drain up to DNS_SO_BATCH datagrams per
+ * call so stale or spoofed replies queued ahead of the answer cost one
+ * syscall per batch rather than one per packet. The first datagram lands
+ * directly in so->answer; the rest in so->batch, which is kept across
+ * queries.
+ */
+#ifndef DNS_SO_HAVE_MMSG
+#if defined MSG_WAITFORONE && !_WIN32
+#define DNS_SO_HAVE_MMSG 1
+#else
+#define DNS_SO_HAVE_MMSG 0
+#endif
+#endif
+
+#define DNS_SO_BATCH 8
+
+static _Bool dns_so_udp_accept(struct dns_socket *so, long n) {
+	so->stat.udp.rcvd.bytes += n;
+	so->stat.udp.rcvd.count++;
+
+	if ((so->answer->end = n) < 12 || dns_so_verify(so, so->answer)) {
+		DNS_CARP("discarding packet");
+
+		return 0;
+	}
+
+	return 1;
+} /* dns_so_udp_accept() */
+
+static int dns_so_udp_recv(struct dns_socket *so) {
+#if DNS_SO_HAVE_MMSG
+	struct mmsghdr mv[DNS_SO_BATCH];
+	struct iovec iov[DNS_SO_BATCH];
+	size_t size = so->answer->size;
+	int i, n;
+
+	if (so->blen < (DNS_SO_BATCH - 1) * size) {
+		void *p;
+
+		if (!(p = realloc(so->batch, (DNS_SO_BATCH - 1) * size)))
+			return dns_syerr();
+
+		so->batch = p;
+		so->blen = (DNS_SO_BATCH - 1) * size;
+	}
+
+	for (;;) {
+		memset(mv, 0, sizeof mv);
+
+		for (i = 0; i < DNS_SO_BATCH; i++) {
+			iov[i].iov_base = (i == 0)? so->answer->data : &so->batch[(i - 1) * size];
+			iov[i].iov_len = size;
+			mv[i].msg_hdr.msg_iov = &iov[i];
+			mv[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		if (0 > (n = recvmmsg(so->udp, mv, DNS_SO_BATCH, 0, NULL)))
+			return dns_soerr();
+
+		for (i = 0; i < n; i++) {
+			if (i > 0)
+				memcpy(so->answer->data, iov[i].iov_base, mv[i].msg_len);
+
+			if (dns_so_udp_accept(so, mv[i].msg_len))
+				return 0;
+		}
+	}
+#else
+	long n;
+
+	do {
+		if (0 > (n = recv(so->udp, (void *)so->answer->data, so->answer->size, 0)))
+			return dns_soerr();
+	} while (!dns_so_udp_accept(so, n));
+
+	return 0;
+#endif
+} /* dns_so_udp_recv() */
+
+
 int dns_so_check(struct dns_socket *so) {
 	int error;
 	long n;
@@ -6609,17 +6699,8 @@ retry:
 
 		so->state++;
 	case DNS_SO_UDP_RECV:
-		if (0 > (n = recv(so->udp, (void *)so->answer->data, so->answer->size, 0)))
-			goto soerr;
-
-		so->stat.udp.rcvd.bytes += n;
-		so->stat.udp.rcvd.count++;
-
-		if ((so->answer->end = n) < 12)
-			goto trash;
-
-		if ((error = dns_so_verify(so, so->answer)))
-			goto trash;
+		if ((error = dns_so_udp_recv(so)))
+			goto error;
 
 		so->state++;
 	case DNS_SO_UDP_DONE:
@@ -6678,9 +6759,6 @@ retry:
 		goto error;
 	} /* switch() */
 
-trash:
-	DNS_CARP("discarding packet");
-	goto retry;
 soerr:
 	error	= dns_soerr();
 
@@ -6823,6 +6901,655 @@ const struct dns_stat *dns_so_stat(struct dns_socket *so) {
 } /* dns_so_stat() */
 
 
+/*
+ * M U L T I P L E X E D  S O C K E T  R O U T I N E S
+ *
+ * Any number of outstanding queries to a single nameserver over one UDP
+ * socket, with answers matched by QID and question. Truncated answers are
+ * retried over a single TCP connection shared by every query, where
+ * queries are pipelined and answers may arrive in any order (RFC 7766).
+ *
+ * The descriptors, QID permutor and statistics are those of an embedded
+ * struct dns_socket; only its per-query state goes unused.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+enum dns_mux_state {
+	DNS_MUX_UDP_SEND = 1,
+	DNS_MUX_UDP_RECV,
+	DNS_MUX_TCP_RECV,
+	DNS_MUX_DONE,
+	DNS_MUX_NSTATE,
+};
+
+#define DNS_MUX_NBUCKET	256
+#define DNS_MUX_MAXUDP	65535
+
+struct dns_mux_query {
+	struct dns_mux_query *next;
+
+	enum dns_mux_state state;
+	unsigned short qid;
+
+	char qname[DNS_D_MAXNAME + 1];
+	size_t qlen;
+	enum dns_type qtype;
+	enum dns_class qclass;
+
+	time_t began, sent;
+
+	struct {
+		unsigned udp; /* datagrams sent */
+		unsigned tcp; /* connections it was queued on */
+	} tries;
+
+	struct dns_packet *query;
+	struct dns_packet *answer;
+	int error;
+}; /* struct dns_mux_query */
+
+struct dns_mux {
+	struct dns_socket so;
+
+	struct dns_clock elapsed;
+	time_t timeout;
+	unsigned attempts;
+
+	struct dns_mux_query *bucket[DNS_MUX_NBUCKET];
+	unsigned count[DNS_MUX_NSTATE];
+
+	unsigned char *ibuf; /* UDP receive buffer */
+
+	struct {
+		_Bool connected;
+
+		unsigned char *obuf; /* length-prefixed queries not yet sent */
+		size_t olen, opos, osiz;
+
+		unsigned char *abuf; /* answer being reassembled, with its length */
+		size_t alen, apos, asiz;
+	} tcp;
+}; /* struct dns_mux */
+
+
+static struct dns_mux_query **dns_mux_find(struct dns_mux *M, unsigned short qid) {
+	struct dns_mux_query **q;
+
+	for (q = &M->bucket[qid % DNS_MUX_NBUCKET]; *q; q = &(*q)->next) {
+		if ((*q)->qid == qid)
+			break;
+	}
+
+	return q;
+} /* dns_mux_find() */
+
+
+static void dns_mux_setstate(struct dns_mux *M, struct dns_mux_query *q, enum dns_mux_state state) {
+	M->count[q->state]--;
+	M->count[(q->state = state)]++;
+} /* dns_mux_setstate() */
+
+
+static void dns_mux_finish(struct dns_mux *M, struct dns_mux_query *q, struct dns_packet *answer, int error) {
+	dns_p_setptr(&q->answer, answer);
+	q->error = error;
+
+	dns_mux_setstate(M, q, DNS_MUX_DONE);
+} /* dns_mux_finish() */
+
+
+static void dns_mux_free(struct dns_mux *M, struct dns_mux_query **qp) {
+	struct dns_mux_query *q = *qp;
+
+	*qp = q->next;
+	M->count[q->state]--;
+
+	dns_p_setptr(&q->query, NULL);
+	dns_p_setptr(&q->answer, NULL);
+	free(q);
+} /* dns_mux_free() */
+
+
+/* queue a length-prefixed copy of the query on the TCP connection */
+static int dns_mux_tcp_queue(struct dns_mux *M, struct dns_mux_query *q) {
+	size_t need = M->tcp.olen + 2 + q->query->end;
+
+	if (need > M->tcp.osiz) {
+		size_t osiz = DNS_PP_MAX(need, DNS_PP_MAX(2 * M->tcp.osiz, 1024));
+		void *p;
+
+		if (!(p = realloc(M->tcp.obuf, osiz)))
+			return dns_syerr();
+
+		M->tcp.obuf = p;
+		M->tcp.osiz = osiz;
+	}
+
+	M->tcp.obuf[M->tcp.olen++] = 0xff & (q->query->end >> 8);
+	M->tcp.obuf[M->tcp.olen++] = 0xff & (q->query->end >> 0);
+	memcpy(&M->tcp.obuf[M->tcp.olen], q->query->data, q->query->end);
+	M->tcp.olen += q->query->end;
+
+	q->sent = dns_elapsed(&M->elapsed);
+	q->tries.tcp++;
+	dns_mux_setstate(M, q, DNS_MUX_TCP_RECV);
+
+	return 0;
+} /* dns_mux_tcp_queue() */
+
+
+static void dns_mux_fail(struct dns_mux *M, enum dns_mux_state state, int error) {
+	struct dns_mux_query *q;
+	unsigned i;
+
+	for (i = 0; i < DNS_MUX_NBUCKET && M->count[state]; i++) {
+		for (q = M->bucket[i]; q; q = q->next) {
+			if (q->state == state)
+				dns_mux_finish(M, q, NULL, error);
+		}
+	}
+} /* dns_mux_fail() */
+
+
+struct dns_mux *dns_mux_open(const struct sockaddr *remote, int type, const struct dns_options *opts, int *error) {
+	struct sockaddr_storage local;
+	struct dns_mux *M;
+
+	if (!(M = calloc(1, sizeof *M)))
+		goto syerr;
+
+	memset(&local, 0, sizeof local);
+	local.ss_family = remote->sa_family;
+
+	if (!dns_so_init(&M->so, (struct sockaddr *)&local, type, opts, error)) {
+		free(M);
+
+		return NULL;
+	}
+
+	memcpy(&M->so.remote, remote, dns_sa_len(remote));
+
+	dns_begin(&M->elapsed);
+	M->timeout = 5;
+	M->attempts = 2;
+
+	if (!(M->ibuf = malloc(DNS_MUX_MAXUDP)))
+		goto syerr;
+
+	if (0 != connect(M->so.udp, remote, dns_sa_len(remote))) {
+		*error = dns_soerr();
+
+		goto error;
+	}
+
+	return M;
+syerr:
+	*error = dns_syerr();
+error:
+	dns_mux_close(M);
+
+	return NULL;
+} /* dns_mux_open() */
+
+
+void dns_mux_setopts(struct dns_mux *M, time_t timeout, unsigned attempts) {
+	M->timeout = DNS_PP_MAX(1, timeout);
+	M->attempts = DNS_PP_MAX(1, attempts);
+} /* dns_mux_setopts() */
+
+
+static void dns_mux_destroy(struct dns_mux *M) {
+	unsigned i;
+
+	for (i = 0; i < DNS_MUX_NBUCKET; i++) {
+		while (M->bucket[i])
+			dns_mux_free(M, &M->bucket[i]);
+	}
+
+	free(M->ibuf);
+	free(M->tcp.obuf);
+	free(M->tcp.abuf);
+
+	dns_so_destroy(&M->so);
+} /* dns_mux_destroy() */
+
+
+void dns_mux_close(struct dns_mux *M) {
+	if (!M)
+		return;
+
+	dns_mux_destroy(M);
+
+	free(M);
+} /* dns_mux_close() */
+
+
+int dns_mux_submit(struct dns_mux *M, struct dns_packet *Q, unsigned *id) {
+	struct dns_mux_query *q, **qp;
+	struct dns_rr rr;
+	unsigned i, n;
+	int error;
+
+	for (n = 0, i = 1; i < DNS_MUX_NSTATE; i++)
+		n += M->count[i];
+
+	if (n >= 65535)
+		return DNS_ENOBUFS;
+
+	if (!(q = calloc(1, sizeof *q)))
+		return dns_syerr();
+
+	if ((error = dns_rr_parse(&rr, 12, Q)))
+		goto error;
+
+	if (!(q->qlen = dns_d_expand(q->qname, sizeof q->qname, rr.dn.p, Q, &error)))
+		goto error;
+
+	q->qtype = rr.type;
+	q->qclass = rr.class;
+
+	if (!(q->query = dns_p_copy(dns_p_make(Q->end, &error), Q)))
+		goto error;
+
+	do {
+		q->qid = dns_so_mkqid(&M->so);
+	} while (*(qp = dns_mux_find(M, q->qid)));
+
+	dns_header(q->query)->qid = q->qid;
+	q->began = dns_elapsed(&M->elapsed);
+
+	*qp = q;
+	M->count[(q->state = DNS_MUX_UDP_SEND)]++;
+	M->so.stat.queries++;
+
+	if (M->so.type == SOCK_STREAM && (error = dns_mux_tcp_queue(M, q))) {
+		dns_mux_free(M, qp);
+
+		return error;
+	}
+
+	*id = q->qid;
+
+	return 0;
+error:
+	dns_p_setptr(&q->query, NULL);
+	free(q);
+
+	return error;
+} /* dns_mux_submit() */
+
+
+static _Bool dns_mux_verify(struct dns_mux_query *q, struct dns_packet *P) {
+	char qname[DNS_D_MAXNAME + 1];
+	struct dns_rr rr;
+	size_t qlen;
+	int error;
+
+	if (!dns_p_count(P, DNS_S_QD) || dns_rr_parse(&rr, 12, P))
+		return 0;
+
+	if (rr.type != q->qtype || rr.class != q->qclass)
+		return 0;
+
+	if (!(qlen = dns_d_expand(qname, sizeof qname, rr.dn.p, P, &error)))
+		return 0;
+
+	return qlen < sizeof qname && qlen == q->qlen && !strcasecmp(qname, q->qname);
+} /* dns_mux_verify() */
+
+
+/* match an answer to an outstanding query; unmatched answers are dropped */
+static int dns_mux_accept(struct dns_mux *M, const unsigned char *src, size_t len, enum dns_mux_state state) {
+	struct dns_mux_query *q;
+	struct dns_packet *P;
+	int error;
+
+	if (len < 12)
+		return 0;
+
+	if (!(P = dns_p_make(len, &error)))
+		return error;
+
+	memcpy(P->data, src, len);
+	P->end = len;
+
+	q = *dns_mux_find(M, dns_header(P)->qid);
+
+	if (!q || q->state != state || !dns_mux_verify(q, P)) {
+		DNS_SHOW(P, "discarding packet");
+		dns_p_setptr(&P, NULL);
+
+		return 0;
+	}
+
+	if (dns_header(P)->tc && state == DNS_MUX_UDP_RECV && M->so.type != SOCK_DGRAM) {
+		dns_p_setptr(&P, NULL);
+
+		return dns_mux_tcp_queue(M, q);
+	}
+
+	dns_mux_finish(M, q, P, 0);
+
+	return 0;
+} /* dns_mux_accept() */
+
+
+static int dns_mux_udp_send(struct dns_mux *M) {
+	struct dns_mux_query *q;
+	unsigned i;
+	long n;
+
+	for (i = 0; i < DNS_MUX_NBUCKET && M->count[DNS_MUX_UDP_SEND]; i++) {
+		for (q = M->bucket[i]; q; q = q->next) {
+			if (q->state != DNS_MUX_UDP_SEND)
+				continue;
+
+			if (0 > (n = send(M->so.udp, (void *)q->query->data, q->query->end, 0)))
+				return dns_soerr();
+
+			M->so.stat.udp.sent.bytes += n;
+			M->so.stat.udp.sent.count++;
+
+			q->sent = dns_elapsed(&M->elapsed);
+			q->tries.udp++;
+			dns_mux_setstate(M, q, DNS_MUX_UDP_RECV);
+		}
+	}
+
+	return 0;
+} /* dns_mux_udp_send() */
+
+
+static int dns_mux_udp_recv(struct dns_mux *M) {
+	int error;
+	long n;
+
+	while (M->count[DNS_MUX_UDP_RECV]) {
+		if (0 > (n = recv(M->so.udp, (void *)M->ibuf, DNS_MUX_MAXUDP, 0)))
+			return dns_soerr();
+
+		M->so.stat.udp.rcvd.bytes += n;
+		M->so.stat.udp.rcvd.count++;
+
+		if ((error = dns_mux_accept(M, M->ibuf, n, DNS_MUX_UDP_RECV)))
+			return error;
+	}
+
+	return 0;
+} /* dns_mux_udp_recv() */
+
+
+/* the connection went away; resend what's outstanding on a new one */
+static int dns_mux_tcp_reset(struct dns_mux *M, int error) {
+	struct dns_mux_query *q;
+	unsigned i;
+	int error2;
+
+	dns_so_closefd(&M->so, &M->so.tcp);
+	M->tcp.connected = 0;
+	M->tcp.olen = M->tcp.opos = 0;
+	M->tcp.alen = M->tcp.apos = 0;
+
+	for (i = 0; i < DNS_MUX_NBUCKET && M->count[DNS_MUX_TCP_RECV]; i++) {
+		for (q = M->bucket[i]; q; q = q->next) {
+			if (q->state != DNS_MUX_TCP_RECV)
+				continue;
+
+			if (q->tries.tcp >= M->attempts)
+				dns_mux_finish(M, q, NULL, error);
+			else if ((error2 = dns_mux_tcp_queue(M, q)))
+				return error2;
+		}
+	}
+
+	return 0;
+} /* dns_mux_tcp_reset() */
+
+
+static int dns_mux_tcp_recv(struct dns_mux *M) {
+	int error;
+	long n;
+
+	while (M->count[DNS_MUX_TCP_RECV]) {
+		size_t aend = M->tcp.alen + 2;
+
+		if (M->tcp.asiz < aend) {
+			size_t asiz = DNS_PP_MAX(aend, DNS_SO_MINBUF);
+			void *p;
+
+			if (!(p = realloc(M->tcp.abuf, asiz)))
+				return dns_syerr();
+
+			M->tcp.abuf = p;
+			M->tcp.asiz = asiz;
+		}
+
+		if (0 > (n = recv(M->so.tcp, (void *)&M->tcp.abuf[M->tcp.apos], aend - M->tcp.apos, 0)))
+			return dns_soerr();
+		else if (n == 0)
+			return dns_mux_tcp_reset(M, DNS_ECONNRESET);
+
+		M->tcp.apos += n;
+		M->so.stat.tcp.rcvd.bytes += n;
+
+		if (M->tcp.apos < aend)
+			continue;
+
+		if (M->tcp.alen == 0) {
+			M->tcp.alen = ((0xff & M->tcp.abuf[0]) << 8)
+			            | ((0xff & M->tcp.abuf[1]) << 0);
+
+			if (M->tcp.alen == 0)
+				M->tcp.apos = 0;
+		} else {
+			M->so.stat.tcp.rcvd.count++;
+
+			error = dns_mux_accept(M, &M->tcp.abuf[2], M->tcp.alen, DNS_MUX_TCP_RECV);
+			M->tcp.alen = M->tcp.apos = 0;
+
+			if (error)
+				return error;
+		}
+	}
+
+	return 0;
+} /* dns_mux_tcp_recv() */
+
+
+static int dns_mux_tcp_send(struct dns_mux *M) {
+	long n;
+
+	if (M->tcp.olen == 0)
+		return 0;
+
+	while (M->tcp.opos < M->tcp.olen) {
+		if (0 > (n = dns_send(M->so.tcp, (void *)&M->tcp.obuf[M->tcp.opos], M->tcp.olen - M->tcp.opos, 0)))
+			return dns_soerr();
+
+		M->tcp.opos += n;
+		M->so.stat.tcp.sent.bytes += n;
+	}
+
+	M->so.stat.tcp.sent.count++;
+	M->tcp.olen = M->tcp.opos = 0;
+
+	return 0;
+} /* dns_mux_tcp_send() */
+
+
+static int dns_mux_tcp(struct dns_mux *M) {
+	int error;
+
+	if (!M->count[DNS_MUX_TCP_RECV])
+		return 0;
+
+	if (M->so.tcp == -1) {
+		if (-1 == (M->so.tcp = dns_socket((struct sockaddr *)&M->so.local, SOCK_STREAM, &error)))
+			return error;
+	}
+
+	if (!M->tcp.connected) {
+		if (0 != connect(M->so.tcp, (struct sockaddr *)&M->so.remote, dns_sa_len(&M->so.remote))) {
+			if ((error = dns_soerr()) != DNS_EISCONN)
+				return error;
+		}
+
+		M->tcp.connected = 1;
+	}
+
+	if ((error = dns_mux_tcp_send(M)))
+		return error;
+
+	return dns_mux_tcp_recv(M);
+} /* dns_mux_tcp() */
+
+
+/* retransmit or time out unanswered queries */
+static void dns_mux_expire(struct dns_mux *M) {
+	time_t now = dns_elapsed(&M->elapsed);
+	struct dns_mux_query *q;
+	unsigned i;
+
+	for (i = 0; i < DNS_MUX_NBUCKET; i++) {
+		for (q = M->bucket[i]; q; q = q->next) {
+			if (q->state == DNS_MUX_UDP_RECV && now - q->sent >= M->timeout) {
+				if (q->tries.udp < M->attempts)
+					dns_mux_setstate(M, q, DNS_MUX_UDP_SEND);
+				else
+					dns_mux_finish(M, q, NULL, DNS_ETIMEDOUT);
+			} else if (q->state == DNS_MUX_TCP_RECV && now - q->sent >= M->timeout) {
+				dns_mux_finish(M, q, NULL, DNS_ETIMEDOUT);
+			}
+		}
+	}
+} /* dns_mux_expire() */
+
+
+static _Bool dns_mux_again(int error) {
+	switch (error) {
+	case DNS_EINTR:
+	case DNS_EINPROGRESS:
+	case DNS_EALREADY:
+#if DNS_EWOULDBLOCK != DNS_EAGAIN
+	case DNS_EWOULDBLOCK:
+#endif
+	case DNS_EAGAIN:
+		return 1;
+	default:
+		return 0;
+	}
+} /* dns_mux_again() */
+
+
+int dns_mux_check(struct dns_mux *M) {
+	int error;
+
+	dns_so_clear(&M->so);
+
+	dns_mux_expire(M);
+
+	if ((error = dns_mux_udp_send(M)) && !dns_mux_again(error))
+		dns_mux_fail(M, DNS_MUX_UDP_SEND, error);
+
+	if ((error = dns_mux_udp_recv(M)) && !dns_mux_again(error))
+		dns_mux_fail(M, DNS_MUX_UDP_RECV, error);
+
+	if ((error = dns_mux_tcp(M)) && !dns_mux_again(error)) {
+		if ((error = dns_mux_tcp_reset(M, error)))
+			return error;
+	}
+
+	return 0;
+} /* dns_mux_check() */
+
+
+struct dns_packet *dns_mux_fetch(struct dns_mux *M, unsigned id, int *error) {
+	struct dns_mux_query **qp = dns_mux_find(M, id), *q = *qp;
+	struct dns_packet *answer;
+
+	if (!q)
+		return *error = DNS_ENOQUERY, (void *)0;
+
+	if (q->state != DNS_MUX_DONE)
+		return *error = DNS_EAGAIN, (void *)0;
+
+	if (!(answer = q->answer))
+		*error = q->error;
+
+	q->answer = NULL;
+	dns_mux_free(M, qp);
+
+	return answer;
+} /* dns_mux_fetch() */
+
+
+void dns_mux_cancel(struct dns_mux *M, unsigned id) {
+	struct dns_mux_query **qp = dns_mux_find(M, id);
+
+	if (*qp)
+		dns_mux_free(M, qp);
+} /* dns_mux_cancel() */
+
+
+int dns_mux_pollfd(struct dns_mux *M, int type) {
+	return (type == SOCK_STREAM)? M->so.tcp : M->so.udp;
+} /* dns_mux_pollfd() */
+
+
+int dns_mux_events(struct dns_mux *M, int type) {
+	int events = 0;
+
+	if (type == SOCK_STREAM) {
+		if (M->so.tcp != -1) {
+			if (!M->tcp.connected || M->tcp.opos < M->tcp.olen)
+				events |= DNS_POLLOUT;
+			if (M->count[DNS_MUX_TCP_RECV])
+				events |= DNS_POLLIN;
+		}
+	} else {
+		if (M->count[DNS_MUX_UDP_SEND])
+			events |= DNS_POLLOUT;
+		if (M->count[DNS_MUX_UDP_RECV])
+			events |= DNS_POLLIN;
+	}
+
+	return (M->so.opts.events == DNS_LIBEVENT)? DNS_POLL2EV(events) : events;
+} /* dns_mux_events() */
+
+
+/* seconds until the next retransmission or timeout, or -1 if idle */
+time_t dns_mux_timeout(struct dns_mux *M) {
+	time_t now = dns_elapsed(&M->elapsed), timeout = -1;
+	struct dns_mux_query *q;
+	unsigned i;
+
+	if (M->count[DNS_MUX_UDP_SEND])
+		return 0;
+
+	for (i = 0; i < DNS_MUX_NBUCKET; i++) {
+		for (q = M->bucket[i]; q; q = q->next) {
+			if (q->state == DNS_MUX_UDP_RECV || q->state == DNS_MUX_TCP_RECV) {
+				time_t left = DNS_PP_MAX(0, (q->sent + M->timeout) - now);
+
+				timeout = (timeout == -1)? left : DNS_PP_MIN(timeout, left);
+			}
+		}
+	}
+
+	return timeout;
+} /* dns_mux_timeout() */
+
+
+unsigned dns_mux_count(struct dns_mux *M) {
+	return M->count[DNS_MUX_UDP_SEND] + M->count[DNS_MUX_UDP_RECV] + M->count[DNS_MUX_TCP_RECV] + M->count[DNS_MUX_DONE];
+} /* dns_mux_count() */
+
+
+const struct dns_stat *dns_mux_stat(struct dns_mux *M) {
+	return &M->so.stat;
+} /* dns_mux_stat() */
+
+
 /*
  * R E S O L V E R  R O U T I N E S
  *
@@ -7246,6 +7973,28 @@ static int dns_res_nameserv_cmp(struct dns_rr *a, struct dns_rr *b, struct dns_r
 } /* dns_res_nameserv_cmp() */
 
 
+/*
+ * A negative answer (RFC 2308) has an empty ANSWER section and either an
+ * NXDOMAIN rcode or an SOA record in the AUTHORITY section. Unlike a
+ * referral, when returned from the application cache it's final.
+ */
+static _Bool dns_res_isnegative(struct dns_packet *P) {
+	struct dns_rr rr;
+
+	if (dns_p_count(P, DNS_S_AN) > 0)
+		return 0;
+
+	if (dns_p_rcode(P) == DNS_RC_NXDOMAIN)
+		return 1;
+
+	dns_rr_foreach(&rr, P, .section = DNS_S_NS, .type = DNS_T_SOA) {
+		return 1;
+	}
+
+	return 0;
+} /* dns_res_isnegative() */
+
+
 #define dgoto(sp, i)	\
 	do { R->stack[(sp)].state = (i); goto exec; } while (0)
 
@@ -7373,7 +8122,7 @@ exec:
 			goto error;
 
 		if (dns_p_setptr(&F->answer, R->cache->query(F->query, R->cache, &error))) {
-			if (dns_p_count(F->answer, DNS_S_AN) > 0)
+			if (dns_p_count(F->answer, DNS_S_AN) > 0 || dns_res_isnegative(F->answer))
 				dgoto(R->sp, DNS_R_FINISH);
 
 			dns_p_setptr(&F->answer, NULL);
@@ -7397,7 +8146,7 @@ exec:
 		error = 0;
 
 		if (dns_p_setptr(&F->answer, R->cache->fetch(R->cache, &error))) {
-			if (dns_p_count(F->answer, DNS_S_AN) > 0)
+			if (dns_p_count(F->answer, DNS_S_AN) > 0 || dns_res_isnegative(F->answer))
 				dgoto(R->sp, DNS_R_FINISH);
 
 			dns_p_setptr(&F->answer, NULL);
@@ -1130,6 +1130,38 @@ DNS_PUBLIC int dns_so_poll(struct dns_socket *, int);
 DNS_PUBLIC const struct dns_stat *dns_so_stat(struct dns_socket *);
 
 
+/*
+ * M U L T I P L E X E D  S O C K E T  I N T E R F A C E
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct dns_mux;
+
+DNS_PUBLIC struct dns_mux *dns_mux_open(const struct sockaddr *, int, const struct dns_options *, int *);
+
+DNS_PUBLIC void dns_mux_close(struct dns_mux *);
+
+DNS_PUBLIC void dns_mux_setopts(struct dns_mux *, time_t, unsigned);
+
+DNS_PUBLIC int dns_mux_submit(struct dns_mux *, struct dns_packet *, unsigned *);
+
+DNS_PUBLIC int dns_mux_check(struct dns_mux *);
+
+DNS_PUBLIC struct dns_packet *dns_mux_fetch(struct dns_mux *, unsigned, int *);
+
+DNS_PUBLIC void dns_mux_cancel(struct dns_mux *, unsigned);
+
+DNS_PUBLIC int dns_mux_pollfd(struct dns_mux *, int);
+
+DNS_PUBLIC int dns_mux_events(struct dns_mux *, int);
+
+DNS_PUBLIC time_t dns_mux_timeout(struct dns_mux *);
+
+DNS_PUBLIC unsigned dns_mux_count(struct dns_mux *);
+
+DNS_PUBLIC const struct dns_stat *dns_mux_stat(struct dns_mux *);
+
+
 /*
  * R E S O L V E R  I N T E R F A C E
  *
@@ -30,7 +30,7 @@
 #include <stddef.h>	/* size_t */
 #include <stdint.h>	/* SIZE_MAX */
 #include <stdio.h>	/* EOF FILE fputc(3) vsnprintf(3) */
-#include <stdlib.h>	/* realloc(3) free(3) */
+#include <stdlib.h>	/* malloc(3) realloc(3) free(3) */
 
 #include <string.h>	/* memcpy(3) memmove(3) strlen(3) memchr(3) */
 
@@ -42,6 +42,29 @@
 
 #include <sys/uio.h>	/* struct iovec */
 
+#if defined __linux__
+#include <sys/mman.h>	/* MFD_CLOEXEC memfd_create(2) mmap(2) munmap(2) */
+#endif
+
+/*
+ * Dynamic buffers of at least FIFO_MIRRORMIN bytes can be backed by a
+ * memfd mapped twice, back-to-back, so that every read and write window
+ * is contiguous and never needs realigning. This is opt-in per fifo with
+ * fifo_setmirror(), as such buffers are shared, not copied, across
+ * fork(2).
+ */
+#ifndef FIFO_MIRROR
+#if defined MFD_CLOEXEC
+#define FIFO_MIRROR 1
+#else
+#define FIFO_MIRROR 0
+#endif
+#endif
+
+#if FIFO_MIRROR
+#include <unistd.h>	/* close(2) ftruncate(2) getpid(2) sysconf(3) */
+#endif
+
 
 /*
  * V E R S I O N  I N T E R F A C E S
@@ -60,7 +83,7 @@
 #define FIFO_VENDOR "william@25thandClement.com"
 
 #define FIFO_V_REL  0x20140424 /* 0x20130330 */
-#define FIFO_V_ABI  0x20111113 /* 0x20100815 */
+#define FIFO_V_ABI  0x20260601 /* 0x20111113 */
 #define FIFO_V_API  0x20130325 /* 0x20111113 */
 
 static inline const char *fifo_vendor(void) { return FIFO_VENDOR; }
@@ -108,6 +131,11 @@ struct fifo {
 	unsigned char *base;
 	size_t size, head, count;
 
+	/* base is doubly mapped; see FIFO_MIRROR */
+	_Bool mirror;
+	_Bool canmirror; /* see fifo_setmirror() */
+	long mirrorpid; /* process which mapped the mirror */
+
 	/* bit accumulators */
 	struct {
 		unsigned char byte, count;
@@ -138,6 +166,9 @@ static struct fifo *fifo_init(struct fifo *fifo, void *buf, size_t size) {
 	fifo->size  = fifo->sbuf.iov_len;
 	fifo->head  = 0;
 	fifo->count = 0;
+	fifo->mirror = 0;
+	fifo->canmirror = 0;
+	fifo->mirrorpid = 0;
 	fifo->rbits.byte  = 0;
 	fifo->rbits.count = 0;
 	fifo->wbits.byte  = 0;
@@ -171,8 +202,12 @@ static inline struct fifo *fifo_from(struct fifo *fifo, void *src, size_t size)
 #define fifo_into(...)        FIFO_XPASTE(fifo_into, FIFO_NARG(__VA_ARGS__))(__VA_ARGS__)
 
 
+static void fifo_mirror_free(void *, size_t, long); /* forward declaration */
+
 FIFO_NOTUSED static struct fifo *fifo_reset(struct fifo *fifo) {
-	if (fifo->base != fifo->sbuf.iov_base)
+	if (fifo->mirror)
+		fifo_mirror_free(fifo->base, fifo->size, fifo->mirrorpid);
+	else if (fifo->base != fifo->sbuf.iov_base)
 		free(fifo->base);
 
 	return fifo_init(fifo, fifo->sbuf.iov_base, fifo->sbuf.iov_len);
@@ -199,8 +234,201 @@ FIFO_NOTUSED static struct fifo *fifo_purge(struct fifo *fifo) {
 #define FIFO_TMPBUFSIZ 2048
 #endif
 
+#ifndef FIFO_MIRRORMIN
+#define FIFO_MIRRORMIN 65536
+#endif
+
+/* number of released mirrors kept per process for reuse */
+#ifndef FIFO_MIRRORCACHE
+#if __GNUC__
+#define FIFO_MIRRORCACHE 8
+#else
+#define FIFO_MIRRORCACHE 0
+#endif
+#endif
+
+#if FIFO_MIRROR && FIFO_MIRRORCACHE > 0
+/*
+ * The cache is inherited by fork(2) along with the shared mappings, so
+ * entries are tagged with their process. Otherwise parent and child could
+ * each hand the same pages to a different buffer.
+ */
+static struct {
+	void *base;
+	size_t size;
+	long pid;
+} fifo_mirror_cache[FIFO_MIRRORCACHE];
+
+static volatile int fifo_mirror_lock;
+
+#define FIFO_MIRROR_LOCK() do { \
+	while (__sync_lock_test_and_set(&fifo_mirror_lock, 1)) \
+		; \
+} while (0)
+
+#define FIFO_MIRROR_UNLOCK() __sync_lock_release(&fifo_mirror_lock)
+#endif
+
+
+/*
+ * Returns size bytes mapped at both base and base + size, or NULL. size
+ * must be a multiple of the page size. The process is returned in owner.
+ */
+FIFO_NOTUSED static void *fifo_mirror_alloc(size_t size, long *owner) {
+#if FIFO_MIRROR
+	unsigned char *base;
+	int fd, error;
+#if FIFO_MIRRORCACHE > 0
+	long pid = getpid();
+	unsigned i;
+
+	FIFO_MIRROR_LOCK();
+
+	for (i = 0; i < FIFO_MIRRORCACHE; i++) {
+		if (!fifo_mirror_cache[i].base)
+			continue;
+
+		if (fifo_mirror_cache[i].pid != pid) {
+			/* inherited; our copy of the mapping is ours to drop */
+			munmap(fifo_mirror_cache[i].base, 2 * fifo_mirror_cache[i].size);
+			fifo_mirror_cache[i].base = NULL;
+		} else if (fifo_mirror_cache[i].size == size) {
+			base = fifo_mirror_cache[i].base;
+			fifo_mirror_cache[i].base = NULL;
+			FIFO_MIRROR_UNLOCK();
+
+			*owner = pid;
+
+			return base;
+		}
+	}
+
+	FIFO_MIRROR_UNLOCK();
+#endif
+
+	if (size > ((size_t)-1) / 2)
+		return NULL;
+
+	if (-1 == (fd = memfd_create("fifo", MFD_CLOEXEC)))
+		return NULL;
+
+	if (0 != ftruncate(fd, size))
+		goto error;
+
+	if (MAP_FAILED == (base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)))
+		goto error;
+
+	if (MAP_FAILED == mmap(base, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0)
+	||  MAP_FAILED == mmap(base + size, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0)) {
+		error = errno;
+		munmap(base, 2 * size);
+		errno = error;
+
+		goto error;
+	}
+
+	close(fd);
+
+	*owner = getpid();
+
+	return base;
+error:
+	error = errno;
+	close(fd);
+	errno = error;
+
+	return NULL;
+#else
+	(void)size;
+	(void)owner;
+
+	return NULL;
+#endif
+} /* fifo_mirror_alloc() */
+
+
+/*
+ * Release a mirror mapped by process owner. One inherited across fork(2)
+ * is still in use by its owner, so it's never cached.
+ */
+FIFO_NOTUSED static void fifo_mirror_free(void *base, size_t size, long owner) {
+#if FIFO_MIRROR
+#if FIFO_MIRRORCACHE > 0
+	long pid = getpid();
+	unsigned i;
+
+	if (owner == pid) {
+		FIFO_MIRROR_LOCK();
+
+		for (i = 0; i < FIFO_MIRRORCACHE; i++) {
+			if (fifo_mirror_cache[i].base && fifo_mirror_cache[i].pid != pid) {
+				munmap(fifo_mirror_cache[i].base, 2 * fifo_mirror_cache[i].size);
+				fifo_mirror_cache[i].base = NULL;
+			}
+
+			if (!fifo_mirror_cache[i].base) {
+				fifo_mirror_cache[i].base = base;
+				fifo_mirror_cache[i].size = size;
+				fifo_mirror_cache[i].pid = pid;
+				FIFO_MIRROR_UNLOCK();
+
+				return;
+			}
+		}
+
+		FIFO_MIRROR_UNLOCK();
+	}
+#else
+	(void)owner;
+#endif
+
+	munmap(base, 2 * size);
+#else
+	(void)base;
+	(void)size;
+	(void)owner;
+#endif
+} /* fifo_mirror_free() */
+
+
+/*
+ * Allow or forbid a mirror for the buffer. A mirrored buffer is copied
+ * out of its mapping the next time it grows after mirroring was turned
+ * off.
+ */
+static inline void fifo_setmirror(struct fifo *fifo, _Bool enable) {
+	fifo->canmirror = enable;
+} /* fifo_setmirror() */
+
+
+static inline _Bool fifo_canmirror(struct fifo *fifo, size_t size) {
+#if FIFO_MIRROR
+	static size_t pagesize;
+
+	if (!fifo->canmirror)
+		return 0;
+
+	if (!pagesize) {
+		long n = sysconf(_SC_PAGESIZE);
+
+		pagesize = (n > 0)? (size_t)n : 4096;
+	}
+
+	return size >= FIFO_MIRRORMIN && size % pagesize == 0;
+#else
+	(void)fifo;
+	(void)size;
+
+	return 0;
+#endif
+} /* fifo_canmirror() */
+
+
+/* mirrored buffers are always contiguous */
 static void fifo_realign(struct fifo *fifo) {
-	if (fifo->size - fifo->head >= fifo->count) {
+	if (fifo->mirror) {
+		return;
+	} else if (fifo->size - fifo->head >= fifo->count) {
 		memmove(fifo->base, &fifo->base[fifo->head], fifo->count);
 		fifo->head = 0;
 	} else {
@@ -248,16 +476,64 @@ static inline size_t fifo_roundup(size_t i) {
 
 static int fifo_realloc(struct fifo *fifo, size_t size) {
 	void *tmp;
+	long owner;
 
 	if (fifo->size >= size)
 		return 0;
 	if (fifo_type(fifo) == FIFO_STATIC)
 		return ENOMEM;
 
-	fifo_realign(fifo);
-
 	size = fifo_roundup(size);
 
+	/*
+	 * Copy the old contents into the new mirror in at most two pieces,
+	 * rather than realigning them first.
+	 */
+	if (fifo_canmirror(fifo, size) && (tmp = fifo_mirror_alloc(size, &owner))) {
+		size_t n = FIFO_MIN(fifo->size - fifo->head, fifo->count);
+
+		if (fifo->mirror)
+			n = fifo->count;
+
+		if (fifo->count) {
+			memcpy(tmp, &fifo->base[fifo->head], n);
+			memcpy((unsigned char *)tmp + n, fifo->base, fifo->count - n);
+		}
+
+		if (fifo->mirror)
+			fifo_mirror_free(fifo->base, fifo->size, fifo->mirrorpid);
+		else
+			free(fifo->base);
+
+		fifo->base = tmp;
+		fifo->size = size;
+		fifo->head = 0;
+		fifo->mirror = 1;
+		fifo->mirrorpid = owner;
+
+		return 0;
+	} else if (fifo->mirror) {
+		/*
+		 * Mapping can fail where malloc wouldn't, e.g. at a memfd
+		 * limit, so fall back to a plain buffer. The mirrored
+		 * contents are contiguous and copy in one piece.
+		 */
+		if (!(tmp = malloc(size)))
+			return errno;
+
+		memcpy(tmp, &fifo->base[fifo->head], fifo->count);
+		fifo_mirror_free(fifo->base, fifo->size, fifo->mirrorpid);
+
+		fifo->base = tmp;
+		fifo->size = size;
+		fifo->head = 0;
+		fifo->mirror = 0;
+
+		return 0;
+	}
+
+	fifo_realign(fifo);
+
 	if (!(tmp = realloc(fifo->base, size)))
 		return errno;
 
@@ -299,7 +575,7 @@ static size_t fifo_rvec(struct fifo *fifo, struct iovec *iov, _Bool realign) {
 		fifo_realign(fifo);
 
 	iov->iov_base = &fifo->base[fifo->head];
-	iov->iov_len  = FIFO_MIN(fifo->size - fifo->head, fifo->count);
+	iov->iov_len  = (fifo->mirror)? fifo->count : FIFO_MIN(fifo->size - fifo->head, fifo->count);
 
 	return iov->iov_len;
 } /* fifo_rvec() */
@@ -318,7 +594,7 @@ static size_t fifo_wvec(struct fifo *fifo, struct iovec *iov, _Bool realign) {
 	count = fifo_wlen(fifo);
 
 	iov->iov_base	= &fifo->base[tail];
-	iov->iov_len	= FIFO_MIN(fifo->size - tail, count);
+	iov->iov_len	= (fifo->mirror)? count : FIFO_MIN(fifo->size - tail, count);
 
 	return iov->iov_len;
 } /* fifo_wvec() */
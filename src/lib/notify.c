@@ -33,7 +33,7 @@
 #include <strings.h>	/* ffs(3) */
 #include <errno.h>	/* ENAMETOOLONG EINTR EAGAIN EMFILE EISDIR ENOTDIR */
 
-#include <sys/queue.h>	/* LIST_* */
+#include <sys/queue.h>	/* LIST_* TAILQ_* */
 #include <unistd.h>	/* close(2) */
 #include <fcntl.h>	/* O_CLOEXEC O_DIRECTORY ... open(2) openat(2) fcntl(2) */
 #include <dirent.h>	/* DIR fdopendir(3) opendir(3) readdir_r(3) closedir(3) */
@@ -78,6 +78,7 @@
 
 #if ENABLE_INOTIFY
 
+#include <sys/stat.h>
 #include <sys/inotify.h>
 
 #elif ENABLE_FEN
@@ -423,6 +424,8 @@ struct notify {
 
 #if ENABLE_INOTIFY
 	_Bool critical;
+
+	struct tree *tree; /* NULL unless opened with notify_opentree */
 #endif
 
 #if ENABLE_FEN
@@ -438,6 +441,11 @@ struct notify {
 LLRB_GENERATE_STATIC(files, file, rbe, filecmp)
 
 
+#if ENABLE_INOTIFY
+static void tree_close(struct notify *);
+#endif
+
+
 static struct file *lookup(struct notify *nfy, const char *name, size_t namelen) {
 #if ENABLE_FEN
 	struct file key = { .name = (char *)name, .namelen = namelen };
@@ -618,6 +626,10 @@ void notify_close(struct notify *nfy) {
 		discard(nfy, file);
 	}
 
+#if ENABLE_INOTIFY
+	tree_close(nfy);
+#endif
+
 	closefd(&nfy->fd);
 	closefd(&nfy->dirfd);
 
@@ -634,7 +646,16 @@ int notify_pollfd(struct notify *nfy) {
 } /* notify_pollfd() */
 
 
+#if ENABLE_INOTIFY
+static int tree_timeout(struct notify *);
+#endif
+
 int notify_timeout(struct notify *nfy) {
+#if ENABLE_INOTIFY
+	if (nfy->tree)
+		return tree_timeout(nfy);
+#endif
+
 	if (nfy->dirty || !LIST_EMPTY(&nfy->pending) || !LIST_EMPTY(&nfy->changed))
 		return 0;
 	else
@@ -1045,10 +1066,492 @@ static int kq_post(struct notify *nfy) {
 } /* kq_post() */
 #endif
 
+/*
+ * R E C U R S I V E  W A T C H E S
+ *
+ * notify_opentree reports changes to every entry beneath a directory,
+ * named by their path relative to it. Each subdirectory gets its own
+ * inotify watch, added as the directory appears. Changes are coalesced
+ * by path until retrieved, so a file rewritten many times between steps
+ * is reported once with the union of its change flags.
+ *
+ * fanotify could watch a whole filesystem with one mark, but that needs
+ * CAP_SYS_ADMIN and reports events outside of the tree, so it isn't
+ * used.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#if ENABLE_INOTIFY
+
+#define TREE_BUFSIZ 65536 /* read in large gulps to drain bursts quickly */
+#define TREE_MAXREAD 16 /* reads per step, so one busy tree can't starve the loop */
+
+#define TREE_MASK (IN_ATTRIB|IN_CREATE|IN_DELETE|IN_DELETE_SELF|IN_MODIFY|IN_MOVE|IN_MOVE_SELF|IN_ONLYDIR|IN_DONT_FOLLOW)
+
+struct tdir {
+	int wd;
+
+	LLRB_ENTRY(tdir) rbe;
+	LIST_ENTRY(tdir) sle; /* awaiting scan */
+
+	size_t pathlen;
+	char path[]; /* relative to the root, which is "" */
+}; /* struct tdir */
+
+static inline int tdircmp(const struct tdir *a, const struct tdir *b)
+	{ return (a->wd < b->wd)? -1 : (a->wd > b->wd); }
+
+struct tchange {
+	int changes;
+
+	LLRB_ENTRY(tchange) rbe;
+	TAILQ_ENTRY(tchange) tqe;
+
+	char *path;
+}; /* struct tchange */
+
+static inline int tchangecmp(const struct tchange *a, const struct tchange *b)
+	{ return strcmp(a->path, b->path); }
+
+struct tree {
+	LLRB_HEAD(tdirs, tdir) dirs;
+	LIST_HEAD(, tdir) unscanned;
+
+	LLRB_HEAD(tchanges, tchange) changes;
+	TAILQ_HEAD(, tchange) changed;
+
+	struct tchange *last; /* returned by tree_get, freed by the next call */
+
+	char full[PATH_MAX];
+	unsigned char buf[TREE_BUFSIZ];
+}; /* struct tree */
+
+LLRB_GENERATE_STATIC(tdirs, tdir, rbe, tdircmp)
+
+LLRB_GENERATE_STATIC(tchanges, tchange, rbe, tchangecmp)
+
+
+static int tree_record(struct notify *nfy, const char *path, size_t pathlen, int changes) {
+	struct tree *tree = nfy->tree;
+	struct tchange *change;
+
+	if (!(changes &= nfy->flags))
+		return 0;
+
+	if ((change = LLRB_FIND(tchanges, &tree->changes, &(struct tchange){ .path = (char *)path }))) {
+		change->changes |= changes;
+
+		return 0;
+	}
+
+	if (!(change = calloc(1, sizeof *change + pathlen + 1)))
+		return errno;
+
+	change->changes = changes;
+	change->path = (char *)&change[1];
+	memcpy(change->path, path, pathlen);
+
+	LLRB_INSERT(tchanges, &tree->changes, change);
+	TAILQ_INSERT_TAIL(&tree->changed, change, tqe);
+
+	return 0;
+} /* tree_record() */
+
+
+/* path of a root-relative entry, in tree->full */
+static int tree_fullpath(struct notify *nfy, const char *path, size_t pathlen) {
+	struct tree *tree = nfy->tree;
+
+	if (nfy->dirlen + 1 + pathlen >= sizeof tree->full)
+		return ENAMETOOLONG;
+
+	memcpy(tree->full, nfy->dirpath, nfy->dirlen);
+	tree->full[nfy->dirlen] = '/';
+	memcpy(&tree->full[nfy->dirlen + 1], path, pathlen);
+	tree->full[nfy->dirlen + 1 + pathlen] = '\0';
+
+	return 0;
+} /* tree_fullpath() */
+
+
+static void tree_unwatch(struct notify *nfy, struct tdir *dir) {
+	LLRB_REMOVE(tdirs, &nfy->tree->dirs, dir);
+
+	if (dir->sle.le_prev)
+		LIST_REMOVE(dir, sle);
+
+	free(dir);
+} /* tree_unwatch() */
+
+
+static int tree_watch(struct notify *nfy, const char *path, size_t pathlen) {
+	struct tree *tree = nfy->tree;
+	struct tdir *dir;
+	int wd, error;
+
+	if ((error = tree_fullpath(nfy, path, pathlen)))
+		return error;
+
+	if (-1 == (wd = inotify_add_watch(nfy->fd, (pathlen)? tree->full : nfy->dirpath, TREE_MASK))) {
+		switch ((error = errno)) {
+		case ENOENT:
+		case ENOTDIR:
+		case EACCES:
+			/* gone or hidden already; the parent tells us if it returns */
+			return 0;
+		default:
+			return error;
+		}
+	}
+
+	if (!(dir = calloc(1, sizeof *dir + pathlen + 1)))
+		return errno;
+
+	dir->wd = wd;
+	dir->pathlen = pathlen;
+	memcpy(dir->path, path, pathlen);
+
+	/* the same directory reached twice, e.g. through a bind mount */
+	if (LLRB_INSERT(tdirs, &tree->dirs, dir)) {
+		free(dir);
+
+		return 0;
+	}
+
+	LIST_INSERT_HEAD(&tree->unscanned, dir, sle);
+
+	return 0;
+} /* tree_watch() */
+
+
+/*
+ * Walk newly watched directories, watching their subdirectories in turn.
+ * Entries of a directory created after the tree was opened may predate
+ * its watch, so they're reported as created.
+ */
+static int tree_scan(struct notify *nfy, _Bool report) {
+	struct tree *tree = nfy->tree;
+	struct tdir *dir;
+	struct dirent *ent;
+	char path[PATH_MAX];
+	size_t pathlen, namelen;
+	DIR *dp;
+	int error;
+
+	while ((dir = LIST_FIRST(&tree->unscanned))) {
+		LIST_REMOVE(dir, sle);
+		dir->sle.le_prev = NULL;
+
+		if ((error = tree_fullpath(nfy, dir->path, dir->pathlen)))
+			return error;
+
+		if (!(dp = opendir((dir->pathlen)? tree->full : nfy->dirpath)))
+			continue;
+
+		memcpy(path, dir->path, dir->pathlen);
+		pathlen = dir->pathlen;
+
+		if (pathlen)
+			path[pathlen++] = '/';
+
+		while ((ent = readdir(dp))) {
+			_Bool isdir;
+
+			if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+				continue;
+
+			if ((namelen = strlen(ent->d_name)) >= sizeof path - pathlen)
+				continue;
+
+			memcpy(&path[pathlen], ent->d_name, namelen + 1);
+
+#if defined DT_DIR
+			if (ent->d_type != DT_UNKNOWN) {
+				isdir = (ent->d_type == DT_DIR);
+			} else
+#endif
+			{
+				struct stat st;
+
+				if ((error = tree_fullpath(nfy, path, pathlen + namelen)) || 0 != lstat(tree->full, &st))
+					continue;
+
+				isdir = S_ISDIR(st.st_mode);
+			}
+
+			if (report && (error = tree_record(nfy, path, pathlen + namelen, NOTIFY_CREATE)))
+				goto error;
+
+			if (isdir && (error = tree_watch(nfy, path, pathlen + namelen)))
+				goto error;
+		}
+
+		closedir(dp);
+	}
+
+	return 0;
+error:
+	closedir(dp);
+
+	return error;
+} /* tree_scan() */
+
+
+/* forget a moved away directory and everything beneath it */
+static void tree_prune(struct notify *nfy, const char *path, size_t pathlen) {
+	struct tdir *dir, *next;
+
+	for (dir = LLRB_MIN(tdirs, &nfy->tree->dirs); dir; dir = next) {
+		next = LLRB_NEXT(tdirs, &nfy->tree->dirs, dir);
+
+		if (dir->pathlen < pathlen || memcmp(dir->path, path, pathlen))
+			continue;
+
+		if (dir->pathlen > pathlen && dir->path[pathlen] != '/')
+			continue;
+
+		inotify_rm_watch(nfy->fd, dir->wd);
+		tree_unwatch(nfy, dir);
+	}
+} /* tree_prune() */
+
+
+static int tree_event(struct notify *nfy, const struct inotify_event *msg) {
+	struct tree *tree = nfy->tree;
+	struct tdir *dir;
+	char path[PATH_MAX];
+	size_t pathlen, namelen;
+	int error;
+
+	if (msg->mask & IN_Q_OVERFLOW) {
+		/* events were lost; the caller should rescan */
+		return tree_record(nfy, ".", 1, NOTIFY_REVOKE);
+	}
+
+	if (!(dir = LLRB_FIND(tdirs, &tree->dirs, &(struct tdir){ .wd = msg->wd })))
+		return 0;
+
+	namelen = (msg->len)? strlen(msg->name) : 0;
+
+	if (!namelen) {
+		if (msg->mask & IN_IGNORED) {
+			_Bool isroot = !dir->pathlen;
+
+			tree_unwatch(nfy, dir);
+
+			if (isroot) {
+				nfy->critical = 1;
+
+				return tree_record(nfy, ".", 1, NOTIFY_DELETE);
+			}
+
+			return 0;
+		}
+
+		/* a subdirectory's own deletion is reported by its parent */
+		if (dir->pathlen && (msg->mask & (IN_DELETE_SELF|IN_MOVE_SELF)))
+			return 0;
+
+		return (dir->pathlen)? tree_record(nfy, dir->path, dir->pathlen, decode(msg->mask)) : tree_record(nfy, ".", 1, decode(msg->mask));
+	}
+
+	if (dir->pathlen + 1 + namelen >= sizeof path)
+		return 0;
+
+	memcpy(path, dir->path, dir->pathlen);
+	pathlen = dir->pathlen;
+
+	if (pathlen)
+		path[pathlen++] = '/';
+
+	memcpy(&path[pathlen], msg->name, namelen + 1);
+	pathlen += namelen;
+
+	if ((error = tree_record(nfy, path, pathlen, decode(msg->mask))))
+		return error;
+
+	if (msg->mask & IN_ISDIR) {
+		if (msg->mask & IN_MOVED_FROM)
+			tree_prune(nfy, path, pathlen);
+
+		if (msg->mask & (IN_CREATE|IN_MOVED_TO)) {
+			if ((error = tree_watch(nfy, path, pathlen)) || (error = tree_scan(nfy, 1)))
+				return error;
+		}
+	}
+
+	return 0;
+} /* tree_event() */
+
+
+static int tree_step1(struct notify *nfy) {
+	struct inotify_event *msg, *end;
+	ssize_t len;
+	int count = 0, error;
+
+	while (count < TREE_MAXREAD && (len = read(nfy->fd, nfy->tree->buf, sizeof nfy->tree->buf)) > 0) {
+		msg = (struct inotify_event *)nfy->tree->buf;
+
+		for (end = in_msgend(msg, len); msg < end; msg = in_msgnxt(msg)) {
+			if ((error = tree_event(nfy, msg)))
+				return error;
+		}
+
+		++count;
+	}
+
+	if (count > 0)
+		return 0;
+	else if (len == 0)
+		return EPIPE;
+	else
+		return errno;
+} /* tree_step1() */
+
+
+static int tree_step(struct notify *nfy, int timeout) {
+	int error;
+
+	/* with changes waiting, only gather what's already queued */
+	if (!TAILQ_EMPTY(&nfy->tree->changed))
+		timeout = 0;
+
+	if (!(error = tree_step1(nfy)))
+		return 0;
+	else if (error != EAGAIN)
+		goto error;
+	else if (timeout == 0)
+		return 0;
+
+	if (-1 == poll(&(struct pollfd){ nfy->fd, POLLIN, 0 }, 1, timeout))
+		goto syerr;
+
+	if ((error = tree_step1(nfy)))
+		goto error;
+
+	return 0;
+syerr:
+	error = errno;
+error:
+	switch (error) {
+	case EINTR:
+		/* FALL THROUGH */
+	case EAGAIN:
+		return 0;
+	default:
+		return error;
+	}
+} /* tree_step() */
+
+
+static int tree_timeout(struct notify *nfy) {
+	return (TAILQ_EMPTY(&nfy->tree->changed))? -1 : 0;
+} /* tree_timeout() */
+
+
+static int tree_get(struct notify *nfy, const char **name) {
+	struct tree *tree = nfy->tree;
+	struct tchange *change;
+
+	free(tree->last);
+	tree->last = NULL;
+
+	if (!(change = TAILQ_FIRST(&tree->changed)))
+		return 0;
+
+	TAILQ_REMOVE(&tree->changed, change, tqe);
+	LLRB_REMOVE(tchanges, &tree->changes, change);
+	tree->last = change;
+
+	if (name)
+		*name = change->path;
+
+	return change->changes;
+} /* tree_get() */
+
+
+static void tree_close(struct notify *nfy) {
+	struct tree *tree = nfy->tree;
+	struct tdir *dir;
+	struct tchange *change;
+
+	if (!tree)
+		return;
+
+	while ((dir = LLRB_MIN(tdirs, &tree->dirs)))
+		tree_unwatch(nfy, dir);
+
+	while ((change = TAILQ_FIRST(&tree->changed))) {
+		TAILQ_REMOVE(&tree->changed, change, tqe);
+		LLRB_REMOVE(tchanges, &tree->changes, change);
+		free(change);
+	}
+
+	free(tree->last);
+	free(tree);
+
+	nfy->tree = NULL;
+} /* tree_close() */
+
+
+struct notify *notify_opentree(const char *dirpath, int flags, int *_error) {
+	struct notify *nfy;
+	int error;
+
+	if (!(nfy = notify_opendir(dirpath, flags, &error)))
+		goto error;
+
+	/* the tree's own watches replace the directory watch */
+	inotify_rm_watch(nfy->fd, nfy->dirwd);
+	nfy->dirwd = -1;
+
+	if (!(nfy->tree = calloc(1, sizeof *nfy->tree)))
+		goto syerr;
+
+	LLRB_INIT(&nfy->tree->dirs);
+	LIST_INIT(&nfy->tree->unscanned);
+	LLRB_INIT(&nfy->tree->changes);
+	TAILQ_INIT(&nfy->tree->changed);
+
+	if ((error = tree_watch(nfy, "", 0)) || (error = tree_scan(nfy, 0)))
+		goto error;
+
+	if (LLRB_EMPTY(&nfy->tree->dirs)) {
+		error = ENOENT;
+		goto error;
+	}
+
+	return nfy;
+syerr:
+	error = errno;
+error:
+	*_error = error;
+
+	notify_close(nfy);
+
+	return NULL;
+} /* notify_opentree() */
+
+#else
+
+struct notify *notify_opentree(const char *dirpath NOTUSED, int flags NOTUSED, int *_error) {
+	*_error = EOPNOTSUPP;
+
+	return NULL;
+} /* notify_opentree() */
+
+#endif /* ENABLE_INOTIFY */
+
+
 
 int notify_step(struct notify *nfy, int timeout) {
 	int error;
 
+#if ENABLE_INOTIFY
+	if (nfy->tree)
+		return tree_step(nfy, timeout);
+#endif
+
 	if (nfy->dirty || !LIST_EMPTY(&nfy->pending))
 		goto post;
 
@@ -1076,6 +1579,12 @@ int notify_add(struct notify *nfy, const char *name, int flags) {
 	if (memchr(name, '/', namelen))
 		return EISDIR;
 
+#if ENABLE_INOTIFY
+	/* a tree already reports every entry */
+	if (nfy->tree)
+		return EINVAL;
+#endif
+
 	if ((file = lookup(nfy, name, namelen)))
 		return 0;
 
@@ -1147,6 +1656,11 @@ int notify_get(struct notify *nfy, const char **name) {
 	struct file *file;
 	int changes;
 
+#if ENABLE_INOTIFY
+	if (nfy->tree)
+		return tree_get(nfy, name);
+#endif
+
 	if ((file = LIST_FIRST(&nfy->changed))) {
 		NFY_LIST_MOVE(&nfy->dormant, file, le);
 
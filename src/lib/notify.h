@@ -48,6 +48,8 @@
 
 struct notify *notify_opendir(const char *, nfy_flags_t, nfy_error_t *);
 
+struct notify *notify_opentree(const char *, nfy_flags_t, nfy_error_t *);
+
 void notify_close(struct notify *);
 
 int notify_pollfd(struct notify *);
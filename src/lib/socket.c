@@ -31,6 +31,7 @@
 #include <limits.h> /* INT_MAX LONG_MAX */
 #include <stdlib.h> /* malloc(3) free(3) */
 #include <string.h> /* strdup(3) strlen(3) memset(3) strncpy(3) memcpy(3) strerror(3) */
+#include <stdio.h>  /* FILE fopen(3) fgets(3) fclose(3) */
 #include <errno.h>  /* EINVAL EAFNOSUPPORT EAGAIN EWOULDBLOCK EINPROGRESS EALREADY ENAMETOOLONG EOPNOTSUPP ENOTSOCK ENOPROTOOPT */
 #include <signal.h> /* SIGPIPE SIG_BLOCK SIG_SETMASK sigset_t sigprocmask(2) pthread_sigmask(3) sigtimedwait(2) sigpending(2) sigemptyset(3) sigismember(3) sigaddset(3) */
 #include <assert.h> /* assert(3) */
@@ -50,6 +51,14 @@
 #include <unistd.h>      /* _POSIX_REALTIME_SIGNALS _POSIX_THREADS close(2) unlink(2) getpeereid(2) */
 #include <fcntl.h>       /* F_SETFD F_GETFD F_GETFL F_SETFL FD_CLOEXEC O_NONBLOCK O_NOSIGPIPE F_SETNOSIGPIPE F_GETNOSIGPIPE */
 #include <poll.h>        /* POLLIN POLLOUT */
+#include <sys/ioctl.h>   /* FIONWRITE TIOCOUTQ ioctl(2) */
+
+#if __linux__
+#include <sys/sendfile.h> /* sendfile(2) */
+#include <linux/sockios.h> /* SIOCOUTQNSD */
+#elif __FreeBSD__ || __DragonFly__ || __APPLE__
+#include <sys/uio.h>      /* sendfile(2) */
+#endif
 #if defined __sun
 #include <ucred.h>       /* ucred_t getpeerucred(2) ucred_free(3) */
 #endif
@@ -939,6 +948,23 @@ int so_nopush(int fd, _Bool nopush) {
 } /* so_nopush() */
 
 
+int so_notsentlowat(int fd, size_t lowat) {
+#if defined TCP_NOTSENT_LOWAT
+	int val = (lowat > INT_MAX)? INT_MAX : (int)lowat;
+
+	if (0 != setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &val, sizeof val))
+		return errno;
+
+	return 0;
+#else
+	(void)fd;
+	(void)lowat;
+
+	return EOPNOTSUPP;
+#endif
+} /* so_notsentlowat() */
+
+
 int so_nosigpipe(int fd, _Bool nosigpipe) {
 #if defined O_NOSIGPIPE
 	int flags, mask = (nosigpipe)? ~0 : (~O_NOSIGPIPE);
@@ -1202,11 +1228,30 @@ static int math_addull(unsigned long long *x, unsigned long long a, unsigned lon
 static void st_update(struct st_log *log, size_t len, const struct so_options *opts) {
 	math_addull(&log->count, log->count, len);
 
-	if (opts->st_time)
+	if (opts->st_time) {
 		time(&log->time);
+
+		if (!log->first)
+			log->first = log->time;
+	}
 } /* st_update() */
 
 
+/* count a system call, and whether it would have blocked */
+static void st_syscall(struct st_log *log, _Bool failed) {
+	log->calls++;
+
+	if (failed && (errno == SO_EAGAIN || errno == SO_EWOULDBLOCK))
+		log->again++;
+} /* st_syscall() */
+
+
+/* SSL_write splits its input into records of at most 16KiB */
+static void st_records(struct st_log *log, size_t len) {
+	log->records += (len + SSL3_RT_MAX_PLAIN_LENGTH - 1) / SSL3_RT_MAX_PLAIN_LENGTH;
+} /* st_records() */
+
+
 /*
  * S O C K E T  R O U T I N E S
  *
@@ -1273,6 +1318,9 @@ struct socket {
 		int state;
 		_Bool accept;
 		_Bool vrfd;
+		_Bool ktls; /* requested */
+		int ktlsio; /* SO_KTLS_SEND|SO_KTLS_RECV once engaged */
+		_Bool sesscache; /* client session cache in use */
 	} ssl;
 
 	struct {
@@ -1288,10 +1336,16 @@ struct socket {
 
 	struct {
 		int ncalls;
+		int nomsg;
 		sigset_t pending;
 		sigset_t blocked;
 	} pipeign;
 
+	struct {
+		int fd[2];
+		size_t count;
+	} splice;
+
 	struct {
 		pid_t pid;
 		uid_t uid;
@@ -1308,7 +1362,7 @@ static _Bool so_needign(struct socket *so, _Bool rdonly) {
 	if (rdonly)
 		return 0;
 #if defined MSG_NOSIGNAL
-	if (S_ISSOCK(so->mode))
+	if (S_ISSOCK(so->mode) && !so->pipeign.nomsg)
 		return 0;
 #endif
 	return 1;
@@ -1492,6 +1546,400 @@ error:
 
 static BIO *so_newbio(struct socket *, int *);
 
+/*
+ * Kernel TLS needs OpenSSL's own socket BIO, which it can hand the
+ * session keys. Record crypto then happens in the kernel and plaintext
+ * sendfile(2) works. Pushback data requires our BIO, so kTLS is skipped
+ * in that case.
+ */
+#ifndef SO_HAVE_KTLS
+#if __linux__ && OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined LIBRESSL_VERSION_NUMBER && defined SSL_OP_ENABLE_KTLS && !defined OPENSSL_NO_KTLS
+#define SO_HAVE_KTLS 1
+#else
+#define SO_HAVE_KTLS 0
+#endif
+#endif
+
+#if SO_HAVE_KTLS
+/*
+ * NOTE: Without the tls ULP, OpenSSL 3.0 can stall TLS 1.2 handshakes
+ * with SSL_OP_ENABLE_KTLS set, so only ask for kTLS once the kernel
+ * lists it. A benign race may repeat the check.
+ */
+static _Bool so_ktlsavail(void) {
+	static int avail = -1;
+	char buf[256] = "";
+	FILE *fp;
+
+	if (avail < 0) {
+		if ((fp = fopen("/proc/sys/net/ipv4/tcp_available_ulp", "r"))) {
+			if (!fgets(buf, sizeof buf, fp))
+				*buf = '\0';
+
+			fclose(fp);
+		}
+
+		avail = !!strstr(buf, "tls");
+	}
+
+	return avail;
+} /* so_ktlsavail() */
+#endif
+
+#if SO_HAVE_KTLS
+/* the socket BIO does its own I/O, so count its system calls here */
+static long so_ktlsbio_st(BIO *bio, int oper, const char *argp, size_t len, int argi, long argl, int ret, size_t *processed) {
+	struct socket *so = (struct socket *)BIO_get_callback_arg(bio);
+
+	(void)argp; (void)len; (void)argi; (void)argl; (void)processed;
+
+	if (oper == (BIO_CB_READ|BIO_CB_RETURN))
+		st_syscall(&so->st.rcvd, ret <= 0);
+	else if (oper == (BIO_CB_WRITE|BIO_CB_RETURN))
+		st_syscall(&so->st.sent, ret <= 0);
+
+	return ret;
+} /* so_ktlsbio_st() */
+#endif
+
+static BIO *so_newktlsbio(struct socket *so, int *error) {
+#if SO_HAVE_KTLS
+	BIO *bio;
+
+	if (!so->ssl.ktls || so->bio.ahead.p < so->bio.ahead.pe || !so_ktlsavail())
+		return so_newbio(so, error);
+
+	if (!(bio = BIO_new_socket(so->fd, BIO_NOCLOSE))) {
+		*error = SO_EOPENSSL;
+		return NULL;
+	}
+
+	BIO_set_callback_arg(bio, (char *)so);
+	BIO_set_callback_ex(bio, &so_ktlsbio_st);
+
+	SSL_set_options(so->ssl.ctx, SSL_OP_ENABLE_KTLS);
+
+	return bio;
+#else
+	return so_newbio(so, error);
+#endif
+} /* so_newktlsbio() */
+
+static void so_checkktls(struct socket *so) {
+	so->ssl.ktlsio = 0;
+#if SO_HAVE_KTLS
+	if (BIO_get_ktls_send(SSL_get_wbio(so->ssl.ctx)))
+		so->ssl.ktlsio |= SO_KTLS_SEND;
+
+	if (BIO_get_ktls_recv(SSL_get_rbio(so->ssl.ctx)))
+		so->ssl.ktlsio |= SO_KTLS_RECV;
+#endif
+} /* so_checkktls() */
+
+/*
+ * Client sessions are cached per SSL_CTX, keyed by the SNI host name (or
+ * peer address if none is sent) and port, and resumed automatically. TLS
+ * 1.3 tickets arrive after the handshake, so entries are filled from the
+ * new session callback rather than from SSL_get1_session. Contexts which
+ * already have a new session callback are left alone.
+ */
+#ifndef SO_HAVE_SESSCACHE
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined LIBRESSL_VERSION_NUMBER
+#define SO_HAVE_SESSCACHE 1
+#else
+#define SO_HAVE_SESSCACHE 0
+#endif
+#endif
+
+#if SO_HAVE_SESSCACHE
+
+#define SO_SESS_MAX 64 /* entries per SSL_CTX, most recently used first */
+
+struct so_sesscache {
+	struct {
+		char *key;
+		SSL_SESSION *session;
+	} ent[SO_SESS_MAX];
+	unsigned count;
+
+	unsigned long hits, misses;
+}; /* struct so_sesscache */
+
+static CRYPTO_ONCE so_sess_once = CRYPTO_ONCE_STATIC_INIT;
+static CRYPTO_RWLOCK *so_sess_lock;
+static int so_sess_ctxidx = -1, so_sess_sslidx = -1;
+
+static void so_sesscache_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp) {
+	struct so_sesscache *cache = ptr;
+
+	(void)parent; (void)ad; (void)idx; (void)argl; (void)argp;
+
+	if (!cache)
+		return;
+
+	for (unsigned i = 0; i < cache->count; i++) {
+		free(cache->ent[i].key);
+		SSL_SESSION_free(cache->ent[i].session);
+	}
+
+	free(cache);
+} /* so_sesscache_free() */
+
+static void so_sesskey_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp) {
+	(void)parent; (void)ad; (void)idx; (void)argl; (void)argp;
+
+	free(ptr);
+} /* so_sesskey_free() */
+
+static void so_sess_init(void) {
+	if (!(so_sess_lock = CRYPTO_THREAD_lock_new()))
+		return;
+
+	so_sess_ctxidx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, &so_sesscache_free);
+	so_sess_sslidx = SSL_get_ex_new_index(0, NULL, NULL, NULL, &so_sesskey_free);
+} /* so_sess_init() */
+
+static _Bool so_sess_ready(void) {
+	CRYPTO_THREAD_run_once(&so_sess_once, &so_sess_init);
+
+	return so_sess_lock && so_sess_ctxidx >= 0 && so_sess_sslidx >= 0;
+} /* so_sess_ready() */
+
+/* call with so_sess_lock held */
+static struct so_sesscache *so_sesscache(SSL_CTX *ctx, _Bool create) {
+	struct so_sesscache *cache;
+
+	if (!(cache = SSL_CTX_get_ex_data(ctx, so_sess_ctxidx)) && create) {
+		if (!(cache = calloc(1, sizeof *cache)))
+			return NULL;
+
+		if (!SSL_CTX_set_ex_data(ctx, so_sess_ctxidx, cache)) {
+			free(cache);
+
+			return NULL;
+		}
+	}
+
+	return cache;
+} /* so_sesscache() */
+
+static int so_sesscache_find(struct so_sesscache *cache, const char *key) {
+	for (unsigned i = 0; i < cache->count; i++) {
+		if (!strcmp(cache->ent[i].key, key))
+			return i;
+	}
+
+	return -1;
+} /* so_sesscache_find() */
+
+/* move entry i to the front */
+static void so_sesscache_touch(struct so_sesscache *cache, unsigned i) {
+	__typeof__(cache->ent[0]) ent = cache->ent[i];
+
+	memmove(&cache->ent[1], &cache->ent[0], i * sizeof ent);
+	cache->ent[0] = ent;
+} /* so_sesscache_touch() */
+
+/* remove entry i, returning its session */
+static SSL_SESSION *so_sesscache_take(struct so_sesscache *cache, unsigned i) {
+	SSL_SESSION *session = cache->ent[i].session;
+
+	free(cache->ent[i].key);
+	memmove(&cache->ent[i], &cache->ent[i + 1], (--cache->count - i) * sizeof cache->ent[0]);
+
+	return session;
+} /* so_sesscache_take() */
+
+static int so_sess_new(SSL *ssl, SSL_SESSION *session) {
+	const char *key = SSL_get_ex_data(ssl, so_sess_sslidx);
+	struct so_sesscache *cache;
+	char *dup;
+	int i;
+
+	if (!key || !SSL_SESSION_is_resumable(session))
+		return 0;
+
+	/*
+	 * NOTE: Keep a copy. OpenSSL marks the live session unresumable
+	 * when the connection is freed without a close_notify.
+	 */
+	if (!(dup = strdup(key)))
+		return 0;
+
+	if (!(session = SSL_SESSION_dup(session))) {
+		free(dup);
+
+		return 0;
+	}
+
+	CRYPTO_THREAD_write_lock(so_sess_lock);
+
+	if (!(cache = so_sesscache(SSL_get_SSL_CTX(ssl), 1))) {
+		CRYPTO_THREAD_unlock(so_sess_lock);
+		SSL_SESSION_free(session);
+		free(dup);
+
+		return 0;
+	}
+
+	if ((i = so_sesscache_find(cache, key)) >= 0) {
+		SSL_SESSION_free(cache->ent[i].session);
+		cache->ent[i].session = session;
+		free(dup);
+	} else {
+		if (cache->count == SO_SESS_MAX)
+			SSL_SESSION_free(so_sesscache_take(cache, cache->count - 1));
+
+		i = cache->count++;
+		cache->ent[i].key = dup;
+		cache->ent[i].session = session;
+	}
+
+	so_sesscache_touch(cache, i);
+
+	CRYPTO_THREAD_unlock(so_sess_lock);
+
+	return 0;
+} /* so_sess_new() */
+
+static _Bool so_sesskey(struct socket *so, char *dst, size_t lim) {
+	struct sockaddr_storage ss;
+	char addr[SA_ADDRSTRLEN];
+	const char *name;
+	int n, error;
+
+	memset(&ss, 0, sizeof ss);
+
+	if (0 != getpeername(so->fd, (struct sockaddr *)&ss, &(socklen_t){ sizeof ss }))
+		return 0;
+
+	/* whatever SNI is sent, so virtual hosts on one address stay apart */
+	if ((name = SSL_get_servername(so->ssl.ctx, TLSEXT_NAMETYPE_host_name)))
+		;
+	else if (so->opts.tls_sendname && so->opts.tls_sendname != SO_OPTS_TLS_HOSTNAME)
+		name = so->opts.tls_sendname;
+	else if (ss.ss_family == AF_INET || ss.ss_family == AF_INET6)
+		name = sa_ntop(addr, sizeof addr, &ss, NULL, &error);
+	else
+		return 0;
+
+	n = snprintf(dst, lim, "%s %hu", name, ntohs(*sa_port(&ss, SA_PORT_NONE, NULL)));
+
+	return n > 0 && (size_t)n < lim;
+} /* so_sesskey() */
+
+/* look up and apply a cached session before the client handshake */
+static void so_sessresume(struct socket *so) {
+	SSL_CTX *ctx = SSL_get_SSL_CTX(so->ssl.ctx);
+	struct so_sesscache *cache;
+	SSL_SESSION *session = NULL;
+	char key[SO_MAX(SA_ADDRSTRLEN, 256) + 8], *dup;
+	int i;
+
+	if (so->ssl.accept || !so_sess_ready() || !so_sesskey(so, key, sizeof key))
+		return;
+
+	CRYPTO_THREAD_write_lock(so_sess_lock);
+
+	/*
+	 * NOTE: Our list is the only store. Without NO_INTERNAL_STORE
+	 * OpenSSL would also keep every client session in the context's own
+	 * cache (20480 by default), which clients never look up.
+	 */
+	if (!SSL_CTX_sess_get_new_cb(ctx)) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_CTX_get_session_cache_mode(ctx) | SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, &so_sess_new);
+	} else if (SSL_CTX_sess_get_new_cb(ctx) != &so_sess_new) {
+		CRYPTO_THREAD_unlock(so_sess_lock);
+
+		return;
+	}
+
+	if ((cache = so_sesscache(ctx, 0)) && (i = so_sesscache_find(cache, key)) >= 0) {
+		/* RFC 8446 tickets are single-use; the server will send more */
+		if (SSL_SESSION_get_protocol_version(cache->ent[i].session) >= TLS1_3_VERSION) {
+			session = so_sesscache_take(cache, i);
+		} else {
+			/* a copy, for the same reason as in so_sess_new() */
+			session = SSL_SESSION_dup(cache->ent[i].session);
+			so_sesscache_touch(cache, i);
+		}
+	}
+
+	CRYPTO_THREAD_unlock(so_sess_lock);
+
+	if ((dup = strdup(key)) && !SSL_set_ex_data(so->ssl.ctx, so_sess_sslidx, dup))
+		free(dup);
+
+	if (session) {
+		SSL_set_session(so->ssl.ctx, session);
+		SSL_SESSION_free(session);
+	}
+
+	so->ssl.sesscache = 1;
+} /* so_sessresume() */
+
+/* count the handshake as a hit or miss */
+static void so_sessdone(struct socket *so) {
+	struct so_sesscache *cache;
+
+	if (!so->ssl.sesscache)
+		return;
+
+	CRYPTO_THREAD_write_lock(so_sess_lock);
+
+	if ((cache = so_sesscache(SSL_get_SSL_CTX(so->ssl.ctx), 1))) {
+		if (SSL_session_reused(so->ssl.ctx))
+			cache->hits++;
+		else
+			cache->misses++;
+	}
+
+	CRYPTO_THREAD_unlock(so_sess_lock);
+} /* so_sessdone() */
+
+#else
+
+static void so_sessresume(struct socket *so) {
+	(void)so;
+} /* so_sessresume() */
+
+static void so_sessdone(struct socket *so) {
+	(void)so;
+} /* so_sessdone() */
+
+#endif /* SO_HAVE_SESSCACHE */
+
+
+int so_sessstat(SSL_CTX *ctx, unsigned long *hits, unsigned long *misses, unsigned *count) {
+	*hits = 0;
+	*misses = 0;
+	*count = 0;
+#if SO_HAVE_SESSCACHE
+	struct so_sesscache *cache;
+
+	if (!so_sess_ready())
+		return ENOTSUP;
+
+	CRYPTO_THREAD_read_lock(so_sess_lock);
+
+	if ((cache = so_sesscache(ctx, 0))) {
+		*hits = cache->hits;
+		*misses = cache->misses;
+		*count = cache->count;
+	}
+
+	CRYPTO_THREAD_unlock(so_sess_lock);
+
+	return 0;
+#else
+	(void)ctx;
+
+	return ENOTSUP;
+#endif
+} /* so_sessstat() */
+
+
 static int so_starttls_(struct socket *so) {
 	X509 *peer;
 	int rval, error;
@@ -1533,10 +1981,12 @@ static int so_starttls_(struct socket *so) {
 		} else {
 			BIO *bio;
 
-			if (!(bio = so_newbio(so, &error)))
+			if (!(bio = so_newktlsbio(so, &error)))
 				goto error;
 
 			SSL_set_bio(so->ssl.ctx, bio, bio);
+
+			so_sessresume(so);
 		}
 
 		if (so->ssl.accept) {
@@ -1573,6 +2023,9 @@ static int so_starttls_(struct socket *so) {
 		so->ssl.vrfd = (peer && SSL_get_verify_result(so->ssl.ctx) == X509_V_OK);
 		x509_discard(&peer);
 
+		so_checkktls(so);
+		so_sessdone(so);
+
 		so->ssl.state++;
 	case 3:
 		if (so->opts.tls_verify && !so->ssl.vrfd) {
@@ -1617,6 +2070,20 @@ static int so_rstlowat_(struct socket *so) {
 
 
 static int so_shutwr_(struct socket *so) {
+	/*
+	 * Send close_notify first so the peer sees a clean TLS closure. If
+	 * the alert can't be sent for any reason other than a full buffer
+	 * the peer is likely gone, so fall through to shutdown(2) anyway.
+	 */
+	if (so->ssl.ctx && SSL_is_init_finished(so->ssl.ctx)) {
+		int n, error;
+
+		ERR_clear_error();
+
+		if ((n = SSL_shutdown(so->ssl.ctx)) < 0 && SO_EAGAIN == (error = ssl_error(so->ssl.ctx, n, &so->events)))
+			return error;
+	}
+
 	if (so->fd != -1 && 0 != shutdown(so->fd, SHUT_WR))
 		return so_soerr();
 
@@ -1793,7 +2260,8 @@ static struct socket *so_make(const struct so_options *opts, int *error) {
 	static const struct socket so_initializer = {
 		.fd = -1,
 		.domain = PF_UNSPEC,
-		.cred = { (pid_t)-1, (uid_t)-1, (gid_t)-1, }
+		.cred = { (pid_t)-1, (uid_t)-1, (gid_t)-1, },
+		.splice = { { -1, -1 }, 0 },
 	};
 	struct socket *so;
 	size_t len;
@@ -1852,6 +2320,10 @@ static int so_destroy(struct socket *so) {
 
 	so_closesocket(&so->fd, &so->opts);
 
+	so_closesocket(&so->splice.fd[0], NULL);
+	so_closesocket(&so->splice.fd[1], NULL);
+	so->splice.count = 0;
+
 	so->events = 0;
 
 	if (so->opts.tls_sendname && so->opts.tls_sendname != SO_OPTS_TLS_HOSTNAME) {
@@ -2074,6 +2546,15 @@ int so_listen(struct socket *so) {
 
 
 int so_accept(struct socket *so, struct sockaddr *saddr, socklen_t *slen, int *error_) {
+	return so_accept4(so, saddr, slen, 0, error_);
+} /* so_accept() */
+
+
+/*
+ * Like so_accept, but flags may include SO_F_NONBLOCK so that the new
+ * descriptor is ready for so_fdopen without another fcntl round trip.
+ */
+int so_accept4(struct socket *so, struct sockaddr *saddr, socklen_t *slen, int flags, int *error_) {
 	int fd = -1, error;
 
 	if ((error = so_listen(so)))
@@ -2086,10 +2567,10 @@ int so_accept(struct socket *so, struct sockaddr *saddr, socklen_t *slen, int *e
 
 retry:
 #if HAVE_ACCEPT4 && defined SOCK_CLOEXEC
-	if (-1 == (fd = accept4(so->fd, saddr, slen, SOCK_CLOEXEC)))
+	if (-1 == (fd = accept4(so->fd, saddr, slen, SOCK_CLOEXEC|((flags & SO_F_NONBLOCK)? SOCK_NONBLOCK : 0))))
 		goto soerr;
 #elif HAVE_PACCEPT && defined SOCK_CLOEXEC
-	if (-1 == (fd = paccept(so->fd, saddr, slen, NULL, SOCK_CLOEXEC)))
+	if (-1 == (fd = paccept(so->fd, saddr, slen, NULL, SOCK_CLOEXEC|((flags & SO_F_NONBLOCK)? SOCK_NONBLOCK : 0))))
 		goto soerr;
 #else
 	if (-1 == (fd = accept(so->fd, saddr, slen)))
@@ -2097,6 +2578,9 @@ retry:
 
 	if ((error = so_cloexec(fd, 1)))
 		goto error;
+
+	if ((flags & SO_F_NONBLOCK) && (error = so_nonblock(fd, 1)))
+		goto error;
 #endif
 
 	return fd;
@@ -2121,7 +2605,7 @@ error:
 	so_closesocket(&fd, NULL);
 
 	return -1;
-} /* so_accept() */
+} /* so_accept4() */
 
 
 static void so_resetssl(struct socket *so) {
@@ -2130,6 +2614,9 @@ static void so_resetssl(struct socket *so) {
 	so->ssl.error  = 0;
 	so->ssl.accept = 0;
 	so->ssl.vrfd   = 0;
+	so->ssl.ktls   = 0;
+	so->ssl.ktlsio = 0;
+	so->ssl.sesscache = 0;
 
 	if (so->bio.ctx) {
 		BIO_free(so->bio.ctx);
@@ -2197,6 +2684,8 @@ int so_starttls(struct socket *so, const struct so_starttls *cfg) {
 		so->ssl.accept = SSL_is_server(so->ssl.ctx);
 	}
 
+	so->ssl.ktls = cfg->ktls;
+
 	if (!so->ssl.accept && so->opts.tls_sendname && so->opts.tls_sendname != SO_OPTS_TLS_HOSTNAME) {
 		if (!SSL_set_tlsext_host_name(so->ssl.ctx, so->opts.tls_sendname))
 			goto eossl;
@@ -2229,7 +2718,14 @@ SSL *so_checktls(struct socket *so) {
 } /* so_checktls() */
 
 
+int so_ktls(struct socket *so) {
+	return (so->ssl.ctx)? so->ssl.ktlsio : 0;
+} /* so_ktls() */
+
+
 int so_shutdown(struct socket *so, int how) {
+	int error;
+
 	switch (how) {
 	case SHUT_RD:
 		so->todo |= SO_S_SHUTRD;
@@ -2245,7 +2741,11 @@ int so_shutdown(struct socket *so, int how) {
 		break;
 	} /* switch (how) */
 
-	return so_exec(so);
+	so_pipeign(so, 0);
+	error = so_exec(so);
+	so_pipeok(so, 0);
+
+	return error;
 } /* so_shutdown() */
 
 
@@ -2258,6 +2758,7 @@ retry:
 #else
 	len = read(so->fd, dst, SO_MIN(lim, LONG_MAX));
 #endif
+	st_syscall(&so->st.rcvd, len == -1);
 
 	if (len == -1)
 		goto error;
@@ -2322,6 +2823,8 @@ retry:
 		count = write(so->fd, src, SO_MIN(len, LONG_MAX));
 	}
 
+	st_syscall(&so->st.sent, count == -1);
+
 	if (count == -1)
 		goto error;
 
@@ -2588,6 +3091,10 @@ retry:
 		}
 
 		len = n;
+
+		/* SSL_read returns at most one record, maybe over several calls */
+		if (!SSL_pending(so->ssl.ctx))
+			so->st.rcvd.records++;
 	} else {
 		if (!(len = so_sysread(so, dst, lim, &error)))
 			goto error;
@@ -2611,6 +3118,8 @@ error:
 } /* so_read() */
 
 
+static int so_splicedrain(struct socket *);
+
 size_t so_write(struct socket *so, const void *src, size_t len, int *error_) {
 	size_t count;
 	int error;
@@ -2627,6 +3136,9 @@ size_t so_write(struct socket *so, const void *src, size_t len, int *error_) {
 		goto error;
 	}
 
+	if ((error = so_splicedrain(so)))
+		goto error;
+
 	so->events &= ~POLLOUT;
 retry:
 	if (so->ssl.ctx) {
@@ -2646,6 +3158,7 @@ retry:
 			}
 
 			count = n;
+			st_records(&so->st.sent, count);
 		} else {
 			count = 0;
 		}
@@ -2672,42 +3185,442 @@ error:
 } /* so_write() */
 
 
-size_t so_peek(struct socket *so, void *dst, size_t lim, int flags, int *_error) {
-	int rstlowat = so->todo & SO_S_RSTLOWAT;
-	long count;
-	int lowat, error;
-
-	so->todo &= ~SO_S_RSTLOWAT;
-
-	error = so_exec(so);
+/*
+ * Z E R O - C O P Y  T R A N S F E R S
+ *
+ * sendfile(2) and splice(2) can't be passed MSG_NOSIGNAL, so .nomsg
+ * forces so_pipeign to block SIGPIPE around them. Data spliced from the
+ * source socket waits in a pipe owned by the destination until the
+ * destination is writable, and is flushed before any other output.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-	so->todo |= rstlowat;
+#ifndef SO_HAVE_SENDFILE
+#if __linux__ || __FreeBSD__ || __DragonFly__ || __APPLE__
+#define SO_HAVE_SENDFILE 1
+#else
+#define SO_HAVE_SENDFILE 0
+#endif
+#endif
 
-	if (error)
-		goto error;
+#ifndef SO_HAVE_SPLICE
+#if __linux__ && defined SPLICE_F_NONBLOCK
+#define SO_HAVE_SPLICE 1
+#else
+#define SO_HAVE_SPLICE 0
+#endif
+#endif
 
-	if (flags & SO_F_PEEKALL)
-		so->events &= ~POLLIN;
-retry:
-	count = recv(so->fd, dst, lim, MSG_PEEK);
+#define SO_SPLICE_MAX 65536 /* default pipe capacity on Linux */
 
-	if (count == -1)
-		goto soerr;
+static int so_splicedrain(struct socket *so) {
+#if SO_HAVE_SPLICE
+	ssize_t n;
+	int error = 0;
 
-	if ((size_t)count == lim || !(flags & SO_F_PEEKALL))
-		return count;
-pollin:
-	if (!(so->todo & SO_S_RSTLOWAT)) {
-		if (0 != getsockopt(so->fd, SOL_SOCKET, SO_RCVLOWAT, &so->olowat, &(socklen_t){ sizeof so->olowat }))
-			goto soerr;
+	if (!so->splice.count)
+		return 0;
 
-		if (lim > INT_MAX) {
-			error = EOVERFLOW;
+	so->pipeign.nomsg++;
+	so_pipeign(so, 0);
 
-			goto error;
-		}
+	while (so->splice.count) {
+		n = splice(so->splice.fd[0], NULL, so->fd, NULL, so->splice.count, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		st_syscall(&so->st.sent, n == -1);
 
-		lowat = (int)lim;
+		if (n == -1) {
+			if ((error = so_soerr()) == SO_EINTR)
+				continue;
+
+			switch (error) {
+#if SO_EWOULDBLOCK != SO_EAGAIN
+			case SO_EWOULDBLOCK:
+				error = SO_EAGAIN;
+				/* FALL THROUGH */
+#endif
+			case SO_EAGAIN:
+				so->events |= POLLOUT;
+
+				break;
+			case EPIPE:
+				so->st.sent.eof = 1;
+
+				break;
+			} /* switch() */
+
+			break;
+		}
+
+		so->splice.count -= n;
+		st_update(&so->st.sent, n, &so->opts);
+	}
+
+	so_pipeok(so, 0);
+	so->pipeign.nomsg--;
+
+	return error;
+#else
+	(void)so;
+
+	return 0;
+#endif
+} /* so_splicedrain() */
+
+
+size_t so_splicelen(struct socket *so) {
+	return so->splice.count;
+} /* so_splicelen() */
+
+
+int so_sendfile(struct socket *so, int fd, off_t *offset, size_t len, size_t *count) {
+	int error;
+
+	*count = 0;
+
+	so->pipeign.nomsg++;
+	so_pipeign(so, 0);
+
+	so->todo |= SO_S_SETWRITE;
+
+	if ((error = so_exec(so)))
+		goto error;
+
+	if (so->fd == -1) {
+		error = ENOTCONN;
+		goto error;
+	}
+
+	/* under kTLS the kernel encrypts file pages as they are sent */
+	if ((so->ssl.ctx && !(so->ssl.ktlsio & SO_KTLS_SEND)) || !S_ISSOCK(so->mode) || !SO_HAVE_SENDFILE) {
+		error = ENOTSUP;
+		goto error;
+	}
+
+	if (so->st.sent.eof) {
+		error = EPIPE;
+		goto error;
+	}
+
+	if ((error = so_splicedrain(so)))
+		goto error;
+
+	so->events &= ~POLLOUT;
+
+	if (!len)
+		goto leave;
+retry:
+#if SO_HAVE_KTLS
+	if (so->ssl.ctx) {
+		ossl_ssize_t n;
+
+		ERR_clear_error();
+
+		if (0 > (n = SSL_sendfile(so->ssl.ctx, fd, *offset, SO_MIN(len, SSIZE_MAX), 0))) {
+			if ((error = ssl_error(so->ssl.ctx, (int)n, &so->events)) == SO_EINTR)
+				goto retry;
+
+			goto error;
+		}
+
+		*offset += n;
+		*count = n;
+	} else
+#endif
+#if __linux__
+	{
+		ssize_t n;
+
+		n = sendfile(so->fd, fd, offset, SO_MIN(len, SSIZE_MAX));
+		st_syscall(&so->st.sent, n == -1);
+
+		if (n == -1)
+			goto syerr;
+
+		*count = n;
+	}
+#elif __FreeBSD__ || __DragonFly__
+	{
+		off_t n = 0;
+		int rv = sendfile(fd, so->fd, *offset, len, NULL, &n, 0);
+
+		st_syscall(&so->st.sent, rv == -1);
+		*offset += n;
+		*count = n;
+
+		if (rv == -1 && n == 0)
+			goto syerr;
+	}
+#elif __APPLE__
+	{
+		off_t n = SO_MIN(len, (size_t)INT64_MAX);
+		int rv = sendfile(fd, so->fd, *offset, &n, NULL, 0);
+
+		st_syscall(&so->st.sent, rv == -1);
+		*offset += n;
+		*count = n;
+
+		if (rv == -1 && n == 0)
+			goto syerr;
+	}
+#endif
+
+	so_trace(SO_T_WRITE, so->fd, so->host, (void *)0, (size_t)0, "sent %zu bytes from fd %d", *count, fd);
+	st_update(&so->st.sent, *count, &so->opts);
+leave:
+	so_pipeok(so, 0);
+	so->pipeign.nomsg--;
+
+	return 0;
+syerr:
+	error = so_soerr();
+
+	switch (error) {
+	case SO_EINTR:
+		goto retry;
+#if SO_EWOULDBLOCK != SO_EAGAIN
+	case SO_EWOULDBLOCK:
+		error = SO_EAGAIN;
+		/* FALL THROUGH */
+#endif
+	case SO_EAGAIN:
+		so->events |= POLLOUT;
+
+		break;
+	case EPIPE:
+		so->st.sent.eof = 1;
+
+		break;
+	case EINVAL:
+		/* FALL THROUGH */
+	case ENOSYS:
+		/* input descriptor can't be mapped */
+		error = ENOTSUP;
+
+		break;
+	} /* switch() */
+error:
+	if (error != SO_EAGAIN)
+		so_trace(SO_T_WRITE, so->fd, so->host, (void *)0, (size_t)0, "%s", so_strerror(error));
+
+	so_pipeok(so, 0);
+	so->pipeign.nomsg--;
+
+	return error;
+} /* so_sendfile() */
+
+
+int so_splice(struct socket *dst, struct socket *src, size_t len, size_t *count) {
+	int error;
+
+	*count = 0;
+
+	dst->todo |= SO_S_SETWRITE;
+	src->todo |= SO_S_SETREAD;
+
+	if ((error = so_exec(dst)) || (error = so_exec(src)))
+		return error;
+
+	if (dst->fd == -1 || src->fd == -1)
+		return ENOTCONN;
+
+	if ((error = so_splicedrain(dst)))
+		return error;
+
+	if (!len)
+		return 0;
+
+#if SO_HAVE_SPLICE
+	ssize_t n;
+
+	if (dst->ssl.ctx || src->ssl.ctx || !S_ISSOCK(dst->mode) || !S_ISSOCK(src->mode))
+		return ENOTSUP;
+
+	if (dst->splice.fd[0] == -1 && 0 != pipe2(dst->splice.fd, O_NONBLOCK|O_CLOEXEC))
+		return so_syerr();
+
+	dst->events &= ~POLLOUT;
+	src->events &= ~POLLIN;
+retry:
+	n = splice(src->fd, NULL, dst->splice.fd[1], NULL, SO_MIN(len, SO_SPLICE_MAX), SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	st_syscall(&src->st.rcvd, n == -1);
+
+	if (n == -1) {
+		switch ((error = so_soerr())) {
+		case SO_EINTR:
+			goto retry;
+#if SO_EWOULDBLOCK != SO_EAGAIN
+		case SO_EWOULDBLOCK:
+			error = SO_EAGAIN;
+			/* FALL THROUGH */
+#endif
+		case SO_EAGAIN:
+			src->events |= POLLIN;
+
+			break;
+		case EINVAL:
+			/* source can't be spliced */
+			error = ENOTSUP;
+
+			break;
+		} /* switch() */
+
+		return error;
+	} else if (n == 0) {
+		src->st.rcvd.eof = 1;
+
+		return 0; /* EOF */
+	}
+
+	st_update(&src->st.rcvd, n, &src->opts);
+
+	dst->splice.count += n;
+	*count = n;
+
+	/* an EAGAIN here is picked up from so_splicelen by the caller */
+	if ((error = so_splicedrain(dst)) && error != SO_EAGAIN)
+		return error;
+
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+} /* so_splice() */
+
+
+/*
+ * Gathered write. TLS can't write vectors, so only the first non-empty
+ * segment is sent over TLS.
+ */
+size_t so_writev(struct socket *so, const struct iovec *iov, int iovcnt, int *error_) {
+	struct msghdr msg = { 0 };
+	ssize_t count;
+	int flags = 0, error;
+
+	if (so->ssl.ctx) {
+		while (iovcnt > 0 && iov->iov_len == 0) {
+			iov++;
+			iovcnt--;
+		}
+
+		return so_write(so, (iovcnt > 0)? iov->iov_base : "", (iovcnt > 0)? iov->iov_len : 0, error_);
+	}
+
+	so_pipeign(so, 0);
+
+	so->todo |= SO_S_SETWRITE;
+
+	if ((error = so_exec(so)))
+		goto error;
+
+	if (so->fd == -1) {
+		error = ENOTCONN;
+		goto error;
+	}
+
+	if ((error = so_splicedrain(so)))
+		goto error;
+
+	if (so->st.sent.eof) {
+		error = EPIPE;
+		goto error;
+	}
+
+	so->events &= ~POLLOUT;
+
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = iovcnt;
+
+#if defined MSG_NOSIGNAL
+	if (so->opts.fd_nosigpipe)
+		flags |= MSG_NOSIGNAL;
+#endif
+	if (so->type == SOCK_SEQPACKET)
+		flags |= MSG_EOR;
+retry:
+	if (S_ISSOCK(so->mode))
+		count = sendmsg(so->fd, &msg, flags);
+	else
+		count = writev(so->fd, iov, iovcnt);
+
+	st_syscall(&so->st.sent, count == -1);
+
+	if (count == -1)
+		goto syerr;
+
+	so_trace(SO_T_WRITE, so->fd, so->host, (void *)0, (size_t)0, "sent %zu bytes from %d segments", (size_t)count, iovcnt);
+	st_update(&so->st.sent, count, &so->opts);
+
+	so_pipeok(so, 0);
+
+	return count;
+syerr:
+	error = so_soerr();
+
+	switch (error) {
+	case SO_EINTR:
+		goto retry;
+#if SO_EWOULDBLOCK != SO_EAGAIN
+	case SO_EWOULDBLOCK:
+		error = SO_EAGAIN;
+		/* FALL THROUGH */
+#endif
+	case SO_EAGAIN:
+		so->events |= POLLOUT;
+
+		break;
+	case EPIPE:
+		so->st.sent.eof = 1;
+
+		break;
+	} /* switch() */
+error:
+	*error_ = error;
+
+	if (error != SO_EAGAIN)
+		so_trace(SO_T_WRITE, so->fd, so->host, (void *)0, (size_t)0, "%s", so_strerror(error));
+
+	so_pipeok(so, 0);
+
+	return 0;
+} /* so_writev() */
+
+
+size_t so_peek(struct socket *so, void *dst, size_t lim, int flags, int *_error) {
+	int rstlowat = so->todo & SO_S_RSTLOWAT;
+	long count;
+	int lowat, error;
+
+	so->todo &= ~SO_S_RSTLOWAT;
+
+	error = so_exec(so);
+
+	so->todo |= rstlowat;
+
+	if (error)
+		goto error;
+
+	if (flags & SO_F_PEEKALL)
+		so->events &= ~POLLIN;
+retry:
+	count = recv(so->fd, dst, lim, MSG_PEEK);
+
+	if (count == -1)
+		goto soerr;
+
+	if ((size_t)count == lim || !(flags & SO_F_PEEKALL))
+		return count;
+pollin:
+	if (!(so->todo & SO_S_RSTLOWAT)) {
+		if (0 != getsockopt(so->fd, SOL_SOCKET, SO_RCVLOWAT, &so->olowat, &(socklen_t){ sizeof so->olowat }))
+			goto soerr;
+
+		if (lim > INT_MAX) {
+			error = EOVERFLOW;
+
+			goto error;
+		}
+
+		lowat = (int)lim;
 
 		if (0 != setsockopt(so->fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof lowat))
 			goto soerr;
@@ -2743,6 +3656,61 @@ error:
 } /* so_peek() */
 
 
+/*
+ * Check that an idle connection is still open without consuming anything.
+ * Under TLS this goes through SSL_peek so that post-handshake records are
+ * processed and a close_notify alert counts as closure rather than as
+ * pending data. Returns 0 if open, EPIPE or ECONNRESET if the peer went
+ * away, or EPROTO if data arrived while idle.
+ */
+int so_alive(struct socket *so) {
+	unsigned char byte;
+	long count;
+	int error;
+
+	if ((error = so_exec(so)))
+		return (error == SO_EAGAIN)? 0 : error;
+retry:
+	if (so->ssl.ctx) {
+		int n;
+
+		ERR_clear_error();
+
+		if ((n = SSL_peek(so->ssl.ctx, &byte, 1)) > 0)
+			return EPROTO;
+
+		switch ((error = ssl_error(so->ssl.ctx, n, &so->events))) {
+		case SO_EINTR:
+			goto retry;
+		case SO_EAGAIN:
+			return 0;
+		case SO_ECLOSURE:
+			return EPIPE;
+		default:
+			return error;
+		}
+	}
+
+	if ((count = recv(so->fd, (void *)&byte, 1, MSG_PEEK)) > 0)
+		return EPROTO;
+	else if (count == 0)
+		return EPIPE;
+
+	switch ((error = so_soerr())) {
+	case SO_EINTR:
+		goto retry;
+#if SO_EWOULDBLOCK != SO_EAGAIN
+	case SO_EWOULDBLOCK:
+		/* FALL THROUGH */
+#endif
+	case SO_EAGAIN:
+		return 0;
+	default:
+		return error;
+	}
+} /* so_alive() */
+
+
 int so_sendmsg(struct socket *so, const struct msghdr *msg, int flags) {
 	ssize_t count;
 	int error;
@@ -2754,6 +3722,9 @@ int so_sendmsg(struct socket *so, const struct msghdr *msg, int flags) {
 	if ((error = so_exec(so)))
 		goto error;
 
+	if ((error = so_splicedrain(so)))
+		goto error;
+
 	so->events &= ~POLLOUT;
 
 #if defined MSG_NOSIGNAL
@@ -2762,7 +3733,10 @@ int so_sendmsg(struct socket *so, const struct msghdr *msg, int flags) {
 #endif
 
 retry:
-	if (-1 == (count = sendmsg(so->fd, msg, flags)))
+	count = sendmsg(so->fd, msg, flags);
+	st_syscall(&so->st.sent, count == -1);
+
+	if (count == -1)
 		goto syerr;
 
 	st_update(&so->st.sent, count, &so->opts);
@@ -2805,7 +3779,10 @@ int so_recvmsg(struct socket *so, struct msghdr *msg, int flags) {
 
 	so->events &= ~POLLIN;
 retry:
-	if (-1 == (count = recvmsg(so->fd, msg, flags))) {
+	count = recvmsg(so->fd, msg, flags);
+	st_syscall(&so->st.rcvd, count == -1);
+
+	if (count == -1) {
 		goto syerr;
 	} else if (!count) {
 		so->st.rcvd.eof = 1;
@@ -2860,6 +3837,166 @@ error:
 } /* so_recvmsg() */
 
 
+/*
+ * NOTE: recvmmsg(2) and sendmmsg(2) take struct mmsghdr, which isn't
+ * portable, so callers pass struct so_mmsg and we copy in batches of
+ * SO_MMSG_MAX. Where the calls don't exist we loop over recvmsg(2) and
+ * sendmsg(2), which costs a syscall per datagram but is otherwise
+ * equivalent.
+ */
+#ifndef SO_HAVE_MMSG
+#if defined MSG_WAITFORONE
+#define SO_HAVE_MMSG 1
+#else
+#define SO_HAVE_MMSG 0
+#endif
+#endif
+
+#define SO_MMSG_MAX 64
+
+static void so_mmsgtrim(struct msghdr *msg, size_t count) {
+	for (size_t i = 0; i < (size_t)msg->msg_iovlen; i++) {
+		if (count < msg->msg_iov[i].iov_len) {
+			msg->msg_iov[i].iov_len = count;
+
+			count = 0;
+		} else {
+			count -= msg->msg_iov[i].iov_len;
+		}
+	}
+} /* so_mmsgtrim() */
+
+
+static ssize_t so_mmsgio(struct socket *so, struct so_mmsg *msgs, unsigned n, int flags, _Bool send) {
+#if SO_HAVE_MMSG
+	struct mmsghdr mv[SO_MMSG_MAX];
+	unsigned i;
+	int count;
+
+	n = SO_MIN(n, SO_MMSG_MAX);
+
+	for (i = 0; i < n; i++) {
+		mv[i].msg_hdr = msgs[i].msg_hdr;
+		mv[i].msg_len = 0;
+	}
+
+	if (send)
+		count = sendmmsg(so->fd, mv, n, flags);
+	else
+		count = recvmmsg(so->fd, mv, n, flags, NULL);
+
+	for (i = 0; count > 0 && i < (unsigned)count; i++) {
+		msgs[i].msg_hdr.msg_namelen = mv[i].msg_hdr.msg_namelen;
+		msgs[i].msg_hdr.msg_controllen = mv[i].msg_hdr.msg_controllen;
+		msgs[i].msg_hdr.msg_flags = mv[i].msg_hdr.msg_flags;
+		msgs[i].msg_len = mv[i].msg_len;
+	}
+
+	return count;
+#else
+	ssize_t len;
+
+	if (send)
+		len = sendmsg(so->fd, &msgs->msg_hdr, flags);
+	else
+		len = recvmsg(so->fd, &msgs->msg_hdr, flags);
+
+	if (len == -1)
+		return -1;
+
+	msgs->msg_len = len;
+
+	return 1;
+#endif
+} /* so_mmsgio() */
+
+
+static int so_mmsg(struct socket *so, struct so_mmsg *msgs, unsigned n, int flags, unsigned *_count, _Bool send) {
+	short event = (send)? POLLOUT : POLLIN;
+	unsigned count = 0;
+	ssize_t m;
+	int error;
+
+	*_count = 0;
+
+	so_pipeign(so, !send);
+
+	so->todo |= (send)? SO_S_SETWRITE : SO_S_SETREAD;
+
+	if ((error = so_exec(so)))
+		goto error;
+
+	if (send && (error = so_splicedrain(so)))
+		goto error;
+
+	so->events &= ~event;
+
+#if defined MSG_NOSIGNAL
+	if (send && so->opts.fd_nosigpipe)
+		flags |= MSG_NOSIGNAL;
+#endif
+
+	while (count < n) {
+		m = so_mmsgio(so, &msgs[count], n - count, flags, send);
+		st_syscall((send)? &so->st.sent : &so->st.rcvd, m == -1);
+
+		if (m == -1) {
+			if ((error = errno) == SO_EINTR)
+				continue;
+
+			goto error;
+		}
+
+		for (unsigned i = count; i < count + (unsigned)m; i++) {
+			if (send) {
+				st_update(&so->st.sent, msgs[i].msg_len, &so->opts);
+			} else {
+				st_update(&so->st.rcvd, msgs[i].msg_len, &so->opts);
+				so_mmsgtrim(&msgs[i].msg_hdr, msgs[i].msg_len);
+			}
+		}
+
+		count += m;
+		*_count = count;
+	}
+
+	so_pipeok(so, !send);
+
+	return 0;
+error:
+	switch (error) {
+#if SO_EWOULDBLOCK != SO_EAGAIN
+	case SO_EWOULDBLOCK:
+		error = SO_EAGAIN;
+
+		/* FALL THROUGH */
+#endif
+	case SO_EAGAIN:
+		so->events |= event;
+
+		/* a partial batch is still a success */
+		if (count > 0)
+			error = 0;
+
+		break;
+	} /* switch() */
+
+	so_pipeok(so, !send);
+
+	return error;
+} /* so_mmsg() */
+
+
+int so_sendmmsg(struct socket *so, struct so_mmsg *msgs, unsigned n, int flags, unsigned *count) {
+	return so_mmsg(so, msgs, n, flags, count, 1);
+} /* so_sendmmsg() */
+
+
+int so_recvmmsg(struct socket *so, struct so_mmsg *msgs, unsigned n, int flags, unsigned *count) {
+	return so_mmsg(so, msgs, n, flags, count, 0);
+} /* so_recvmmsg() */
+
+
 const struct so_stat *so_stat(struct socket *so) {
 	return &so->st;
 } /* so_stat() */
@@ -2956,6 +4093,43 @@ int so_uncork(struct socket *so) {
 } /* so_uncork() */
 
 
+/*
+ * Count of bytes written to the kernel but not yet sent. Where only the
+ * whole send queue can be queried, unacknowledged bytes are included.
+ */
+int so_unsent(struct socket *so, size_t *count) {
+	int n = 0;
+
+	if (so->fd == -1)
+		return ENOTCONN;
+
+#if defined SIOCOUTQNSD
+	/* TCP only; other sockets fall through to the whole queue */
+	if (0 == ioctl(so->fd, SIOCOUTQNSD, &n)) {
+		*count = (n > 0)? (size_t)n : 0;
+
+		return 0;
+	}
+#endif
+#if defined FIONWRITE
+	if (0 != ioctl(so->fd, FIONWRITE, &n))
+		return errno;
+#elif defined TIOCOUTQ
+	if (0 != ioctl(so->fd, TIOCOUTQ, &n))
+		return errno;
+#elif defined SO_NWRITE
+	if (0 != getsockopt(so->fd, SOL_SOCKET, SO_NWRITE, &n, &(socklen_t){ sizeof n }))
+		return errno;
+#else
+	return EOPNOTSUPP;
+#endif
+
+	*count = (n > 0)? (size_t)n : 0;
+
+	return 0;
+} /* so_unsent() */
+
+
 static int so_loadcred(struct socket *so) {
 	if (so->cred.uid != (uid_t)-1)
 		return 0;
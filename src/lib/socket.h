@@ -60,7 +60,7 @@
 #define SOCKET_VENDOR "william@25thandClement.com"
 
 #define SOCKET_V_REL  0x20150831
-#define SOCKET_V_ABI  0x20150625
+#define SOCKET_V_ABI  0x20261014
 #define SOCKET_V_API  0x20150625
 
 const char *socket_vendor(void);
@@ -484,6 +484,8 @@ int so_nodelay(int, _Bool);
 
 int so_nopush(int, _Bool);
 
+int so_notsentlowat(int, size_t);
+
 int so_nosigpipe(int, _Bool);
 
 int so_v6only(int, _Bool);
@@ -551,6 +553,8 @@ int so_listen(struct socket *);
 
 int so_accept(struct socket *, struct sockaddr *, socklen_t *, int *);
 
+int so_accept4(struct socket *, struct sockaddr *, socklen_t *, int, int *);
+
 struct so_starttls {
 	SSL_METHOD *method;
 	SSL_CTX *context;
@@ -559,18 +563,35 @@ struct so_starttls {
 	struct iovec pushback;
 
 	so_optional accept;
+
+	_Bool ktls; /* try kernel TLS offload; see so_ktls() */
 }; /* struct so_starttls */
 
 int so_starttls(struct socket *, const struct so_starttls *);
 
 SSL *so_checktls(struct socket *);
 
+#define SO_KTLS_SEND 0x01
+#define SO_KTLS_RECV 0x02
+
+int so_ktls(struct socket *);
+
+int so_sessstat(SSL_CTX *, unsigned long *, unsigned long *, unsigned *);
+
 int so_shutdown(struct socket *, int /* SHUT_RD, SHUT_WR, SHUT_RDWR */);
 
 size_t so_read(struct socket *, void *, size_t, int *);
 
 size_t so_write(struct socket *, const void *, size_t, int *);
 
+size_t so_writev(struct socket *, const struct iovec *, int, int *);
+
+int so_sendfile(struct socket *, int, off_t *, size_t, size_t *);
+
+int so_splice(struct socket *, struct socket *, size_t, size_t *);
+
+size_t so_splicelen(struct socket *);
+
 #define SO_F_PEEKALL 0x01
 
 size_t so_peek(struct socket *, void *, size_t, int, int *);
@@ -578,6 +599,8 @@ size_t so_peek(struct socket *, void *, size_t, int, int *);
 #define so_peekall(so, dst, lim, ep) so_peek((so), (dst), (lim), SO_F_PEEKALL, (ep))
 #define so_peekany(so, dst, lim, ep) so_peek((so), (dst), (lim), 0, (ep))
 
+int so_alive(struct socket *);
+
 
 /*
  * NOTE: CMSG_SPACE does not evaluate to a constant on OS X or NetBSD, so
@@ -611,12 +634,26 @@ int so_sendmsg(struct socket *, const struct msghdr *, int);
 
 int so_recvmsg(struct socket *, struct msghdr *, int);
 
+struct so_mmsg {
+	struct msghdr msg_hdr;
+	size_t msg_len; /* bytes sent or received */
+}; /* struct so_mmsg */
+
+int so_sendmmsg(struct socket *, struct so_mmsg *, unsigned, int, unsigned *);
+
+int so_recvmmsg(struct socket *, struct so_mmsg *, unsigned, int, unsigned *);
+
 
 struct so_stat {
 	struct st_log {
 		unsigned long long count;
 		_Bool eof;
 		time_t time;
+
+		unsigned long long calls; /* system calls */
+		unsigned long long again; /* calls which would have blocked */
+		unsigned long long records; /* TLS records */
+		time_t first; /* first transfer */
 	} sent, rcvd;
 }; /* struct so_stat */
 
@@ -637,6 +674,8 @@ int so_peerfd(struct socket *);
 
 int so_uncork(struct socket *);
 
+int so_unsent(struct socket *, size_t *);
+
 int so_peereid(struct socket *, uid_t *, gid_t *);
 int so_peerpid(struct socket *, pid_t *);
 
@@ -25,6 +25,9 @@
  */
 #include "config.h"
 
+#include <math.h>	/* NAN */
+#include <poll.h>	/* POLLIN */
+
 #include "lib/notify.h"
 #include "cqueues.h"
 
@@ -66,6 +69,29 @@ static int ln_get(lua_State *L) {
 } /* ln_get() */
 
 
+/*
+ * Everything gathered by the last step as one table of name -> changes,
+ * so a burst costs one call rather than one per name.
+ */
+static int ln_batch(lua_State *L) {
+	struct luanotify *N = luaL_checkudata(L, 1, CQS_NOTIFY);
+	const char *name = 0;
+	int changes, count = 0;
+
+	lua_newtable(L);
+
+	while ((changes = notify_get(N->notify, &name))) {
+		lua_pushinteger(L, changes);
+		lua_setfield(L, -2, name);
+		count++;
+	}
+
+	lua_pushinteger(L, count);
+
+	return 2;
+} /* ln_batch() */
+
+
 static int ln_add(lua_State *L) {
 	struct luanotify *N = luaL_checkudata(L, 1, CQS_NOTIFY);
 	const char *name = luaL_checkstring(L, 2);
@@ -85,10 +111,40 @@ static int ln_add(lua_State *L) {
 } /* ln_add() */
 
 
+static int ln_pollfd_(lua_State *L, int index) {
+	struct luanotify *N = lua_touserdata(L, index);
+
+	return notify_pollfd(N->notify);
+} /* ln_pollfd_() */
+
+
+static short ln_events_(lua_State *L NOTUSED, int index NOTUSED) {
+	return POLLIN;
+} /* ln_events_() */
+
+
+static double ln_timeout_(lua_State *L, int index) {
+	struct luanotify *N = lua_touserdata(L, index);
+	int timeout;
+
+	if ((timeout = notify_timeout(N->notify)) >= 0)
+		return (double)timeout / 1000;
+
+	return NAN;
+} /* ln_timeout_() */
+
+
+static const struct cqs_pollable ln_pollable = {
+	.pollfd  = &ln_pollfd_,
+	.events  = &ln_events_,
+	.timeout = &ln_timeout_,
+}; /* ln_pollable */
+
+
 static int ln_pollfd(lua_State *L) {
-	struct luanotify *N = luaL_checkudata(L, 1, CQS_NOTIFY);
+	luaL_checkudata(L, 1, CQS_NOTIFY);
 
-	lua_pushinteger(L, notify_pollfd(N->notify));
+	lua_pushinteger(L, ln_pollfd_(L, 1));
 
 	return 1;
 } /* ln_pollfd() */
@@ -120,6 +176,7 @@ static int ln_timeout(lua_State *L) {
 static const luaL_Reg ln_methods[] = {
 	{ "step",    &ln_step },
 	{ "get",     &ln_get },
+	{ "batch",   &ln_batch },
 	{ "add",     &ln_add },
 	{ "pollfd",  &ln_pollfd },
 	{ "events",  &ln_events },
@@ -165,6 +222,27 @@ error:
 } /* ln_opendir */
 
 
+static int ln_opentree(lua_State *L) {
+	const char *path = luaL_checkstring(L, 1);
+	struct luanotify *N = 0;
+	int error;
+
+	N = lua_newuserdata(L, sizeof *N);
+	N->notify = 0;
+	luaL_setmetatable(L, CQS_NOTIFY);
+
+	if (!(N->notify = notify_opentree(path, NOTIFY_ALL, &error)))
+		goto error;
+
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* ln_opentree */
+
+
 static int ln_type(lua_State *L) {
 	if (luaL_testudata(L, 1, CQS_NOTIFY)) {
 		lua_pushstring(L, "file notifier");
@@ -234,6 +312,7 @@ static int ln_flags(lua_State *L) {
 
 static const luaL_Reg ln_globals[] = {
 	{ "opendir",   &ln_opendir },
+	{ "opentree",  &ln_opentree },
 	{ "type",      &ln_type },
 	{ "interpose", &ln_interpose },
 	{ "strflag",   &ln_strflag },
@@ -270,6 +349,8 @@ int luaopen__cqueues_notify(lua_State *L) {
 
 		luaL_newlib(L, ln_methods);
 		lua_setfield(L, -2, "__index");
+
+		cqs_setpollable(L, -1, &ln_pollable);
 	}
 
 	luaL_newlib(L, ln_globals);
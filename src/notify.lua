@@ -43,6 +43,40 @@ local loader = function(loader, ...)
 		return changes, filename
 	end)
 
+	--
+	-- notify:batch
+	--
+	-- Wait for changes, then return all of them as a table of
+	-- name -> changes, and their count.
+	--
+	local batch; batch = notify.interpose("batch", function(self, timeout)
+		local deadline = timeout and (cqueues.monotime() + timeout)
+
+		while true do
+			local okay, why = self:step()
+
+			if not okay then
+				oops(self, "batch", why)
+			end
+
+			local changes, count = batch(self)
+
+			if count > 0 then
+				return changes, count
+			elseif deadline then
+				local curtime = cqueues.monotime()
+
+				if curtime >= deadline then
+					return changes, 0
+				else
+					cqueues.poll(self, deadline - curtime)
+				end
+			else
+				cqueues.poll(self)
+			end
+		end
+	end)
+
 	--
 	-- notify:changes
 	--
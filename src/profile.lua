@@ -0,0 +1,75 @@
+local loader = function(loader, ...)
+	local auxlib = require"cqueues.auxlib"
+	local assert3 = auxlib.assert3
+	local tostring = auxlib.tostring
+	local ipairs = ipairs
+	local sort = table.sort
+	local format = string.format
+	local concat = table.concat
+
+	local profile = {}
+
+	--
+	-- profile.top
+	--
+	-- Return up to n (default 10) per-coroutine records from
+	-- cqueue:profile(), ordered by key ("cpu", "max" or "resumes")
+	-- descending.
+	--
+	function profile.top(cq, n, key)
+		local list = assert3(cq:profile(), "profiling not enabled; see cqueues.new{ profile = true }")
+		local top = {}
+
+		key = key or "cpu"
+
+		sort(list, function (a, b)
+			return a[key] > b[key]
+		end)
+
+		for i = 1, math.min(n or 10, #list) do
+			top[i] = list[i]
+		end
+
+		return top
+	end -- profile.top
+
+	--
+	-- profile.dump
+	--
+	-- Write a summary of the controller's step profile and its top n
+	-- coroutines to file (default io.stderr).
+	--
+	function profile.dump(cq, n, key, file)
+		local stats = cq:stats()
+		local P = assert3(stats.profile, "profiling not enabled; see cqueues.new{ profile = true }")
+		local out = {}
+
+		file = file or io.stderr
+
+		out[#out + 1] = format("steps %d  events %d  resumes %d  wait %.6fs  run %.6fs",
+			P.steps, P.events, P.resumes, P.wait, P.run)
+
+		for i, count in ipairs(P.latency) do
+			if count > 0 then
+				local lo = (i == 1 and 0) or 2^(i - 2)
+
+				out[#out + 1] = format("  >= %10.0fus  %d", lo, count)
+			end
+		end
+
+		for i, rec in ipairs(profile.top(cq, n, key)) do
+			out[#out + 1] = format("%3d. %-24s resumes %-8d cpu %.6fs  max %.6fs",
+				i, tostring(rec.coroutine), rec.resumes, rec.cpu, rec.max)
+		end
+
+		out[#out + 1] = ""
+
+		file:write(concat(out, "\n"))
+	end -- profile.dump
+
+	profile.loader = loader
+
+	return profile
+end
+
+return loader(loader, ...)
@@ -37,6 +37,7 @@
 #endif
 #include <sys/time.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -353,10 +354,45 @@ static int lsl_wait(lua_State *L) {
 } /* lsl_wait() */
 
 
+static int lsl_pollfd_(lua_State *L, int index) {
+	struct signalfd *S = lua_touserdata(L, index);
+
+	return S->fd;
+} /* lsl_pollfd_() */
+
+
+static short lsl_events_(lua_State *L NOTUSED, int index NOTUSED) {
+	return POLLIN;
+} /* lsl_events_() */
+
+
+static double lsl_timeout_(lua_State *L, int index) {
+	struct signalfd *S = lua_touserdata(L, index);
+	sigset_t none;
+
+	sigemptyset(&none);
+
+	if (sfd_diff(&S->pending, &none)) {
+		return 0.0;
+	} else if (isnormal(S->timeout) && !signbit(S->timeout)) {
+		return S->timeout;
+	} else {
+		return NAN;
+	}
+} /* lsl_timeout_() */
+
+
+static const struct cqs_pollable lsl_pollable = {
+	.pollfd  = &lsl_pollfd_,
+	.events  = &lsl_events_,
+	.timeout = &lsl_timeout_,
+}; /* lsl_pollable */
+
+
 static int lsl_pollfd(lua_State *L) {
-	struct signalfd *S = luaL_checkudata(L, 1, LSL_CLASS);
+	luaL_checkudata(L, 1, LSL_CLASS);
 
-	lua_pushinteger(L, S->fd);
+	lua_pushinteger(L, lsl_pollfd_(L, 1));
 
 	return 1;
 } /* lsl_pollfd() */
@@ -372,17 +408,14 @@ static int lsl_events(lua_State *L) {
 
 
 static int lsl_timeout(lua_State *L) {
-	struct signalfd *S = luaL_checkudata(L, 1, LSL_CLASS);
-	sigset_t none;
+	double timeout;
 
-	sigemptyset(&none);
+	luaL_checkudata(L, 1, LSL_CLASS);
 
-	if (sfd_diff(&S->pending, &none)) {
-		lua_pushnumber(L, 0.0);
-	} else if (isnormal(S->timeout) && !signbit(S->timeout)) {
-		lua_pushnumber(L, S->timeout);
-	} else {
+	if (isnan(timeout = lsl_timeout_(L, 1))) {
 		lua_pushnil(L);
+	} else {
+		lua_pushnumber(L, timeout);
 	}
 
 	return 1;
@@ -657,6 +690,8 @@ int luaopen__cqueues_signal(lua_State *L) {
 
 		luaL_newlib(L, lsl_methods);
 		lua_setfield(L, -2, "__index");
+
+		cqs_setpollable(L, -1, &lsl_pollable);
 	}
 
 	luaL_newlib(L, ls_globals);
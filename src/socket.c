@@ -133,6 +133,12 @@ static size_t iov_eoh(const struct iovec *iov, _Bool eof, int flags, int *_error
 	p = tp;
 	pe = tp + iov->iov_len;
 
+	/*
+	 * NOTE: The field name is short and every byte of it must be
+	 * classified anyway, so it's scanned a byte at a time. The value,
+	 * which is where the bulk of a header lies, is crossed with memchr
+	 * below.
+	 */
 	while (p < pe && mime_isfname(*p))
 		p++;
 
@@ -194,10 +200,28 @@ static size_t iov_eot(const struct iovec *iov, size_t minbuf, size_t maxbuf, _Bo
 	p = iov->iov_base;
 	pe = p + iov->iov_len;
 
-	for (; p < pe && n < maxbuf; ++n) {
-		lc = *p++;
+	/*
+	 * Each byte counts once toward n, except that \r\n counts as one.
+	 * Skip over runs without \r using memchr rather than testing each
+	 * byte.
+	 */
+	while (p < pe && n < maxbuf) {
+		size_t lim = MIN((size_t)(pe - p), maxbuf - n);
+		const char *cr;
+
+		if (!(cr = memchr(p, '\r', lim))) {
+			n += lim;
+			p += lim;
+			lc = (unsigned char)p[-1];
+
+			break;
+		}
+
+		n += cr - p + 1;
+		p = cr + 1;
+		lc = '\r';
 
-		if (lc == '\r' && p < pe && *p == '\n') {
+		if (p < pe && *p == '\n') {
 			lc = *p++; /* skip \n so we don't ++n */
 		}
 	}
@@ -242,24 +266,36 @@ error:
 } /* iov_eot() */
 
 
+#ifndef HAVE_MEMRCHR
+#define HAVE_MEMRCHR (__GLIBC__ || __FreeBSD__ || __NetBSD__ || __OpenBSD__ || __DragonFly__)
+#endif
+
 static size_t iov_eol(const struct iovec *iov) {
 	const char *p, *pe;
-	size_t eol = 0;
 
 	p = iov->iov_base;
 	pe = p + iov->iov_len;
 
-	while (p < pe && (p = memchr(p, '\n', pe - p))) {
-		eol = ++p - (char *)iov->iov_base;
+#if HAVE_MEMRCHR
+	if ((pe = memrchr(p, '\n', pe - p)))
+		return ++pe - p;
+#else
+	while (pe > p) {
+		if (*--pe == '\n')
+			return ++pe - p;
 	}
+#endif
 
-	return (eol)? eol : iov->iov_len;
+	return iov->iov_len;
 } /* iov_eol() */
 
 
-/* strip \r from \r\n sequences */
+/*
+ * strip \r from \r\n sequences. Text between matches is compacted in one
+ * pass rather than shifting the remainder on every match.
+ */
 static size_t iov_trimcr(struct iovec *iov, _Bool chomp) {
-	char *p, *pe;
+	char *p, *pe, *dp, *cr;
 
 	p = iov->iov_base;
 	pe = p + iov->iov_len;
@@ -268,14 +304,21 @@ static size_t iov_trimcr(struct iovec *iov, _Bool chomp) {
 		if (pe - p >= 2 && pe[-1] == '\n' && pe[-2] == '\r')
 			*(--pe - 1) = '\n';
 	} else {
-		while (p < pe && (p = memchr(p, '\r', pe - p))) {
-			if (++p >= pe) {
-				break;
-			} else if (*p == '\n') {
-				memmove(p - 1, p, pe - p);
-				--pe;
+		dp = p;
+
+		while (p < pe && (cr = memchr(p, '\r', pe - p))) {
+			memmove(dp, p, cr - p + 1);
+			dp += cr - p + 1;
+			p = cr + 1;
+
+			if (p < pe && *p == '\n') {
+				dp[-1] = '\n';
+				p++;
 			}
 		}
+
+		memmove(dp, p, pe - p);
+		pe = dp + (pe - p);
 	}
 
 	return iov->iov_len = pe - (char *)iov->iov_base;
@@ -284,9 +327,8 @@ static size_t iov_trimcr(struct iovec *iov, _Bool chomp) {
 
 /* strip \r?\n from \r?\n sequences */
 static size_t iov_trimcrlf(struct iovec *iov, _Bool chomp) {
-	char *sp, *p, *pe;
+	char *p, *pe, *dp, *lf;
 
-	sp = iov->iov_base;
 	p = iov->iov_base;
 	pe = p + iov->iov_len;
 
@@ -298,16 +340,20 @@ static size_t iov_trimcrlf(struct iovec *iov, _Bool chomp) {
 				--pe;
 		}
 	} else {
-		while (p < pe && (p = memchr(p, '\n', pe - p))) {
-			if (p > sp && p[-1] == '\r') {
-				++p;
-				memmove(p - 2, p, pe - p);
-				pe -= 2;
-			} else {
-				memmove(p, p + 1, pe - p - 1);
-				--pe;
-			}
+		dp = p;
+
+		while (p < pe && (lf = memchr(p, '\n', pe - p))) {
+			memmove(dp, p, lf - p);
+			dp += lf - p;
+
+			if (lf > p && lf[-1] == '\r')
+				--dp;
+
+			p = lf + 1;
 		}
+
+		memmove(dp, p, pe - p);
+		pe = dp + (pe - p);
 	}
 
 	return iov->iov_len = pe - (char *)iov->iov_base;
@@ -373,6 +419,7 @@ struct luasocket {
 		int mode;
 		size_t maxline;
 		size_t bufsiz;
+		_Bool mirror; /* see lso_setmirror_() */
 
 		struct fifo fifo;
 
@@ -388,12 +435,15 @@ struct luasocket {
 		int mode;
 		size_t maxline;
 		size_t bufsiz;
+		_Bool mirror;
 
 		struct fifo fifo;
 
 		_Bool eof;
 		size_t eol;
 
+		size_t lowat; /* see lso_setlowat2() */
+
 		int error;
 		size_t numerrs;
 		size_t maxerrs;
@@ -402,8 +452,12 @@ struct luasocket {
 	int type;
 	struct socket *socket;
 
+	int aerror; /* deferred by lso_acceptmany3() */
+
 	cqs_ref_t onerror;
 
+	struct cqs_iostat credited; /* see cqs_socket_iostat() */
+
 	lua_State *mainthread;
 
 	double timeout;
@@ -803,6 +857,8 @@ static struct luasocket *lso_newsocket(lua_State *L, int type) {
 
 	fifo_init(&S->ibuf.fifo);
 	fifo_init(&S->obuf.fifo);
+	fifo_setmirror(&S->ibuf.fifo, S->ibuf.mirror);
+	fifo_setmirror(&S->obuf.fifo, S->obuf.mirror);
 
 	if (S->onerror != LUA_NOREF && S->onerror != LUA_REFNIL) {
 		cqs_getref(L, S->onerror);
@@ -1098,6 +1154,16 @@ static lso_nargs_t lso_starttls(lua_State *L) {
 	if ((S->todo & LSO_DO_STARTTLS))
 		goto check;
 
+	/* { context = ctx, ktls = boolean } */
+	if (lua_istable(L, 2)) {
+		lua_getfield(L, 2, "ktls");
+		S->tls.config.ktls = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 2, "context");
+		lua_replace(L, 2);
+	}
+
 	if ((ctx = luaL_testudata(L, 2, "SSL_CTX*"))) {
 		/* accept-mode check handled by so_starttls() */
 	} else if ((ctx = luaL_testudata(L, 2, "SSL:Context"))) { /* luasec compatability */
@@ -1466,6 +1532,43 @@ static lso_nargs_t lso_setmaxline_(struct lua_State *L, struct luasocket *S, int
 } /* lso_setmaxline_() */
 
 
+/*
+ * Bound the bytes the kernel holds unsent with TCP_NOTSENT_LOWAT, so
+ * that the descriptor only polls writable once the queue drains below
+ * it. Together with the output buffer size this bounds per-connection
+ * memory. 0 restores the system default.
+ */
+static lso_nargs_t lso_setlowat2(struct lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	size_t lowat;
+	int fd, error;
+
+	lso_pushsize(L, S->obuf.lowat);
+
+	if (lua_isnoneornil(L, 2))
+		return 1;
+
+	lowat = lso_checksize(L, 2);
+
+	if ((fd = so_pollfd(S->socket)) == -1) {
+		error = ENOTCONN;
+		goto error;
+	}
+
+	if ((error = so_notsentlowat(fd, (lowat == 0)? LSO_INFSIZ : lowat)))
+		goto error;
+
+	S->obuf.lowat = (lowat == LSO_INFSIZ)? 0 : lowat;
+
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_setlowat2() */
+
+
 static lso_nargs_t lso_setmaxline2(struct lua_State *L) {
 	lua_settop(L, 2);
 
@@ -1480,6 +1583,47 @@ static lso_nargs_t lso_setmaxline3(struct lua_State *L) {
 } /* lso_setmaxline3() */
 
 
+/*
+ * Large buffers can be mapped twice back-to-back so they never need
+ * realigning (see FIFO_MIRROR), but such mappings are shared rather than
+ * copied by fork(2), so it's opt-in.
+ */
+static lso_nargs_t lso_setmirror_(struct lua_State *L, struct luasocket *S, int ridx, int widx) {
+	lua_pushboolean(L, S->ibuf.mirror);
+	lua_pushboolean(L, S->obuf.mirror);
+
+	if (!lua_isnoneornil(L, ridx))
+		S->ibuf.mirror = lua_toboolean(L, ridx);
+
+	if (!lua_isnoneornil(L, widx))
+		S->obuf.mirror = lua_toboolean(L, widx);
+
+	return 2;
+} /* lso_setmirror_() */
+
+
+static lso_nargs_t lso_setmirror2(struct lua_State *L) {
+	lua_settop(L, 2);
+
+	return lso_setmirror_(L, lso_prototype(L), 1, 2);
+} /* lso_setmirror2() */
+
+
+static lso_nargs_t lso_setmirror3(struct lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	int n;
+
+	lua_settop(L, 3);
+
+	n = lso_setmirror_(L, S, 2, 3);
+
+	fifo_setmirror(&S->ibuf.fifo, S->ibuf.mirror);
+	fifo_setmirror(&S->obuf.fifo, S->obuf.mirror);
+
+	return n;
+} /* lso_setmirror3() */
+
+
 static lso_nargs_t lso_settimeout_(struct lua_State *L, struct luasocket *S, int index) {
 	double timeout;
 
@@ -2177,6 +2321,68 @@ error:
 } /* lso_recv3() */
 
 
+/*
+ * Return up to n lines as an array. Only the first line may wait on the
+ * socket; the rest are the complete lines already buffered, so a consumer
+ * of line-oriented input makes one call per fill instead of per line.
+ */
+static lso_nargs_t lso_recvlines4(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	unsigned n = luaL_optunsigned(L, 2, 64);
+	struct lso_rcvop op;
+	struct iovec iov;
+	size_t count;
+	unsigned i;
+	int error;
+
+	luaL_argcheck(L, n > 0, 2, "line count out of range");
+
+	if ((error = lso_preprcv(L, S)))
+		goto error;
+
+	lua_settop(L, 4);
+
+	op = lso_checkrcvop(L, 3, lso_imode(luaL_optstring(L, 4, ""), S->ibuf.mode));
+
+	if (op.type != LSO_CHOMP && op.type != LSO_LINE)
+		return luaL_argerror(L, 3, "expected *l or *L");
+
+	if ((error = lso_getline(S, &iov)))
+		goto error;
+
+	lua_createtable(L, MIN(n, 64), 0);
+
+	for (i = 1; ; i++) {
+		count = iov.iov_len;
+
+		if (op.mode & LSO_TEXT)
+			iov_trimcr(&iov, 1);
+
+		if (op.type == LSO_CHOMP && iov_lc(&iov) == '\n')
+			--iov.iov_len;
+
+		lua_pushlstring(L, iov.iov_base, iov.iov_len);
+		lua_rawseti(L, -2, i);
+		fifo_discard(&S->ibuf.fifo, count);
+
+		if (i >= n || !fifo_lvec(&S->ibuf.fifo, &iov))
+			break;
+
+		iov.iov_len = MIN(iov.iov_len, S->ibuf.maxline);
+	}
+
+	if (!fifo_rlen(&S->ibuf.fifo))
+		S->ibuf.eom = 0;
+
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushinteger(L, lso_asserterror(error));
+
+	return 2;
+} /* lso_recvlines4() */
+
+
 static lso_nargs_t lso_unget2(lua_State *L) {
 	struct luasocket *S = lso_checkself(L, 1);
 	const void *src;
@@ -2208,8 +2414,8 @@ error:
 
 static lso_error_t lso_doflush(struct luasocket *S, int mode) {
 	size_t amount = 0, n;
-	struct iovec iov;
-	int error;
+	struct iovec iov[2];
+	int iovcnt, error;
 
 	if (mode & LSO_LINEBUF) {
 		if (S->obuf.eol > 0) {
@@ -2225,10 +2431,20 @@ static lso_error_t lso_doflush(struct luasocket *S, int mode) {
 	}
 
 	while (amount) {
-		if (!fifo_slice(&S->obuf.fifo, &iov, 0, amount))
+		/* write both segments of a wrapped buffer rather than realign */
+		if (!(n = fifo_rvec(&S->obuf.fifo, &iov[0])))
 			break; /* should never happen */
 
-		if (!(n = so_write(S->socket, iov.iov_base, iov.iov_len, &error)))
+		iov[0].iov_len = MIN(n, amount);
+		iovcnt = 1;
+
+		if (amount > iov[0].iov_len) {
+			iov[1].iov_base = S->obuf.fifo.base;
+			iov[1].iov_len = amount - iov[0].iov_len;
+			iovcnt = 2;
+		}
+
+		if (!(n = so_writev(S->socket, iov, iovcnt, &error)))
 			goto error;
 
 		fifo_discard(&S->obuf.fifo, n);
@@ -2249,34 +2465,15 @@ error:
 } /* lso_doflush() */
 
 
-static lso_nargs_t lso_send5(lua_State *L) {
-	struct luasocket *S = lso_checkself(L, 1);
-	const unsigned char *src, *lf;
-	size_t tp, p, pe, end, n;
-	int mode, byline, error;
-
-	if ((error = lso_prepsnd(L, S))) {
-		lua_pushinteger(L, 0);
-		lua_pushinteger(L, error);
-
-		return 2;
-	}
-
-	lua_settop(L, 5);
+static lso_error_t lso_sendbytes(struct luasocket *S, const unsigned char *src, size_t tp, size_t pe, int mode, size_t *count) {
+	const unsigned char *lf;
+	size_t p, n;
+	int byline, error;
 
-	src = (const void *)luaL_checklstring(L, 2, &end);
-	tp = lso_checksize(L, 3) - 1;
-	pe = lso_checksize(L, 4);
-	mode = lso_imode(luaL_optstring(L, 5, ""), S->obuf.mode);
 	byline = (mode & (LSO_TEXT|LSO_LINEBUF)) || (S->obuf.mode & LSO_LINEBUF);
 
-	luaL_argcheck(L, tp <= end, 3, "start index beyond object boundary");
-	luaL_argcheck(L, pe <= end, 4, "end index beyond object boundary");
-
 	p = tp;
 
-	so_clear(S->socket);
-
 	while (p < pe) {
 		if (byline) {
 			n = MIN(pe - p, S->obuf.maxline);
@@ -2317,20 +2514,209 @@ static lso_nargs_t lso_send5(lua_State *L) {
 		}
 	}
 
+	*count = p - tp;
+
+	return 0;
+error:
+	*count = p - tp;
+
+	return error;
+} /* lso_sendbytes() */
+
+
+static lso_nargs_t lso_send5(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	const unsigned char *src;
+	size_t tp, pe, end, count = 0;
+	int mode, error;
+
+	if ((error = lso_prepsnd(L, S))) {
+		lua_pushinteger(L, 0);
+		lua_pushinteger(L, error);
+
+		return 2;
+	}
+
+	lua_settop(L, 5);
+
+	src = (const void *)luaL_checklstring(L, 2, &end);
+	tp = lso_checksize(L, 3) - 1;
+	pe = lso_checksize(L, 4);
+	mode = lso_imode(luaL_optstring(L, 5, ""), S->obuf.mode);
+
+	luaL_argcheck(L, tp <= end, 3, "start index beyond object boundary");
+	luaL_argcheck(L, pe <= end, 4, "end index beyond object boundary");
+
+	so_clear(S->socket);
+
+	if ((error = lso_sendbytes(S, src, tp, pe, mode, &count)))
+		goto error;
+
 	if ((error = lso_doflush(S, mode)))
 		goto error;
 
-	lua_pushinteger(L, p - tp);
+	lua_pushinteger(L, count);
 
 	return 1;
 error:
-	lua_pushinteger(L, p - tp);
+	lua_pushinteger(L, count);
 	lua_pushinteger(L, error);
 
 	return 2;
 } /* lso_send5() */
 
 
+#if defined IOV_MAX && IOV_MAX < 64
+#define LSO_IOVMAX IOV_MAX
+#else
+#define LSO_IOVMAX 64
+#endif
+
+/*
+ * Vectored send of strings at stack indices base..top. Output is buffered
+ * as lso_sendbytes would. Where that would flush, the output buffer and
+ * the strings are handed to a single gathered write of the same amount,
+ * and only the rest is copied into the buffer. Text mode needs EOL
+ * translation and line buffering must find the last newline, so each
+ * string goes through lso_sendbytes instead.
+ */
+static lso_error_t lso_sendv_(lua_State *L, struct luasocket *S, int base, int top, size_t *count) {
+	struct iovec iov[LSO_IOVMAX];
+	const char *src;
+	size_t len, off = 0, buffered, limit, n;
+	int index = base, iovcnt, i, error = 0;
+
+	*count = 0;
+
+	if (S->obuf.mode & (LSO_TEXT|LSO_LINEBUF)) {
+		for (; index <= top; index++) {
+			src = lua_tolstring(L, index, &len);
+			error = lso_sendbytes(S, (const void *)src, 0, len, S->obuf.mode, &n);
+			*count += n;
+
+			if (error)
+				return error;
+		}
+
+		return 0;
+	}
+
+	/* how much write() would have flushed, buffer included */
+	limit = fifo_rlen(&S->obuf.fifo);
+
+	for (i = base; i <= top; i++) {
+		lua_tolstring(L, i, &len);
+		limit += len;
+	}
+
+	if (S->obuf.mode & LSO_FULLBUF)
+		limit -= limit % S->obuf.bufsiz;
+
+	while (limit > 0 && index <= top) {
+		iovcnt = 0;
+
+		if ((buffered = MIN(fifo_rlen(&S->obuf.fifo), limit))) {
+			/* a wrapped buffer yields two segments */
+			n = MIN(fifo_rvec(&S->obuf.fifo, &iov[iovcnt]), buffered);
+			iov[iovcnt++].iov_len = n;
+
+			if (buffered > n) {
+				iov[iovcnt].iov_base = S->obuf.fifo.base;
+				iov[iovcnt].iov_len = buffered - n;
+				iovcnt++;
+			}
+		}
+
+		for (i = index, n = limit - buffered; i <= top && n > 0 && iovcnt < LSO_IOVMAX; i++) {
+			src = lua_tolstring(L, i, &len);
+			iov[iovcnt].iov_base = (void *)((i == index)? src + off : src);
+			iov[iovcnt].iov_len = MIN(n, (i == index)? len - off : len);
+			n -= iov[iovcnt].iov_len;
+			iovcnt++;
+		}
+
+		if (!(n = so_writev(S->socket, iov, iovcnt, &error)))
+			break;
+
+		limit -= n;
+		buffered = MIN(n, buffered);
+		fifo_discard(&S->obuf.fifo, buffered);
+		S->obuf.eol -= MIN(S->obuf.eol, buffered);
+		n -= buffered;
+
+		while (n > 0 && index <= top) {
+			lua_tolstring(L, index, &len);
+
+			if (n >= len - off) {
+				n -= len - off;
+				*count += len - off;
+				index++;
+				off = 0;
+			} else {
+				off += n;
+				*count += n;
+				n = 0;
+			}
+		}
+	}
+
+	if (error && error != EAGAIN)
+		return error;
+
+	/* buffer whatever the kernel didn't take */
+	for (; index <= top; index++, off = 0) {
+		src = lua_tolstring(L, index, &len);
+
+		if ((error = fifo_write(&S->obuf.fifo, src + off, len - off)))
+			return error;
+
+		if (memchr(src + off, '\n', len - off))
+			S->obuf.eol = fifo_rlen(&S->obuf.fifo);
+
+		*count += len - off;
+	}
+
+	return 0;
+} /* lso_sendv_() */
+
+
+static lso_nargs_t lso_sendv(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	size_t count = 0;
+	int top, error;
+
+	if ((error = lso_prepsnd(L, S)))
+		goto error;
+
+	if (lua_gettop(L) == 2 && lua_istable(L, 2)) {
+		for (int i = 1; lua_rawgeti(L, 2, i), !lua_isnil(L, -1); i++)
+			luaL_checkstack(L, 1, "too many strings");
+
+		lua_pop(L, 1);
+		lua_remove(L, 2);
+	}
+
+	top = lua_gettop(L);
+
+	for (int index = 2; index <= top; index++)
+		luaL_checkstring(L, index);
+
+	so_clear(S->socket);
+
+	if ((error = lso_sendv_(L, S, 2, top, &count)))
+		goto error;
+
+	lua_pushinteger(L, count);
+
+	return 1;
+error:
+	lua_pushinteger(L, count);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_sendv() */
+
+
 static lso_nargs_t lso_flush(lua_State *L) {
 	struct luasocket *S = lso_checkself(L, 1);
 	int mode = lso_imode(luaL_optstring(L, 2, "n"), S->obuf.mode);
@@ -2369,10 +2755,17 @@ static lso_nargs_t lso_uncork(lua_State *L) {
 static lso_nargs_t lso_pending(lua_State *L) {
 	struct luasocket *S = lso_checkself(L, 1);
 
+	size_t unsent;
+
 	lua_pushunsigned(L, fifo_rlen(&S->ibuf.fifo));
 	lua_pushunsigned(L, fifo_rlen(&S->obuf.fifo));
 
-	return 2;
+	if (so_unsent(S->socket, &unsent))
+		return 2;
+
+	lua_pushunsigned(L, unsent);
+
+	return 3;
 } /* lso_pending() */
 
 
@@ -2410,6 +2803,149 @@ error:
 } /* lso_sendfd3() */
 
 
+/*
+ * Copy file data through the output buffer when sendfile(2) is
+ * unavailable, e.g. for TLS sockets.
+ */
+static lso_error_t lso_sendcopy(struct luasocket *S, int fd, off_t offset, size_t len, size_t *count) {
+	struct iovec iov;
+	ssize_t n;
+	int error;
+
+	*count = 0;
+
+	if ((error = fifo_wbuf(&S->obuf.fifo, &iov, MIN(len, S->obuf.bufsiz))))
+		return error;
+
+	while (-1 == (n = pread(fd, iov.iov_base, MIN(iov.iov_len, len), offset))) {
+		if (errno != EINTR)
+			return errno;
+	}
+
+	fifo_update(&S->obuf.fifo, n);
+	*count = n;
+
+	return lso_doflush(S, LSO_NOBUF);
+} /* lso_sendcopy() */
+
+
+static lso_nargs_t lso_sendfile4(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	size_t len, count = 0;
+	off_t offset;
+	int fd, error;
+
+	if ((error = lso_prepsnd(L, S)))
+		goto error;
+
+	lua_settop(L, 4);
+
+	if ((fd = lso_tofileno(L, 2)) < 0)
+		goto badfd;
+
+	offset = (off_t)luaL_optnumber(L, 3, 0);
+	luaL_argcheck(L, offset >= 0, 3, "negative file offset");
+	len = (lua_isnil(L, 4))? LSO_INFSIZ : lso_checksize(L, 4);
+
+	so_clear(S->socket);
+
+	/* buffered output must be sent first */
+	if (fifo_rlen(&S->obuf.fifo) > 0 && (error = lso_doflush(S, LSO_NOBUF)))
+		goto error;
+
+	if (ENOTSUP == (error = so_sendfile(S->socket, fd, &offset, len, &count)))
+		error = lso_sendcopy(S, fd, offset, len, &count);
+
+	if (error)
+		goto error;
+
+	lua_pushinteger(L, count);
+
+	return 1;
+badfd:
+	error = EBADF;
+error:
+	lua_pushinteger(L, count);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_sendfile4() */
+
+
+static lso_nargs_t lso_splice3(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	struct luasocket *T = lso_checkself(L, 2);
+	size_t len, count = 0;
+	struct iovec iov;
+	int error;
+
+	if ((error = lso_prepsnd(L, S)) || (error = lso_preprcv(L, T)))
+		goto error;
+
+	lua_settop(L, 3);
+
+	len = (lua_isnil(L, 3))? LSO_INFSIZ : lso_checksize(L, 3);
+
+	so_clear(S->socket);
+	so_clear(T->socket);
+
+	if (fifo_rlen(&S->obuf.fifo) > 0 && (error = lso_doflush(S, LSO_NOBUF)))
+		goto error;
+
+	/* input already buffered by the source is copied */
+	if (len > 0 && fifo_rlen(&T->ibuf.fifo) > 0) {
+		while (count < len && fifo_slice(&T->ibuf.fifo, &iov, 0, len - count)) {
+			if ((error = fifo_write(&S->obuf.fifo, iov.iov_base, iov.iov_len)))
+				goto error;
+
+			fifo_discard(&T->ibuf.fifo, iov.iov_len);
+			count += iov.iov_len;
+		}
+
+		if ((error = lso_doflush(S, LSO_NOBUF)))
+			goto error;
+
+		goto done;
+	}
+
+	if (len > 0 && T->ibuf.eof)
+		goto done;
+
+	if (ENOTSUP == (error = so_splice(S->socket, T->socket, len, &count))) {
+		if ((error = fifo_wbuf(&S->obuf.fifo, &iov, MIN(len, S->obuf.bufsiz))))
+			goto error;
+
+		if ((count = so_read(T->socket, iov.iov_base, MIN(iov.iov_len, len), &error))) {
+			fifo_update(&S->obuf.fifo, count);
+			error = lso_doflush(S, LSO_NOBUF);
+		} else if (error == EPIPE) {
+			error = 0;
+		}
+	}
+
+	if (error)
+		goto error;
+
+	if (len > 0 && count == 0)
+		T->ibuf.eof = 1;
+
+	/* spliced data still waiting on the destination */
+	if (so_splicelen(S->socket) > 0) {
+		error = EAGAIN;
+		goto error;
+	}
+done:
+	lua_pushinteger(L, count);
+
+	return 1;
+error:
+	lua_pushinteger(L, count);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_splice3() */
+
+
 static lso_nargs_t lso_recvfd2(lua_State *L) {
 	struct luasocket *S = lso_checkself(L, 1);
 	size_t bufsiz = luaL_optunsigned(L, 2, S->ibuf.maxline);
@@ -2615,6 +3151,30 @@ static lso_nargs_t lso_events(lua_State *L) {
 } /* lso_events() */
 
 
+static void lso_credit(unsigned long long *total, unsigned long long *credited, unsigned long long count) {
+	/* counters restart if the socket was reopened */
+	*total += (count >= *credited)? count - *credited : count;
+	*credited = count;
+} /* lso_credit() */
+
+static void lso_iostat(struct luasocket *S, struct cqs_iostat *total) {
+	const struct so_stat *st = so_stat(S->socket);
+
+	lso_credit(&total->sent.count, &S->credited.sent.count, st->sent.count);
+	lso_credit(&total->sent.calls, &S->credited.sent.calls, st->sent.calls);
+	lso_credit(&total->sent.again, &S->credited.sent.again, st->sent.again);
+	lso_credit(&total->sent.records, &S->credited.sent.records, st->sent.records);
+	lso_credit(&total->rcvd.count, &S->credited.rcvd.count, st->rcvd.count);
+	lso_credit(&total->rcvd.calls, &S->credited.rcvd.calls, st->rcvd.calls);
+	lso_credit(&total->rcvd.again, &S->credited.rcvd.again, st->rcvd.again);
+	lso_credit(&total->rcvd.records, &S->credited.rcvd.records, st->rcvd.records);
+} /* lso_iostat() */
+
+void cqs_socket_iostat(lua_State *L, int index, struct cqs_iostat *total) {
+	lso_iostat(lso_checkvalid(L, index, lua_touserdata(L, index)), total);
+} /* cqs_socket_iostat() */
+
+
 double cqs_socket_timeout(lua_State *L NOTUSED, int index NOTUSED) {
 	struct luasocket *S = lso_checkvalid(L, index, lua_touserdata(L, index));
 
@@ -2691,6 +3251,43 @@ static lso_nargs_t lso_eof(lua_State *L) {
 } /* lso_eof() */
 
 
+/*
+ * Cheap liveness check for an idle connection, e.g. before reuse from a
+ * pool. Peeks at the descriptor without consuming anything. Unread input
+ * on a plain socket means we're out of sync with the peer, so it counts
+ * as dead; under TLS it may just be a late session ticket.
+ */
+static lso_nargs_t lso_alive(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	int error = 0;
+
+	if (S->ibuf.eof || S->obuf.eof) {
+		error = EPIPE;
+	} else if (S->ibuf.error || S->obuf.error) {
+		error = (S->ibuf.error)? S->ibuf.error : S->obuf.error;
+	} else if (fifo_rlen(&S->ibuf.fifo) > 0 || fifo_rlen(&S->obuf.fifo) > 0) {
+		error = EPROTO;
+	} else if (so_pollfd(S->socket) == -1) {
+		error = EBADF;
+	} else {
+		so_clear(S->socket);
+
+		error = so_alive(S->socket);
+	}
+
+	if (error) {
+		lua_pushboolean(L, 0);
+		lua_pushinteger(L, error);
+
+		return 2;
+	}
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+} /* lso_alive() */
+
+
 static lso_nargs_t lso_accept(lua_State *L) {
 	struct luasocket *A = lso_checkself(L, 1);
 	struct so_options opts;
@@ -2719,6 +3316,68 @@ error:
 } /* lso_accept() */
 
 
+/*
+ * Accept up to n connections in one go, so a listener woken by a burst
+ * only costs a single trip through Lua. The options are parsed once and
+ * applied to every new socket.
+ */
+static lso_nargs_t lso_acceptmany3(lua_State *L) {
+	struct luasocket *A = lso_checkself(L, 1);
+	unsigned n = luaL_optunsigned(L, 2, 16), count = 0;
+	struct so_options opts;
+	int fd, error;
+
+	luaL_argcheck(L, n > 0, 2, "connection count out of range");
+
+	if (lua_istable(L, 3)) {
+		opts = lso_checkopts(L, 3);
+	} else {
+		opts = *so_opts();
+	}
+
+	/* an error held back from the previous call */
+	if ((error = A->aerror)) {
+		A->aerror = 0;
+
+		goto error;
+	}
+
+	lua_settop(L, 3);
+	lua_createtable(L, MIN(n, 64), 0);
+
+	so_clear(A->socket);
+
+	while (count < n) {
+		if (-1 == (fd = so_accept4(A->socket, 0, 0, (opts.fd_nonblock)? SO_F_NONBLOCK : 0, &error)))
+			goto stop;
+
+		if ((error = cqs_socket_fdopen(L, fd, &opts))) {
+			so_closesocket(&fd, NULL);
+
+			goto stop;
+		}
+
+		lua_rawseti(L, 4, ++count);
+	}
+
+	return 1;
+stop:
+	if (count == 0)
+		goto error;
+
+	/* return what we have and report the error next time */
+	if (error != EAGAIN && error != EWOULDBLOCK)
+		A->aerror = error;
+
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_acceptmany3() */
+
+
 static lso_nargs_t lso_pushname(lua_State *L, struct sockaddr_storage *ss, socklen_t salen) {
 	switch (ss->ss_family) {
 	case AF_INET:
@@ -2759,6 +3418,202 @@ static lso_nargs_t lso_pushname(lua_State *L, struct sockaddr_storage *ss, sockl
 } /* lso_pushname() */
 
 
+/*
+ * Batched datagram I/O. Messages are tables of the form
+ * { data, host|path, port }, with .family set on receipt. Scratch space
+ * for the headers, addresses and payloads is a single userdata.
+ */
+#define LSO_MMSGMAX 1024
+
+static lso_nargs_t lso_recvmany3(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	unsigned n = luaL_optunsigned(L, 2, 16);
+	size_t bufsiz = luaL_optunsigned(L, 3, S->ibuf.maxline);
+	struct so_mmsg *msgs;
+	struct iovec *iov;
+	struct sockaddr_storage *ss;
+	unsigned char *buf;
+	unsigned count, i;
+	int error;
+
+	luaL_argcheck(L, n > 0 && n <= LSO_MMSGMAX, 2, "message count out of range");
+	luaL_argcheck(L, bufsiz > 0 && bufsiz <= (size_t)-1 / LSO_MMSGMAX / 2, 3, "buffer size out of range");
+
+	if ((error = lso_preprcv(L, S)))
+		goto error;
+
+	lua_settop(L, 3);
+
+	msgs = lua_newuserdata(L, n * (sizeof *msgs + sizeof *iov + sizeof *ss + bufsiz));
+	iov = (struct iovec *)&msgs[n];
+	ss = (struct sockaddr_storage *)&iov[n];
+	buf = (unsigned char *)&ss[n];
+
+	for (i = 0; i < n; i++) {
+		memset(&msgs[i], 0, sizeof msgs[i]);
+		iov[i].iov_base = &buf[i * bufsiz];
+		iov[i].iov_len = bufsiz;
+		msgs[i].msg_hdr.msg_name = &ss[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof ss[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if ((error = so_recvmmsg(S->socket, msgs, n, 0, &count)))
+		goto error;
+
+	lua_createtable(L, count, 0);
+
+	for (i = 0; i < count; i++) {
+		struct msghdr *msg = &msgs[i].msg_hdr;
+		int j;
+
+		lua_createtable(L, 3, 2);
+
+		lua_pushlstring(L, iov[i].iov_base, iov[i].iov_len);
+		lua_rawseti(L, -2, 1);
+
+		if (msg->msg_namelen == 0)
+			ss[i].ss_family = AF_UNSPEC;
+
+		for (j = lso_pushname(L, &ss[i], msg->msg_namelen); j > 1; j--)
+			lua_rawseti(L, -(j + 1), j);
+
+		lua_setfield(L, -2, "family");
+
+		if (msg->msg_flags & MSG_TRUNC) {
+			lua_pushboolean(L, 1);
+			lua_setfield(L, -2, "truncated");
+		}
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+error:
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_recvmany3() */
+
+
+static void lso_checkname(lua_State *L, int index, struct sockaddr_storage *ss, socklen_t *salen, int arg) {
+	const char *host;
+	size_t hlen;
+	int port, error;
+
+	lua_rawgeti(L, index, 2);
+	lua_rawgeti(L, index, 3);
+
+	memset(ss, 0, sizeof *ss);
+	*salen = 0;
+
+	if (lua_isnil(L, -2)) {
+		lua_pop(L, 2);
+
+		return;
+	}
+
+	host = luaL_checklstring(L, -2, &hlen);
+
+	if (lua_isnil(L, -1)) {
+		struct sockaddr_un *sun = (struct sockaddr_un *)ss;
+
+		luaL_argcheck(L, hlen < sizeof sun->sun_path, arg, "unix domain path too long");
+
+		sun->sun_family = AF_UNIX;
+		memcpy(sun->sun_path, host, hlen);
+		*salen = offsetof(struct sockaddr_un, sun_path) + hlen + 1;
+	} else {
+		port = luaL_checkint(L, -1);
+
+		if (!sa_pton(ss, sizeof *ss, host, NULL, &error))
+			luaL_argerror(L, arg, lua_pushfstring(L, "%s: unable to parse address (%s)", host, cqs_strerror(error)));
+
+		*sa_port(ss, &(unsigned short){ 0 }, NULL) = htons((unsigned short)port);
+		*salen = sa_len(ss);
+	}
+
+	lua_pop(L, 2);
+} /* lso_checkname() */
+
+
+static lso_nargs_t lso_sendmany3(lua_State *L) {
+	struct luasocket *S = lso_checkself(L, 1);
+	struct so_mmsg *msgs;
+	struct iovec *iov;
+	struct sockaddr_storage *ss;
+	unsigned count = 0, first, last, n, i;
+	int error;
+
+	if ((error = lso_prepsnd(L, S)))
+		goto error;
+
+	lua_settop(L, 3);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	first = luaL_optunsigned(L, 3, 1);
+	last = lua_rawlen(L, 2);
+
+	luaL_argcheck(L, first > 0, 3, "index out of range");
+
+	if (first > last)
+		goto done;
+
+	n = MIN(last - first + 1, LSO_MMSGMAX);
+
+	msgs = lua_newuserdata(L, n * (sizeof *msgs + sizeof *iov + sizeof *ss));
+	iov = (struct iovec *)&msgs[n];
+	ss = (struct sockaddr_storage *)&iov[n];
+
+	/* payloads stay anchored by the message table */
+	for (i = 0; i < n; i++) {
+		socklen_t salen = 0;
+		size_t len;
+
+		memset(&msgs[i], 0, sizeof msgs[i]);
+
+		lua_rawgeti(L, 2, first + i);
+
+		if (lua_istable(L, -1)) {
+			lua_rawgeti(L, -1, 1);
+			iov[i].iov_base = (void *)luaL_checklstring(L, -1, &len);
+			lua_pop(L, 1);
+
+			lso_checkname(L, lua_gettop(L), &ss[i], &salen, 2);
+		} else {
+			iov[i].iov_base = (void *)luaL_checklstring(L, -1, &len);
+		}
+
+		lua_pop(L, 1);
+
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_name = (salen)? &ss[i] : NULL;
+		msgs[i].msg_hdr.msg_namelen = salen;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	so_clear(S->socket);
+
+	if (fifo_rlen(&S->obuf.fifo) > 0 && (error = lso_doflush(S, LSO_NOBUF)))
+		goto error;
+
+	if ((error = so_sendmmsg(S->socket, msgs, n, 0, &count)))
+		goto error;
+done:
+	lua_pushinteger(L, count);
+
+	return 1;
+error:
+	lua_pushinteger(L, count);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* lso_sendmany3() */
+
+
 static lso_nargs_t lso_peername(lua_State *L) {
 	struct luasocket *S = lso_checkself(L, 1);
 	struct sockaddr_storage ss;
@@ -2835,37 +3690,79 @@ static lso_nargs_t lso_localname(lua_State *L) {
 } /* lso_localname() */
 
 
+static void lso_pushstlog(lua_State *L, const struct st_log *log) {
+	lua_createtable(L, 0, 7);
+	lua_pushinteger(L, log->count);
+	lua_setfield(L, -2, "count");
+	lua_pushboolean(L, log->eof);
+	lua_setfield(L, -2, "eof");
+	lua_pushinteger(L, log->time);
+	lua_setfield(L, -2, "time");
+	lua_pushinteger(L, log->first);
+	lua_setfield(L, -2, "first");
+	lua_pushinteger(L, log->calls);
+	lua_setfield(L, -2, "calls");
+	lua_pushinteger(L, log->again);
+	lua_setfield(L, -2, "again");
+	lua_pushinteger(L, log->records);
+	lua_setfield(L, -2, "records");
+} /* lso_pushstlog() */
+
+
 static lso_nargs_t lso_stat(lua_State *L) {
 	struct luasocket *S = lso_checkself(L, 1);
 	const struct so_stat *st = so_stat(S->socket);
+	SSL *ssl;
 
 	lua_newtable(L);
 
-	lua_newtable(L);
-	lua_pushinteger(L, st->sent.count);
-	lua_setfield(L, -2, "count");
-	lua_pushboolean(L, st->sent.eof);
-	lua_setfield(L, -2, "eof");
-	lua_pushinteger(L, st->sent.time);
-	lua_setfield(L, -2, "time");
+	lso_pushstlog(L, &st->sent);
 	lua_setfield(L, -2, "sent");
 
-	lua_newtable(L);
-	lua_pushinteger(L, st->rcvd.count);
-	lua_setfield(L, -2, "count");
-	lua_pushboolean(L, st->rcvd.eof);
-	lua_setfield(L, -2, "eof");
-	lua_pushinteger(L, st->rcvd.time);
-	lua_setfield(L, -2, "time");
+	lso_pushstlog(L, &st->rcvd);
 	lua_setfield(L, -2, "rcvd");
 
+	if ((ssl = so_checktls(S->socket))) {
+		int ktls = so_ktls(S->socket);
+		unsigned long hits, misses;
+		unsigned count;
+
+		lua_newtable(L);
+		lua_pushboolean(L, !!(ktls & SO_KTLS_SEND));
+		lua_setfield(L, -2, "send");
+		lua_pushboolean(L, !!(ktls & SO_KTLS_RECV));
+		lua_setfield(L, -2, "recv");
+		lua_setfield(L, -2, "ktls");
+
+		lua_newtable(L);
+		lua_pushboolean(L, SSL_session_reused(ssl));
+		lua_setfield(L, -2, "reused");
+
+		if (!so_sessstat(SSL_get_SSL_CTX(ssl), &hits, &misses, &count)) {
+			lua_pushnumber(L, hits);
+			lua_setfield(L, -2, "hits");
+			lua_pushnumber(L, misses);
+			lua_setfield(L, -2, "misses");
+			lua_pushinteger(L, count);
+			lua_setfield(L, -2, "count");
+		}
+
+		lua_setfield(L, -2, "session");
+	}
+
 	return 1;
 } /* lso_stat() */
 
 
 static void lso_destroy(lua_State *L, struct luasocket *S) {
+	struct cqs_iostat *total;
+
 	cqs_unref(L, &S->onerror);
 
+	/* I/O since the last poll, which would otherwise go uncounted */
+	if (S->socket && (total = cqs_running_iostat(L)))
+		lso_iostat(S, total);
+
 	if (S->tls.config.context) {
 		SSL_CTX_free(S->tls.config.context);
 		S->tls.config.context = NULL;
@@ -2933,6 +3830,8 @@ static luaL_Reg lso_methods[] = {
 	{ "setmode",    &lso_setmode3 },
 	{ "setbufsiz",  &lso_setbufsiz3 },
 	{ "setmaxline", &lso_setmaxline3 },
+	{ "setmirror",  &lso_setmirror3 },
+	{ "setlowat",   &lso_setlowat2 },
 	{ "settimeout", &lso_settimeout2 },
 	{ "seterror",   &lso_seterror },
 	{ "setmaxerrs", &lso_setmaxerrs2 },
@@ -2940,6 +3839,7 @@ static luaL_Reg lso_methods[] = {
 	{ "clearerr",   &lso_clearerr },
 	{ "onerror",    &lso_onerror2 },
 	{ "recv",       &lso_recv3 },
+	{ "recvlines",  &lso_recvlines4 },
 	{ "unget",      &lso_unget2 },
 	{ "send",       &lso_send5 },
 	{ "flush",      &lso_flush },
@@ -2947,6 +3847,11 @@ static luaL_Reg lso_methods[] = {
 	{ "pending",    &lso_pending },
 	{ "sendfd",     &lso_sendfd3 },
 	{ "recvfd",     &lso_recvfd2 },
+	{ "sendv",      &lso_sendv },
+	{ "recvmany",   &lso_recvmany3 },
+	{ "sendmany",   &lso_sendmany3 },
+	{ "sendfile",   &lso_sendfile4 },
+	{ "splice",     &lso_splice3 },
 	{ "pack",       &lso_pack4 },
 	{ "unpack",     &lso_unpack2 },
 	{ "fill",       &lso_fill2 },
@@ -2956,7 +3861,9 @@ static luaL_Reg lso_methods[] = {
 	{ "timeout",    &lso_timeout },
 	{ "shutdown",   &lso_shutdown },
 	{ "eof",        &lso_eof },
+	{ "alive",      &lso_alive },
 	{ "accept",     &lso_accept },
+	{ "acceptmany", &lso_acceptmany3 },
 	{ "peername",   &lso_peername },
 	{ "peereid",    &lso_peereid },
 	{ "peerpid",    &lso_peerpid },
@@ -2985,6 +3892,7 @@ static luaL_Reg lso_globals[] = {
 	{ "setmode",    &lso_setmode2 },
 	{ "setbufsiz",  &lso_setbufsiz2 },
 	{ "setmaxline", &lso_setmaxline2 },
+	{ "setmirror",  &lso_setmirror2 },
 	{ "settimeout", &lso_settimeout1 },
 	{ "setmaxerrs", &lso_setmaxerrs1 },
 	{ "onerror",    &lso_onerror1 },
@@ -118,16 +118,18 @@ end)
 -- read timeout. Timeouts are exceptional but not necessarily errors.
 --
 local preserve = {
-	read = "r", lines = "r", fill = "r", unpack = "r",
+	read = "r", lines = "r", recvlines = "r", fill = "r", unpack = "r",
 	write = "w", flush = "w", pack = "w",
 
 	-- these too for good measure, even though they're not buffered
-	recvfd = "r", sendfd = "w",
+	recvfd = "r", sendfd = "w", sendfile = "w", splice = "w",
+	recvmany = "r", sendmany = "w",
 }
 
 -- drop EPIPE errors on input channel
 local nopipe = {
-	read = true, lines = true, fill = true, unpack = true, recvfd = true
+	read = true, lines = true, recvlines = true, fill = true, unpack = true,
+	recvfd = true
 }
 
 local function oops(self, op, why, level)
@@ -238,10 +240,70 @@ local _accept; _accept = socket.interpose("accept", function(self, opts, timeout
 end)
 
 
+--
+-- Yielding socket:acceptmany
+--
+local _acceptmany; _acceptmany = socket.interpose("acceptmany", function(self, n, opts, timeout)
+	-- n may be omitted
+	if type(n) == "table" then
+		n, opts, timeout = nil, n, opts
+	end
+
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local cons, why
+
+	repeat
+		cons, why = _acceptmany(self, n, opts)
+
+		if not cons then
+			if why == EAGAIN then
+				if not timed_poll(self, deadline) then
+					return nil, oops(self, "acceptmany", ETIMEDOUT)
+				end
+			else
+				return nil, oops(self, "acceptmany", why)
+			end
+		end
+	until cons
+
+	return cons
+end)
+
+
 --
 -- Add socket:clients
 --
+-- With opts.batch connections are taken from the listener up to that
+-- many at a time, and handed out one by one.
+--
 socket.interpose("clients", function(self, opts, timeout)
+	if type(opts) == "table" and opts.batch then
+		local cons, i = {}, 1
+
+		return function()
+			if not cons[i] then
+				local why
+
+				cons, why = self:acceptmany(opts.batch, opts, timeout)
+
+				if not cons then
+					cons = {}
+
+					return nil, why
+				end
+
+				i = 1
+			end
+
+			local con = cons[i]
+
+			cons[i], i = nil, i + 1
+
+			return con
+		end
+	end
+
 	return function() return self:accept(opts, timeout) end
 end)
 
@@ -270,15 +332,193 @@ local _connect; _connect = socket.interpose("connect", function(self, timeout)
 end)
 
 
+--
+-- socket.dial
+--
+-- Resolve and connect to opts.host/.port RFC 8305 ("Happy Eyeballs")
+-- style: AAAA and A are queried in parallel through the shared DNS
+-- resolver pool, and connection attempts to the interleaved addresses
+-- are started .delay (default 250ms) apart until one succeeds. Returns a
+-- connected socket. Falls back to socket.connect when there's nothing to
+-- race (.path, numeric host, fixed .family, or no running controller).
+--
+local DIAL_RESOLUTION_DELAY = 0.05
+local DIAL_CONNECTION_DELAY = 0.25
+
+local function dial_lookup(cq, pool, host, type, result, condvar, deadline)
+	cq:wrap(function ()
+		local answer = pool:query(host, type, "IN", deadline and math.max(0, deadline - monotime()))
+
+		if answer then
+			for rr in answer:grep{ section = "answer", type = type } do
+				result[#result + 1] = rr:addr()
+			end
+		end
+
+		result.done = monotime()
+		condvar:signal()
+	end)
+end -- dial_lookup
+
+local function dial_args(opts, addr, family)
+	local args = {}
+
+	for k, v in pairs(opts) do
+		args[k] = v
+	end
+
+	if opts.sendname == nil and opts.tls_sendname == nil then
+		args.sendname = opts.host
+	end
+
+	args.host, args.family, args.delay = addr, family, nil
+
+	return args
+end -- dial_args
+
+socket.dial = function(opts, timeout)
+	local host = opts.host
+	local cq = cqueues.running()
+
+	if opts.path or not cq or (opts.family and opts.family ~= socket.AF_UNSPEC)
+	or string.find(tostring(host), "^[%d.]+$") or string.find(tostring(host), ":") then
+		local con, why = socket.connect(opts)
+
+		if not con then
+			return nil, why
+		end
+
+		return con:connect(timeout)
+	end
+
+	local condition = require"cqueues.condition"
+	local pool = require"cqueues.dns".getpool()
+	local deadline = timeout and (monotime() + timeout)
+	local delay = opts.delay or DIAL_CONNECTION_DELAY
+	local condvar = condition.new()
+	local lookup = { [AF_INET6] = {}, [AF_INET] = {} }
+	local taken = { [AF_INET6] = 0, [AF_INET] = 0 }
+	local active, nextstart, lastfamily, lasterr = {}, 0, AF_INET, nil
+
+	dial_lookup(cq, pool, host, "AAAA", lookup[AF_INET6], condvar, deadline)
+	dial_lookup(cq, pool, host, "A", lookup[AF_INET], condvar, deadline)
+
+	local function pending(family)
+		return taken[family] < #lookup[family]
+	end
+
+	-- once A has arrived give AAAA a head start (RFC 8305 section 3)
+	local function hold(curtime)
+		if lookup[AF_INET6].done then
+			return 0
+		elseif lookup[AF_INET].done then
+			return math.max(0, lookup[AF_INET].done + DIAL_RESOLUTION_DELAY - curtime)
+		else
+			return math.huge
+		end
+	end
+
+	-- alternate address families, preferring IPv6
+	local function nextaddr()
+		local family = (lastfamily == AF_INET) and AF_INET6 or AF_INET
+
+		if not pending(family) then
+			family = (family == AF_INET) and AF_INET6 or AF_INET
+		end
+
+		taken[family] = taken[family] + 1
+		lastfamily = family
+
+		return lookup[family][taken[family]], family
+	end
+
+	local function closeall()
+		for _, con in ipairs(active) do
+			con:close()
+		end
+	end
+
+	while true do
+		local curtime = monotime()
+		local ready = hold(curtime) == 0 and (pending(AF_INET6) or pending(AF_INET))
+
+		if ready and (#active == 0 or curtime >= nextstart) then
+			local addr, family = nextaddr()
+			local con, why = socket.connect(dial_args(opts, addr, family))
+
+			if con then
+				local ok
+
+				ok, why = _connect(con)
+
+				if ok then
+					closeall()
+
+					return con
+				elseif why == EAGAIN then
+					active[#active + 1] = con
+				else
+					con:close()
+				end
+			end
+
+			lasterr = why or lasterr
+			nextstart = curtime + delay
+		else
+			local wait = math.huge
+
+			if #active == 0 and not ready and lookup[AF_INET6].done and lookup[AF_INET].done then
+				return nil, lasterr or errno.ENOENT
+			elseif deadline and deadline <= curtime then
+				closeall()
+
+				return nil, ETIMEDOUT
+			end
+
+			if ready then
+				wait = nextstart - curtime
+			elseif pending(AF_INET) then
+				wait = hold(curtime)
+			end
+
+			if deadline then
+				wait = math.min(wait, deadline - curtime)
+			end
+
+			poll((wait < math.huge and wait) or nil, condvar, (table.unpack or unpack)(active))
+
+			for i = #active, 1, -1 do
+				local con = active[i]
+				local ok, why = _connect(con)
+
+				if ok then
+					table.remove(active, i)
+					closeall()
+
+					return con
+				elseif why ~= EAGAIN then
+					table.remove(active, i)
+					con:close()
+					lasterr = why
+
+					-- a failed attempt starts the next one immediately
+					nextstart = 0
+				end
+			end
+		end
+	end
+end -- socket.dial
+
+
 --
 -- Yielding socket:starttls
 --
 local _starttls; _starttls = socket.interpose("starttls", function(self, arg1, arg2)
 	local ctx, timeout
 
-	if type(arg1) == "userdata" then
+	if type(arg1) == "userdata" or type(arg1) == "table" then
 		ctx = arg1
-	elseif type(arg2) == "userdata" then
+	elseif type(arg2) == "userdata" or type(arg2) == "table" then
 		ctx = arg2
 	end
 
@@ -379,6 +619,46 @@ _flush = socket.interpose("flush", function (self, arg1, arg2)
 end)
 
 
+--
+-- Add socket:drain
+--
+-- Flush the output buffer, then wait until the kernel's unsent queue is
+-- below the socket:setlowat threshold. The kernel only polls the socket
+-- writable once that's true, so a single wakeup suffices.
+--
+socket.interpose("drain", function (self, timeout)
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local lowat = self:setlowat()
+	local ok, why = timed_flush(self, nil, timeout, 2)
+
+	if not ok then
+		return false, why
+	end
+
+	local unsent = select(3, self:pending())
+
+	if lowat > 0 and unsent and unsent >= lowat then
+		local writable = {
+			pollfd = function () return self:pollfd() end,
+			events = function () return "w" end,
+			timeout = function () return nil end,
+		}
+
+		-- writability alone isn't proof; it may be a stray wakeup
+		repeat
+			if not timed_poll(writable, deadline) then
+				return false, oops(self, "drain", ETIMEDOUT)
+			end
+
+			unsent = select(3, self:pending())
+		until not unsent or unsent < lowat
+	end
+
+	return true
+end)
+
+
 --
 -- Yielding socket:read
 --
@@ -483,6 +763,23 @@ socket.interpose("write", function (self, ...)
 end)
 
 
+--
+-- Vectored socket:writev
+--
+-- socket:sendv accepts every string at once, buffering whatever the
+-- kernel doesn't take, so only the flush can yield.
+--
+socket.interpose("writev", function (self, ...)
+	local _, why = self:sendv(...)
+
+	if why then
+		return nil, oops(self, "write", why)
+	end
+
+	return fileresult(self, timed_flush(self, "", nil, 2))
+end)
+
+
 --
 -- Add socket:lines
 --
@@ -667,6 +964,155 @@ local _recvfd; _recvfd = socket.interpose("recvfd", function (self, prepbufsiz,
 end)
 
 
+--
+-- Yielding socket:recvmany
+--
+local _recvmany; _recvmany = socket.interpose("recvmany", function (self, n, prepbufsiz, timeout)
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local msgs, why
+
+	repeat
+		msgs, why = _recvmany(self, n, prepbufsiz)
+
+		if not msgs then
+			if why == EAGAIN then
+				if not timed_poll(self, deadline) then
+					return nil, oops(self, "recvmany", ETIMEDOUT)
+				end
+			else
+				return nil, oops(self, "recvmany", why)
+			end
+		end
+	until msgs
+
+	return msgs
+end)
+
+
+--
+-- Yielding socket:recvlines
+--
+local _recvlines; _recvlines = socket.interpose("recvlines", function (self, n, format, mode, timeout)
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local lines, why
+
+	repeat
+		lines, why = _recvlines(self, n, format, mode)
+
+		if not lines then
+			if why == EAGAIN then
+				if not timed_poll(self, deadline) then
+					return nil, oops(self, "recvlines", ETIMEDOUT)
+				end
+			else
+				return nil, oops(self, "recvlines", why)
+			end
+		end
+	until lines
+
+	return lines
+end)
+
+
+--
+-- Yielding socket:sendmany
+--
+local _sendmany; _sendmany = socket.interpose("sendmany", function (self, msgs, timeout)
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local total = 0
+
+	while total < #msgs do
+		local n, why = _sendmany(self, msgs, total + 1)
+
+		total = total + n
+
+		if why == EAGAIN then
+			if not timed_poll(self, deadline) then
+				return nil, oops(self, "sendmany", ETIMEDOUT)
+			end
+		elseif why then
+			return nil, oops(self, "sendmany", why)
+		end
+	end
+
+	return total
+end)
+
+
+--
+-- Yielding socket:sendfile
+--
+local _sendfile; _sendfile = socket.interpose("sendfile", function (self, file, offset, len, timeout)
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local limit = len or math.huge
+	local total = 0
+
+	offset = offset or 0
+
+	while total < limit do
+		local n, why = _sendfile(self, file, offset + total, len and (len - total))
+
+		total = total + n
+
+		if why == EAGAIN then
+			if not timed_poll(self, deadline) then
+				return nil, oops(self, "sendfile", ETIMEDOUT)
+			end
+		elseif why then
+			return nil, oops(self, "sendfile", why)
+		elseif n == 0 then
+			break -- EOF
+		end
+	end
+
+	return total
+end)
+
+
+--
+-- Yielding socket:splice
+--
+-- The destination may stall on output and the source on input, so both
+-- are polled.
+--
+local _splice; _splice = socket.interpose("splice", function (self, other, len, timeout)
+	local timeout = timeout or self:timeout()
+	local deadline = timeout and (monotime() + timeout)
+	local limit = len or math.huge
+	local total, eof = 0, false
+
+	repeat
+		local n, why = _splice(self, other, (eof and 0) or (len and (len - total)))
+
+		total = total + n
+
+		if why == EAGAIN then
+			if deadline then
+				local curtime = monotime()
+
+				if deadline <= curtime then
+					return nil, oops(self, "splice", ETIMEDOUT)
+				end
+
+				poll(self, other, deadline - curtime)
+			else
+				poll(self, other)
+			end
+		elseif why then
+			return nil, oops(self, "splice", why)
+		elseif n == 0 then
+			eof = true
+		end
+	until not why and (eof or total >= limit)
+
+	return total
+end)
+
+
 --
 -- Yielding socket:pack
 --
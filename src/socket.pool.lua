@@ -0,0 +1,349 @@
+local loader = function(loader, ...)
+	local socket = require"cqueues.socket"
+	local condition = require"cqueues.condition"
+	local monotime = require"cqueues".monotime
+	local errno = require"cqueues.errno"
+	local ETIMEDOUT = errno.ETIMEDOUT
+
+
+	local function todeadline(timeout)
+		return (timeout and (monotime() + timeout)) or nil
+	end -- todeadline
+
+	local function totimeout(deadline)
+		return (deadline and math.max(0, deadline - monotime())) or nil
+	end -- totimeout
+
+
+	--
+	-- NOTE: Connections are grouped by (host, port, tls), where tls is
+	-- false, true or an SSL context object. Each group keeps a LIFO
+	-- stack of idle connections, a count of checked out connections and
+	-- a condition variable for callers waiting on the concurrency cap.
+	--
+	local function tokey(opts)
+		local tls = opts.tls
+
+		if tls == nil or tls == false then
+			tls = ""
+		elseif tls == true then
+			tls = "tls"
+		else
+			tls = tostring(tls)
+		end
+
+		return string.format("%s|%s|%s", tostring(opts.host or opts.path), tostring(opts.port), tls)
+	end -- tokey
+
+
+	--
+	-- NOTE: A checked out connection is tracked by a reference holding
+	-- its group and a hook. If the connection is dropped without put or
+	-- discard, the hook's finalizer gives its slot back. Lua 5.1 doesn't
+	-- support __gc on tables, so use newproxy there.
+	--
+	local newhook
+
+	if _G._VERSION == "Lua 5.1" then
+		newhook = function (gc)
+			local u = newproxy(true)
+			getmetatable(u).__gc = gc
+			return u
+		end
+	else
+		newhook = function (gc)
+			return setmetatable({}, { __gc = gc })
+		end
+	end
+
+	local function checkout(self, con, group)
+		local ref = { group = group }
+
+		ref.hook = newhook(function ()
+			if ref.group then
+				ref.group = nil
+				group.busy = group.busy - 1
+				group.condvar:signal(1)
+				self.stats.leaked = self.stats.leaked + 1
+			end
+		end)
+
+		self.owner[con] = ref
+	end -- checkout
+
+
+	local pool = {}
+
+	local function getgroup(self, key)
+		local group = self.groups[key]
+
+		if not group then
+			group = { idle = {}, busy = 0, condvar = condition.new() }
+			self.groups[key] = group
+		end
+
+		return group
+	end -- getgroup
+
+
+	local function evict(self, group, now)
+		local idle = group.idle
+		local n = 0
+
+		-- oldest connections are at the bottom of the stack
+		while idle[n + 1] and now - idle[n + 1].time >= self.idletimeout do
+			n = n + 1
+		end
+
+		if n > 0 then
+			for i = 1, n do
+				idle[i].con:close()
+			end
+
+			for i = 1, #idle do
+				idle[i] = idle[i + n]
+			end
+
+			self.stats.evicted = self.stats.evicted + n
+		end
+	end -- evict
+
+
+	local function connect(self, opts, deadline)
+		local args = {}
+		local con, ok, why
+
+		for k, v in pairs(opts) do
+			if k ~= "tls" then
+				args[k] = v
+			end
+		end
+
+		con, why = socket.connect(args)
+
+		if not con then
+			return nil, why
+		end
+
+		ok, why = con:connect(totimeout(deadline))
+
+		if ok and opts.tls then
+			ok, why = con:starttls((opts.tls ~= true and opts.tls) or nil, totimeout(deadline))
+		end
+
+		if not ok then
+			con:close()
+
+			return nil, why
+		end
+
+		return con
+	end -- connect
+
+
+	--
+	-- pool:get
+	--
+	-- Check out a connection for opts (as for socket.connect, plus
+	-- .tls), reusing a live idle one when possible. Waits while the
+	-- group is at its .max concurrency.
+	--
+	function pool:get(opts, timeout)
+		local deadline = todeadline(timeout or self.timeout)
+		local key = tokey(opts)
+		local group = getgroup(self, key)
+		local stats = self.stats
+		local con, why
+
+		while true do
+			local idle = group.idle
+
+			evict(self, group, monotime())
+
+			while #idle > 0 do
+				con = idle[#idle].con
+				idle[#idle] = nil
+
+				if con:alive() then
+					stats.hits = stats.hits + 1
+					group.busy = group.busy + 1
+					checkout(self, con, group)
+
+					return con
+				end
+
+				con:close()
+				stats.dead = stats.dead + 1
+			end
+
+			if group.busy < self.max then
+				break
+			end
+
+			local curtime = monotime()
+
+			if deadline and deadline <= curtime then
+				return nil, ETIMEDOUT
+			end
+
+			stats.waits = stats.waits + 1
+			group.condvar:wait(deadline and (deadline - curtime))
+
+			local waited = monotime() - curtime
+
+			stats.waittime = stats.waittime + waited
+			stats.maxwait = math.max(stats.maxwait, waited)
+		end
+
+		stats.misses = stats.misses + 1
+		group.busy = group.busy + 1
+
+		con, why = connect(self, opts, deadline)
+
+		if not con then
+			group.busy = group.busy - 1
+			group.condvar:signal(1)
+
+			return nil, why
+		end
+
+		checkout(self, con, group)
+
+		return con
+	end -- pool:get
+
+
+	local function release(self, con)
+		local ref = self.owner[con]
+		local group = ref and ref.group
+
+		if not group then
+			return nil
+		end
+
+		self.owner[con] = nil
+		ref.group = nil
+		group.busy = group.busy - 1
+		group.condvar:signal(1)
+
+		return group
+	end -- release
+
+
+	--
+	-- pool:put
+	--
+	-- Return a checked out connection. It's kept idle unless it has
+	-- failed or the group already holds .idlemax idle connections.
+	--
+	function pool:put(con)
+		local group = release(self, con)
+
+		if group and #group.idle < self.idlemax and con:alive() then
+			group.idle[#group.idle + 1] = { con = con, time = monotime() }
+		else
+			con:close()
+		end
+	end -- pool:put
+
+
+	--
+	-- pool:discard
+	--
+	-- Close a checked out connection, e.g. after a protocol error.
+	--
+	function pool:discard(con)
+		release(self, con)
+		con:close()
+	end -- pool:discard
+
+
+	--
+	-- pool:sweep
+	--
+	-- Close idle connections older than .idletimeout. Called implicitly
+	-- by pool:get for the group being checked out from.
+	--
+	function pool:sweep()
+		local now = monotime()
+
+		for key, group in pairs(self.groups) do
+			evict(self, group, now)
+
+			if #group.idle == 0 and group.busy == 0 then
+				self.groups[key] = nil
+			end
+		end
+	end -- pool:sweep
+
+
+	function pool:close()
+		for _, group in pairs(self.groups) do
+			for _, ent in ipairs(group.idle) do
+				ent.con:close()
+			end
+
+			group.idle = {}
+		end
+	end -- pool:close
+
+
+	function pool:stat()
+		local stats = {}
+		local idle, busy = 0, 0
+
+		for k, v in pairs(self.stats) do
+			stats[k] = v
+		end
+
+		for _, group in pairs(self.groups) do
+			idle = idle + #group.idle
+			busy = busy + group.busy
+		end
+
+		stats.idle = idle
+		stats.busy = busy
+		stats.hitrate = (stats.hits + stats.misses > 0 and stats.hits / (stats.hits + stats.misses)) or 0
+
+		return stats
+	end -- pool:stat
+
+
+	local sockpool = {}
+
+	sockpool.max = 16
+	sockpool.idlemax = 16
+	sockpool.idletimeout = 60
+
+	function sockpool.new(opts)
+		local self = {}
+
+		opts = opts or {}
+
+		self.max = opts.max or sockpool.max
+		self.idlemax = opts.idlemax or sockpool.idlemax
+		self.idletimeout = opts.idletimeout or sockpool.idletimeout
+		self.timeout = opts.timeout or sockpool.timeout
+		self.groups = {}
+		self.owner = setmetatable({}, { __mode = "k" })
+		self.stats = { hits = 0, misses = 0, dead = 0, evicted = 0, leaked = 0, waits = 0, waittime = 0, maxwait = 0 }
+
+		return setmetatable(self, { __index = pool })
+	end -- sockpool.new
+
+
+	function sockpool.type(o)
+		local mt = getmetatable(o)
+
+		if mt and mt.__index == pool then
+			return "socket pool"
+		end
+	end -- sockpool.type
+
+
+	sockpool.loader = loader
+
+	return sockpool
+end
+
+return loader(loader, ...)
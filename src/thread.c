@@ -31,6 +31,8 @@
 #include <setjmp.h>
 #include <signal.h>
 #include <errno.h>
+#include <math.h>
+#include <poll.h>
 
 #include <sys/uio.h>
 #include <sys/socket.h>
@@ -39,6 +41,10 @@
 
 #include <dlfcn.h>
 
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #include "cqueues.h"
 #include "lib/llrb.h"
 
@@ -47,6 +53,24 @@
 #define ENABLE_PTHREAD_MUTEX_ROBUST ((HAVE_DECL_PTHREAD_MUTEX_ROBUST+0) || (HAVE_PTHREAD_MUTEX_ROBUST+0))
 #endif
 
+#ifndef ENABLE_AFFINITY
+#define ENABLE_AFFINITY (__linux__ || __FreeBSD__ || __DragonFly__)
+#endif
+
+#if ENABLE_AFFINITY
+#if __FreeBSD__ || __DragonFly__
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#include <pthread_np.h>
+
+typedef cpuset_t ct_cpuset_t;
+#else
+#include <sched.h>
+
+typedef cpu_set_t ct_cpuset_t;
+#endif
+#endif
+
 #if defined EOWNERDEAD
 #define CT_EOWNERDEAD EOWNERDEAD
 #else
@@ -57,6 +81,7 @@ struct cthread_arg {
 	int type;
 	int iscfunction:1;
 	int isinteger:1;
+	int isposter:1; /* LUA_TUSERDATA is a post box, not a channel */
 
 	/*
 	 * NB: The value representation below is not a simple mapping to the
@@ -253,6 +278,524 @@ syerr:
 } /* ct_addfunc() */
 
 
+/*
+ * Channels are bounded multi-producer, multi-consumer rings shared by
+ * reference between threads (see Dmitry Vyukov's bounded MPMC queue).
+ * Each slot carries a sequence number, so enqueue and dequeue are a
+ * single CAS each, and messages are handed over by pointer without
+ * entering the kernel.
+ *
+ * Each side also has a doorbell, an eventfd or pipe descriptor for
+ * cqueues to poll. A doorbell is only written when the other side has
+ * armed it after finding the ring empty (or full), so a busy consumer
+ * sees no syscalls at all.
+ */
+#define CHAN_MINSIZE 2
+#define CHAN_MAXSIZE (1U << 24)
+
+struct chan_msg {
+	int type;
+	_Bool isinteger;
+
+	union {
+		lua_Number number;
+		lua_Integer integer;
+		_Bool boolean;
+	} v;
+
+	size_t len;
+	char data[];
+}; /* struct chan_msg */
+
+struct chan_cell {
+	size_t seq;
+	struct chan_msg *msg;
+}; /* struct chan_cell */
+
+struct chan_bell {
+	int fd[2]; /* fd[1] is -1 for an eventfd */
+	int armed, rung;
+}; /* struct chan_bell */
+
+struct channel {
+	int refs;
+	size_t mask;
+
+	struct chan_bell readable, writable;
+
+	/* keep producer and consumer positions on separate cache lines */
+	char pad0[64];
+	size_t head;
+	char pad1[64 - sizeof (size_t)];
+	size_t tail;
+	char pad2[64 - sizeof (size_t)];
+
+	struct chan_cell cell[];
+}; /* struct channel */
+
+
+static int bell_init(struct chan_bell *bell) {
+	bell->armed = 0;
+	bell->rung = 0;
+	bell->fd[1] = -1;
+
+#if HAVE_EVENTFD
+	if (-1 == (bell->fd[0] = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)))
+		return errno;
+
+	return 0;
+#else
+	bell->fd[0] = -1;
+
+	return cqs_pipe(bell->fd, O_NONBLOCK|O_CLOEXEC);
+#endif
+} /* bell_init() */
+
+static void bell_destroy(struct chan_bell *bell) {
+	cqs_closefd(&bell->fd[0]);
+	cqs_closefd(&bell->fd[1]);
+} /* bell_destroy() */
+
+/* announce that we're about to sleep on the bell */
+static void bell_arm(struct chan_bell *bell) {
+	__atomic_store_n(&bell->armed, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+} /* bell_arm() */
+
+static void bell_disarm(struct chan_bell *bell) {
+	__atomic_store_n(&bell->armed, 0, __ATOMIC_RELAXED);
+} /* bell_disarm() */
+
+/* wake a sleeper, if any; free unless the other side armed the bell */
+static void bell_ring(struct chan_bell *bell) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!__atomic_load_n(&bell->armed, __ATOMIC_SEQ_CST))
+		return;
+
+	if (!__atomic_exchange_n(&bell->armed, 0, __ATOMIC_SEQ_CST))
+		return;
+
+	__atomic_store_n(&bell->rung, 1, __ATOMIC_RELEASE);
+
+#if HAVE_EVENTFD
+	static const uint64_t one = 1;
+
+	while (-1 == write(bell->fd[0], &one, sizeof one) && errno == EINTR)
+		;;
+#else
+	while (-1 == write(bell->fd[1], "!", 1) && errno == EINTR)
+		;;
+#endif
+} /* bell_ring() */
+
+/*
+ * Drain the descriptor before sleeping again. Waiters only clear the bell
+ * once they've found the ring empty (or full), so every waiter woken by a
+ * ring sees it readable until the condition it signalled is gone.
+ */
+static void bell_clear(struct chan_bell *bell) {
+	if (!__atomic_load_n(&bell->rung, __ATOMIC_ACQUIRE))
+		return;
+
+	if (!__atomic_exchange_n(&bell->rung, 0, __ATOMIC_ACQ_REL))
+		return;
+
+#if HAVE_EVENTFD
+	uint64_t n;
+
+	while (-1 == read(bell->fd[0], &n, sizeof n) && errno == EINTR)
+		;;
+#else
+	for (;;) {
+		char buf[64];
+
+		if (-1 == read(bell->fd[0], buf, sizeof buf)) {
+			if (errno != EINTR)
+				break;
+		}
+	}
+#endif
+} /* bell_clear() */
+
+
+static struct channel *chan_open(size_t size, int *_error) {
+	struct channel *chan;
+	size_t n = CHAN_MINSIZE;
+	int error;
+
+	while (n < size && n < CHAN_MAXSIZE)
+		n <<= 1;
+
+	if (!(chan = calloc(1, sizeof *chan + n * sizeof chan->cell[0])))
+		goto syerr;
+
+	chan->refs = 1;
+	chan->mask = n - 1;
+	chan->readable.fd[0] = chan->readable.fd[1] = -1;
+	chan->writable.fd[0] = chan->writable.fd[1] = -1;
+
+	for (size_t i = 0; i < n; i++)
+		chan->cell[i].seq = i;
+
+	if ((error = bell_init(&chan->readable)) || (error = bell_init(&chan->writable)))
+		goto error;
+
+	return chan;
+syerr:
+	error = errno;
+error:
+	if (chan) {
+		bell_destroy(&chan->readable);
+		bell_destroy(&chan->writable);
+		free(chan);
+	}
+
+	*_error = error;
+
+	return NULL;
+} /* chan_open() */
+
+static void chan_acquire(struct channel *chan) {
+	__atomic_add_fetch(&chan->refs, 1, __ATOMIC_RELAXED);
+} /* chan_acquire() */
+
+static struct chan_msg *chan_dequeue(struct channel *);
+
+static void chan_release(struct channel *chan) {
+	struct chan_msg *msg;
+
+	if (!chan || __atomic_sub_fetch(&chan->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	while ((msg = chan_dequeue(chan)))
+		free(msg);
+
+	bell_destroy(&chan->readable);
+	bell_destroy(&chan->writable);
+	free(chan);
+} /* chan_release() */
+
+static _Bool chan_enqueue(struct channel *chan, struct chan_msg *msg) {
+	size_t pos = __atomic_load_n(&chan->head, __ATOMIC_RELAXED);
+	struct chan_cell *cell;
+
+	for (;;) {
+		cell = &chan->cell[pos & chan->mask];
+
+		intptr_t dif = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&chan->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return 0; /* full */
+		} else {
+			pos = __atomic_load_n(&chan->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->msg = msg;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 1;
+} /* chan_enqueue() */
+
+static struct chan_msg *chan_dequeue(struct channel *chan) {
+	size_t pos = __atomic_load_n(&chan->tail, __ATOMIC_RELAXED);
+	struct chan_cell *cell;
+	struct chan_msg *msg;
+
+	for (;;) {
+		cell = &chan->cell[pos & chan->mask];
+
+		intptr_t dif = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&chan->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return NULL; /* empty */
+		} else {
+			pos = __atomic_load_n(&chan->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	msg = cell->msg;
+	__atomic_store_n(&cell->seq, pos + chan->mask + 1, __ATOMIC_RELEASE);
+
+	return msg;
+} /* chan_dequeue() */
+
+/* returns 0, or EAGAIN with the writable doorbell armed */
+static int chan_send(struct channel *chan, struct chan_msg *msg) {
+	if (!chan_enqueue(chan, msg)) {
+		bell_clear(&chan->writable);
+		bell_arm(&chan->writable);
+
+		/* a consumer may have made room before seeing our arm */
+		if (!chan_enqueue(chan, msg))
+			return EAGAIN;
+
+		bell_disarm(&chan->writable);
+	}
+
+	bell_ring(&chan->readable);
+
+	return 0;
+} /* chan_send() */
+
+/* returns a message, or NULL with the readable doorbell armed */
+static struct chan_msg *chan_recv(struct channel *chan) {
+	struct chan_msg *msg;
+
+	if (!(msg = chan_dequeue(chan))) {
+		bell_clear(&chan->readable);
+		bell_arm(&chan->readable);
+
+		/* a producer may have enqueued before seeing our arm */
+		if (!(msg = chan_dequeue(chan)))
+			return NULL;
+
+		bell_disarm(&chan->readable);
+	}
+
+	bell_ring(&chan->writable);
+
+	return msg;
+} /* chan_recv() */
+
+
+static struct channel *chan_checkself(lua_State *L, int index) {
+	struct channel **chan = luaL_checkudata(L, index, CQS_CHANNEL);
+
+	luaL_argcheck(L, *chan, index, CQS_CHANNEL " expected, got NULL");
+
+	return *chan;
+} /* chan_checkself() */
+
+/* push a channel object, taking over the caller's reference */
+static void chan_push(lua_State *L, struct channel *chan) {
+	struct channel **ud = lua_newuserdata(L, sizeof *ud);
+
+	*ud = chan;
+
+	luaL_getmetatable(L, CQS_CHANNEL);
+	lua_setmetatable(L, -2);
+} /* chan_push() */
+
+static int chan_new(lua_State *L) {
+	lua_Integer size = luaL_optinteger(L, 1, 64);
+	struct channel **ud;
+	int error;
+
+	luaL_argcheck(L, size > 0, 1, "channel size must be positive");
+
+	ud = lua_newuserdata(L, sizeof *ud);
+	*ud = NULL;
+
+	luaL_getmetatable(L, CQS_CHANNEL);
+	lua_setmetatable(L, -2);
+
+	if (!(*ud = chan_open(size, &error))) {
+		lua_pushnil(L);
+		lua_pushinteger(L, error);
+
+		return 2;
+	}
+
+	return 1;
+} /* chan_new() */
+
+static int chan_send_(lua_State *L) {
+	struct channel *chan = chan_checkself(L, 1);
+	struct chan_msg *msg;
+	const char *data = NULL;
+	size_t len = 0;
+	int type = lua_type(L, 2), error;
+
+	switch (type) {
+	case LUA_TNIL:
+	case LUA_TNUMBER:
+	case LUA_TBOOLEAN:
+		break;
+	case LUA_TNONE:
+		type = LUA_TNIL;
+		break;
+	default:
+		/* FALL THROUGH (maybe has __tostring metamethod) */
+	case LUA_TSTRING:
+		data = luaL_checklstring(L, 2, &len);
+		type = LUA_TSTRING;
+		break;
+	}
+
+	if (!(msg = malloc(sizeof *msg + len)))
+		goto syerr;
+
+	msg->type = type;
+	msg->isinteger = 0;
+	msg->len = len;
+
+	if (type == LUA_TNUMBER) {
+#if LUA_VERSION_NUM >= 503
+		if ((msg->isinteger = lua_isinteger(L, 2)))
+			msg->v.integer = lua_tointeger(L, 2);
+		else
+#endif
+		msg->v.number = lua_tonumber(L, 2);
+	} else if (type == LUA_TBOOLEAN) {
+		msg->v.boolean = lua_toboolean(L, 2);
+	} else if (len) {
+		memcpy(msg->data, data, len);
+	}
+
+	if ((error = chan_send(chan, msg))) {
+		free(msg);
+		goto error;
+	}
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+syerr:
+	error = errno;
+error:
+	lua_pushboolean(L, 0);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* chan_send_() */
+
+static int chan_recv_(lua_State *L) {
+	struct channel *chan = chan_checkself(L, 1);
+	struct chan_msg *msg;
+
+	if (!(msg = chan_recv(chan))) {
+		lua_pushboolean(L, 0);
+		lua_pushinteger(L, EAGAIN);
+
+		return 2;
+	}
+
+	lua_pushboolean(L, 1);
+
+	switch (msg->type) {
+	case LUA_TNUMBER:
+		if (msg->isinteger)
+			lua_pushinteger(L, msg->v.integer);
+		else
+			lua_pushnumber(L, msg->v.number);
+		break;
+	case LUA_TBOOLEAN:
+		lua_pushboolean(L, msg->v.boolean);
+		break;
+	case LUA_TSTRING:
+		/* FIXME: Leaks message if lua_pushlstring throws */
+		lua_pushlstring(L, msg->data, msg->len);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+
+	free(msg);
+
+	return 2;
+} /* chan_recv_() */
+
+static int chan_count(lua_State *L) {
+	struct channel *chan = chan_checkself(L, 1);
+	size_t head = __atomic_load_n(&chan->head, __ATOMIC_RELAXED);
+	size_t tail = __atomic_load_n(&chan->tail, __ATOMIC_RELAXED);
+
+	lua_pushinteger(L, (head > tail)? head - tail : 0);
+	lua_pushinteger(L, chan->mask + 1);
+
+	return 2;
+} /* chan_count() */
+
+static int chan_which(lua_State *L, int index) {
+	static const char *const opts[] = { "r", "w", NULL };
+
+	return luaL_checkoption(L, index, "r", opts);
+} /* chan_which() */
+
+static int chan_pollfd_(lua_State *L, int index) {
+	struct channel **chan = lua_touserdata(L, index);
+
+	return (*chan)? (*chan)->readable.fd[0] : -1;
+} /* chan_pollfd_() */
+
+static short chan_events_(lua_State *L NOTUSED, int index NOTUSED) {
+	return POLLIN;
+} /* chan_events_() */
+
+static double chan_timeout_(lua_State *L NOTUSED, int index NOTUSED) {
+	return NAN;
+} /* chan_timeout_() */
+
+static const struct cqs_pollable chan_pollable = {
+	.pollfd  = &chan_pollfd_,
+	.events  = &chan_events_,
+	.timeout = &chan_timeout_,
+}; /* chan_pollable */
+
+static int chan_pollfd(lua_State *L) {
+	struct channel *chan = chan_checkself(L, 1);
+
+	lua_pushinteger(L, (chan_which(L, 2))? chan->writable.fd[0] : chan->readable.fd[0]);
+
+	return 1;
+} /* chan_pollfd() */
+
+static int chan_events(lua_State *L) {
+	chan_checkself(L, 1);
+
+	lua_pushliteral(L, "r");
+
+	return 1;
+} /* chan_events() */
+
+static int chan_timeout(lua_State *L) {
+	chan_checkself(L, 1);
+
+	return 0;
+} /* chan_timeout() */
+
+static int chan__eq(lua_State *L) {
+	struct channel **a = luaL_testudata(L, 1, CQS_CHANNEL);
+	struct channel **b = luaL_testudata(L, 2, CQS_CHANNEL);
+
+	lua_pushboolean(L, a && b && (*a == *b));
+
+	return 1;
+} /* chan__eq() */
+
+static int chan__gc(lua_State *L) {
+	struct channel **ud = luaL_checkudata(L, 1, CQS_CHANNEL);
+
+	chan_release(*ud);
+	*ud = NULL;
+
+	return 0;
+} /* chan__gc() */
+
+static int chan_type(lua_State *L) {
+	if (luaL_testudata(L, 1, CQS_CHANNEL)) {
+		lua_pushstring(L, "thread channel");
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+} /* chan_type() */
+
+static int chan_interpose(lua_State *L) {
+	return cqs_interpose(L, CQS_CHANNEL);
+} /* chan_interpose() */
+
+
 static struct cthread *ct_checkthread(lua_State *L, int index) {
 	struct cthread **ct = luaL_checkudata(L, index, CQS_THREAD);
 
@@ -292,6 +835,16 @@ static void ct_release(struct cthread *ct) {
 	cqs_closefd(&ct->tmp.fd[0]);
 	cqs_closefd(&ct->tmp.fd[1]);
 
+	for (unsigned i = 0; ct->tmp.arg && i < ct->tmp.argc; i++) {
+		if (ct->tmp.arg[i].type != LUA_TUSERDATA)
+			continue;
+
+		if (ct->tmp.arg[i].isposter)
+			cqs_postbox_release(ct->tmp.arg[i].v.pointer);
+		else
+			chan_release(ct->tmp.arg[i].v.pointer);
+	}
+
 	free(ct->tmp.arg);
 
 	free(ct->msg);
@@ -402,6 +955,14 @@ static void *ct_enter(void *arg) {
 				luaL_loadbuffer(L, arg->v.string.iov_base, arg->v.string.iov_len, NULL);
 			}
 			break;
+		case LUA_TUSERDATA:
+			/* channel or post box reference passes to the new object */
+			if (arg->isposter)
+				cqs_postbox_push(L, arg->v.pointer);
+			else
+				chan_push(L, arg->v.pointer);
+			arg->type = LUA_TNIL;
+			break;
 		default:
 			lua_pushnil(L);
 			break;
@@ -649,6 +1210,19 @@ static int ct_start(lua_State *L) {
 			if ((error = ct_setfarg(L, ct, arg, index)))
 				goto error;
 			break;
+		case LUA_TUSERDATA:
+			if (luaL_testudata(L, index, CQS_CHANNEL)) {
+				arg->v.pointer = chan_checkself(L, index);
+				chan_acquire(arg->v.pointer);
+				arg->type = LUA_TUSERDATA;
+				break;
+			} else if (luaL_testudata(L, index, CQS_POSTER)) {
+				arg->v.pointer = cqs_postbox_acquire(L, index);
+				arg->isposter = 1;
+				arg->type = LUA_TUSERDATA;
+				break;
+			}
+			/* FALL THROUGH */
 		default:
 			/* FALL THROUGH (maybe has __tostring metamethod) */
 		case LUA_TSTRING:
@@ -735,6 +1309,30 @@ static int ct_join(lua_State *L) {
 } /* ct_join() */
 
 
+static int ct_pollfd_(lua_State *L, int index) {
+	struct cthread **ct = lua_touserdata(L, index);
+
+	return (*ct)? (*ct)->pipe[0] : -1;
+} /* ct_pollfd_() */
+
+
+static short ct_events_(lua_State *L NOTUSED, int index NOTUSED) {
+	return POLLIN;
+} /* ct_events_() */
+
+
+static double ct_timeout_(lua_State *L NOTUSED, int index NOTUSED) {
+	return NAN;
+} /* ct_timeout_() */
+
+
+static const struct cqs_pollable ct_pollable = {
+	.pollfd  = &ct_pollfd_,
+	.events  = &ct_events_,
+	.timeout = &ct_timeout_,
+}; /* ct_pollable */
+
+
 static int ct_pollfd(lua_State *L) {
 	struct cthread *ct = ct_checkthread(L, 1);
 
@@ -803,6 +1401,98 @@ static int ct_self(lua_State *L) {
 } /* ct_self() */
 
 
+/*
+ * Affinity is always applied to the calling thread, so a thread started
+ * with thread.start binds itself from its entry function.
+ */
+#if ENABLE_AFFINITY
+static void ct_addcpu(lua_State *L, ct_cpuset_t *set, int index, int arg) {
+	lua_Integer cpu = luaL_checkinteger(L, index);
+
+	luaL_argcheck(L, cpu >= 0 && cpu < CPU_SETSIZE, arg, "cpu out of range");
+
+	CPU_SET(cpu, set);
+} /* ct_addcpu() */
+#endif
+
+
+static int ct_setaffinity(lua_State *L) {
+#if ENABLE_AFFINITY
+	ct_cpuset_t set;
+	int top = lua_gettop(L), error;
+
+	CPU_ZERO(&set);
+
+	for (int index = 1; index <= top; index++) {
+		if (lua_istable(L, index)) {
+			for (int i = 1; lua_rawgeti(L, index, i), !lua_isnil(L, -1); i++) {
+				ct_addcpu(L, &set, -1, index);
+				lua_pop(L, 1);
+			}
+
+			lua_pop(L, 1);
+		} else {
+			ct_addcpu(L, &set, index, index);
+		}
+	}
+
+	if ((error = pthread_setaffinity_np(pthread_self(), sizeof set, &set)))
+		goto error;
+
+	lua_pushboolean(L, 1);
+
+	return 1;
+error:
+#else
+	int error = ENOTSUP;
+#endif
+	lua_pushboolean(L, 0);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* ct_setaffinity() */
+
+
+static int ct_getaffinity(lua_State *L) {
+#if ENABLE_AFFINITY
+	ct_cpuset_t set;
+	int cpu, n = 0, error;
+
+	CPU_ZERO(&set);
+
+	if ((error = pthread_getaffinity_np(pthread_self(), sizeof set, &set)))
+		goto error;
+
+	lua_newtable(L);
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set)) {
+			lua_pushinteger(L, cpu);
+			lua_rawseti(L, -2, ++n);
+		}
+	}
+
+	return 1;
+error:
+#else
+	int error = ENOTSUP;
+#endif
+	lua_pushnil(L);
+	lua_pushinteger(L, error);
+
+	return 2;
+} /* ct_getaffinity() */
+
+
+static int ct_ncpu(lua_State *L) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	lua_pushinteger(L, (n > 0)? n : 1);
+
+	return 1;
+} /* ct_ncpu() */
+
+
 static const luaL_Reg ct_methods[] = {
 	{ "join",    &ct_join },
 	{ "pollfd",  &ct_pollfd },
@@ -820,11 +1510,14 @@ static const luaL_Reg ct_metamethods[] = {
 
 
 static const luaL_Reg ct_globals[] = {
-	{ "start",     &ct_start },
-	{ "type",      &ct_type },
-	{ "interpose", &ct_interpose },
-	{ "self",      &ct_self },
-	{ NULL,        NULL }
+	{ "start",       &ct_start },
+	{ "type",        &ct_type },
+	{ "interpose",   &ct_interpose },
+	{ "self",        &ct_self },
+	{ "setaffinity", &ct_setaffinity },
+	{ "getaffinity", &ct_getaffinity },
+	{ "ncpu",        &ct_ncpu },
+	{ NULL,          NULL }
 };
 
 
@@ -842,6 +1535,10 @@ int luaopen__cqueues_thread(lua_State *L) {
 	}
 
 	cqs_newmetatable(L, CQS_THREAD, ct_methods, ct_metamethods, 0);
+	cqs_setpollable(L, -1, &ct_pollable);
+
+	/* thread.start must recognize channel arguments */
+	cqs_requiref(L, "_cqueues.thread.channel", &luaopen__cqueues_thread_channel, 0);
 
 	luaL_newlib(L, ct_globals);
 
@@ -849,6 +1546,42 @@ int luaopen__cqueues_thread(lua_State *L) {
 } /* luaopen__cqueues_thread() */
 
 
+static const luaL_Reg chan_methods[] = {
+	{ "send",    &chan_send_ },
+	{ "recv",    &chan_recv_ },
+	{ "count",   &chan_count },
+	{ "pollfd",  &chan_pollfd },
+	{ "events",  &chan_events },
+	{ "timeout", &chan_timeout },
+	{ NULL,      NULL }
+};
+
+
+static const luaL_Reg chan_metamethods[] = {
+	{ "__eq", &chan__eq },
+	{ "__gc", &chan__gc },
+	{ NULL,   NULL }
+};
+
+
+static const luaL_Reg chan_globals[] = {
+	{ "new",       &chan_new },
+	{ "type",      &chan_type },
+	{ "interpose", &chan_interpose },
+	{ NULL,        NULL }
+};
+
+
+int luaopen__cqueues_thread_channel(lua_State *L) {
+	cqs_newmetatable(L, CQS_CHANNEL, chan_methods, chan_metamethods, 0);
+	cqs_setpollable(L, -1, &chan_pollable);
+
+	luaL_newlib(L, chan_globals);
+
+	return 1;
+} /* luaopen__cqueues_thread_channel() */
+
+
 /*
  * OpenSSL is not thread-safe without explicit locking handlers installed.
  */
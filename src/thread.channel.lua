@@ -0,0 +1,109 @@
+local loader = function(loader, ...)
+	local channel = require"_cqueues.thread.channel"
+	local cqueues = require"cqueues"
+	local errno = require"cqueues.errno"
+	local EAGAIN = errno.EAGAIN
+	local ETIMEDOUT = errno.ETIMEDOUT
+	local monotime = cqueues.monotime
+	local poll = cqueues.poll
+
+	--
+	-- The writable doorbell is polled through a proxy object, as the
+	-- channel itself polls on its readable doorbell.
+	--
+	local function writable(self)
+		return {
+			pollfd = function () return self:pollfd"w" end,
+			events = function () return "r" end,
+			timeout = function () return nil end,
+		}
+	end -- writable
+
+	local function wait(deadline, obj)
+		if deadline then
+			local curtime = monotime()
+
+			if curtime >= deadline then
+				return false
+			end
+
+			poll(deadline - curtime, obj)
+		else
+			poll(obj)
+		end
+
+		return true
+	end -- wait
+
+	--
+	-- channel:put
+	--
+	-- Send a string, number, boolean or nil, waiting while the channel
+	-- is full.
+	--
+	channel.interpose("put", function (self, v, timeout)
+		local deadline = timeout and (monotime() + timeout)
+		local proxy
+
+		while true do
+			local ok, why = self:send(v)
+
+			if ok then
+				return true
+			elseif why ~= EAGAIN then
+				return false, why
+			end
+
+			proxy = proxy or writable(self)
+
+			if not wait(deadline, proxy) then
+				return false, ETIMEDOUT
+			end
+		end
+	end)
+
+	--
+	-- channel:get
+	--
+	-- Receive the next value, waiting while the channel is empty.
+	-- Returns true and the value, or false and an error.
+	--
+	channel.interpose("get", function (self, timeout)
+		local deadline = timeout and (monotime() + timeout)
+
+		while true do
+			local ok, v = self:recv()
+
+			if ok then
+				return true, v
+			elseif v ~= EAGAIN then
+				return false, v
+			end
+
+			if not wait(deadline, self) then
+				return false, ETIMEDOUT
+			end
+		end
+	end)
+
+	--
+	-- channel:values
+	--
+	-- Iterate over received values until a nil is sent.
+	--
+	channel.interpose("values", function (self, timeout)
+		return function ()
+			local ok, v = self:get(timeout)
+
+			if ok then
+				return v
+			end
+		end
+	end)
+
+	channel.loader = loader
+
+	return channel
+end
+
+return loader(loader, ...)
@@ -24,6 +24,7 @@ local loader = function(loader, ...)
 		"cqueues.socket",
 		"cqueues.signal",
 		"cqueues.thread",
+		"cqueues.thread.channel",
 		"cqueues.notify",
 	}
 
@@ -108,6 +109,17 @@ local loader = function(loader, ...)
 	end)
 
 
+	--
+	-- thread.pool
+	--
+	-- See cqueues.thread.pool. Loaded on demand as it depends on this
+	-- module.
+	--
+	thread.pool = function (opts, ...)
+		return require"cqueues.thread.pool".new(opts, ...)
+	end -- thread.pool
+
+
 	thread.loader = loader
 
 	return thread
@@ -0,0 +1,555 @@
+local loader = function(loader, ...)
+	local cqueues = require"cqueues"
+	local thread = require"cqueues.thread"
+	local channel = require"cqueues.thread.channel"
+	local condition = require"cqueues.condition"
+	local errno = require"cqueues.errno"
+	local EAGAIN = errno.EAGAIN
+	local EPIPE = errno.EPIPE
+	local ETIMEDOUT = errno.ETIMEDOUT
+	local monotime = cqueues.monotime
+	local poll = cqueues.poll
+	local unpack = assert(table.unpack or unpack)
+
+	--
+	-- Messages are a concatenation of encoded values: "s<len>:<bytes>"
+	-- for strings, "i<n>;" or "n<n>;" for numbers, "T", "F" and "z" for
+	-- true, false and nil. Strings are length prefixed so chunks of
+	-- bytecode pass through untouched.
+	--
+	-- A job is (id, key, chunk, args...), where chunk is nil once every
+	-- worker has cached key. A result is (id, loaded, ok, values...),
+	-- where loaded is the key if the job made the worker cache it. A
+	-- worker whose init fails sends (0, false, false, error) and exits.
+	-- A nil message stops a worker.
+	--
+	-- The codec is duplicated inside worker below, which is serialized
+	-- by thread.start and so cannot reference upvalues.
+	--
+	local function encode(...)
+		local out = {}
+
+		for i = 1, select("#", ...) do
+			local v = select(i, ...)
+			local t = type(v)
+
+			if t == "string" then
+				out[#out + 1] = "s" .. #v .. ":" .. v
+			elseif t == "number" then
+				if math.type and math.type(v) == "integer" then
+					out[#out + 1] = "i" .. string.format("%d", v) .. ";"
+				else
+					out[#out + 1] = "n" .. string.format("%.17g", v) .. ";"
+				end
+			elseif t == "boolean" then
+				out[#out + 1] = (v and "T") or "F"
+			elseif t == "nil" then
+				out[#out + 1] = "z"
+			else
+				error(string.format("%s: cannot pass to pool thread", t), 3)
+			end
+		end
+
+		return table.concat(out)
+	end -- encode
+
+	local function decode(s, pos, lim)
+		local list, n = {}, 0
+
+		while pos <= #s and n < (lim or math.huge) do
+			local tag = string.sub(s, pos, pos)
+			local v
+
+			if tag == "s" then
+				local colon = string.find(s, ":", pos, true)
+				local len = tonumber(string.sub(s, pos + 1, colon - 1))
+
+				v = string.sub(s, colon + 1, colon + len)
+				pos = colon + len + 1
+			elseif tag == "i" or tag == "n" then
+				local semi = string.find(s, ";", pos, true)
+
+				v = tonumber(string.sub(s, pos + 1, semi - 1))
+				pos = semi + 1
+			else
+				v = (tag == "T") or ((tag == "F") and false) or nil
+				pos = pos + 1
+			end
+
+			n = n + 1
+			list[n] = v
+		end
+
+		return list, n, pos
+	end -- decode
+
+
+	--
+	-- worker
+	--
+	-- Entry point of each pool thread. Runs init(...) once, then jobs
+	-- until stopped. Loaded chunks are cached by key so each function
+	-- is only loaded once per worker; a chunk already cached is skipped
+	-- over without being copied out of the message.
+	--
+	local function worker(pipe, jobs, results, init, ...)
+		local load = (_VERSION == "Lua 5.1" and _G.loadstring) or _G.load
+		local unpack = table.unpack or _G.unpack
+		local cache = {}
+
+		local function encode(...)
+			local out = {}
+
+			for i = 1, select("#", ...) do
+				local v = select(i, ...)
+				local t = type(v)
+
+				if t == "string" then
+					out[#out + 1] = "s" .. #v .. ":" .. v
+				elseif t == "number" then
+					if math.type and math.type(v) == "integer" then
+						out[#out + 1] = "i" .. string.format("%d", v) .. ";"
+					else
+						out[#out + 1] = "n" .. string.format("%.17g", v) .. ";"
+					end
+				elseif t == "boolean" then
+					out[#out + 1] = (v and "T") or "F"
+				elseif t == "nil" then
+					out[#out + 1] = "z"
+				else
+					v = tostring(v)
+					out[#out + 1] = "s" .. #v .. ":" .. v
+				end
+			end
+
+			return table.concat(out)
+		end
+
+		local function decode(s, pos, lim)
+			local list, n = {}, 0
+
+			while pos <= #s and n < (lim or math.huge) do
+				local tag = string.sub(s, pos, pos)
+				local v
+
+				if tag == "s" then
+					local colon = string.find(s, ":", pos, true)
+					local len = tonumber(string.sub(s, pos + 1, colon - 1))
+
+					v = string.sub(s, colon + 1, colon + len)
+					pos = colon + len + 1
+				elseif tag == "i" or tag == "n" then
+					local semi = string.find(s, ";", pos, true)
+
+					v = tonumber(string.sub(s, pos + 1, semi - 1))
+					pos = semi + 1
+				else
+					v = (tag == "T") or ((tag == "F") and false) or nil
+					pos = pos + 1
+				end
+
+				n = n + 1
+				list[n] = v
+			end
+
+			return list, n, pos
+		end
+
+		local function finish(id, loaded, ok, ...)
+			return results:put(encode(id, loaded, ok, ...))
+		end
+
+		if init then
+			local ok, why = pcall(init, ...)
+
+			if not ok then
+				finish(0, false, false, why)
+
+				return
+			end
+		end
+
+		while true do
+			local ok, msg = jobs:get()
+
+			if not ok or msg == nil then
+				break
+			end
+
+			local head, _, pos = decode(msg, 1, 2)
+			local id, key = head[1], head[2]
+			local fn, why, loaded = cache[key], nil, false
+
+			if string.sub(msg, pos, pos) == "z" then
+				pos = pos + 1
+			else
+				local colon = string.find(msg, ":", pos, true)
+				local len = tonumber(string.sub(msg, pos + 1, colon - 1))
+
+				if not fn then
+					fn, why = load(string.sub(msg, colon + 1, colon + len), "[pool job]")
+					cache[key] = fn
+					loaded = fn and key
+				end
+
+				pos = colon + len + 1
+			end
+
+			if fn then
+				local args, n = decode(msg, pos)
+
+				finish(id, loaded, pcall(fn, unpack(args, 1, n)))
+			else
+				finish(id, loaded, false, why or "job function not cached")
+			end
+		end
+	end -- worker
+
+
+	local pool = {}
+	local mt = { __index = pool }
+
+	-- job functions are dumped once per parent Lua state
+	local chunks = setmetatable({}, { __mode = "k" })
+	local nchunks = 0
+
+	-- thread.start only allows _ENV (Lua 5.2+), and so do we
+	local maxups = (_VERSION == "Lua 5.1" and 0) or 1
+
+	local function tochunk(fn)
+		local ent = chunks[fn]
+
+		if not ent then
+			if type(fn) == "function" and debug.getinfo(fn, "u").nups > maxups then
+				error("bad argument #1 to 'submit' (function has upvalues)", 3)
+			end
+
+			nchunks = nchunks + 1
+			ent = { key = tostring(nchunks), chunk = string.dump(fn) }
+			chunks[fn] = ent
+		end
+
+		return ent
+	end -- tochunk
+
+
+	--
+	-- A worker's init failed and it exited. Once none are left, every
+	-- outstanding job fails with the last init error.
+	--
+	local function failed(self, why)
+		self.live = self.live - 1
+		self.failed = self.failed + 1
+		self.error = why
+
+		if self.live == 0 then
+			for id in pairs(self.pending) do
+				self.done[id] = self.done[id] or { n = 2, false, why }
+			end
+		end
+	end -- failed
+
+
+	-- read every available result and wake their waiters
+	local function collect(self)
+		local got = false
+
+		while true do
+			local ok, msg = self.results:recv()
+
+			if not ok then
+				break
+			end
+
+			local list, n = decode(msg, 1)
+			local id, loaded = list[1], list[2]
+
+			if loaded then
+				self.cached[loaded] = (self.cached[loaded] or 0) + 1
+			end
+
+			if id == 0 then
+				failed(self, list[4])
+			else
+				self.done[id] = { n = n - 2, unpack(list, 3, n) }
+			end
+
+			got = true
+		end
+
+		if got then
+			self.condvar:signal()
+		end
+	end -- collect
+
+
+	--
+	-- pool:submit
+	--
+	-- Queue fn(...) on the next free worker. fn must not have upvalues,
+	-- and its arguments and results must be strings, numbers, booleans
+	-- or nil. Returns a job identifier. The function's bytecode is sent
+	-- along until each live worker has reported caching it.
+	--
+	-- While the job queue is full, results are collected so that
+	-- workers blocked on a full result queue can make progress.
+	--
+	function pool:submit(fn, ...)
+		local ent = tochunk(fn)
+		local chunk = ent.chunk
+		local msg, id
+
+		if self.closed then
+			return nil, EPIPE
+		end
+
+		collect(self)
+
+		if self.live == 0 then
+			return nil, self.error
+		end
+
+		-- every worker has this function loaded already
+		if (self.cached[ent.key] or 0) >= self.live then
+			chunk = nil
+		end
+
+		self.lastid = self.lastid + 1
+		id = self.lastid
+		msg = encode(id, ent.key, chunk, ...)
+
+		while true do
+			local ok, why = self.jobs:send(msg)
+
+			if ok then
+				break
+			elseif why ~= EAGAIN then
+				return nil, why
+			end
+
+			collect(self)
+			poll(self.writable, self.results)
+		end
+
+		self.pending[id] = true
+
+		-- the last worker may have failed while we were collecting
+		if self.live == 0 then
+			self.done[id] = { n = 2, false, self.error }
+		end
+
+		return id
+	end -- pool:submit
+
+
+	--
+	-- pool:wait
+	--
+	-- Wait for job id. Returns true and its results, false and the
+	-- error it raised, or false and ETIMEDOUT.
+	--
+	function pool:wait(id, timeout)
+		local deadline = timeout and (monotime() + timeout)
+
+		if not self.pending[id] then
+			error(string.format("%s: unknown job", tostring(id)), 2)
+		end
+
+		while not self.done[id] do
+			collect(self)
+
+			if not self.done[id] then
+				if deadline then
+					local curtime = monotime()
+
+					if curtime >= deadline then
+						return false, ETIMEDOUT
+					end
+
+					poll(deadline - curtime, self.results, self.condvar)
+				else
+					poll(self.results, self.condvar)
+				end
+			end
+		end
+
+		local res = self.done[id]
+
+		self.done[id] = nil
+		self.pending[id] = nil
+
+		return unpack(res, 1, res.n)
+	end -- pool:wait
+
+
+	--
+	-- pool:run
+	--
+	-- Submit fn(...) and wait for it.
+	--
+	function pool:run(fn, ...)
+		local id, why = self:submit(fn, ...)
+
+		if not id then
+			return false, why
+		end
+
+		return self:wait(id)
+	end -- pool:run
+
+
+	--
+	-- pool:close
+	--
+	-- Stop every worker once the queued jobs are done, and join them.
+	-- Results are collected meanwhile, as workers blocked on a full
+	-- result queue would never see their stop message.
+	--
+	function pool:close(timeout)
+		local deadline = timeout and (monotime() + timeout)
+
+		local function pause(...)
+			collect(self)
+
+			if deadline then
+				local curtime = monotime()
+
+				if curtime >= deadline then
+					return false
+				end
+
+				poll(deadline - curtime, ...)
+			else
+				poll(...)
+			end
+
+			return true
+		end
+
+		if not self.closed then
+			self.closed = true
+			self.stops = #self.threads
+		end
+
+		while self.stops > 0 do
+			local ok, why = self.jobs:send(nil)
+
+			if ok then
+				self.stops = self.stops - 1
+			elseif why ~= EAGAIN then
+				return false, why
+			elseif not pause(self.writable, self.results) then
+				return false, ETIMEDOUT
+			end
+		end
+
+		for i, thr in ipairs(self.threads) do
+			while self.threads[i] do
+				local ok, why = thr:join(0)
+
+				if ok then
+					self.threads[i] = false
+				elseif why ~= ETIMEDOUT then
+					return false, why
+				elseif not pause(thr, self.results) then
+					return false, ETIMEDOUT
+				end
+			end
+		end
+
+		return true
+	end -- pool:close
+
+
+	function pool:stat()
+		local npending = 0
+
+		for _ in pairs(self.pending) do
+			npending = npending + 1
+		end
+
+		return { size = #self.threads, queued = (self.jobs:count()), pending = npending, failed = self.failed }
+	end -- pool:stat
+
+
+	local thrpool = {}
+
+	--
+	-- thrpool.new
+	--
+	-- Start opts.size (default thread.ncpu()) worker threads, each
+	-- running opts.init(...) once before taking jobs. opts.queue bounds
+	-- the number of queued jobs and results (default 256).
+	--
+	function thrpool.new(opts, ...)
+		opts = opts or {}
+
+		local size = opts.size or thread.ncpu()
+		local self = setmetatable({
+			threads = {},
+			lastid = 0,
+			pending = {},
+			done = {},
+			cached = {},
+			live = size,
+			failed = 0,
+			condvar = condition.new(),
+			closed = false,
+			stops = 0,
+		}, mt)
+		local why
+
+		self.jobs, why = channel.new(opts.queue or 256)
+
+		if not self.jobs then
+			return nil, why
+		end
+
+		self.results, why = channel.new(opts.queue or 256)
+
+		if not self.results then
+			return nil, why
+		end
+
+		local jobs = self.jobs
+
+		self.writable = {
+			pollfd = function () return jobs:pollfd"w" end,
+			events = function () return "r" end,
+			timeout = function () return nil end,
+		}
+
+		for i = 1, size do
+			local thr, con
+
+			thr, con, why = thread.start(worker, self.jobs, self.results, opts.init or false, ...)
+
+			if not thr then
+				self:close()
+
+				return nil, why
+			end
+
+			-- jobs and results travel over the channels
+			con:close()
+
+			self.threads[i] = thr
+		end
+
+		return self
+	end -- thrpool.new
+
+
+	function thrpool.type(o)
+		if getmetatable(o) == mt then
+			return "thread pool"
+		end
+	end -- thrpool.type
+
+
+	thrpool.loader = loader
+
+	return thrpool
+end
+
+return loader(loader, ...)